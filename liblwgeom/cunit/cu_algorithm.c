@@ -16,6 +16,7 @@
 #include "CUnit/Basic.h"
 
 #include "liblwgeom_internal.h"
+#include "lwrandom.h"
 #include "cu_tester.h"
 
 /*
@@ -1759,6 +1760,94 @@ static void test_kmeans(void)
 	return;
 }
 
+static void test_kmeans_ties(void)
+{
+	/* Integer inputs, ending with objects halfway between two centers */
+	static const char *inputs[] = {
+	    "MULTIPOINT(8 0,2 6,8 0,4 4,2 8,0 2)",
+	    "MULTIPOINT(0 4,2 2,2 4,4 0,4 4,4 4,0 0,0 0,2 0,0 0,4 2,0 2,0 0)"};
+	static int num_clusters[] = {3, 4};
+	int t, i, j;
+
+	for (t = 0; t < 2; t++)
+	{
+		LWGEOM *input = lwgeom_from_wkt(inputs[t], LW_PARSER_CHECK_NONE);
+		LWMPOINT *mpt = lwgeom_as_lwmpoint(input);
+		int N = mpt->ngeoms;
+		int k = num_clusters[t];
+		double cx[4] = {0}, cy[4] = {0}, cn[4] = {0};
+		int *r = lwgeom_cluster_kmeans((const LWGEOM **)mpt->geoms, N, k, 0.0);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+
+		for (i = 0; i < N; i++)
+		{
+			cx[r[i]] += lwpoint_get_x(mpt->geoms[i]);
+			cy[r[i]] += lwpoint_get_y(mpt->geoms[i]);
+			cn[r[i]] += 1;
+		}
+		for (j = 0; j < k; j++)
+		{
+			cx[j] /= cn[j];
+			cy[j] /= cn[j];
+		}
+
+		/* Every object is in the nearest cluster, the lowest numbered on ties */
+		for (i = 0; i < N; i++)
+		{
+			double x = lwpoint_get_x(mpt->geoms[i]);
+			double y = lwpoint_get_y(mpt->geoms[i]);
+			double d = (cx[r[i]] - x) * (cx[r[i]] - x) + (cy[r[i]] - y) * (cy[r[i]] - y);
+			for (j = 0; j < k; j++)
+			{
+				double dj = (cx[j] - x) * (cx[j] - x) + (cy[j] - y) * (cy[j] - y);
+				CU_ASSERT(dj > d || (dj == d && j >= r[i]));
+			}
+		}
+
+		lwfree(r);
+		lwgeom_free(input);
+	}
+}
+
+static void test_kmeans_large_k(void)
+{
+	static int side = 30;
+	static int num_clusters = 100;
+	int N = side * side;
+	LWGEOM **geoms = lwalloc(sizeof(LWGEOM*) * N);
+	int *count = lwalloc(sizeof(int) * num_clusters);
+	int i, batch_size;
+	int *r;
+
+	for (i = 0; i < N; i++)
+		geoms[i] = lwpoint_as_lwgeom(lwpoint_make2d(SRID_UNKNOWN, i % side, i / side));
+
+	/* Exact, then mini-batch: every cluster gets some of the lattice */
+	for (batch_size = 0; batch_size <= 300; batch_size += 300)
+	{
+		/* The shared generator is not reseeded */
+		_lwrandom_set_seeds(1234, 5678);
+		r = lwgeom_cluster_kmeans_batch((const LWGEOM **)geoms, N, num_clusters, 0.0, batch_size);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(r);
+		memset(count, 0, sizeof(int) * num_clusters);
+		for (i = 0; i < N; i++)
+		{
+			CU_ASSERT(r[i] >= 0 && r[i] < num_clusters);
+			count[r[i]]++;
+		}
+		for (i = 0; i < num_clusters; i++)
+			CU_ASSERT(count[i] > 0);
+		CU_ASSERT_EQUAL(_lwrandom_get_seed(1), 1234);
+		CU_ASSERT_EQUAL(_lwrandom_get_seed(2), 5678);
+		lwfree(r);
+	}
+
+	lwfree(count);
+	for (i = 0; i < N; i++)
+		lwgeom_free(geoms[i]);
+	lwfree(geoms);
+}
+
 static void test_trim_bits(void)
 {
 	POINTARRAY *pta = ptarray_construct_empty(LW_TRUE, LW_TRUE, 2);
@@ -1837,6 +1926,8 @@ void algorithms_suite_setup(void)
 	PG_ADD_TEST(suite,test_lw_arc_center);
 	PG_ADD_TEST(suite,test_point_density);
 	PG_ADD_TEST(suite,test_kmeans);
+	PG_ADD_TEST(suite,test_kmeans_ties);
+	PG_ADD_TEST(suite,test_kmeans_large_k);
 	PG_ADD_TEST(suite,test_median_handles_3d_correctly);
 	PG_ADD_TEST(suite,test_median_robustness);
 	PG_ADD_TEST(suite,test_lwpoly_construct_circle);
@@ -0,0 +1,106 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+/*
+ * Microbenchmark of the point array reductions, at every SIMD level
+ * the CPU supports. Prints nanoseconds per point for the cartesian
+ * bounding box, the 2D length and the signed area of random walks.
+ *
+ *   make -C liblwgeom/cunit bench
+ *   liblwgeom/cunit/cu_bench [npoints [repeats]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "liblwgeom_internal.h"
+
+static const char *level_names[] = {"scalar", "sse2", "avx", "neon"};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static POINTARRAY *
+random_walk(int has_z, int has_m, uint32_t npoints)
+{
+	POINTARRAY *pa = ptarray_construct(has_z, has_m, npoints);
+	POINT4D p = {500000, 5000000, 100, 0};
+	uint32_t i;
+
+	srand(4326);
+	for (i = 0; i < npoints; i++)
+	{
+		p.x += rand() / (double)RAND_MAX - 0.5;
+		p.y += rand() / (double)RAND_MAX - 0.5;
+		p.z += rand() / (double)RAND_MAX - 0.5;
+		p.m += 1;
+		ptarray_set_point4d(pa, i, &p);
+	}
+	return pa;
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t npoints = argc > 1 ? (uint32_t)atol(argv[1]) : 10000;
+	uint32_t repeats = argc > 2 ? (uint32_t)atol(argv[2]) : 1000;
+	const char *layouts[] = {"XY", "XYZ", "XYM", "XYZM"};
+	int best = lw_simd_get_level();
+	volatile double sink = 0.0;
+	int layout, level;
+	uint32_t r;
+
+	printf("%u points, %u repeats, ns per point\n", npoints, repeats);
+	printf("%-6s %-8s %10s %10s %10s\n", "dims", "level", "gbox", "length", "area");
+
+	for (layout = 0; layout < 4; layout++)
+	{
+		POINTARRAY *pa = random_walk(layout & 1, (layout & 2) >> 1, npoints);
+
+		for (level = LW_SIMD_SCALAR; level <= LW_SIMD_NEON; level++)
+		{
+			double t0, t1, t2, t3;
+			GBOX box;
+
+			if (lw_simd_set_level(level) != LW_SUCCESS)
+				continue;
+
+			t0 = now();
+			for (r = 0; r < repeats; r++)
+			{
+				ptarray_calculate_gbox_cartesian(pa, &box);
+				sink += box.xmin;
+			}
+			t1 = now();
+			for (r = 0; r < repeats; r++)
+				sink += ptarray_length_2d(pa);
+			t2 = now();
+			for (r = 0; r < repeats; r++)
+				sink += ptarray_signed_area(pa);
+			t3 = now();
+
+			printf("%-6s %-8s %10.3f %10.3f %10.3f\n",
+			       layouts[layout], level_names[level],
+			       (t1 - t0) * 1e9 / repeats / npoints,
+			       (t2 - t1) * 1e9 / repeats / npoints,
+			       (t3 - t2) * 1e9 / repeats / npoints);
+		}
+		ptarray_free(pa);
+	}
+
+	lw_simd_set_level(best);
+	return 0;
+}
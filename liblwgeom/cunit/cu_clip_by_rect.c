@@ -73,6 +73,79 @@ static void test_lwgeom_clip_by_rect(void)
 	lwgeom_free(in);
 }
 
+static void test_lwgeom_clip_by_box_grid(void)
+{
+	LWGEOM *in, *out;
+	GBOX box = {0};
+	char *tmp;
+
+	cu_error_msg_reset();
+
+	box.xmin = 0; box.ymin = 0; box.xmax = 10; box.ymax = 10;
+
+	/* Shell is oriented positive, hole negative */
+	in = lwgeom_from_wkt("POLYGON((0 0,0 10,10 10,10 0,0 0),(2 2,8 2,8 8,2 8,2 2))", LW_PARSER_CHECK_NONE);
+	out = lwgeom_clip_by_box_grid(in, &box);
+	tmp = lwgeom_to_ewkt(out);
+	CU_ASSERT_STRING_EQUAL("POLYGON((0 0,10 0,10 10,0 10,0 0),(2 2,2 8,8 8,8 2,2 2))", tmp);
+	lwfree(tmp); lwgeom_free(out); lwgeom_free(in);
+
+	/* Hole crossing the border becomes a notch */
+	in = lwgeom_from_wkt("POLYGON((0 0,10 0,10 10,0 10,0 0),(8 4,12 4,12 6,8 6,8 4))", LW_PARSER_CHECK_NONE);
+	out = lwgeom_clip_by_box_grid(in, &box);
+	tmp = lwgeom_to_ewkt(out);
+	CU_ASSERT_STRING_EQUAL("POLYGON((0 0,10 0,10 4,8 4,8 6,10 6,10 10,0 10,0 0))", tmp);
+	lwfree(tmp); lwgeom_free(out); lwgeom_free(in);
+
+	/* Arms of a U shape come out as separate polygons */
+	box.ymin = 5;
+	in = lwgeom_from_wkt("POLYGON((0 0,10 0,10 10,8 10,8 2,2 2,2 10,0 10,0 0))", LW_PARSER_CHECK_NONE);
+	out = lwgeom_clip_by_box_grid(in, &box);
+	tmp = lwgeom_to_ewkt(out);
+	CU_ASSERT_STRING_EQUAL("MULTIPOLYGON(((0 5,2 5,2 10,0 10,0 5)),((8 5,10 5,10 10,8 10,8 5)))", tmp);
+	lwfree(tmp); lwgeom_free(out); lwgeom_free(in);
+	box.ymin = 0;
+
+	/* Shared edges cancel out */
+	in = lwgeom_from_wkt("MULTIPOLYGON(((0 0,5 0,5 5,0 5,0 0)),((5 0,10 0,10 5,5 5,5 0)))", LW_PARSER_CHECK_NONE);
+	out = lwgeom_clip_by_box_grid(in, &box);
+	tmp = lwgeom_to_ewkt(out);
+	CU_ASSERT_STRING_EQUAL("POLYGON((0 0,10 0,10 5,0 5,0 0))", tmp);
+	lwfree(tmp); lwgeom_free(out); lwgeom_free(in);
+
+	/* Polygons touching in a point are kept apart */
+	in = lwgeom_from_wkt("MULTIPOLYGON(((0 0,5 0,5 5,0 5,0 0)),((5 5,10 5,10 10,5 10,5 5)))", LW_PARSER_CHECK_NONE);
+	out = lwgeom_clip_by_box_grid(in, &box);
+	tmp = lwgeom_to_ewkt(out);
+	CU_ASSERT_STRING_EQUAL("MULTIPOLYGON(((0 0,5 0,5 5,0 5,0 0)),((5 5,10 5,10 10,5 10,5 5)))", tmp);
+	lwfree(tmp); lwgeom_free(out); lwgeom_free(in);
+
+	/* Spikes are removed */
+	in = lwgeom_from_wkt("POLYGON((0 0,10 0,10 5,15 5,10 5,10 10,0 10,0 0))", LW_PARSER_CHECK_NONE);
+	out = lwgeom_clip_by_box_grid(in, &box);
+	tmp = lwgeom_to_ewkt(out);
+	CU_ASSERT_STRING_EQUAL("POLYGON((0 0,10 0,10 10,0 10,0 0))", tmp);
+	lwfree(tmp); lwgeom_free(out); lwgeom_free(in);
+
+	/* Disjoint and collapsed polygons give an empty result */
+	in = lwgeom_from_wkt("POLYGON((100 100,110 100,110 110,100 100))", LW_PARSER_CHECK_NONE);
+	out = lwgeom_clip_by_box_grid(in, &box);
+	CU_ASSERT_EQUAL(out->type, MULTIPOLYGONTYPE);
+	CU_ASSERT(lwgeom_is_empty(out));
+	lwgeom_free(out); lwgeom_free(in);
+
+	in = lwgeom_from_wkt("POLYGON((1 2,1 3,1 4,1 2))", LW_PARSER_CHECK_NONE);
+	out = lwgeom_clip_by_box_grid(in, &box);
+	CU_ASSERT(lwgeom_is_empty(out));
+	lwgeom_free(out); lwgeom_free(in);
+
+	/* Only polygons are supported */
+	in = lwgeom_from_wkt("LINESTRING(0 0,5 5)", LW_PARSER_CHECK_NONE);
+	out = lwgeom_clip_by_box_grid(in, &box);
+	CU_ASSERT_PTR_NULL(out);
+	lwgeom_free(in);
+}
+
 /*
 ** Used by test harness to register the tests in this file.
 */
@@ -81,4 +154,5 @@ void clip_by_rect_suite_setup(void)
 {
 	CU_pSuite suite = CU_add_suite("clip_by_rectangle", NULL, NULL);
 	PG_ADD_TEST(suite, test_lwgeom_clip_by_rect);
+	PG_ADD_TEST(suite, test_lwgeom_clip_by_box_grid);
 }
@@ -266,7 +266,7 @@ struct dbscan_test_info {
 	int* expected_in_cluster;
 };
 
-static void do_dbscan_test(struct dbscan_test_info test)
+static void do_dbscan_test_threads(struct dbscan_test_info test, uint32_t num_threads)
 {
 	LWGEOM** geoms = WKTARRAY2LWGEOM(test.wkt_inputs, test.num_geoms);
 	UNIONFIND* uf = UF_create(test.num_geoms);
@@ -274,7 +274,10 @@ static void do_dbscan_test(struct dbscan_test_info test)
 	char* in_a_cluster;
 	uint32_t i;
 
-	union_dbscan(geoms, test.num_geoms, uf, test.eps, test.min_points, &in_a_cluster);
+	if (num_threads)
+		union_dbscan_parallel(geoms, test.num_geoms, uf, test.eps, test.min_points, &in_a_cluster, num_threads);
+	else
+		union_dbscan(geoms, test.num_geoms, uf, test.eps, test.min_points, &in_a_cluster);
 	ids = UF_get_collapsed_cluster_ids(uf, in_a_cluster);
 
 	for (i = 0; i < test.num_geoms; i++)
@@ -294,6 +297,13 @@ static void do_dbscan_test(struct dbscan_test_info test)
 	lwfree(ids);
 }
 
+/* Same expectations single threaded and multi-threaded */
+static void do_dbscan_test(struct dbscan_test_info test)
+{
+	do_dbscan_test_threads(test, 0);
+	do_dbscan_test_threads(test, 4);
+}
+
 static void dbscan_test(void)
 {
 	struct dbscan_test_info test;
@@ -367,6 +377,110 @@ static void dbscan_test_3612c(void)
 	do_dbscan_test(test);
 }
 
+static void dbscan_parallel_test(void)
+{
+	uint32_t num_geoms = 2000, i, threads;
+	LWGEOM** geoms = lwalloc(num_geoms * sizeof(LWGEOM*));
+	uint32_t* ids[2];
+
+	/* Two blocks of 10 rows of points 1 apart, 2.5 apart from each other */
+	for (i = 0; i < num_geoms; i++)
+		geoms[i] = lwpoint_as_lwgeom(lwpoint_make2d(SRID_UNKNOWN, i % 100, (i / 100) + (i / 1000) * 1.5));
+
+	for (threads = 1; threads <= 8; threads *= 8)
+	{
+		UNIONFIND* uf = UF_create(num_geoms);
+		char* in_a_cluster;
+		union_dbscan_parallel(geoms, num_geoms, uf, 1.0, 3, &in_a_cluster, threads);
+		ids[threads == 1 ? 0 : 1] = UF_get_collapsed_cluster_ids(uf, in_a_cluster);
+		ASSERT_INT_EQUAL(uf->num_clusters, 2);
+		for (i = 0; i < num_geoms; i++)
+			CU_ASSERT_TRUE(in_a_cluster[i]);
+		lwfree(in_a_cluster);
+		UF_destroy(uf);
+	}
+
+	/* Ids follow input order, whatever the number of threads */
+	for (i = 0; i < num_geoms; i++)
+	{
+		ASSERT_INT_EQUAL(ids[0][i], i < 1000 ? 0 : 1);
+		ASSERT_INT_EQUAL(ids[1][i], ids[0][i]);
+	}
+
+	for (i = 0; i < num_geoms; i++)
+		lwgeom_free(geoms[i]);
+	lwfree(geoms);
+	lwfree(ids[0]);
+	lwfree(ids[1]);
+}
+
+/* Points are clustered on a grid, which must agree with the tree used for other types */
+static void dbscan_grid_test(void)
+{
+	uint32_t num_geoms = 3000, i, run;
+	LWGEOM** points = lwalloc(num_geoms * sizeof(LWGEOM*));
+	LWGEOM** multipoints = lwalloc(num_geoms * sizeof(LWGEOM*));
+	double eps[] = {0.0, 1.0, 1.5, 4.0};
+	uint32_t min_points[] = {1, 3, 5, 2};
+
+	/* Points on a coarse lattice, with duplicates and a few empties */
+	for (i = 0; i < num_geoms; i++)
+	{
+		double x = (i * 7919) % 97;
+		double y = (i * 104729) % 89;
+		if (i % 101 == 0)
+		{
+			points[i] = lwpoint_as_lwgeom(lwpoint_construct_empty(SRID_UNKNOWN, 0, 0));
+			multipoints[i] = lwmpoint_as_lwgeom(lwmpoint_construct_empty(SRID_UNKNOWN, 0, 0));
+			continue;
+		}
+		points[i] = lwpoint_as_lwgeom(lwpoint_make2d(SRID_UNKNOWN, x, y));
+		multipoints[i] = lwmpoint_as_lwgeom(
+		    lwmpoint_add_lwpoint(lwmpoint_construct_empty(SRID_UNKNOWN, 0, 0), lwpoint_make2d(SRID_UNKNOWN, x, y)));
+	}
+
+	CU_ASSERT_TRUE(union_dbscan_grid_accepts(points, num_geoms));
+	CU_ASSERT_FALSE(union_dbscan_grid_accepts(multipoints, num_geoms));
+
+	for (run = 0; run < sizeof(eps) / sizeof(double); run++)
+	{
+		UNIONFIND* uf_grid = UF_create(num_geoms);
+		UNIONFIND* uf_tree = UF_create(num_geoms);
+		char* in_grid;
+		char* in_tree;
+		uint32_t* ids_grid;
+		uint32_t* ids_tree;
+
+		union_dbscan_parallel(points, num_geoms, uf_grid, eps[run], min_points[run], &in_grid, 4);
+		union_dbscan_parallel(multipoints, num_geoms, uf_tree, eps[run], min_points[run], &in_tree, 4);
+		ids_grid = UF_get_collapsed_cluster_ids(uf_grid, in_grid);
+		ids_tree = UF_get_collapsed_cluster_ids(uf_tree, in_tree);
+
+		ASSERT_INT_EQUAL(uf_grid->num_clusters, uf_tree->num_clusters);
+		for (i = 0; i < num_geoms; i++)
+		{
+			ASSERT_INT_EQUAL(in_grid[i], in_tree[i]);
+			if (in_grid[i])
+				ASSERT_INT_EQUAL(ids_grid[i], ids_tree[i]);
+		}
+
+		lwfree(in_grid);
+		lwfree(in_tree);
+		lwfree(ids_grid);
+		lwfree(ids_tree);
+		UF_destroy(uf_grid);
+		UF_destroy(uf_tree);
+	}
+
+	for (i = 0; i < num_geoms; i++)
+	{
+		lwgeom_free(points[i]);
+		lwgeom_free(multipoints[i]);
+	}
+	lwfree(points);
+	lwfree(multipoints);
+}
+
 void geos_cluster_suite_setup(void);
 void geos_cluster_suite_setup(void)
 {
@@ -381,4 +495,6 @@ void geos_cluster_suite_setup(void)
 	PG_ADD_TEST(suite, dbscan_test_3612a);
 	PG_ADD_TEST(suite, dbscan_test_3612b);
 	PG_ADD_TEST(suite, dbscan_test_3612c);
+	PG_ADD_TEST(suite, dbscan_parallel_test);
+	PG_ADD_TEST(suite, dbscan_grid_test);
 }
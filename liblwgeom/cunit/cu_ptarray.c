@@ -832,6 +832,71 @@ static void test_ptarray_closest_point_on_segment(void)
 
 }
 
+/*
+ * Every SIMD level has to give the scalar results bit for bit,
+ * also when NaN and signed zeros make the order of the points matter.
+ */
+static void test_ptarray_simd()
+{
+	int saved = lw_simd_get_level();
+	uint32_t seed = 12345;
+	int layout, special, level;
+	uint32_t npoints, i;
+
+	CU_ASSERT(saved != LW_SIMD_AUTO);
+
+	for (layout = 0; layout < 4; layout++)
+	{
+		int has_z = layout & 1;
+		int has_m = (layout & 2) >> 1;
+
+		for (npoints = 1; npoints < 40; npoints++)
+		{
+			for (special = 0; special < 4; special++)
+			{
+				POINTARRAY *pa = ptarray_construct(has_z, has_m, npoints);
+				double *ords = (double *)pa->serialized_pointlist;
+				uint32_t nords = npoints * FLAGS_NDIMS(pa->flags);
+				GBOX ref, box;
+				double len_ref, len;
+
+				for (i = 0; i < nords; i++)
+				{
+					seed = seed * 1103515245 + 12345;
+					ords[i] = ((double)(seed >> 8) - 8388608.0) / 7.0;
+					if (special == 2 && (seed & 0x300) == 0)
+						ords[i] = (seed & 0x400) ? 0.0 : -0.0;
+					if (special == 3)
+						ords[i] = (seed & 0x400) ? 0.0 : -0.0;
+				}
+				if (special == 1)
+					ords[nords / 2] = NAN;
+
+				memset(&ref, 0, sizeof(GBOX));
+				CU_ASSERT_EQUAL(lw_simd_set_level(LW_SIMD_SCALAR), LW_SUCCESS);
+				ptarray_calculate_gbox_cartesian(pa, &ref);
+				len_ref = ptarray_length_2d(pa);
+
+				for (level = LW_SIMD_SSE2; level <= LW_SIMD_NEON; level++)
+				{
+					if (lw_simd_set_level(level) != LW_SUCCESS)
+						continue;
+					memset(&box, 0, sizeof(GBOX));
+					ptarray_calculate_gbox_cartesian(pa, &box);
+					len = ptarray_length_2d(pa);
+					CU_ASSERT_EQUAL(box.flags, ref.flags);
+					CU_ASSERT(memcmp(&box.xmin, &ref.xmin, 8 * sizeof(double)) == 0);
+					CU_ASSERT(memcmp(&len, &len_ref, sizeof(double)) == 0);
+				}
+				ptarray_free(pa);
+			}
+		}
+	}
+
+	lw_simd_set_level(saved);
+	CU_ASSERT_EQUAL(lw_simd_get_level(), saved);
+}
+
 
 /*
 ** Used by the test harness to register the tests in this file.
@@ -853,4 +918,5 @@ void ptarray_suite_setup(void)
 	PG_ADD_TEST(suite, test_ptarray_closest_vertex_2d);
 	PG_ADD_TEST(suite, test_ptarray_closest_segment_2d);
 	PG_ADD_TEST(suite, test_ptarray_closest_point_on_segment);
+	PG_ADD_TEST(suite, test_ptarray_simd);
 }
@@ -0,0 +1,171 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+#include "CUnit/Basic.h"
+#include "cu_tester.h"
+
+#include "liblwgeom.h"
+#include "liblwgeom_internal.h"
+
+/*
+ * Points on a lon/lat lattice, all in one array, shifted
+ * to be around lon_0 and inside the +/-85 latitudes.
+ */
+static POINTARRAY *
+lattice_lonlat(double lon_0, double lon_range)
+{
+	POINTARRAY *pa = ptarray_construct_empty(0, 0, 512);
+	POINT4D p = {0, 0, 0, 0};
+	int i, j;
+	for (i = 0; i <= 40; i++)
+	{
+		for (j = 0; j <= 34; j++)
+		{
+			p.x = lon_0 - lon_range + 2 * lon_range * i / 40.0 + 0.0123;
+			p.y = -85.0 + 5.0 * j + 0.0456;
+			if (p.y > 85.0) p.y = 85.0;
+			ptarray_append_point(pa, &p, LW_TRUE);
+		}
+	}
+	return pa;
+}
+
+/*
+ * Transform a copy of the points with and without the native
+ * transform, returning the largest difference in any ordinate.
+ */
+static double
+native_vs_proj(LWPROJ *lp, const POINTARRAY *pa)
+{
+	POINTARRAY *native = ptarray_clone_deep(pa);
+	POINTARRAY *proj = ptarray_clone_deep(pa);
+	LWPROJ_NATIVE saved = lp->native;
+	double maxdiff = 0.0;
+	uint32_t i;
+
+	CU_ASSERT_EQUAL(ptarray_transform(native, lp), LW_SUCCESS);
+	lp->native.type = LWPROJ_NATIVE_NONE;
+	CU_ASSERT_EQUAL(ptarray_transform(proj, lp), LW_SUCCESS);
+	lp->native = saved;
+
+	for (i = 0; i < pa->npoints; i++)
+	{
+		POINT4D p1, p2;
+		getPoint4d_p(native, i, &p1);
+		getPoint4d_p(proj, i, &p2);
+		maxdiff = FP_MAX(maxdiff, fabs(p1.x - p2.x));
+		maxdiff = FP_MAX(maxdiff, fabs(p1.y - p2.y));
+	}
+
+	ptarray_free(native);
+	ptarray_free(proj);
+	return maxdiff;
+}
+
+/*
+ * Compare a CRS pair both ways, lon/lat first. A negative
+ * type does not check which native transform is used.
+ */
+static void
+check_pair(const char *lonlat, const char *projected, int type, double lon_0, double lon_range)
+{
+	LWPROJ *fwd = lwproj_from_str(lonlat, projected);
+	LWPROJ *inv = lwproj_from_str(projected, lonlat);
+	POINTARRAY *pa = lattice_lonlat(lon_0, lon_range);
+	POINTARRAY *pm = ptarray_clone_deep(pa);
+	double diff;
+
+	CU_ASSERT_FATAL(fwd != NULL);
+	CU_ASSERT_FATAL(inv != NULL);
+	if (type >= 0)
+	{
+		CU_ASSERT_EQUAL((int)fwd->native.type, type);
+		CU_ASSERT_EQUAL((int)inv->native.type, type);
+		CU_ASSERT(!fwd->native.inverse);
+		CU_ASSERT(type == LWPROJ_NATIVE_NONE || inv->native.inverse);
+	}
+
+	/* Metres */
+	diff = native_vs_proj(fwd, pa);
+	ASSERT_DOUBLE_EQUAL_TOLERANCE(diff, 0.0, 1e-4);
+
+	/* Degrees, from what PROJ makes of the lattice */
+	fwd->native.type = LWPROJ_NATIVE_NONE;
+	CU_ASSERT_EQUAL(ptarray_transform(pm, fwd), LW_SUCCESS);
+	diff = native_vs_proj(inv, pm);
+	ASSERT_DOUBLE_EQUAL_TOLERANCE(diff, 0.0, 1e-9);
+
+	ptarray_free(pa);
+	ptarray_free(pm);
+	proj_destroy(fwd->pj);
+	proj_destroy(inv->pj);
+	lwfree(fwd);
+	lwfree(inv);
+}
+
+static void test_transform_native_webmerc(void)
+{
+	check_pair("EPSG:4326", "EPSG:3857", LWPROJ_NATIVE_WEBMERC, 0.0, 179.9);
+}
+
+static void test_transform_native_utm(void)
+{
+	check_pair("EPSG:4326", "EPSG:32633", LWPROJ_NATIVE_TMERC, 15.0, 29.9);
+	check_pair("EPSG:4326", "EPSG:32719", LWPROJ_NATIVE_TMERC, -69.0, 29.9);
+	check_pair("EPSG:4326", "+proj=utm +zone=60 +south +ellps=WGS84 +datum=WGS84 +units=m +no_defs", LWPROJ_NATIVE_TMERC, 177.0, 2.9);
+}
+
+static void test_transform_native_tmerc(void)
+{
+	LWPROJ *lp;
+	POINTARRAY *pa;
+
+	/* Points far from the central meridian go through PROJ */
+	lp = lwproj_from_str("EPSG:4326", "EPSG:32633");
+	CU_ASSERT_FATAL(lp != NULL);
+	pa = lattice_lonlat(15.0, 89.0);
+	ASSERT_DOUBLE_EQUAL_TOLERANCE(native_vs_proj(lp, pa), 0.0, 1e-4);
+	ptarray_free(pa);
+	proj_destroy(lp->pj);
+	lwfree(lp);
+
+	/* Inverse pipelines */
+	lp = lwproj_from_str_pipeline("+proj=pipeline +step +proj=unitconvert +xy_in=deg +xy_out=rad "
+				      "+step +proj=tmerc +lat_0=0 +lon_0=173 +k=0.9996 +x_0=1600000 +y_0=10000000 +ellps=GRS80",
+				      false);
+	CU_ASSERT_FATAL(lp != NULL);
+	CU_ASSERT_EQUAL((int)lp->native.type, LWPROJ_NATIVE_TMERC);
+	pa = ptarray_construct_empty(0, 0, 2);
+	{
+		POINT4D p = {1688980, 5904660, 0, 0};
+		ptarray_append_point(pa, &p, LW_TRUE);
+	}
+	ASSERT_DOUBLE_EQUAL_TOLERANCE(native_vs_proj(lp, pa), 0.0, 1e-9);
+	ptarray_free(pa);
+	proj_destroy(lp->pj);
+	lwfree(lp);
+
+	/* Transverse Mercator with a latitude of origin (British National Grid) */
+	check_pair("EPSG:4326",
+		   "+proj=tmerc +lat_0=49 +lon_0=-2 +k=0.9996012717 +x_0=400000 +y_0=-100000 +a=6377563.396 +rf=299.3249646 +units=m +no_defs",
+		   -1, -2.0, 10.0);
+}
+
+/*
+** Used by test harness to register the tests in this file.
+*/
+void transform_suite_setup(void);
+void transform_suite_setup(void)
+{
+	CU_pSuite suite = CU_add_suite("transform", NULL, NULL);
+	PG_ADD_TEST(suite, test_transform_native_webmerc);
+	PG_ADD_TEST(suite, test_transform_native_utm);
+	PG_ADD_TEST(suite, test_transform_native_tmerc);
+}
@@ -533,73 +533,11 @@ static int lw_arc_calculate_gbox_cartesian(const POINT4D *p1, const POINT4D *p2,
 	return rv;
 }
 
-static void
-ptarray_calculate_gbox_cartesian_2d(const POINTARRAY *pa, GBOX *gbox)
-{
-	const POINT2D *p = getPoint2d_cp(pa, 0);
-
-	gbox->xmax = gbox->xmin = p->x;
-	gbox->ymax = gbox->ymin = p->y;
-
-	for (uint32_t i = 1; i < pa->npoints; i++)
-	{
-		p = getPoint2d_cp(pa, i);
-		gbox->xmin = FP_MIN(gbox->xmin, p->x);
-		gbox->xmax = FP_MAX(gbox->xmax, p->x);
-		gbox->ymin = FP_MIN(gbox->ymin, p->y);
-		gbox->ymax = FP_MAX(gbox->ymax, p->y);
-	}
-}
-
-/* Works with X/Y/Z. Needs to be adjusted after if X/Y/M was required */
-static void
-ptarray_calculate_gbox_cartesian_3d(const POINTARRAY *pa, GBOX *gbox)
-{
-	const POINT3D *p = getPoint3d_cp(pa, 0);
-
-	gbox->xmax = gbox->xmin = p->x;
-	gbox->ymax = gbox->ymin = p->y;
-	gbox->zmax = gbox->zmin = p->z;
-
-	for (uint32_t i = 1; i < pa->npoints; i++)
-	{
-		p = getPoint3d_cp(pa, i);
-		gbox->xmin = FP_MIN(gbox->xmin, p->x);
-		gbox->xmax = FP_MAX(gbox->xmax, p->x);
-		gbox->ymin = FP_MIN(gbox->ymin, p->y);
-		gbox->ymax = FP_MAX(gbox->ymax, p->y);
-		gbox->zmin = FP_MIN(gbox->zmin, p->z);
-		gbox->zmax = FP_MAX(gbox->zmax, p->z);
-	}
-}
-
-static void
-ptarray_calculate_gbox_cartesian_4d(const POINTARRAY *pa, GBOX *gbox)
-{
-	const POINT4D *p = getPoint4d_cp(pa, 0);
-
-	gbox->xmax = gbox->xmin = p->x;
-	gbox->ymax = gbox->ymin = p->y;
-	gbox->zmax = gbox->zmin = p->z;
-	gbox->mmax = gbox->mmin = p->m;
-
-	for (uint32_t i = 1; i < pa->npoints; i++)
-	{
-		p = getPoint4d_cp(pa, i);
-		gbox->xmin = FP_MIN(gbox->xmin, p->x);
-		gbox->xmax = FP_MAX(gbox->xmax, p->x);
-		gbox->ymin = FP_MIN(gbox->ymin, p->y);
-		gbox->ymax = FP_MAX(gbox->ymax, p->y);
-		gbox->zmin = FP_MIN(gbox->zmin, p->z);
-		gbox->zmax = FP_MAX(gbox->zmax, p->z);
-		gbox->mmin = FP_MIN(gbox->mmin, p->m);
-		gbox->mmax = FP_MAX(gbox->mmax, p->m);
-	}
-}
-
 int
 ptarray_calculate_gbox_cartesian(const POINTARRAY *pa, GBOX *gbox)
 {
+	double min[4], max[4];
+
 	if (!pa || pa->npoints == 0)
 		return LW_FAILURE;
 	if (!gbox)
@@ -609,38 +547,21 @@ ptarray_calculate_gbox_cartesian(const POINTARRAY *pa, GBOX *gbox)
 	int has_m = FLAGS_GET_M(pa->flags);
 	gbox->flags = lwflags(has_z, has_m, 0);
 	LWDEBUGF(4, "ptarray_calculate_gbox Z: %d M: %d", has_z, has_m);
-	int coordinates = 2 + has_z + has_m;
 
-	switch (coordinates)
+	ptarray_minmax_simd(pa, min, max);
+	gbox->xmin = min[0];
+	gbox->xmax = max[0];
+	gbox->ymin = min[1];
+	gbox->ymax = max[1];
+	if (has_z)
 	{
-	case 2:
-	{
-		ptarray_calculate_gbox_cartesian_2d(pa, gbox);
-		break;
+		gbox->zmin = min[2];
+		gbox->zmax = max[2];
 	}
-	case 3:
+	if (has_m)
 	{
-		if (has_z)
-		{
-			ptarray_calculate_gbox_cartesian_3d(pa, gbox);
-		}
-		else
-		{
-			double zmin = gbox->zmin;
-			double zmax = gbox->zmax;
-			ptarray_calculate_gbox_cartesian_3d(pa, gbox);
-			gbox->mmin = gbox->zmin;
-			gbox->mmax = gbox->zmax;
-			gbox->zmin = zmin;
-			gbox->zmax = zmax;
-		}
-		break;
-	}
-	default:
-	{
-		ptarray_calculate_gbox_cartesian_4d(pa, gbox);
-		break;
-	}
+		gbox->mmin = min[2 + has_z];
+		gbox->mmax = max[2 + has_z];
 	}
 	return LW_SUCCESS;
 }
@@ -323,6 +323,21 @@ int ptarray_has_z(const POINTARRAY *pa);
 int ptarray_has_m(const POINTARRAY *pa);
 double ptarray_signed_area(const POINTARRAY *pa);
 
+/*
+* SIMD kernels for the point array reductions, picked at first use
+* from what the CPU supports. Every level gives the same results,
+* bit for bit.
+*/
+#define LW_SIMD_AUTO -1
+#define LW_SIMD_SCALAR 0
+#define LW_SIMD_SSE2 1
+#define LW_SIMD_AVX 2
+#define LW_SIMD_NEON 3
+int lw_simd_get_level(void);
+int lw_simd_set_level(int level);
+void ptarray_minmax_simd(const POINTARRAY *pa, double *min, double *max);
+double ptarray_length_2d_simd(const POINTARRAY *pa);
+
 /*
 * Length
 */
@@ -864,6 +864,23 @@ typedef struct LWT_BE_CALLBACKS_T {
    */
   GBOX *(*computeFaceMBR)(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID face);
 
+  /**
+   * Get a set of available edge identifiers
+   *
+   * Identifiers returned by this function should not be considered
+   * available anymore.
+   *
+   * This callback is optional, getNextEdgeId will be called once
+   * per identifier when it is not registered.
+   *
+   * @param topo the topology to act upon
+   * @param ids output parameter, gets numelems edge identifiers
+   * @param numelems number of identifiers to reserve
+   *
+   * @return 0 on success, -1 on error (@see lastErrorMessage)
+   */
+  int (*getNextEdgeIds)(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID *ids, uint64_t numelems);
+
 } LWT_BE_CALLBACKS;
 
 
@@ -1143,6 +1160,66 @@ int lwt_Polygonize(LWT_TOPOLOGY* topo);
 LWT_ELEMID* lwt_AddPolygon(LWT_TOPOLOGY* topo, LWPOLY* poly, double tol,
                         int* nfaces);
 
+/**
+ * Load a batch of geometries into the topology
+ *
+ * When nothing exists in the topology within the bounding box of the
+ * batch, the linework of all geometries is noded in memory (snap-rounded
+ * to a grid of the given tolerance, or the topology precision when 0),
+ * nodes, edges and faces are built in a single pass and written to the
+ * backend with batched inserts. Points are then added as by lwt_AddPoint.
+ *
+ * When the area is not empty, the geometries are added one by one as by
+ * lwt_AddPoint, lwt_AddLine and lwt_AddPolygon.
+ *
+ * @param topo the topology to operate on
+ * @param geoms the geometries to load, of any type but curves
+ * @param ngeoms number of elements in the geoms array
+ * @param tol snap tolerance, the topology tolerance will be used if 0
+ *
+ * @return 0 on success, -1 on error
+ *         (liblwgeom error handler will be invoked with error message)
+ */
+int lwt_LoadGeometries(LWT_TOPOLOGY* topo, LWGEOM **geoms, uint32_t ngeoms,
+                       double tol);
+
+/** A topology inconsistency, as reported by ValidateTopology */
+typedef struct LWT_VALIDATION_ERROR_T {
+  /* Static description of the error */
+  const char *error;
+  LWT_ELEMID id1;
+  /* 0 if the error has no second element */
+  LWT_ELEMID id2;
+} LWT_VALIDATION_ERROR;
+
+/**
+ * Validate a topology, or the part of it owned by a partition
+ *
+ * Performs the checks of the SQL ValidateTopology function. Each check
+ * is owned by a reference point: the node point for node checks, the
+ * first vertex for edge checks, the lower left corner of the
+ * intersection of the edge boxes for crossing checks, the start of the
+ * identifying signed edge for ring checks and the lower left corner of
+ * the mbr for face checks.
+ *
+ * A partition owns the reference points in the half-open box
+ * [xmin,xmax) x [ymin,ymax), so that validating every cell of a grid
+ * covering the topology reports each error exactly once. As in the
+ * SQL function, ring and face checks are skipped when edge linking
+ * errors are found, and face checks when ring errors are found,
+ * here limited to the partition.
+ *
+ * @param topo the topology to operate on
+ * @param partition the partition box, or NULL for the whole topology
+ * @param errors will be set to an array of errors, sorted by check
+ *               and identifiers, to be released with lwfree
+ *
+ * @return the number of errors in the errors array, or -1 on error
+ *         (liblwgeom error handler will be invoked with error message)
+ */
+int lwt_ValidateTopology(LWT_TOPOLOGY *topo, const GBOX *partition,
+                         LWT_VALIDATION_ERROR **errors);
+
 /*******************************************************************
  *
  * ISO signatures here
@@ -0,0 +1,866 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+/*
+ * Multi-threaded DBSCAN.
+ *
+ * The work runs in three phases over a read-only packed R-tree:
+ *
+ *  1. every input counts its neighbours within eps, up to min_points,
+ *     to find the core inputs;
+ *  2. every core input unions with its core neighbours and claims its
+ *     border neighbours, a border input going to its lowest numbered
+ *     core neighbour;
+ *  3. border inputs join the cluster of the core input that claimed them.
+ *
+ * Phases 1 and 2 are spread over threads in chunks of inputs. Worker
+ * threads never allocate, nor call lwerror: everything they need is
+ * allocated beforehand, and only geometry types whose distance can be
+ * computed without allocating are accepted. Clusters are rooted at their
+ * smallest input number, so the result does not depend on the number of
+ * threads nor on their scheduling.
+ *
+ * When every input is a point, the R-tree is replaced by a uniform grid of
+ * eps sized cells over a flat array of coordinates, sorted by cell: the
+ * neighbours of a point are then in the three runs of cells of the rows
+ * above, below and at its own cell. Work is handed out in chunks of cells.
+ */
+
+#include "../postgis_config.h"
+
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#include "liblwgeom_internal.h"
+#include "lwgeom_log.h"
+#include "lwgeom_geos.h"
+#include "measures.h"
+
+#define DBSCAN_NODE_CAPACITY 16
+#define DBSCAN_MAX_DEPTH 16
+#define DBSCAN_CHUNK_SIZE 256
+#define DBSCAN_NONE UINT32_MAX
+
+typedef struct
+{
+	double xmin, ymin, xmax, ymax;
+} DBSCAN_BOX;
+
+/* Packed (Sort-Tile-Recursive) R-tree, read-only once built */
+typedef struct
+{
+	uint32_t num_items;
+	uint32_t *items;	 /* input numbers in leaf order */
+	uint32_t num_levels;
+	uint32_t level_size[DBSCAN_MAX_DEPTH];
+	DBSCAN_BOX *level[DBSCAN_MAX_DEPTH];
+} DBSCAN_TREE;
+
+typedef struct
+{
+	double x, y;
+	uint32_t id;
+} DBSCAN_GRID_POINT;
+
+typedef struct
+{
+	uint64_t key;	/* row << 32 | column */
+	uint32_t start; /* first point of the cell */
+} DBSCAN_GRID_CELL;
+
+/* Points sorted by cell, then by input number */
+typedef struct
+{
+	DBSCAN_GRID_POINT *points;
+	uint32_t num_points;
+	DBSCAN_GRID_CELL *cells; /* in key order, plus an end marker */
+	uint32_t num_cells;
+} DBSCAN_GRID;
+
+typedef struct
+{
+	LWGEOM **geoms;
+	const DBSCAN_BOX *boxes;
+	const DBSCAN_TREE *tree;
+	const DBSCAN_GRID *grid;
+	UNIONFIND *uf;
+	double eps;
+	uint32_t num_geoms;
+	uint32_t min_points;
+	char *is_core;
+	uint32_t *owner;
+	uint32_t next_chunk;
+	uint32_t phase;
+	int interrupted;
+} DBSCAN_STATE;
+
+typedef struct
+{
+	double key;
+	uint32_t id;
+} DBSCAN_SORT_ITEM;
+
+static int
+dbscan_sort_cmp(const void *a, const void *b)
+{
+	const DBSCAN_SORT_ITEM *ia = a;
+	const DBSCAN_SORT_ITEM *ib = b;
+	if (ia->key < ib->key) return -1;
+	if (ia->key > ib->key) return 1;
+	return ia->id < ib->id ? -1 : ia->id > ib->id;
+}
+
+/*
+ * Types whose distance lw_dist2d_distribute_bruteforce computes without
+ * allocating memory or raising errors.
+ */
+static int
+dbscan_type_is_threadsafe(const LWGEOM *geom)
+{
+	switch (geom->type)
+	{
+	case POINTTYPE:
+	case LINETYPE:
+	case POLYGONTYPE:
+	case TRIANGLETYPE:
+		return LW_TRUE;
+	case MULTIPOINTTYPE:
+	case MULTILINETYPE:
+	case MULTIPOLYGONTYPE:
+	case COLLECTIONTYPE:
+	{
+		const LWCOLLECTION *col = (const LWCOLLECTION *)geom;
+		uint32_t i;
+		for (i = 0; i < col->ngeoms; i++)
+			if (!dbscan_type_is_threadsafe(col->geoms[i]))
+				return LW_FALSE;
+		return LW_TRUE;
+	}
+	default:
+		return LW_FALSE;
+	}
+}
+
+static void
+dbscan_distance_recursive(const LWGEOM *g1, const LWGEOM *g2, DISTPTS *dl)
+{
+	uint32_t i;
+
+	if (dl->distance <= dl->tolerance)
+		return;
+
+	if (lwgeom_is_collection(g1))
+	{
+		const LWCOLLECTION *col = (const LWCOLLECTION *)g1;
+		for (i = 0; i < col->ngeoms && dl->distance > dl->tolerance; i++)
+			dbscan_distance_recursive(col->geoms[i], g2, dl);
+		return;
+	}
+	if (lwgeom_is_collection(g2))
+	{
+		const LWCOLLECTION *col = (const LWCOLLECTION *)g2;
+		for (i = 0; i < col->ngeoms && dl->distance > dl->tolerance; i++)
+			dbscan_distance_recursive(g1, col->geoms[i], dl);
+		return;
+	}
+	if (lwgeom_is_empty(g1) || lwgeom_is_empty(g2))
+		return;
+
+	lw_dist2d_distribute_bruteforce(g1, g2, dl);
+}
+
+static int
+dbscan_is_within(const DBSCAN_STATE *state, uint32_t p, uint32_t q)
+{
+	const LWGEOM *g1 = state->geoms[p];
+	const LWGEOM *g2 = state->geoms[q];
+	DISTPTS dl;
+
+	if (p == q)
+		return LW_TRUE;
+
+	if (g1->type == POINTTYPE && g2->type == POINTTYPE)
+	{
+		const POINT2D *p1 = getPoint2d_cp(((const LWPOINT *)g1)->point, 0);
+		const POINT2D *p2 = getPoint2d_cp(((const LWPOINT *)g2)->point, 0);
+		double dx = p1->x - p2->x;
+		double dy = p1->y - p2->y;
+		return sqrt(dx * dx + dy * dy) <= state->eps;
+	}
+
+	lw_dist2d_distpts_init(&dl, DIST_MIN);
+	dl.tolerance = state->eps;
+	dbscan_distance_recursive(g1, g2, &dl);
+	return dl.distance <= state->eps;
+}
+
+static inline int
+dbscan_box_overlaps(const DBSCAN_BOX *a, const DBSCAN_BOX *b)
+{
+	return a->xmin <= b->xmax && b->xmin <= a->xmax && a->ymin <= b->ymax && b->ymin <= a->ymax;
+}
+
+static void
+dbscan_box_expand(DBSCAN_BOX *a, const DBSCAN_BOX *b)
+{
+	a->xmin = FP_MIN(a->xmin, b->xmin);
+	a->ymin = FP_MIN(a->ymin, b->ymin);
+	a->xmax = FP_MAX(a->xmax, b->xmax);
+	a->ymax = FP_MAX(a->ymax, b->ymax);
+}
+
+/* Sort the given inputs into leaves, Sort-Tile-Recursive fashion */
+static void
+dbscan_tree_sort(const DBSCAN_BOX *boxes, uint32_t *items, uint32_t n)
+{
+	DBSCAN_SORT_ITEM *sort = lwalloc(sizeof(DBSCAN_SORT_ITEM) * n);
+	uint32_t num_leaves = (n + DBSCAN_NODE_CAPACITY - 1) / DBSCAN_NODE_CAPACITY;
+	uint32_t num_slices = (uint32_t)ceil(sqrt((double)num_leaves));
+	uint32_t slice_size = ((num_leaves + num_slices - 1) / num_slices) * DBSCAN_NODE_CAPACITY;
+	uint32_t i, start;
+
+	for (i = 0; i < n; i++)
+	{
+		const DBSCAN_BOX *b = &boxes[items[i]];
+		sort[i].key = b->xmin + b->xmax;
+		sort[i].id = items[i];
+	}
+	qsort(sort, n, sizeof(DBSCAN_SORT_ITEM), dbscan_sort_cmp);
+
+	for (start = 0; start < n; start += slice_size)
+	{
+		uint32_t end = start + slice_size < n ? start + slice_size : n;
+		for (i = start; i < end; i++)
+		{
+			const DBSCAN_BOX *b = &boxes[sort[i].id];
+			sort[i].key = b->ymin + b->ymax;
+		}
+		qsort(sort + start, end - start, sizeof(DBSCAN_SORT_ITEM), dbscan_sort_cmp);
+	}
+
+	for (i = 0; i < n; i++)
+		items[i] = sort[i].id;
+	lwfree(sort);
+}
+
+static void
+dbscan_tree_build(DBSCAN_TREE *tree, const DBSCAN_BOX *boxes, const char *skip, uint32_t num_geoms)
+{
+	uint32_t i, n = 0;
+
+	memset(tree, 0, sizeof(DBSCAN_TREE));
+	tree->items = lwalloc(sizeof(uint32_t) * (num_geoms ? num_geoms : 1));
+	for (i = 0; i < num_geoms; i++)
+		if (!skip[i])
+			tree->items[n++] = i;
+	tree->num_items = n;
+	if (!n)
+		return;
+
+	dbscan_tree_sort(boxes, tree->items, n);
+
+	/* Leaves, then parent levels up to a single root */
+	while (tree->num_levels < DBSCAN_MAX_DEPTH)
+	{
+		uint32_t level = tree->num_levels;
+		uint32_t num_children = level ? tree->level_size[level - 1] : n;
+		uint32_t size = (num_children + DBSCAN_NODE_CAPACITY - 1) / DBSCAN_NODE_CAPACITY;
+		DBSCAN_BOX *nodes = lwalloc(sizeof(DBSCAN_BOX) * size);
+
+		for (i = 0; i < num_children; i++)
+		{
+			const DBSCAN_BOX *child = level ? &tree->level[level - 1][i] : &boxes[tree->items[i]];
+			if (i % DBSCAN_NODE_CAPACITY == 0)
+				nodes[i / DBSCAN_NODE_CAPACITY] = *child;
+			else
+				dbscan_box_expand(&nodes[i / DBSCAN_NODE_CAPACITY], child);
+		}
+		tree->level[level] = nodes;
+		tree->level_size[level] = size;
+		tree->num_levels++;
+		if (size == 1)
+			break;
+	}
+}
+
+static void
+dbscan_tree_free(DBSCAN_TREE *tree)
+{
+	uint32_t i;
+	for (i = 0; i < tree->num_levels; i++)
+		lwfree(tree->level[i]);
+	lwfree(tree->items);
+}
+
+/*
+ * Process the inputs whose box overlaps query with visit, until visit
+ * returns LW_FALSE. Uses a fixed stack, so it is safe to call from any
+ * thread.
+ */
+typedef int (*dbscan_visitor)(DBSCAN_STATE *state, uint32_t p, uint32_t q, uint32_t *count);
+
+static void
+dbscan_tree_query(DBSCAN_STATE *state, const DBSCAN_BOX *query, dbscan_visitor visit, uint32_t p, uint32_t *count)
+{
+	const DBSCAN_TREE *tree = state->tree;
+	uint32_t stack_level[DBSCAN_MAX_DEPTH * DBSCAN_NODE_CAPACITY];
+	uint32_t stack_node[DBSCAN_MAX_DEPTH * DBSCAN_NODE_CAPACITY];
+	uint32_t depth = 0;
+
+	if (!tree->num_levels)
+		return;
+
+	stack_level[depth] = tree->num_levels - 1;
+	stack_node[depth++] = 0;
+
+	while (depth)
+	{
+		uint32_t level = stack_level[--depth];
+		uint32_t node = stack_node[depth];
+		uint32_t first = node * DBSCAN_NODE_CAPACITY;
+		uint32_t last, i;
+
+		if (!dbscan_box_overlaps(&tree->level[level][node], query))
+			continue;
+
+		if (level == 0)
+		{
+			last = first + DBSCAN_NODE_CAPACITY < tree->num_items ? first + DBSCAN_NODE_CAPACITY : tree->num_items;
+			for (i = first; i < last; i++)
+			{
+				uint32_t q = tree->items[i];
+				if (dbscan_box_overlaps(&state->boxes[q], query) && !visit(state, p, q, count))
+					return;
+			}
+		}
+		else
+		{
+			last = first + DBSCAN_NODE_CAPACITY < tree->level_size[level - 1] ? first + DBSCAN_NODE_CAPACITY
+											    : tree->level_size[level - 1];
+			for (i = first; i < last; i++)
+			{
+				stack_level[depth] = level - 1;
+				stack_node[depth++] = i;
+			}
+		}
+	}
+}
+
+/* Whether the core p still has to be linked to its neighbour q */
+static inline int
+dbscan_link_needed(DBSCAN_STATE *state, uint32_t p, uint32_t q)
+{
+	if (state->is_core[q])
+		return UF_find_concurrent(state->uf, p) != UF_find_concurrent(state->uf, q);
+	return p < __atomic_load_n(&state->owner[q], __ATOMIC_RELAXED);
+}
+
+/* Union the core p with a core q, or claim a border q for p */
+static inline void
+dbscan_link(DBSCAN_STATE *state, uint32_t p, uint32_t q)
+{
+	if (state->is_core[q])
+	{
+		UF_union_concurrent(state->uf, p, q);
+	}
+	else
+	{
+		uint32_t owner = __atomic_load_n(&state->owner[q], __ATOMIC_RELAXED);
+		while (p < owner && !__atomic_compare_exchange_n(
+				       &state->owner[q], &owner, p, LW_TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+	}
+}
+
+/* Phase 1: count neighbours of p, stopping at min_points */
+static int
+dbscan_visit_count(DBSCAN_STATE *state, uint32_t p, uint32_t q, uint32_t *count)
+{
+	if (dbscan_is_within(state, p, q))
+		(*count)++;
+	return *count < state->min_points;
+}
+
+/* Phase 2: union the core p with its core neighbours, claim border ones */
+static int
+dbscan_visit_union(DBSCAN_STATE *state, uint32_t p, uint32_t q, uint32_t *count)
+{
+	if (p == q)
+		return LW_TRUE;
+
+	/* Each core pair is looked at from its lower numbered side */
+	if (state->is_core[q] && q < p)
+		return LW_TRUE;
+
+	if (dbscan_link_needed(state, p, q) && dbscan_is_within(state, p, q))
+		dbscan_link(state, p, q);
+	return LW_TRUE;
+}
+
+static void
+dbscan_process(DBSCAN_STATE *state, uint32_t p)
+{
+	DBSCAN_BOX query = state->boxes[p];
+	uint32_t count = 0;
+
+	query.xmin -= state->eps;
+	query.ymin -= state->eps;
+	query.xmax += state->eps;
+	query.ymax += state->eps;
+
+	if (state->phase == 1)
+	{
+		dbscan_tree_query(state, &query, dbscan_visit_count, p, &count);
+		state->is_core[p] = count >= state->min_points;
+	}
+	else if (state->is_core[p])
+	{
+		dbscan_tree_query(state, &query, dbscan_visit_union, p, &count);
+	}
+}
+
+/*
+ * Uniform grid over point inputs. Cells are at least eps wide, so the
+ * neighbours of a point are in its own cell or in one of the eight around
+ * it. Cells are numbered from 1, so that the ones around never wrap.
+ */
+static inline uint64_t
+dbscan_grid_key(uint64_t row, uint64_t column)
+{
+	return row << 32 | column;
+}
+
+int
+union_dbscan_grid_accepts(LWGEOM **geoms, uint32_t num_geoms)
+{
+	uint32_t i;
+	for (i = 0; i < num_geoms; i++)
+	{
+		const POINT2D *pt;
+		if (geoms[i]->type != POINTTYPE)
+			return LW_FALSE;
+		if (lwgeom_is_empty(geoms[i]))
+			continue;
+		pt = getPoint2d_cp(((const LWPOINT *)geoms[i])->point, 0);
+		if (!isfinite(pt->x) || !isfinite(pt->y))
+			return LW_FALSE;
+	}
+	return LW_TRUE;
+}
+
+typedef struct
+{
+	uint64_t key;
+	uint32_t id;
+} DBSCAN_RADIX_ITEM;
+
+/* Stable sort on key, sixteen bits at a time, skipping the digits all keys share */
+static DBSCAN_RADIX_ITEM *
+dbscan_radix_sort(DBSCAN_RADIX_ITEM *items, DBSCAN_RADIX_ITEM *buffer, uint32_t n)
+{
+	uint32_t *count = lwalloc(sizeof(uint32_t) * 65536);
+	uint32_t shift, i;
+
+	for (shift = 0; shift < 64; shift += 16)
+	{
+		uint32_t sum = 0;
+		DBSCAN_RADIX_ITEM *swap;
+
+		memset(count, 0, sizeof(uint32_t) * 65536);
+		for (i = 0; i < n; i++)
+			count[(items[i].key >> shift) & 0xFFFF]++;
+		if (count[(items[0].key >> shift) & 0xFFFF] == n)
+			continue;
+
+		for (i = 0; i < 65536; i++)
+		{
+			uint32_t c = count[i];
+			count[i] = sum;
+			sum += c;
+		}
+		for (i = 0; i < n; i++)
+			buffer[count[(items[i].key >> shift) & 0xFFFF]++] = items[i];
+
+		swap = items;
+		items = buffer;
+		buffer = swap;
+	}
+	lwfree(count);
+	return items;
+}
+
+static void
+dbscan_grid_build(DBSCAN_GRID *grid, LWGEOM **geoms, uint32_t num_geoms, double eps)
+{
+	DBSCAN_RADIX_ITEM *items, *buffer, *sorted;
+	double xmin = DBL_MAX, ymin = DBL_MAX, xmax = -DBL_MAX, ymax = -DBL_MAX;
+	double cell_size;
+	uint32_t i, n = 0;
+
+	memset(grid, 0, sizeof(DBSCAN_GRID));
+	items = lwalloc(sizeof(DBSCAN_RADIX_ITEM) * (num_geoms ? num_geoms : 1));
+	for (i = 0; i < num_geoms; i++)
+	{
+		const POINT2D *pt;
+		if (lwgeom_is_empty(geoms[i]))
+			continue;
+		pt = getPoint2d_cp(((const LWPOINT *)geoms[i])->point, 0);
+		xmin = FP_MIN(xmin, pt->x);
+		ymin = FP_MIN(ymin, pt->y);
+		xmax = FP_MAX(xmax, pt->x);
+		ymax = FP_MAX(ymax, pt->y);
+		items[n++].id = i;
+	}
+
+	/* Cells may be wider than eps, to keep row and column numbers in 31 bits */
+	cell_size = FP_MAX(xmax - xmin, ymax - ymin) / 1073741824.0;
+	if (cell_size < eps)
+		cell_size = eps;
+	if (!(cell_size > 0))
+		cell_size = 1;
+
+	for (i = 0; i < n; i++)
+	{
+		const POINT2D *pt = getPoint2d_cp(((const LWPOINT *)geoms[items[i].id])->point, 0);
+		uint64_t column = 1, row = 1;
+		/* An infinite extent or eps puts everything in one cell */
+		if (isfinite(cell_size))
+		{
+			column += (uint64_t)floor((pt->x - xmin) / cell_size);
+			row += (uint64_t)floor((pt->y - ymin) / cell_size);
+		}
+		items[i].key = dbscan_grid_key(row, column);
+	}
+
+	buffer = lwalloc(sizeof(DBSCAN_RADIX_ITEM) * (n ? n : 1));
+	sorted = n ? dbscan_radix_sort(items, buffer, n) : items;
+
+	grid->points = lwalloc(sizeof(DBSCAN_GRID_POINT) * (n ? n : 1));
+	grid->cells = lwalloc(sizeof(DBSCAN_GRID_CELL) * (n + 1));
+	grid->num_points = n;
+	for (i = 0; i < n; i++)
+	{
+		const POINT2D *pt = getPoint2d_cp(((const LWPOINT *)geoms[sorted[i].id])->point, 0);
+		grid->points[i].x = pt->x;
+		grid->points[i].y = pt->y;
+		grid->points[i].id = sorted[i].id;
+		if (!i || sorted[i].key != sorted[i - 1].key)
+		{
+			grid->cells[grid->num_cells].key = sorted[i].key;
+			grid->cells[grid->num_cells++].start = i;
+		}
+	}
+	grid->cells[grid->num_cells].key = UINT64_MAX;
+	grid->cells[grid->num_cells].start = n;
+
+	lwfree(items);
+	lwfree(buffer);
+}
+
+static void
+dbscan_grid_free(DBSCAN_GRID *grid)
+{
+	lwfree(grid->points);
+	lwfree(grid->cells);
+}
+
+/* First cell whose key is not below key */
+static uint32_t
+dbscan_grid_lower_bound(const DBSCAN_GRID *grid, uint64_t key)
+{
+	uint32_t lo = 0, hi = grid->num_cells;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (grid->cells[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static inline int
+dbscan_grid_is_within(const DBSCAN_STATE *state, const DBSCAN_GRID_POINT *a, const DBSCAN_GRID_POINT *b)
+{
+	double dx = a->x - b->x;
+	double dy = a->y - b->y;
+	return sqrt(dx * dx + dy * dy) <= state->eps;
+}
+
+/* Run the current phase over the points of cell c */
+static void
+dbscan_grid_process(DBSCAN_STATE *state, uint32_t c)
+{
+	const DBSCAN_GRID *grid = state->grid;
+	uint64_t key = grid->cells[c].key;
+	uint32_t run_start[3], run_end[3];
+	uint32_t r, j, k;
+
+	/* The points of the three cells of each of the rows around c */
+	for (r = 0; r < 3; r++)
+	{
+		uint64_t first = dbscan_grid_key((key >> 32) + r - 1, (key & 0xFFFFFFFF) - 1);
+		uint32_t a = dbscan_grid_lower_bound(grid, first);
+		uint32_t b = a;
+		while (grid->cells[b].key <= first + 2)
+			b++;
+		run_start[r] = grid->cells[a].start;
+		run_end[r] = grid->cells[b].start;
+	}
+
+	for (k = grid->cells[c].start; k < grid->cells[c + 1].start; k++)
+	{
+		const DBSCAN_GRID_POINT *pt = &grid->points[k];
+		uint32_t p = pt->id;
+
+		if (state->phase == 1)
+		{
+			uint32_t count = 0;
+			for (r = 0; r < 3 && count < state->min_points; r++)
+				for (j = run_start[r]; j < run_end[r] && count < state->min_points; j++)
+					if (dbscan_grid_is_within(state, pt, &grid->points[j]))
+						count++;
+			state->is_core[p] = count >= state->min_points;
+		}
+		else if (state->is_core[p])
+		{
+			for (r = 0; r < 3; r++)
+			{
+				for (j = run_start[r]; j < run_end[r]; j++)
+				{
+					uint32_t q = grid->points[j].id;
+
+					/* Each core pair is looked at from its first side in grid order */
+					if (j == k || (state->is_core[q] && j < k))
+						continue;
+					if (dbscan_link_needed(state, p, q) &&
+					    dbscan_grid_is_within(state, pt, &grid->points[j]))
+						dbscan_link(state, p, q);
+				}
+			}
+		}
+	}
+}
+
+/* Thread body: take chunks of inputs, or of cells, until none are left */
+static void *
+dbscan_worker(void *arg)
+{
+	DBSCAN_STATE *state = arg;
+
+	uint32_t total = state->grid ? state->grid->num_cells : state->num_geoms;
+
+	while (!__atomic_load_n(&state->interrupted, __ATOMIC_RELAXED))
+	{
+		uint32_t start = __atomic_fetch_add(&state->next_chunk, DBSCAN_CHUNK_SIZE, __ATOMIC_RELAXED);
+		uint32_t end, p;
+
+		if (start >= total)
+			break;
+		end = start + DBSCAN_CHUNK_SIZE < total ? start + DBSCAN_CHUNK_SIZE : total;
+
+		if (state->grid)
+		{
+			for (p = start; p < end; p++)
+				dbscan_grid_process(state, p);
+		}
+		else
+		{
+			for (p = start; p < end; p++)
+				if (state->tree->num_items && state->boxes[p].xmin <= state->boxes[p].xmax)
+					dbscan_process(state, p);
+		}
+
+		/* Interrupts are only noticed here, the main thread reports them */
+		if (_lwgeom_interrupt_requested)
+			__atomic_store_n(&state->interrupted, LW_TRUE, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/* Run a phase on num_threads threads, the calling one included */
+static void
+dbscan_run_phase(DBSCAN_STATE *state, uint32_t phase, uint32_t num_threads)
+{
+#ifdef HAVE_PTHREAD
+	pthread_t threads[LW_DBSCAN_MAX_THREADS];
+	uint32_t num_started = 0, i;
+	sigset_t all_signals, old_signals;
+#endif
+
+	state->phase = phase;
+	state->next_chunk = 0;
+
+#ifdef HAVE_PTHREAD
+	/* Signals must keep going to the calling thread only */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_BLOCK, &all_signals, &old_signals);
+	for (i = 1; i < num_threads && i < LW_DBSCAN_MAX_THREADS; i++)
+	{
+		/* Threads we can't start just leave more work for the others */
+		if (pthread_create(&threads[num_started], NULL, dbscan_worker, state) != 0)
+			break;
+		num_started++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+#else
+	(void)num_threads;
+#endif
+
+	dbscan_worker(state);
+
+#ifdef HAVE_PTHREAD
+	for (i = 0; i < num_started; i++)
+		pthread_join(threads[i], NULL);
+#endif
+}
+
+int
+union_dbscan_parallel(LWGEOM **geoms,
+		      uint32_t num_geoms,
+		      UNIONFIND *uf,
+		      double eps,
+		      uint32_t min_points,
+		      char **in_a_cluster_ret,
+		      uint32_t num_threads)
+{
+	DBSCAN_STATE state;
+	DBSCAN_TREE tree;
+	DBSCAN_GRID grid;
+	DBSCAN_BOX *boxes = NULL;
+	char *is_empty;
+	char *in_a_cluster;
+	int use_grid = union_dbscan_grid_accepts(geoms, num_geoms);
+	uint32_t i;
+
+	for (i = 0; i < num_geoms && !use_grid; i++)
+	{
+		if (!dbscan_type_is_threadsafe(geoms[i]))
+		{
+			LWDEBUGF(3, "%s: %s input, running single threaded", __func__, lwtype_name(geoms[i]->type));
+			return union_dbscan(geoms, num_geoms, uf, eps, min_points, in_a_cluster_ret);
+		}
+	}
+
+	if (min_points < 1)
+		min_points = 1;
+
+	memset(&state, 0, sizeof(DBSCAN_STATE));
+	is_empty = lwalloc(num_geoms ? num_geoms : 1);
+	if (use_grid)
+	{
+		for (i = 0; i < num_geoms; i++)
+			is_empty[i] = lwgeom_is_empty(geoms[i]);
+		dbscan_grid_build(&grid, geoms, num_geoms, eps);
+		state.grid = &grid;
+	}
+	else
+	{
+		/* Boxes are computed here, so workers never touch the LWGEOM bbox cache */
+		boxes = lwalloc(sizeof(DBSCAN_BOX) * (num_geoms ? num_geoms : 1));
+		for (i = 0; i < num_geoms; i++)
+		{
+			GBOX gbox;
+			is_empty[i] = lwgeom_is_empty(geoms[i]) || lwgeom_calculate_gbox(geoms[i], &gbox) == LW_FAILURE;
+			if (is_empty[i])
+			{
+				/* Inverted box, never overlaps anything */
+				boxes[i].xmin = boxes[i].ymin = 1;
+				boxes[i].xmax = boxes[i].ymax = -1;
+				continue;
+			}
+			boxes[i].xmin = gbox.xmin;
+			boxes[i].ymin = gbox.ymin;
+			boxes[i].xmax = gbox.xmax;
+			boxes[i].ymax = gbox.ymax;
+		}
+		dbscan_tree_build(&tree, boxes, is_empty, num_geoms);
+		state.boxes = boxes;
+		state.tree = &tree;
+	}
+
+	state.geoms = geoms;
+	state.uf = uf;
+	state.eps = eps;
+	state.num_geoms = num_geoms;
+	state.min_points = min_points;
+	state.is_core = lwalloc(num_geoms ? num_geoms : 1);
+	state.owner = lwalloc(sizeof(uint32_t) * (num_geoms ? num_geoms : 1));
+	for (i = 0; i < num_geoms; i++)
+	{
+		state.is_core[i] = min_points <= 1 && !is_empty[i];
+		state.owner[i] = DBSCAN_NONE;
+	}
+
+	if (min_points > 1)
+		dbscan_run_phase(&state, 1, num_threads);
+	if (!state.interrupted)
+		dbscan_run_phase(&state, 2, num_threads);
+
+	if (use_grid)
+	{
+		dbscan_grid_free(&grid);
+	}
+	else
+	{
+		dbscan_tree_free(&tree);
+		lwfree(boxes);
+	}
+
+	if (state.interrupted)
+	{
+		lwfree(is_empty);
+		lwfree(state.is_core);
+		lwfree(state.owner);
+		LW_ON_INTERRUPT(return LW_FAILURE);
+		return LW_FAILURE;
+	}
+
+	/* Phase 3: border inputs join the cluster of their claiming core */
+	in_a_cluster = lwalloc(num_geoms ? num_geoms : 1);
+	for (i = 0; i < num_geoms; i++)
+	{
+		in_a_cluster[i] = min_points <= 1 || state.is_core[i];
+		if (!state.is_core[i] && state.owner[i] != DBSCAN_NONE)
+		{
+			UF_union_concurrent(uf, i, state.owner[i]);
+			in_a_cluster[i] = LW_TRUE;
+		}
+	}
+	UF_recount(uf);
+
+	lwfree(is_empty);
+	lwfree(state.is_core);
+	lwfree(state.owner);
+
+	if (in_a_cluster_ret)
+		*in_a_cluster_ret = in_a_cluster;
+	else
+		lwfree(in_a_cluster);
+
+	return LW_SUCCESS;
+}
@@ -0,0 +1,890 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+/*
+ * Clipping of polygons snapped to an integer grid (such as the ones
+ * produced by ST_AsMVTGeom) against an axis aligned box.
+ *
+ * All the work is done with integer coordinates:
+ *
+ *  - Every ring is oriented (shells positive, holes negative) and clipped
+ *    against the box with Sutherland-Hodgman, rounding the intersections
+ *    back to the grid.
+ *  - Collinear overlapping edges are netted out. This removes the
+ *    degenerate back and forth edges Sutherland-Hodgman leaves on the box
+ *    sides, and merges polygons that the grid snap made adjacent.
+ *  - The remaining edges are chained back into rings, which are cleaned
+ *    of collinear points and spikes and split where they touch themselves.
+ *  - Holes are assigned to the smallest shell that contains them.
+ *
+ * Unlike wagyu this is not a general purpose make valid: self intersections
+ * present in the input are not resolved.
+ */
+
+#include "liblwgeom_internal.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+typedef struct
+{
+	int64_t x, y;
+} GRIDPT;
+
+typedef struct
+{
+	GRIDPT *pts;
+	uint32_t npoints;
+	uint32_t maxpoints;
+} GRIDRING;
+
+typedef struct
+{
+	GRIDPT a, b;
+} GRIDEDGE;
+
+typedef struct
+{
+	GRIDEDGE *edges;
+	uint32_t nedges;
+	uint32_t maxedges;
+} GRIDEDGES;
+
+typedef struct
+{
+	GRIDRING *rings;
+	uint32_t nrings;
+	uint32_t maxrings;
+} GRIDRINGS;
+
+/* Point of an edge, on its line, used to net out collinear edges */
+typedef struct
+{
+	int64_t px, py; /* primitive direction of the line */
+	int64_t c;      /* offset of the line */
+	int64_t t;      /* position along the line */
+	GRIDPT pt;
+	int32_t delta;
+} GRIDEVENT;
+
+static inline int64_t
+grid_round(double d)
+{
+	return (int64_t)floor(d + 0.5);
+}
+
+static inline int
+gridpt_eq(const GRIDPT *a, const GRIDPT *b)
+{
+	return a->x == b->x && a->y == b->y;
+}
+
+static int
+gridpt_cmp(const void *a, const void *b)
+{
+	const GRIDPT *pa = a;
+	const GRIDPT *pb = b;
+	if (pa->x != pb->x)
+		return pa->x < pb->x ? -1 : 1;
+	if (pa->y != pb->y)
+		return pa->y < pb->y ? -1 : 1;
+	return 0;
+}
+
+/* Cross product of (b - a) x (c - a). Exact while coordinates fit in 2^30 */
+static inline double
+gridpt_cross(const GRIDPT *a, const GRIDPT *b, const GRIDPT *c)
+{
+	return (double)(b->x - a->x) * (double)(c->y - a->y) - (double)(b->y - a->y) * (double)(c->x - a->x);
+}
+
+static void
+gridring_init(GRIDRING *r, uint32_t maxpoints)
+{
+	r->npoints = 0;
+	r->maxpoints = maxpoints > 4 ? maxpoints : 4;
+	r->pts = lwalloc(sizeof(GRIDPT) * r->maxpoints);
+}
+
+static inline void
+gridring_push(GRIDRING *r, int64_t x, int64_t y)
+{
+	if (r->npoints == r->maxpoints)
+	{
+		r->maxpoints *= 2;
+		r->pts = lwrealloc(r->pts, sizeof(GRIDPT) * r->maxpoints);
+	}
+	r->pts[r->npoints].x = x;
+	r->pts[r->npoints].y = y;
+	r->npoints++;
+}
+
+/* Twice the signed area, positive when counter clockwise in a y up system */
+static double
+gridring_area2(const GRIDRING *r)
+{
+	double area = 0;
+	uint32_t i;
+	for (i = 0; i < r->npoints; i++)
+	{
+		const GRIDPT *p1 = &r->pts[i];
+		const GRIDPT *p2 = &r->pts[(i + 1) % r->npoints];
+		area += (double)p1->x * (double)p2->y - (double)p2->x * (double)p1->y;
+	}
+	return area;
+}
+
+static void
+gridring_reverse(GRIDRING *r)
+{
+	uint32_t i, j;
+	if (r->npoints < 2)
+		return;
+	for (i = 0, j = r->npoints - 1; i < j; i++, j--)
+	{
+		GRIDPT tmp = r->pts[i];
+		r->pts[i] = r->pts[j];
+		r->pts[j] = tmp;
+	}
+}
+
+static void
+gridrings_add(GRIDRINGS *rs, GRIDRING *r)
+{
+	if (rs->nrings == rs->maxrings)
+	{
+		rs->maxrings = rs->maxrings ? rs->maxrings * 2 : 8;
+		rs->rings = lwrealloc(rs->rings, sizeof(GRIDRING) * rs->maxrings);
+	}
+	rs->rings[rs->nrings++] = *r;
+}
+
+static inline void
+gridedges_add(GRIDEDGES *es, const GRIDPT *a, const GRIDPT *b)
+{
+	if (gridpt_eq(a, b))
+		return;
+	if (es->nedges == es->maxedges)
+	{
+		es->maxedges = es->maxedges ? es->maxedges * 2 : 64;
+		es->edges = lwrealloc(es->edges, sizeof(GRIDEDGE) * es->maxedges);
+	}
+	es->edges[es->nedges].a = *a;
+	es->edges[es->nedges].b = *b;
+	es->nedges++;
+}
+
+/*
+ * Reads a ring into grid coordinates, dropping the closing point and
+ * consecutive duplicates.
+ */
+static void
+gridring_from_ptarray(GRIDRING *r, const POINTARRAY *pa)
+{
+	uint32_t i;
+	gridring_init(r, pa->npoints);
+	for (i = 0; i < pa->npoints; i++)
+	{
+		const POINT2D *p = getPoint2d_cp(pa, i);
+		int64_t x = grid_round(p->x);
+		int64_t y = grid_round(p->y);
+		if (r->npoints && r->pts[r->npoints - 1].x == x && r->pts[r->npoints - 1].y == y)
+			continue;
+		gridring_push(r, x, y);
+	}
+	while (r->npoints > 1 && gridpt_eq(&r->pts[0], &r->pts[r->npoints - 1]))
+		r->npoints--;
+}
+
+/* Position of a point relative to one of the box sides */
+static inline int
+grid_side_inside(const GRIDPT *p, int side, int64_t v)
+{
+	switch (side)
+	{
+	case 0:
+		return p->x >= v;
+	case 1:
+		return p->x <= v;
+	case 2:
+		return p->y >= v;
+	default:
+		return p->y <= v;
+	}
+}
+
+static inline GRIDPT
+grid_side_intersection(const GRIDPT *a, const GRIDPT *b, int side, int64_t v)
+{
+	GRIDPT p;
+	if (side < 2)
+	{
+		p.x = v;
+		p.y = grid_round(a->y + (double)(b->y - a->y) * (double)(v - a->x) / (double)(b->x - a->x));
+	}
+	else
+	{
+		p.y = v;
+		p.x = grid_round(a->x + (double)(b->x - a->x) * (double)(v - a->y) / (double)(b->y - a->y));
+	}
+	return p;
+}
+
+/* Sutherland-Hodgman clipping of a ring against the four box sides */
+static void
+gridring_clip(GRIDRING *r, const int64_t bounds[4])
+{
+	int side;
+	for (side = 0; side < 4 && r->npoints; side++)
+	{
+		GRIDRING out;
+		uint32_t i;
+		gridring_init(&out, r->npoints + 4);
+		for (i = 0; i < r->npoints; i++)
+		{
+			const GRIDPT *cur = &r->pts[i];
+			const GRIDPT *prev = &r->pts[(i + r->npoints - 1) % r->npoints];
+			int cur_in = grid_side_inside(cur, side, bounds[side]);
+			int prev_in = grid_side_inside(prev, side, bounds[side]);
+			if (cur_in != prev_in)
+			{
+				GRIDPT p = grid_side_intersection(prev, cur, side, bounds[side]);
+				gridring_push(&out, p.x, p.y);
+			}
+			if (cur_in)
+				gridring_push(&out, cur->x, cur->y);
+		}
+		lwfree(r->pts);
+		*r = out;
+	}
+}
+
+static int64_t
+grid_gcd(int64_t a, int64_t b)
+{
+	while (b)
+	{
+		int64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static int
+gridevent_cmp(const void *a, const void *b)
+{
+	const GRIDEVENT *ea = a;
+	const GRIDEVENT *eb = b;
+	if (ea->px != eb->px)
+		return ea->px < eb->px ? -1 : 1;
+	if (ea->py != eb->py)
+		return ea->py < eb->py ? -1 : 1;
+	if (ea->c != eb->c)
+		return ea->c < eb->c ? -1 : 1;
+	if (ea->t != eb->t)
+		return ea->t < eb->t ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Nets out collinear overlapping edges: sweeping along each line, an edge
+ * adds +1 where it starts and -1 where it ends, so the running sum is the
+ * net number of edges running forward over each stretch. The result keeps
+ * |net| copies of every stretch, in the direction given by its sign.
+ * Every vertex keeps as many incoming as outgoing edges.
+ */
+static void
+gridedges_net(GRIDEDGES *es)
+{
+	GRIDEVENT *ev;
+	GRIDEDGES out = {NULL, 0, 0};
+	uint32_t i, nev = 0;
+
+	if (!es->nedges)
+		return;
+
+	ev = lwalloc(sizeof(GRIDEVENT) * es->nedges * 2);
+	for (i = 0; i < es->nedges; i++)
+	{
+		const GRIDEDGE *e = &es->edges[i];
+		int64_t dx = e->b.x - e->a.x;
+		int64_t dy = e->b.y - e->a.y;
+		int64_t g = grid_gcd(dx < 0 ? -dx : dx, dy < 0 ? -dy : dy);
+		int64_t px = dx / g, py = dy / g;
+		if (px < 0 || (px == 0 && py < 0))
+		{
+			px = -px;
+			py = -py;
+		}
+		ev[nev].px = px;
+		ev[nev].py = py;
+		ev[nev].c = px * e->a.y - py * e->a.x;
+		ev[nev].t = px * e->a.x + py * e->a.y;
+		ev[nev].pt = e->a;
+		ev[nev].delta = 1;
+		ev[nev + 1] = ev[nev];
+		ev[nev + 1].t = px * e->b.x + py * e->b.y;
+		ev[nev + 1].pt = e->b;
+		ev[nev + 1].delta = -1;
+		nev += 2;
+	}
+	qsort(ev, nev, sizeof(GRIDEVENT), gridevent_cmp);
+
+	i = 0;
+	while (i < nev)
+	{
+		/* Events on the same line, sorted along it */
+		int32_t net = 0;
+		uint32_t j = i;
+		while (j < nev && ev[j].px == ev[i].px && ev[j].py == ev[i].py && ev[j].c == ev[i].c)
+		{
+			uint32_t k = j;
+			int32_t n;
+			while (k < nev && ev[k].px == ev[j].px && ev[k].py == ev[j].py && ev[k].c == ev[j].c &&
+			       ev[k].t == ev[j].t)
+				net += ev[k++].delta;
+			/* net now covers the stretch between ev[j] and ev[k] */
+			if (net && k < nev && ev[k].px == ev[j].px && ev[k].py == ev[j].py && ev[k].c == ev[j].c)
+			{
+				for (n = 0; n < abs(net); n++)
+				{
+					if (net > 0)
+						gridedges_add(&out, &ev[j].pt, &ev[k].pt);
+					else
+						gridedges_add(&out, &ev[k].pt, &ev[j].pt);
+				}
+			}
+			j = k;
+		}
+		i = j;
+	}
+
+	lwfree(ev);
+	lwfree(es->edges);
+	*es = out;
+}
+
+static int
+gridedge_cmp(const void *a, const void *b)
+{
+	const GRIDEDGE *ea = a;
+	const GRIDEDGE *eb = b;
+	int cmp = gridpt_cmp(&ea->a, &eb->a);
+	if (cmp)
+		return cmp;
+	return gridpt_cmp(&ea->b, &eb->b);
+}
+
+/*
+ * Counter clockwise angle class of direction w, measured from r.
+ * A direction equal to r is considered a full turn.
+ */
+static inline int
+grid_angle_half(int64_t rx, int64_t ry, int64_t wx, int64_t wy)
+{
+	double cross = (double)rx * (double)wy - (double)ry * (double)wx;
+	double dot = (double)rx * (double)wx + (double)ry * (double)wy;
+	if (cross > 0)
+		return 0;
+	if (cross == 0 && dot < 0)
+		return 1;
+	if (cross < 0)
+		return 1;
+	return 2;
+}
+
+/* Is w1 further counter clockwise from r than w2? */
+static int
+grid_angle_gt(int64_t rx, int64_t ry, int64_t w1x, int64_t w1y, int64_t w2x, int64_t w2y)
+{
+	int h1 = grid_angle_half(rx, ry, w1x, w1y);
+	int h2 = grid_angle_half(rx, ry, w2x, w2y);
+	if (h1 != h2)
+		return h1 > h2;
+	return (double)w1x * (double)w2y - (double)w1y * (double)w2x < 0;
+}
+
+/*
+ * Chains directed edges back into rings. On vertices with more than one
+ * way out the walk takes the sharpest left turn, which keeps the interior
+ * on the left tight and separates rings that touch.
+ */
+static void
+gridedges_to_rings(GRIDEDGES *es, GRIDRINGS *rings)
+{
+	uint8_t *used;
+	uint32_t i;
+
+	if (!es->nedges)
+		return;
+
+	qsort(es->edges, es->nedges, sizeof(GRIDEDGE), gridedge_cmp);
+	used = lwalloc(es->nedges);
+	memset(used, 0, es->nedges);
+
+	for (i = 0; i < es->nedges; i++)
+	{
+		GRIDRING r;
+		uint32_t cur = i;
+		if (used[i])
+			continue;
+
+		gridring_init(&r, 16);
+		while (1)
+		{
+			const GRIDEDGE *e = &es->edges[cur];
+			uint32_t lo = 0, hi = es->nedges, k, next = UINT32_MAX;
+			int64_t rx, ry;
+
+			used[cur] = 1;
+			gridring_push(&r, e->a.x, e->a.y);
+			if (gridpt_eq(&e->b, &es->edges[i].a))
+				break;
+
+			/* First edge leaving e->b */
+			while (lo < hi)
+			{
+				uint32_t mid = lo + (hi - lo) / 2;
+				if (gridpt_cmp(&es->edges[mid].a, &e->b) < 0)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+
+			rx = e->a.x - e->b.x;
+			ry = e->a.y - e->b.y;
+			for (k = lo; k < es->nedges && gridpt_eq(&es->edges[k].a, &e->b); k++)
+			{
+				const GRIDEDGE *c = &es->edges[k];
+				if (used[k])
+					continue;
+				if (next == UINT32_MAX ||
+				    grid_angle_gt(rx, ry,
+						  c->b.x - c->a.x, c->b.y - c->a.y,
+						  es->edges[next].b.x - es->edges[next].a.x,
+						  es->edges[next].b.y - es->edges[next].a.y))
+					next = k;
+			}
+
+			/* Dangling edge, can only happen with broken input: close the ring here */
+			if (next == UINT32_MAX)
+				break;
+			cur = next;
+		}
+		gridrings_add(rings, &r);
+	}
+
+	lwfree(used);
+}
+
+/* Removes repeated, collinear and spike points, also across the ring start */
+static void
+gridring_clean(GRIDRING *r)
+{
+	uint32_t i, n = 0, start = 0;
+	GRIDPT *s = r->pts;
+
+	for (i = 0; i < r->npoints; i++)
+	{
+		s[n++] = r->pts[i];
+		while (n >= 3 && gridpt_cross(&s[n - 3], &s[n - 2], &s[n - 1]) == 0)
+		{
+			s[n - 2] = s[n - 1];
+			n--;
+		}
+		if (n == 2 && gridpt_eq(&s[0], &s[1]))
+			n--;
+	}
+
+	while (n - start >= 3)
+	{
+		if (gridpt_cross(&s[n - 2], &s[n - 1], &s[start]) == 0)
+			n--;
+		else if (gridpt_cross(&s[n - 1], &s[start], &s[start + 1]) == 0)
+			start++;
+		else
+			break;
+	}
+
+	if (n - start < 3)
+	{
+		r->npoints = 0;
+		return;
+	}
+	if (start)
+		memmove(s, s + start, sizeof(GRIDPT) * (n - start));
+	r->npoints = n - start;
+}
+
+/*
+ * Splits a ring on every vertex it visits more than once, so that all
+ * the rings that come out are simple.
+ */
+static void
+gridring_split(GRIDRING *r, GRIDRINGS *out)
+{
+	GRIDPT *dups;
+	int32_t *pos;
+	uint32_t i, ndups = 0;
+	GRIDRING stack;
+
+	dups = lwalloc(sizeof(GRIDPT) * r->npoints);
+	memcpy(dups, r->pts, sizeof(GRIDPT) * r->npoints);
+	qsort(dups, r->npoints, sizeof(GRIDPT), gridpt_cmp);
+	for (i = 1; i < r->npoints; i++)
+	{
+		if (gridpt_eq(&dups[i], &dups[i - 1]) && (!ndups || !gridpt_eq(&dups[ndups - 1], &dups[i])))
+			dups[ndups++] = dups[i];
+	}
+
+	if (!ndups)
+	{
+		lwfree(dups);
+		gridrings_add(out, r);
+		return;
+	}
+
+	pos = lwalloc(sizeof(int32_t) * ndups);
+	for (i = 0; i < ndups; i++)
+		pos[i] = -1;
+
+	gridring_init(&stack, r->npoints);
+	for (i = 0; i < r->npoints; i++)
+	{
+		const GRIDPT *p = &r->pts[i];
+		GRIDPT *found = bsearch(p, dups, ndups, sizeof(GRIDPT), gridpt_cmp);
+		if (found)
+		{
+			uint32_t k = found - dups;
+			if (pos[k] >= 0 && (uint32_t)pos[k] < stack.npoints && gridpt_eq(&stack.pts[pos[k]], p))
+			{
+				/* Back on an earlier vertex: what lies after it is a loop */
+				GRIDRING loop;
+				uint32_t from = pos[k];
+				gridring_init(&loop, stack.npoints - from);
+				memcpy(loop.pts, stack.pts + from, sizeof(GRIDPT) * (stack.npoints - from));
+				loop.npoints = stack.npoints - from;
+				gridring_clean(&loop);
+				if (loop.npoints)
+					gridrings_add(out, &loop);
+				else
+					lwfree(loop.pts);
+				stack.npoints = from + 1;
+				continue;
+			}
+			pos[k] = stack.npoints;
+		}
+		gridring_push(&stack, p->x, p->y);
+	}
+
+	gridring_clean(&stack);
+	if (stack.npoints)
+		gridrings_add(out, &stack);
+	else
+		lwfree(stack.pts);
+
+	lwfree(pos);
+	lwfree(dups);
+	lwfree(r->pts);
+}
+
+/*
+ * Point in ring test in doubled coordinates, so edge midpoints can be
+ * tested exactly. Returns 1 inside, -1 outside and 0 on the boundary.
+ */
+static int
+gridring_contains2(const GRIDRING *r, int64_t px2, int64_t py2)
+{
+	uint32_t i;
+	int inside = 0;
+	for (i = 0; i < r->npoints; i++)
+	{
+		const GRIDPT *a = &r->pts[i];
+		const GRIDPT *b = &r->pts[(i + 1) % r->npoints];
+		int64_t ax = 2 * a->x, ay = 2 * a->y, bx = 2 * b->x, by = 2 * b->y;
+		double cross = (double)(bx - ax) * (double)(py2 - ay) - (double)(by - ay) * (double)(px2 - ax);
+
+		if (cross == 0 && px2 >= FP_MIN(ax, bx) && px2 <= FP_MAX(ax, bx) && py2 >= FP_MIN(ay, by) &&
+		    py2 <= FP_MAX(ay, by))
+			return 0;
+
+		if ((ay > py2) != (by > py2))
+		{
+			/* Crossing to the right of the point? */
+			if ((by > ay) == (cross > 0))
+				inside = !inside;
+		}
+	}
+	return inside ? 1 : -1;
+}
+
+/* Is ring r (a hole) inside ring shell? */
+static int
+gridring_within(const GRIDRING *r, const GRIDRING *shell)
+{
+	uint32_t i;
+	for (i = 0; i < r->npoints; i++)
+	{
+		int res = gridring_contains2(shell, 2 * r->pts[i].x, 2 * r->pts[i].y);
+		if (res)
+			return res > 0;
+	}
+	/* Every vertex on the shell boundary, try the edge midpoints */
+	for (i = 0; i < r->npoints; i++)
+	{
+		const GRIDPT *a = &r->pts[i];
+		const GRIDPT *b = &r->pts[(i + 1) % r->npoints];
+		int res = gridring_contains2(shell, a->x + b->x, a->y + b->y);
+		if (res)
+			return res > 0;
+	}
+	return LW_FALSE;
+}
+
+static void
+gridring_bbox(const GRIDRING *r, int64_t bbox[4])
+{
+	uint32_t i;
+	bbox[0] = bbox[1] = r->pts[0].x;
+	bbox[2] = bbox[3] = r->pts[0].y;
+	for (i = 1; i < r->npoints; i++)
+	{
+		bbox[0] = FP_MIN(bbox[0], r->pts[i].x);
+		bbox[1] = FP_MAX(bbox[1], r->pts[i].x);
+		bbox[2] = FP_MIN(bbox[2], r->pts[i].y);
+		bbox[3] = FP_MAX(bbox[3], r->pts[i].y);
+	}
+}
+
+static POINTARRAY *
+gridring_to_ptarray(const GRIDRING *r)
+{
+	POINTARRAY *pa = ptarray_construct(0, 0, r->npoints + 1);
+	uint32_t i;
+	for (i = 0; i <= r->npoints; i++)
+	{
+		const GRIDPT *p = &r->pts[i % r->npoints];
+		POINT4D pt = {(double)p->x, (double)p->y, 0.0, 0.0};
+		ptarray_set_point4d(pa, i, &pt);
+	}
+	return pa;
+}
+
+typedef struct
+{
+	uint32_t ring;
+	double area;
+	int64_t bbox[4];
+} GRIDSHELL;
+
+static int
+gridshell_cmp(const void *a, const void *b)
+{
+	const GRIDSHELL *sa = a;
+	const GRIDSHELL *sb = b;
+	if (sa->area != sb->area)
+		return sa->area < sb->area ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Groups simple rings into polygons: positive rings are shells, negative
+ * ones holes, and every hole goes to the smallest shell containing it.
+ */
+static LWGEOM *
+gridrings_to_lwgeom(GRIDRINGS *rs, int32_t srid)
+{
+	GRIDSHELL *shells;
+	uint32_t *owner, *nholes;
+	uint32_t i, j, nshells = 0;
+	LWGEOM **polys;
+	LWGEOM *out;
+
+	shells = lwalloc(sizeof(GRIDSHELL) * (rs->nrings + 1));
+	owner = lwalloc(sizeof(uint32_t) * (rs->nrings + 1));
+	for (i = 0; i < rs->nrings; i++)
+	{
+		double area = gridring_area2(&rs->rings[i]);
+		owner[i] = UINT32_MAX;
+		if (area > 0)
+		{
+			shells[nshells].ring = i;
+			shells[nshells].area = area;
+			gridring_bbox(&rs->rings[i], shells[nshells].bbox);
+			nshells++;
+		}
+	}
+
+	if (!nshells)
+	{
+		lwfree(owner);
+		lwfree(shells);
+		return lwgeom_construct_empty(MULTIPOLYGONTYPE, srid, 0, 0);
+	}
+
+	qsort(shells, nshells, sizeof(GRIDSHELL), gridshell_cmp);
+	nholes = lwalloc(sizeof(uint32_t) * nshells);
+	memset(nholes, 0, sizeof(uint32_t) * nshells);
+
+	for (i = 0; i < rs->nrings; i++)
+	{
+		int64_t bbox[4];
+		if (gridring_area2(&rs->rings[i]) >= 0)
+			continue;
+		gridring_bbox(&rs->rings[i], bbox);
+		for (j = 0; j < nshells; j++)
+		{
+			const int64_t *sb = shells[j].bbox;
+			if (bbox[0] < sb[0] || bbox[1] > sb[1] || bbox[2] < sb[2] || bbox[3] > sb[3])
+				continue;
+			if (gridring_within(&rs->rings[i], &rs->rings[shells[j].ring]))
+			{
+				owner[i] = j;
+				nholes[j]++;
+				break;
+			}
+		}
+	}
+
+	polys = lwalloc(sizeof(LWGEOM *) * nshells);
+	for (j = 0; j < nshells; j++)
+	{
+		POINTARRAY **ppa = lwalloc(sizeof(POINTARRAY *) * (nholes[j] + 1));
+		uint32_t nrings = 0;
+		ppa[nrings++] = gridring_to_ptarray(&rs->rings[shells[j].ring]);
+		for (i = 0; i < rs->nrings && nrings <= nholes[j]; i++)
+		{
+			if (owner[i] == j)
+				ppa[nrings++] = gridring_to_ptarray(&rs->rings[i]);
+		}
+		polys[j] = (LWGEOM *)lwpoly_construct(srid, NULL, nrings, ppa);
+	}
+
+	if (nshells == 1)
+	{
+		out = polys[0];
+		lwfree(polys);
+	}
+	else
+		out = (LWGEOM *)lwcollection_construct(MULTIPOLYGONTYPE, srid, NULL, nshells, polys);
+
+	lwfree(nholes);
+	lwfree(owner);
+	lwfree(shells);
+	return out;
+}
+
+/* Adds the edges of a polygon, clipped to the box, to the edge list */
+static void
+lwpoly_clip_grid_edges(const LWPOLY *poly, const int64_t bounds[4], GRIDEDGES *es)
+{
+	uint32_t i, j;
+	for (i = 0; i < poly->nrings; i++)
+	{
+		GRIDRING r;
+		double area;
+		int64_t bbox[4];
+
+		gridring_from_ptarray(&r, poly->rings[i]);
+		if (r.npoints < 3 || (area = gridring_area2(&r)) == 0)
+		{
+			lwfree(r.pts);
+			/* A degenerate shell makes the whole polygon degenerate */
+			if (i == 0)
+				return;
+			continue;
+		}
+
+		gridring_bbox(&r, bbox);
+		if (bbox[1] < bounds[0] || bbox[0] > bounds[1] || bbox[3] < bounds[2] || bbox[2] > bounds[3])
+		{
+			lwfree(r.pts);
+			if (i == 0)
+				return;
+			continue;
+		}
+
+		if ((i == 0) != (area > 0))
+			gridring_reverse(&r);
+
+		if (bbox[0] < bounds[0] || bbox[1] > bounds[1] || bbox[2] < bounds[2] || bbox[3] > bounds[3])
+			gridring_clip(&r, bounds);
+
+		for (j = 0; j < r.npoints; j++)
+			gridedges_add(es, &r.pts[j], &r.pts[(j + 1) % r.npoints]);
+		lwfree(r.pts);
+	}
+}
+
+LWGEOM *
+lwgeom_clip_by_box_grid(const LWGEOM *geom, const GBOX *box)
+{
+	GRIDEDGES edges = {NULL, 0, 0};
+	GRIDRINGS chained = {NULL, 0, 0};
+	GRIDRINGS simple = {NULL, 0, 0};
+	int64_t bounds[4];
+	uint32_t i;
+	LWGEOM *out;
+
+	if (!geom || !box)
+		return NULL;
+	if (geom->type != POLYGONTYPE && geom->type != MULTIPOLYGONTYPE)
+		return NULL;
+	if (lwgeom_is_empty(geom))
+		return lwgeom_construct_empty(MULTIPOLYGONTYPE, geom->srid, 0, 0);
+
+	bounds[0] = grid_round(box->xmin);
+	bounds[1] = grid_round(box->xmax);
+	bounds[2] = grid_round(box->ymin);
+	bounds[3] = grid_round(box->ymax);
+
+	if (geom->type == POLYGONTYPE)
+		lwpoly_clip_grid_edges((const LWPOLY *)geom, bounds, &edges);
+	else
+	{
+		const LWMPOLY *mpoly = (const LWMPOLY *)geom;
+		for (i = 0; i < mpoly->ngeoms; i++)
+			lwpoly_clip_grid_edges(mpoly->geoms[i], bounds, &edges);
+	}
+
+	gridedges_net(&edges);
+	gridedges_to_rings(&edges, &chained);
+	lwfree(edges.edges);
+
+	for (i = 0; i < chained.nrings; i++)
+	{
+		GRIDRING *r = &chained.rings[i];
+		gridring_clean(r);
+		if (r->npoints)
+			gridring_split(r, &simple);
+		else
+			lwfree(r->pts);
+	}
+	lwfree(chained.rings);
+
+	out = gridrings_to_lwgeom(&simple, geom->srid);
+
+	for (i = 0; i < simple.nrings; i++)
+		lwfree(simple.rings[i].pts);
+	lwfree(simple.rings);
+
+	return out;
+}
@@ -46,6 +46,19 @@ int cluster_intersecting(GEOSGeometry **geoms, uint32_t num_geoms, GEOSGeometry
 int cluster_within_distance(LWGEOM **geoms, uint32_t num_geoms, double tolerance, LWGEOM ***clusterGeoms, uint32_t *num_clusters);
 int union_dbscan(LWGEOM **geoms, uint32_t num_geoms, UNIONFIND *uf, double eps, uint32_t min_points, char **is_in_cluster_ret);
 
+/* Upper bound of the num_threads argument of union_dbscan_parallel */
+#define LW_DBSCAN_MAX_THREADS 64
+
+/* union_dbscan on num_threads threads. Clusters are rooted at their smallest
+ * input index, so ids do not depend on the number of threads. Inputs other than
+ * points, lines, polygons and their collections are clustered on one thread
+ * by union_dbscan. */
+int union_dbscan_parallel(LWGEOM **geoms, uint32_t num_geoms, UNIONFIND *uf, double eps, uint32_t min_points, char **is_in_cluster_ret, uint32_t num_threads);
+
+/* Whether the inputs are all points with finite coordinates (or empty), which
+ * union_dbscan and union_dbscan_parallel cluster on a grid instead of a tree. */
+int union_dbscan_grid_accepts(LWGEOM **geoms, uint32_t num_geoms);
+
 POINTARRAY* ptarray_from_GEOSCoordSeq(const GEOSCoordSequence* cs, uint8_t want3d);
 
 extern char lwgeom_geos_errmsg[];
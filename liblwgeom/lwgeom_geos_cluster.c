@@ -513,6 +513,10 @@ union_dbscan_general(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double e
 
 int union_dbscan(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double eps, uint32_t min_points, char** in_a_cluster_ret)
 {
+	/* Points are faster on a plain grid than in a GEOS tree */
+	if (union_dbscan_grid_accepts(geoms, num_geoms))
+		return union_dbscan_parallel(geoms, num_geoms, uf, eps, min_points, in_a_cluster_ret, 1);
+
 	if (min_points <= 1)
 		return union_dbscan_minpoints_1(geoms, num_geoms, uf, eps, in_a_cluster_ret);
 	else
@@ -216,6 +216,25 @@ lwt_be_getNextEdgeId(LWT_TOPOLOGY* topo)
   CBT0(topo, getNextEdgeId);
 }
 
+static int
+lwt_be_getNextEdgeIds(LWT_TOPOLOGY *topo, LWT_ELEMID *ids, uint64_t numelems)
+{
+  uint64_t i;
+
+  if ( topo->be_iface->cb && topo->be_iface->cb->getNextEdgeIds )
+  {
+    CBT2(topo, getNextEdgeIds, ids, numelems);
+  }
+
+  /* Optional callback, fall back to one identifier at a time */
+  for ( i=0; i<numelems; ++i )
+  {
+    ids[i] = lwt_be_getNextEdgeId(topo);
+    if ( ids[i] == -1 ) return -1;
+  }
+  return 0;
+}
+
 LWT_ISO_EDGE *
 lwt_be_getEdgeById(LWT_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields)
 {
@@ -7024,329 +7043,2661 @@ lwt_Polygonize(LWT_TOPOLOGY* topo)
   return 0;
 }
 
-LWT_ELEMID
-lwt_GetFaceContainingPoint(LWT_TOPOLOGY* topo, const LWPOINT* pt)
+/*
+ *---- bulk loader
+ */
+
+/* Number of records handed to each backend insert call */
+#define LWT_BULK_BATCH_SIZE 1000
+
+/* An edge end, as seen from the node it is incident to */
+typedef struct LWT_BULK_EDGEEND_T {
+  /* Index of the node in the loader nodes array */
+  uint32_t node;
+  /* Azimuth of the edge end geometry */
+  double az;
+  /* Index of the edge in the loader edges array */
+  uint32_t edge;
+  /* 1 if the edge starts at the node, 0 if it ends there */
+  int outgoing;
+} LWT_BULK_EDGEEND;
+
+typedef struct LWT_BULK_LOADER_T {
+  /* Noded and merged linework of the batch */
+  LWGEOM *merged;
+  /* Sorted and unique endpoints of the input lines */
+  POINT4D *inends;
+  uint32_t ninends;
+  /* Sorted endpoints of the merged lines */
+  POINT4D *mends;
+  uint32_t nmends;
+  /* Sorted and unique endpoints of the edges */
+  POINT4D *nodes;
+  uint32_t nnodes;
+  /* Edges, start_node and end_node hold indexes in the
+   * nodes array until nodes are inserted */
+  LWT_ISO_EDGE *edges;
+  uint32_t nedges;
+  uint32_t maxedges;
+  LWT_BULK_EDGEEND *ends;
+  LWT_ISO_NODE *isonodes;
+  LWT_ISO_FACE *faces;
+  LWT_EDGERING_ARRAY shells;
+  LWT_EDGERING_ARRAY holes;
+} LWT_BULK_LOADER;
+
+static void
+_lwt_BulkLoaderFree(LWT_BULK_LOADER *bl)
 {
-  LWT_ISO_EDGE* closestEdge;
-  LWT_ISO_EDGE* edges;
-  uint64_t numedges, i;
-  const POINT2D *queryPoint;
-  const POINT2D *closestPointOnEdge = NULL;
-  uint32_t closestSegmentIndex;
-  int closestSegmentSide;
-  uint32_t closestPointVertex;
-  const POINT2D *closestSegmentP0, *closestSegmentP1;
-  LWT_ELEMID closestNode = 0;
-  double dist;
-  int containingFace = -1;
+  int k;
 
-  closestEdge = lwt_be_getClosestEdge( topo, pt, &numedges,
-    LWT_COL_EDGE_GEOM|
-    LWT_COL_EDGE_EDGE_ID|
-    LWT_COL_EDGE_START_NODE|
-    LWT_COL_EDGE_END_NODE|
-    LWT_COL_EDGE_FACE_LEFT|
-    LWT_COL_EDGE_FACE_RIGHT
-  );
-  if (numedges == UINT64_MAX)
+  if ( bl->merged ) lwgeom_free(bl->merged);
+  if ( bl->inends ) lwfree(bl->inends);
+  if ( bl->mends ) lwfree(bl->mends);
+  if ( bl->nodes ) lwfree(bl->nodes);
+  if ( bl->edges ) _lwt_release_edges(bl->edges, bl->nedges);
+  if ( bl->ends ) lwfree(bl->ends);
+  if ( bl->isonodes ) _lwt_release_nodes(bl->isonodes, bl->nnodes);
+  /* face boxes are owned by the shell rings */
+  if ( bl->faces ) lwfree(bl->faces);
+  /* rings are cleaned by LWT_EDGERING_ARRAY_CLEAN but not released */
+  for ( k=0; k<bl->shells.size; ++k )
   {
-	  lwerror("Backend error: %s", lwt_be_lastErrorMessage(topo->be_iface));
-    /* cberror(topo->be_data, "Error from cb_getClosestEdge"); */
-	  return -1;
+    LWT_EDGERING_CLEAN(bl->shells.rings[k]);
+    lwfree(bl->shells.rings[k]);
   }
-  if (numedges == 0)
+  bl->shells.size = 0;
+  LWT_EDGERING_ARRAY_CLEAN( &bl->shells );
+  for ( k=0; k<bl->holes.size; ++k )
   {
-    /* If there are no edges the point is in the universal face */
-    return 0;
+    LWT_EDGERING_CLEAN(bl->holes.rings[k]);
+    lwfree(bl->holes.rings[k]);
   }
+  bl->holes.size = 0;
+  LWT_EDGERING_ARRAY_CLEAN( &bl->holes );
+}
 
-  LWDEBUGGF(2, lwline_as_lwgeom(closestEdge->geom), "Closest edge %" LWTFMT_ELEMID, closestEdge->edge_id);
+static int
+compare_bulk_points(const void *si1, const void *si2)
+{
+  const POINT4D *a = si1;
+  const POINT4D *b = si2;
+  if ( a->x != b->x ) return a->x < b->x ? -1 : 1;
+  if ( a->y != b->y ) return a->y < b->y ? -1 : 1;
+  return 0;
+}
 
-  /* Find closest segment of edge to the point */
-  queryPoint = getPoint2d_cp(pt->point, 0);
-  closestSegmentIndex = ptarray_closest_segment_2d(closestEdge->geom->points, queryPoint, &dist);
-  LWDEBUGF(1, "Closest segment on edge %" LWTFMT_ELEMID " is %d (dist %g)", closestEdge->edge_id, closestSegmentIndex, dist);
-  closestSegmentP0 = getPoint2d_cp(closestEdge->geom->points, closestSegmentIndex);
-  closestSegmentP1 = getPoint2d_cp(closestEdge->geom->points, closestSegmentIndex + 1);
-  LWDEBUGF(1, "Closest segment on edge %" LWTFMT_ELEMID " is LINESTRING(%g %g, %g %g)",
-    closestEdge->edge_id,
-    closestSegmentP0->x,
-    closestSegmentP0->y,
-    closestSegmentP1->x,
-    closestSegmentP1->y
-  );
+static int
+compare_bulk_edgeends(const void *si1, const void *si2)
+{
+  const LWT_BULK_EDGEEND *a = si1;
+  const LWT_BULK_EDGEEND *b = si2;
+  if ( a->node != b->node ) return a->node < b->node ? -1 : 1;
+  if ( a->az != b->az ) return a->az < b->az ? -1 : 1;
+  if ( a->edge != b->edge ) return a->edge < b->edge ? -1 : 1;
+  return a->outgoing - b->outgoing;
+}
 
-	/*
-	 * We use comp.graphics.algorithms Frequently Asked Questions method
-	 *
-	 * (1)           AC dot AB
-	 *           r = ----------
-	 *                ||AB||^2
-	 *	r has the following meaning:
-	 *	r=0 P = A
-	 *	r=1 P = B
-	 *	r<0 P is on the backward extension of AB
-	 *	r>1 P is on the forward extension of AB
-	 *	0<r<1 P is interior to AB
-	 *
-	 */
-  const POINT2D *p = queryPoint;
-  const POINT2D *A = closestSegmentP0;
-  const POINT2D *B = closestSegmentP1;
-  double r = ( (p->x-A->x) * (B->x-A->x) + (p->y-A->y) * (B->y-A->y) )/( (B->x-A->x)*(B->x-A->x) +(B->y-A->y)*(B->y-A->y) );
-  if ( r <= 0 )
+/* Sort points by x,y and remove duplicates, return the new count */
+static uint32_t
+_lwt_BulkSortUniquePoints(POINT4D *pts, uint32_t n)
+{
+  uint32_t i, j = 0;
+
+  if ( ! n ) return 0;
+  qsort(pts, n, sizeof(POINT4D), compare_bulk_points);
+  for ( i=1; i<n; ++i )
   {
-    closestPointOnEdge = A;
-    closestPointVertex = closestSegmentIndex;
-    if ( closestSegmentIndex == 0 )
-    {
-      closestNode = closestEdge->start_node;
-    }
+    if ( compare_bulk_points(&pts[j], &pts[i]) ) pts[++j] = pts[i];
   }
-  else if (r >= 1 )
+  return j + 1;
+}
+
+/* Number of occurrences of a point in a sorted array */
+static uint32_t
+_lwt_BulkCountPoint(const POINT4D *pts, uint32_t n, const POINT4D *p)
+{
+  const POINT4D *lo, *hi;
+
+  lo = bsearch(p, pts, n, sizeof(POINT4D), compare_bulk_points);
+  if ( ! lo ) return 0;
+  hi = lo;
+  while ( lo > pts && ! compare_bulk_points(lo - 1, p) ) lo--;
+  while ( hi < pts + n - 1 && ! compare_bulk_points(hi + 1, p) ) hi++;
+  return hi - lo + 1;
+}
+
+static int
+_lwt_BulkIsInputEndpoint(const LWT_BULK_LOADER *bl, const POINT4D *p)
+{
+  return bsearch(p, bl->inends, bl->ninends, sizeof(POINT4D),
+                 compare_bulk_points) != NULL;
+}
+
+/* Index of an edge endpoint in the nodes array */
+static uint32_t
+_lwt_BulkNodeIndex(const LWT_BULK_LOADER *bl, const POINT2D *p)
+{
+  POINT4D key;
+  const POINT4D *found;
+
+  key.x = p->x;
+  key.y = p->y;
+  found = bsearch(&key, bl->nodes, bl->nnodes, sizeof(POINT4D),
+                  compare_bulk_points);
+  /* nodes are built from the edge endpoints, so this is always found */
+  return found - bl->nodes;
+}
+
+/* Push the vertices from..to of a point array as a new edge */
+static void
+_lwt_BulkPushEdge(LWT_BULK_LOADER *bl, int32_t srid, const POINTARRAY *pa,
+                  uint32_t from, uint32_t to)
+{
+  POINTARRAY *sub;
+  LWT_ISO_EDGE *e;
+
+  if ( bl->nedges == bl->maxedges )
   {
-    closestPointOnEdge = B;
-    closestPointVertex = closestSegmentIndex + 1;
-    if ( closestSegmentIndex + 2 == closestEdge->geom->points->npoints )
-    {
-      closestNode = closestEdge->end_node;
-    }
+    bl->maxedges = bl->maxedges ? bl->maxedges * 2 : 64;
+    bl->edges = bl->edges ?
+      lwrealloc(bl->edges, sizeof(LWT_ISO_EDGE) * bl->maxedges) :
+      lwalloc(sizeof(LWT_ISO_EDGE) * bl->maxedges);
   }
-  else
+
+  sub = ptarray_construct(FLAGS_GET_Z(pa->flags), FLAGS_GET_M(pa->flags),
+                          to - from + 1);
+  memcpy(getPoint_internal(sub, 0), getPoint_internal(pa, from),
+         ptarray_point_size(pa) * (to - from + 1));
+
+  e = &(bl->edges[bl->nedges++]);
+  e->edge_id = 0;
+  e->start_node = e->end_node = -1;
+  e->face_left = e->face_right = -1;
+  e->next_left = e->next_right = 0;
+  e->geom = lwline_construct(srid, NULL, sub);
+}
+
+/* Set the face on the walked side of all edges of a ring, in memory */
+static void
+_lwt_BulkSetEdgeRingSideFace(LWT_EDGERING *ring, LWT_ELEMID face)
+{
+  int i;
+  for ( i=0; i<ring->size; ++i )
   {
-    closestPointVertex = closestEdge->geom->points->npoints;
+    LWT_EDGERING_ELEM *elem = ring->elems[i];
+    if ( elem->left ) elem->edge->face_left = face;
+    else elem->edge->face_right = face;
   }
+}
 
-  if ( closestNode != 0 )
+/*
+ * Collect the lines and points of a geometry into the given
+ * collections, converting polygon rings to lines and forcing
+ * everything to the topology dimensions.
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_BulkCollect(LWT_TOPOLOGY *topo, const LWGEOM *geom,
+                 LWCOLLECTION *lines, LWCOLLECTION *points)
+{
+  const LWCOLLECTION *col;
+  const LWPOLY *poly;
+  POINTARRAY *pa;
+  uint32_t i;
+
+  if ( lwgeom_is_empty(geom) ) return 0;
+
+  switch ( geom->type )
   {
-    LWDEBUGF(1, "Closest point is node %d", closestNode);
-    if ( dist == 0 )
-    {
-      LWDEBUGF(1, "Query point is node %d", closestNode);
-      /* Query point is the node
-       *
-       * If all edges incident to the node are
-       * dangling, we can return their common
-       * side face, otherwise the point will be
-       * on multiple face boundaries
-       */
-      if ( closestEdge->face_left != closestEdge->face_right )
-      {
-        _lwt_release_edges(closestEdge, 1);
-        lwerror("Two or more faces found");
-        return -1;
-      }
-      containingFace = closestEdge->face_left;
+    case POINTTYPE:
+      pa = ptarray_force_dims(((LWPOINT *)geom)->point, topo->hasZ, 0, 0, 0);
+      lwcollection_add_lwgeom(points,
+        lwpoint_as_lwgeom(lwpoint_construct(topo->srid, NULL, pa)));
+      return 0;
 
-      /* Check other incident edges */
-      numedges = 1;
-      edges = lwt_be_getEdgeByNode( topo, &closestNode, &numedges, LWT_COL_EDGE_FACE_LEFT|LWT_COL_EDGE_FACE_RIGHT );
-      if (numedges == UINT64_MAX)
+    case LINETYPE:
+      pa = ptarray_force_dims(((LWLINE *)geom)->points, topo->hasZ, 0, 0, 0);
+      lwcollection_add_lwgeom(lines,
+        lwline_as_lwgeom(lwline_construct(topo->srid, NULL, pa)));
+      return 0;
+
+    case POLYGONTYPE:
+      poly = (const LWPOLY *)geom;
+      for ( i=0; i<poly->nrings; ++i )
       {
-        lwerror("Backend error from getEdgeByNode: %s", lwt_be_lastErrorMessage(topo->be_iface));
-        /* cberror(topo->be_data, "Error from cb_getClosestEdge"); */
-        _lwt_release_edges(closestEdge, 1);
-        return -1;
+        pa = ptarray_force_dims(poly->rings[i], topo->hasZ, 0, 0, 0);
+        lwcollection_add_lwgeom(lines,
+          lwline_as_lwgeom(lwline_construct(topo->srid, NULL, pa)));
       }
-      for (i=0; i<numedges; ++i)
+      return 0;
+
+    case MULTIPOINTTYPE:
+    case MULTILINETYPE:
+    case MULTIPOLYGONTYPE:
+    case COLLECTIONTYPE:
+      col = (const LWCOLLECTION *)geom;
+      for ( i=0; i<col->ngeoms; ++i )
       {
-        if ( edges[i].face_left != containingFace ||
-             edges[i].face_right != containingFace )
-        {
-          _lwt_release_edges(edges, numedges);
-          _lwt_release_edges(closestEdge, 1);
-          lwerror("Two or more faces found");
+        if ( _lwt_BulkCollect(topo, col->geoms[i], lines, points) )
           return -1;
-        }
-      }
-      if (numedges < 1 )
-      {
-        lwerror("Unexpected backend return: getEdgeByNode(%d) returns no edges when we previously found edge %d ending on that node",
-          closestNode, closestEdge->edge_id);
-        _lwt_release_edges(edges, numedges);
-        _lwt_release_edges(closestEdge, 1);
-        return -1;
       }
-      LWDEBUGF(1, "lwt_be_getEdgeByNode returned %d edges", numedges);
-      _lwt_release_edges(edges, numedges);
-      _lwt_release_edges(closestEdge, 1);
-      return containingFace;
-    }
-
-    /* Closest point is a node, but query point is NOT on the node */
+      return 0;
 
-    /* let's do azimuth computation */
-    edgeend ee;
-    if ( ! azimuth_pt_pt(closestPointOnEdge, queryPoint, &ee.myaz) ) {
-      lwerror("error computing azimuth of query point [%.15g %.15g,%.15g %.15g]",
-              closestPointOnEdge->x, closestPointOnEdge->y,
-              queryPoint->x, queryPoint->y);
-      _lwt_release_edges(closestEdge, 1);
+    default:
+      lwerror("Unsupported geometry type %s", lwtype_name(geom->type));
       return -1;
-    }
+  }
+}
 
-    LWDEBUGF(1, "Query point azimuth is %g", ee.myaz);
+/*
+ * Add a geometry with the incremental functions
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_LoadGeometryIncremental(LWT_TOPOLOGY *topo, LWGEOM *geom, double tol)
+{
+  LWCOLLECTION *col;
+  LWT_ELEMID *ids = NULL;
+  int num = 0;
+  uint32_t i;
 
-    int found = _lwt_FindAdjacentEdges( topo, closestNode, &ee, NULL, -1 );
-    if ( ! found ) {
-        lwerror("Unexpected backend return: _lwt_FindAdjacentEdges(%d) found no edges when we previously found edge %d ending on that node",
-          closestNode, closestEdge->edge_id);
-        _lwt_release_edges(closestEdge, 1);
-        return -1;
-    }
+  if ( lwgeom_is_empty(geom) ) return 0;
 
-    _lwt_release_edges(closestEdge, 1);
-    return ee.cwFace;
+  switch ( geom->type )
+  {
+    case POINTTYPE:
+      return lwt_AddPoint(topo, (LWPOINT *)geom, tol) == -1 ? -1 : 0;
+
+    case LINETYPE:
+      ids = lwt_AddLine(topo, (LWLINE *)geom, tol, &num);
+      break;
+
+    case POLYGONTYPE:
+      ids = lwt_AddPolygon(topo, (LWPOLY *)geom, tol, &num);
+      break;
 
+    case MULTIPOINTTYPE:
+    case MULTILINETYPE:
+    case MULTIPOLYGONTYPE:
+    case COLLECTIONTYPE:
+      col = (LWCOLLECTION *)geom;
+      for ( i=0; i<col->ngeoms; ++i )
+      {
+        if ( _lwt_LoadGeometryIncremental(topo, col->geoms[i], tol) )
+          return -1;
+      }
+      return 0;
+
+    default:
+      lwerror("Unsupported geometry type %s", lwtype_name(geom->type));
+      return -1;
   }
 
-  LWDEBUG(1, "Closest point is NOT a node");
+  if ( ids ) lwfree(ids);
+  return num < 0 ? -1 : 0;
+}
 
-  /* If this edge has the same face on the left and right sides
-   * we found the face containing our query point */
-  if ( closestEdge->face_left == closestEdge->face_right )
+/*
+ * Node the given lines and split them into edges, in memory
+ *
+ * Edges end at the nodes of the noded linework and at the
+ * endpoints of the input lines, like lwt_AddLine would do.
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_BulkNodeLines(LWT_TOPOLOGY *topo, LWT_BULK_LOADER *bl,
+                   LWCOLLECTION *lines, double prec)
+{
+  LWGEOM *noded;
+  LWCOLLECTION *mcol;
+  gridspec grid;
+  POINT4D p;
+  uint32_t i, j, nlines;
+
+  memset(&grid, 0, sizeof(gridspec));
+  grid.xsize = grid.ysize = prec;
+
+  /* Snap-round to the working precision */
+  if ( prec )
   {
-    containingFace = closestEdge->face_left;
-    _lwt_release_edges(closestEdge, 1);
-    return containingFace;
+    lwgeom_grid_in_place(lwcollection_as_lwgeom(lines), &grid);
+    lwgeom_drop_bbox(lwcollection_as_lwgeom(lines));
   }
 
-  if ( dist == 0 )
+  /* Endpoints of the input lines will be nodes */
+  bl->inends = lwalloc(sizeof(POINT4D) * 2 * (lines->ngeoms ? lines->ngeoms : 1));
+  for ( i=0; i<lines->ngeoms; ++i )
   {
-    /* We checked the dangling case above */
-    _lwt_release_edges(closestEdge, 1);
-    lwerror("Two or more faces found");
-    return -1;
+    const POINTARRAY *pa = ((LWLINE *)lines->geoms[i])->points;
+    if ( ! pa->npoints ) continue;
+    getPoint4d_p(pa, 0, &(bl->inends[bl->ninends++]));
+    getPoint4d_p(pa, pa->npoints - 1, &(bl->inends[bl->ninends++]));
   }
+  bl->ninends = _lwt_BulkSortUniquePoints(bl->inends, bl->ninends);
 
-  /* Find on which side of the segment the query point lays */
-  if ( closestPointVertex != closestEdge->geom->points->npoints )
+  /* Node, then merge at degree-2 nodes */
+#if POSTGIS_GEOS_VERSION >= 30900
+  noded = lwgeom_unaryunion_prec(lwcollection_as_lwgeom(lines), prec ? prec : -1.0);
+#else
+  noded = lwgeom_unaryunion(lwcollection_as_lwgeom(lines));
+#endif
+  if ( ! noded ) return -1; /* lwerror should have been called */
+  bl->merged = lwgeom_linemerge(noded);
+  lwgeom_free(noded);
+  if ( ! bl->merged ) return -1; /* lwerror should have been called */
+
+  /* Bring the vertices computed by GEOS back to the exact grid values */
+  if ( prec ) lwgeom_grid_in_place(bl->merged, &grid);
+
+  mcol = lwgeom_as_lwcollection(bl->merged);
+  nlines = mcol ? mcol->ngeoms : ( lwgeom_is_empty(bl->merged) ? 0 : 1 );
+
+  bl->mends = lwalloc(sizeof(POINT4D) * 2 * (nlines ? nlines : 1));
+  for ( i=0; i<nlines; ++i )
   {
-    /* Closest point is a vertex of the closest segment */
-    LWDEBUGF(1, "Closest point is vertex %d of closest segment", closestPointVertex);
+    LWLINE *l = lwgeom_as_lwline(mcol ? mcol->geoms[i] : bl->merged);
+    if ( ! l || l->points->npoints < 2 ) continue;
+    getPoint4d_p(l->points, 0, &(bl->mends[bl->nmends++]));
+    getPoint4d_p(l->points, l->points->npoints - 1, &(bl->mends[bl->nmends++]));
+  }
+  qsort(bl->mends, bl->nmends, sizeof(POINT4D), compare_bulk_points);
 
-    /*
-     * We need to check if rotating clockwise the line
-     * from previous vertex to closest vertex clockwise
-     * around the closest vertex encounters
-     * the line to query point first (which means it's on the left
-     * of the closest edge) or the line to next vertex first (which
-     * means the query point is on the right)
-     */
+  /* Split merged lines at the input endpoints */
+  for ( i=0; i<nlines; ++i )
+  {
+    LWLINE *l = lwgeom_as_lwline(mcol ? mcol->geoms[i] : bl->merged);
+    POINTARRAY *pa;
+    uint32_t from = 0;
 
-    uint32_t prevVertexIndex = closestPointVertex > 0 ?
-      closestPointVertex - 1u :
-      closestEdge->geom->points->npoints - 2u; /* last vertex would be == first vertex, this being a closed edge */
+    if ( ! l || l->points->npoints < 2 ) continue;
+    pa = l->points;
 
-    const POINT2D *prevVertex = getPoint2d_cp(
-      closestEdge->geom->points,
-      prevVertexIndex
-    );
+    /* A closed line touching nothing else starts at an arbitrary
+     * vertex, move its start to an input endpoint, if any */
+    getPoint4d_p(pa, 0, &p);
+    if ( ptarray_is_closed_2d(pa) &&
+         ! _lwt_BulkIsInputEndpoint(bl, &p) &&
+         _lwt_BulkCountPoint(bl->mends, bl->nmends, &p) == 2 )
+    {
+      for ( j=1; j<pa->npoints-1; ++j )
+      {
+        getPoint4d_p(pa, j, &p);
+        if ( ! _lwt_BulkIsInputEndpoint(bl, &p) ) continue;
+        ptarray_scroll_in_place(pa, &p);
+        break;
+      }
+    }
 
-    LWDEBUGF(1, "Previous vertex %u is POINT(%.15g %.15g)",
-      prevVertexIndex,
-      prevVertex->x,
-      prevVertex->y
-    );
+    for ( j=1; j<pa->npoints-1; ++j )
+    {
+      getPoint4d_p(pa, j, &p);
+      if ( ! _lwt_BulkIsInputEndpoint(bl, &p) ) continue;
+      _lwt_BulkPushEdge(bl, topo->srid, pa, from, j);
+      from = j;
+    }
+    _lwt_BulkPushEdge(bl, topo->srid, pa, from, pa->npoints - 1);
+  }
 
-    uint32_t nextVertexIndex = closestPointVertex == closestEdge->geom->points->npoints - 1u ?
-      1u : /* first point would be == last point, this being a closed edge */
-      closestPointVertex + 1u;
+  LWDEBUGF(1, "Bulk noding: %d input endpoints, %d merged lines, %d edges",
+           bl->ninends, nlines, bl->nedges);
 
-    const POINT2D *nextVertex = getPoint2d_cp(
-      closestEdge->geom->points,
-      nextVertexIndex
-    );
+  return 0;
+}
 
-    LWDEBUGF(1, "Next vertex %u is POINT(%.15g %.15g)",
-      nextVertexIndex,
-      nextVertex->x,
-      nextVertex->y
-    );
+/*
+ * Link the edges to each other and assign them identifiers
+ *
+ * All edge ends are sorted by node and azimuth in one pass, the next
+ * edge on each side is the next edge end clockwise around the node.
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_BulkLinkEdges(LWT_TOPOLOGY *topo, LWT_BULK_LOADER *bl)
+{
+  LWT_ELEMID *ids;
+  uint32_t i, g, k;
 
+  /* Nodes */
+  bl->nodes = lwalloc(sizeof(POINT4D) * 2 * bl->nedges);
+  for ( i=0; i<bl->nedges; ++i )
+  {
+    const POINTARRAY *pa = bl->edges[i].geom->points;
+    getPoint4d_p(pa, 0, &(bl->nodes[2*i]));
+    getPoint4d_p(pa, pa->npoints - 1, &(bl->nodes[2*i+1]));
+  }
+  bl->nnodes = _lwt_BulkSortUniquePoints(bl->nodes, 2 * bl->nedges);
 
-    double azS0; /* azimuth from previous vertex to closestPointVertex */
-    double azS1; /* azimuth from closestPointVertex to next vertex */
-    double azSL; /* azimuth from closestPointVertex to query point */
+  /* Edge ends */
+  bl->ends = lwalloc(sizeof(LWT_BULK_EDGEEND) * 2 * bl->nedges);
+  for ( i=0; i<bl->nedges; ++i )
+  {
+    LWT_ISO_EDGE *e = &(bl->edges[i]);
+    const POINTARRAY *pa = e->geom->points;
+    edgeend fee, lee;
+    POINT2D fp, lp;
 
-    if ( ! azimuth_pt_pt(closestPointOnEdge, prevVertex, &azS0)) {
-      lwerror("error computing azimuth of segment to closest point [%.15g %.15g,%.15g %.15g]",
-              closestPointOnEdge->x, closestPointOnEdge->y,
-              prevVertex->x, prevVertex->y);
-      _lwt_release_edges(closestEdge, 1);
-      return -1;
+    getPoint2d_p(pa, 0, &fp);
+    getPoint2d_p(pa, pa->npoints - 1, &lp);
+    if ( _lwt_InitEdgeEndByLine(&fee, &lee, e->geom, &fp, &lp) )
+      return -1; /* lwerror should have been called */
+
+    e->start_node = _lwt_BulkNodeIndex(bl, &fp);
+    e->end_node = _lwt_BulkNodeIndex(bl, &lp);
+
+    bl->ends[2*i].node = e->start_node;
+    bl->ends[2*i].az = fee.myaz;
+    bl->ends[2*i].edge = i;
+    bl->ends[2*i].outgoing = 1;
+    bl->ends[2*i+1].node = e->end_node;
+    bl->ends[2*i+1].az = lee.myaz;
+    bl->ends[2*i+1].edge = i;
+    bl->ends[2*i+1].outgoing = 0;
+  }
+  qsort(bl->ends, 2 * bl->nedges, sizeof(LWT_BULK_EDGEEND), compare_bulk_edgeends);
+
+  /* Edge identifiers, reserved upfront */
+  ids = lwalloc(sizeof(LWT_ELEMID) * bl->nedges);
+  if ( lwt_be_getNextEdgeIds(topo, ids, bl->nedges) == -1 )
+  {
+    lwfree(ids);
+    lwerror("Backend error: %s", lwt_be_lastErrorMessage(topo->be_iface));
+    return -1;
+  }
+  for ( i=0; i<bl->nedges; ++i ) bl->edges[i].edge_id = ids[i];
+  lwfree(ids);
+
+  /* Walk the edge ends around each node */
+  for ( g=0; g<2*bl->nedges; g=k )
+  {
+    for ( k=g+1; k<2*bl->nedges && bl->ends[k].node == bl->ends[g].node; ++k );
+    for ( i=g; i<k; ++i )
+    {
+      const LWT_BULK_EDGEEND *cur = &(bl->ends[i]);
+      const LWT_BULK_EDGEEND *next = &(bl->ends[i+1 < k ? i+1 : g]);
+      LWT_ELEMID nextid = bl->edges[next->edge].edge_id;
+      if ( ! next->outgoing ) nextid = -nextid;
+      if ( cur->outgoing ) bl->edges[cur->edge].next_right = nextid;
+      else bl->edges[cur->edge].next_left = nextid;
     }
-    if ( ! azimuth_pt_pt(closestPointOnEdge, nextVertex, &azS1)) {
-      lwerror("error computing azimuth of segment from closest point [%.15g %.15g,%.15g %.15g]",
-              closestPointOnEdge->x, closestPointOnEdge->y,
-              nextVertex->x, nextVertex->y);
-      _lwt_release_edges(closestEdge, 1);
+  }
+
+  return 0;
+}
+
+/*
+ * Build the faces of the linked edges
+ *
+ * Rings are walked and classified as by lwt_Polygonize, new faces
+ * get inserted in batches and holes are assigned to their shells
+ * in memory, with holes not in any shell going to outer_face.
+ * TopoGeometries defined by outer_face get the new faces.
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_BulkBuildFaces(LWT_TOPOLOGY *topo, LWT_BULK_LOADER *bl,
+                    LWT_ELEMID outer_face)
+{
+  LWT_ISO_EDGE_TABLE edgetable;
+  uint32_t i, n;
+  int j, ret;
+
+  /* Sort edges by ID (to allow btree searches) */
+  qsort(bl->edges, bl->nedges, sizeof(LWT_ISO_EDGE), compare_iso_edges_by_id);
+  edgetable.edges = bl->edges;
+  edgetable.size = bl->nedges;
+
+  j = 0;
+  while (1)
+  {
+    LWT_ISO_EDGE *edge;
+    LWT_EDGERING *ring;
+    int side;
+
+    j = _lwt_FetchNextUnvisitedEdge(topo, &edgetable, j);
+    if ( j < 0 ) break; /* end of unvisited */
+    edge = &(edgetable.edges[j]);
+
+    for ( side = 1; side >= -1; side -= 2 )
+    {
+      if ( ( side == 1 ? edge->face_left : edge->face_right ) != -1 ) continue;
+      ring = _lwt_BuildEdgeRing(topo, &edgetable, edge, side);
+      if ( _lwt_EdgeRingIsCCW(ring) )
+        LWT_EDGERING_ARRAY_PUSH(&bl->shells, ring)
+      else
+        LWT_EDGERING_ARRAY_PUSH(&bl->holes, ring)
+    }
+  }
+
+  LWDEBUGF(1, "Bulk load found %d holes and %d shells",
+           bl->holes.size, bl->shells.size);
+
+  /* Insert faces of all shells */
+  if ( bl->shells.size )
+  {
+    bl->faces = lwalloc(sizeof(LWT_ISO_FACE) * bl->shells.size);
+    for ( i=0; i<(uint32_t)bl->shells.size; ++i )
+    {
+      bl->faces[i].face_id = -1;
+      bl->faces[i].mbr = _lwt_EdgeRingGetBbox(bl->shells.rings[i]);
+    }
+  }
+  for ( i=0; i<(uint32_t)bl->shells.size; i+=n )
+  {
+    n = bl->shells.size - i;
+    if ( n > LWT_BULK_BATCH_SIZE ) n = LWT_BULK_BATCH_SIZE;
+    ret = lwt_be_insertFaces(topo, &(bl->faces[i]), n);
+    if ( ret == -1 )
+    {
+      lwerror("Backend error: %s", lwt_be_lastErrorMessage(topo->be_iface));
       return -1;
     }
-    if ( ! azimuth_pt_pt(closestPointOnEdge, queryPoint, &azSL) ) {
-      lwerror("error computing azimuth of queryPoint [%.15g %.15g,%.15g %.15g]",
-              closestPointOnEdge->x, closestPointOnEdge->y,
-              queryPoint->x, queryPoint->y);
-      _lwt_release_edges(closestEdge, 1);
+    if ( (uint32_t)ret != n )
+    {
+      lwerror("Unexpected error: %d faces inserted when expecting %d", ret, n);
       return -1;
     }
+  }
+  for ( i=0; i<(uint32_t)bl->shells.size; ++i )
+    _lwt_BulkSetEdgeRingSideFace(bl->shells.rings[i], bl->faces[i].face_id);
 
-    double angle_S0_S1 = azS1 - azS0;
-    if ( angle_S0_S1 < 0 ) angle_S0_S1 += 2 * M_PI;
+  /* New faces are cut out of outer_face, as lwt_AddLine would split it */
+  for ( i=0; outer_face != 0 && i<(uint32_t)bl->shells.size; ++i )
+  {
+    ret = lwt_be_updateTopoGeomFaceSplit(topo, outer_face,
+                                         bl->faces[i].face_id, -1);
+    if ( ret == 0 )
+    {
+      lwerror("Backend error: %s", lwt_be_lastErrorMessage(topo->be_iface));
+      return -1;
+    }
+  }
 
-    double angle_S0_SL = azSL - azS0;
-    if ( angle_S0_SL < 0 ) angle_S0_SL += 2 * M_PI;
+  /* Assign shells to holes */
+  for ( i=0; i<(uint32_t)bl->holes.size; ++i )
+  {
+    LWT_ELEMID containing_face;
 
-    LWDEBUGF(1, "Azimuths from closest (vertex) point: P:%g, N:%g (+%g), Q:%g (+%g)",
-      azS0,
-      azS1, angle_S0_S1,
-      azSL, angle_S0_SL
-    );
-    if ( angle_S0_SL < angle_S0_S1 )
+    containing_face = _lwt_FindFaceContainingRing(topo, bl->holes.rings[i],
+                                                  &bl->shells);
+    if ( containing_face == -1 )
     {
-      /* line to query point was encountered first, is on the left */
-      containingFace = closestEdge->face_left;
+      lwerror("Errors finding face containing ring: %s",
+              lwt_be_lastErrorMessage(topo->be_iface));
+      return -1;
     }
-    else
+    if ( containing_face == 0 ) containing_face = outer_face;
+    _lwt_BulkSetEdgeRingSideFace(bl->holes.rings[i], containing_face);
+  }
+
+  return 0;
+}
+
+/*
+ * Write nodes and edges to the backend in batches
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_BulkWriteEdges(LWT_TOPOLOGY *topo, LWT_BULK_LOADER *bl)
+{
+  uint32_t i, n;
+  int ret;
+
+  bl->isonodes = lwalloc(sizeof(LWT_ISO_NODE) * bl->nnodes);
+  for ( i=0; i<bl->nnodes; ++i )
+  {
+    bl->isonodes[i].node_id = -1;
+    bl->isonodes[i].containing_face = -1;
+    bl->isonodes[i].geom = lwpoint_make(topo->srid, topo->hasZ, 0, &(bl->nodes[i]));
+  }
+  for ( i=0; i<bl->nnodes; i+=n )
+  {
+    n = bl->nnodes - i;
+    if ( n > LWT_BULK_BATCH_SIZE ) n = LWT_BULK_BATCH_SIZE;
+    if ( ! lwt_be_insertNodes(topo, &(bl->isonodes[i]), n) )
     {
-      /* line to query point was NOT encountered first, is on the right */
-      containingFace = closestEdge->face_right;
+      lwerror("Backend error: %s", lwt_be_lastErrorMessage(topo->be_iface));
+      return -1;
     }
   }
-  else
+
+  for ( i=0; i<bl->nedges; ++i )
   {
-    /* Closest point is internal to closest segment, we can use
-     * lw_segment_side */
+    LWT_ISO_EDGE *e = &(bl->edges[i]);
+    e->start_node = bl->isonodes[e->start_node].node_id;
+    e->end_node = bl->isonodes[e->end_node].node_id;
+  }
+  for ( i=0; i<bl->nedges; i+=n )
+  {
+    n = bl->nedges - i;
+    if ( n > LWT_BULK_BATCH_SIZE ) n = LWT_BULK_BATCH_SIZE;
+    ret = lwt_be_insertEdges(topo, &(bl->edges[i]), n);
+    if ( ret == -1 )
+    {
+      lwerror("Backend error: %s", lwt_be_lastErrorMessage(topo->be_iface));
+      return -1;
+    }
+    if ( (uint32_t)ret != n )
+    {
+      lwerror("Unexpected error: %d edges inserted when expecting %d", ret, n);
+      return -1;
+    }
+  }
 
-    LWDEBUGF(1, "Closest point is internal to closest segment, calling lw_segment_side((%g,%g),(%g,%g),(%g,%g)",
-      closestSegmentP0->x,
-      closestSegmentP0->y,
-      closestSegmentP1->x,
-      closestSegmentP1->y,
-      queryPoint->x,
-      queryPoint->y
-    );
+  return 0;
+}
 
-    closestSegmentSide = lw_segment_side(closestSegmentP0, closestSegmentP1, queryPoint);
-    LWDEBUGF(1, "Side of closest segment query point falls on: %d", closestSegmentSide);
+int
+lwt_LoadGeometries(LWT_TOPOLOGY* topo, LWGEOM **geoms, uint32_t ngeoms,
+                   double tol)
+{
+  /*
+     Collect lines, polygon rings and points of the batch
+     If the topology has anything within the batch bbox:
+       add each geometry with lwt_AddPoint, lwt_AddLine, lwt_AddPolygon
+     Else:
+       Snap-round and node all lines at once
+       Split noded lines at input endpoints, to get the edges
+       Sort edge ends by node and azimuth to link edges
+       Walk edge rings to build faces, as lwt_Polygonize does
+       Insert faces, nodes and edges in batches
+       Add points with lwt_AddPoint
+   */
 
-    if ( closestSegmentSide == -1 ) /* left */
-    {
-      containingFace = closestEdge->face_left;
-    }
-    else if ( closestSegmentSide == 1 ) /* right */
+  LWCOLLECTION *lines, *points;
+  LWT_ISO_EDGE *edges;
+  LWT_ISO_NODE *nodes;
+  LWT_BULK_LOADER bl;
+  LWT_ELEMID outer_face;
+  GBOX qbox, pbox;
+  double prec;
+  uint64_t num;
+  uint32_t i;
+  int ret = 0;
+
+  /* The bulk path relabels the input, check it as the column would */
+  for ( i=0; i<ngeoms; ++i )
+  {
+    if ( geoms[i]->srid != topo->srid )
     {
-      containingFace = closestEdge->face_right;
+      lwerror("Geometry SRID (%d) does not match topology SRID (%d)",
+              geoms[i]->srid, topo->srid);
+      return -1;
     }
-    else
+  }
+
+  lines = lwcollection_construct_empty(MULTILINETYPE, topo->srid, topo->hasZ, 0);
+  points = lwcollection_construct_empty(MULTIPOINTTYPE, topo->srid, topo->hasZ, 0);
+  for ( i=0; i<ngeoms; ++i )
+  {
+    if ( _lwt_BulkCollect(topo, geoms[i], lines, points) )
     {
-      lwerror("Unexpected collinearity reported from lw_segment_side");
-      _lwt_release_edges(closestEdge, 1);
+      lwcollection_free(lines);
+      lwcollection_free(points);
       return -1;
     }
+  }
 
+  if ( ! lines->ngeoms && ! points->ngeoms )
+  {
+    lwcollection_free(lines);
+    lwcollection_free(points);
+    return 0;
   }
 
-  _lwt_release_edges(closestEdge, 1);
-  return containingFace;
+  /* Find anything in the topology close to the batch */
+  if ( lines->ngeoms )
+    lwgeom_calculate_gbox(lwcollection_as_lwgeom(lines), &qbox);
+  if ( points->ngeoms )
+  {
+    lwgeom_calculate_gbox(lwcollection_as_lwgeom(points), &pbox);
+    if ( lines->ngeoms ) gbox_merge(&pbox, &qbox);
+    else qbox = pbox;
+  }
+  prec = tol ? tol : topo->precision;
+  gbox_expand(&qbox, prec ? prec : _lwt_minTolerance(
+    lwcollection_as_lwgeom(lines->ngeoms ? lines : points)));
+
+  /* Only identifiers are fetched, so plain lwfree is enough */
+  edges = lwt_be_getEdgeWithinBox2D(topo, &qbox, &num, LWT_COL_EDGE_EDGE_ID, 1);
+  if ( edges ) lwfree(edges);
+  if ( num == 0 )
+  {
+    nodes = lwt_be_getNodeWithinBox2D(topo, &qbox, &num, LWT_COL_NODE_NODE_ID, 1);
+    if ( nodes ) lwfree(nodes);
+  }
+  if ( num == UINT64_MAX )
+  {
+    lwcollection_free(lines);
+    lwcollection_free(points);
+    lwerror("Backend error: %s", lwt_be_lastErrorMessage(topo->be_iface));
+    return -1;
+  }
+
+  if ( num )
+  {
+    LWDEBUG(1, "Topology is not empty within batch extent, loading incrementally");
+    lwcollection_free(lines);
+    lwcollection_free(points);
+    for ( i=0; i<ngeoms; ++i )
+    {
+      if ( _lwt_LoadGeometryIncremental(topo, geoms[i], tol) ) return -1;
+    }
+    return 0;
+  }
+
+  memset(&bl, 0, sizeof(LWT_BULK_LOADER));
+  LWT_EDGERING_ARRAY_INIT(&bl.shells);
+  LWT_EDGERING_ARRAY_INIT(&bl.holes);
+
+  initGEOS(lwnotice, lwgeom_geos_error);
+
+  if ( lines->ngeoms )
+  {
+    ret = _lwt_BulkNodeLines(topo, &bl, lines, prec);
+    if ( ! ret && bl.nedges )
+    {
+      POINT4D p;
+      LWPOINT *pt;
+
+      /* All of the batch falls in the face containing any of its points */
+      getPoint4d_p(bl.edges[0].geom->points, 0, &p);
+      pt = lwpoint_make(topo->srid, topo->hasZ, 0, &p);
+      outer_face = lwt_GetFaceContainingPoint(topo, pt);
+      lwpoint_free(pt);
+
+      ret = outer_face == -1 ? -1 : 0;
+      if ( ! ret ) ret = _lwt_BulkLinkEdges(topo, &bl);
+      if ( ! ret ) ret = _lwt_BulkBuildFaces(topo, &bl, outer_face);
+      if ( ! ret ) ret = _lwt_BulkWriteEdges(topo, &bl);
+    }
+  }
+
+  _lwt_BulkLoaderFree(&bl);
+  lwcollection_free(lines);
+
+  for ( i=0; ! ret && i<points->ngeoms; ++i )
+  {
+    if ( lwt_AddPoint(topo, (LWPOINT *)points->geoms[i], tol) == -1 ) ret = -1;
+  }
+  lwcollection_free(points);
+
+  return ret;
+}
+
+LWT_ELEMID
+lwt_GetFaceContainingPoint(LWT_TOPOLOGY* topo, const LWPOINT* pt)
+{
+  LWT_ISO_EDGE* closestEdge;
+  LWT_ISO_EDGE* edges;
+  uint64_t numedges, i;
+  const POINT2D *queryPoint;
+  const POINT2D *closestPointOnEdge = NULL;
+  uint32_t closestSegmentIndex;
+  int closestSegmentSide;
+  uint32_t closestPointVertex;
+  const POINT2D *closestSegmentP0, *closestSegmentP1;
+  LWT_ELEMID closestNode = 0;
+  double dist;
+  int containingFace = -1;
+
+  closestEdge = lwt_be_getClosestEdge( topo, pt, &numedges,
+    LWT_COL_EDGE_GEOM|
+    LWT_COL_EDGE_EDGE_ID|
+    LWT_COL_EDGE_START_NODE|
+    LWT_COL_EDGE_END_NODE|
+    LWT_COL_EDGE_FACE_LEFT|
+    LWT_COL_EDGE_FACE_RIGHT
+  );
+  if (numedges == UINT64_MAX)
+  {
+	  lwerror("Backend error: %s", lwt_be_lastErrorMessage(topo->be_iface));
+    /* cberror(topo->be_data, "Error from cb_getClosestEdge"); */
+	  return -1;
+  }
+  if (numedges == 0)
+  {
+    /* If there are no edges the point is in the universal face */
+    return 0;
+  }
+
+  LWDEBUGGF(2, lwline_as_lwgeom(closestEdge->geom), "Closest edge %" LWTFMT_ELEMID, closestEdge->edge_id);
+
+  /* Find closest segment of edge to the point */
+  queryPoint = getPoint2d_cp(pt->point, 0);
+  closestSegmentIndex = ptarray_closest_segment_2d(closestEdge->geom->points, queryPoint, &dist);
+  LWDEBUGF(1, "Closest segment on edge %" LWTFMT_ELEMID " is %d (dist %g)", closestEdge->edge_id, closestSegmentIndex, dist);
+  closestSegmentP0 = getPoint2d_cp(closestEdge->geom->points, closestSegmentIndex);
+  closestSegmentP1 = getPoint2d_cp(closestEdge->geom->points, closestSegmentIndex + 1);
+  LWDEBUGF(1, "Closest segment on edge %" LWTFMT_ELEMID " is LINESTRING(%g %g, %g %g)",
+    closestEdge->edge_id,
+    closestSegmentP0->x,
+    closestSegmentP0->y,
+    closestSegmentP1->x,
+    closestSegmentP1->y
+  );
+
+	/*
+	 * We use comp.graphics.algorithms Frequently Asked Questions method
+	 *
+	 * (1)           AC dot AB
+	 *           r = ----------
+	 *                ||AB||^2
+	 *	r has the following meaning:
+	 *	r=0 P = A
+	 *	r=1 P = B
+	 *	r<0 P is on the backward extension of AB
+	 *	r>1 P is on the forward extension of AB
+	 *	0<r<1 P is interior to AB
+	 *
+	 */
+  const POINT2D *p = queryPoint;
+  const POINT2D *A = closestSegmentP0;
+  const POINT2D *B = closestSegmentP1;
+  double r = ( (p->x-A->x) * (B->x-A->x) + (p->y-A->y) * (B->y-A->y) )/( (B->x-A->x)*(B->x-A->x) +(B->y-A->y)*(B->y-A->y) );
+  if ( r <= 0 )
+  {
+    closestPointOnEdge = A;
+    closestPointVertex = closestSegmentIndex;
+    if ( closestSegmentIndex == 0 )
+    {
+      closestNode = closestEdge->start_node;
+    }
+  }
+  else if (r >= 1 )
+  {
+    closestPointOnEdge = B;
+    closestPointVertex = closestSegmentIndex + 1;
+    if ( closestSegmentIndex + 2 == closestEdge->geom->points->npoints )
+    {
+      closestNode = closestEdge->end_node;
+    }
+  }
+  else
+  {
+    closestPointVertex = closestEdge->geom->points->npoints;
+  }
+
+  if ( closestNode != 0 )
+  {
+    LWDEBUGF(1, "Closest point is node %d", closestNode);
+    if ( dist == 0 )
+    {
+      LWDEBUGF(1, "Query point is node %d", closestNode);
+      /* Query point is the node
+       *
+       * If all edges incident to the node are
+       * dangling, we can return their common
+       * side face, otherwise the point will be
+       * on multiple face boundaries
+       */
+      if ( closestEdge->face_left != closestEdge->face_right )
+      {
+        _lwt_release_edges(closestEdge, 1);
+        lwerror("Two or more faces found");
+        return -1;
+      }
+      containingFace = closestEdge->face_left;
+
+      /* Check other incident edges */
+      numedges = 1;
+      edges = lwt_be_getEdgeByNode( topo, &closestNode, &numedges, LWT_COL_EDGE_FACE_LEFT|LWT_COL_EDGE_FACE_RIGHT );
+      if (numedges == UINT64_MAX)
+      {
+        lwerror("Backend error from getEdgeByNode: %s", lwt_be_lastErrorMessage(topo->be_iface));
+        /* cberror(topo->be_data, "Error from cb_getClosestEdge"); */
+        _lwt_release_edges(closestEdge, 1);
+        return -1;
+      }
+      for (i=0; i<numedges; ++i)
+      {
+        if ( edges[i].face_left != containingFace ||
+             edges[i].face_right != containingFace )
+        {
+          _lwt_release_edges(edges, numedges);
+          _lwt_release_edges(closestEdge, 1);
+          lwerror("Two or more faces found");
+          return -1;
+        }
+      }
+      if (numedges < 1 )
+      {
+        lwerror("Unexpected backend return: getEdgeByNode(%d) returns no edges when we previously found edge %d ending on that node",
+          closestNode, closestEdge->edge_id);
+        _lwt_release_edges(edges, numedges);
+        _lwt_release_edges(closestEdge, 1);
+        return -1;
+      }
+      LWDEBUGF(1, "lwt_be_getEdgeByNode returned %d edges", numedges);
+      _lwt_release_edges(edges, numedges);
+      _lwt_release_edges(closestEdge, 1);
+      return containingFace;
+    }
+
+    /* Closest point is a node, but query point is NOT on the node */
+
+    /* let's do azimuth computation */
+    edgeend ee;
+    if ( ! azimuth_pt_pt(closestPointOnEdge, queryPoint, &ee.myaz) ) {
+      lwerror("error computing azimuth of query point [%.15g %.15g,%.15g %.15g]",
+              closestPointOnEdge->x, closestPointOnEdge->y,
+              queryPoint->x, queryPoint->y);
+      _lwt_release_edges(closestEdge, 1);
+      return -1;
+    }
+
+    LWDEBUGF(1, "Query point azimuth is %g", ee.myaz);
+
+    int found = _lwt_FindAdjacentEdges( topo, closestNode, &ee, NULL, -1 );
+    if ( ! found ) {
+        lwerror("Unexpected backend return: _lwt_FindAdjacentEdges(%d) found no edges when we previously found edge %d ending on that node",
+          closestNode, closestEdge->edge_id);
+        _lwt_release_edges(closestEdge, 1);
+        return -1;
+    }
+
+    _lwt_release_edges(closestEdge, 1);
+    return ee.cwFace;
+
+  }
+
+  LWDEBUG(1, "Closest point is NOT a node");
+
+  /* If this edge has the same face on the left and right sides
+   * we found the face containing our query point */
+  if ( closestEdge->face_left == closestEdge->face_right )
+  {
+    containingFace = closestEdge->face_left;
+    _lwt_release_edges(closestEdge, 1);
+    return containingFace;
+  }
+
+  if ( dist == 0 )
+  {
+    /* We checked the dangling case above */
+    _lwt_release_edges(closestEdge, 1);
+    lwerror("Two or more faces found");
+    return -1;
+  }
+
+  /* Find on which side of the segment the query point lays */
+  if ( closestPointVertex != closestEdge->geom->points->npoints )
+  {
+    /* Closest point is a vertex of the closest segment */
+    LWDEBUGF(1, "Closest point is vertex %d of closest segment", closestPointVertex);
+
+    /*
+     * We need to check if rotating clockwise the line
+     * from previous vertex to closest vertex clockwise
+     * around the closest vertex encounters
+     * the line to query point first (which means it's on the left
+     * of the closest edge) or the line to next vertex first (which
+     * means the query point is on the right)
+     */
+
+    uint32_t prevVertexIndex = closestPointVertex > 0 ?
+      closestPointVertex - 1u :
+      closestEdge->geom->points->npoints - 2u; /* last vertex would be == first vertex, this being a closed edge */
+
+    const POINT2D *prevVertex = getPoint2d_cp(
+      closestEdge->geom->points,
+      prevVertexIndex
+    );
+
+    LWDEBUGF(1, "Previous vertex %u is POINT(%.15g %.15g)",
+      prevVertexIndex,
+      prevVertex->x,
+      prevVertex->y
+    );
+
+    uint32_t nextVertexIndex = closestPointVertex == closestEdge->geom->points->npoints - 1u ?
+      1u : /* first point would be == last point, this being a closed edge */
+      closestPointVertex + 1u;
+
+    const POINT2D *nextVertex = getPoint2d_cp(
+      closestEdge->geom->points,
+      nextVertexIndex
+    );
+
+    LWDEBUGF(1, "Next vertex %u is POINT(%.15g %.15g)",
+      nextVertexIndex,
+      nextVertex->x,
+      nextVertex->y
+    );
+
+
+    double azS0; /* azimuth from previous vertex to closestPointVertex */
+    double azS1; /* azimuth from closestPointVertex to next vertex */
+    double azSL; /* azimuth from closestPointVertex to query point */
+
+    if ( ! azimuth_pt_pt(closestPointOnEdge, prevVertex, &azS0)) {
+      lwerror("error computing azimuth of segment to closest point [%.15g %.15g,%.15g %.15g]",
+              closestPointOnEdge->x, closestPointOnEdge->y,
+              prevVertex->x, prevVertex->y);
+      _lwt_release_edges(closestEdge, 1);
+      return -1;
+    }
+    if ( ! azimuth_pt_pt(closestPointOnEdge, nextVertex, &azS1)) {
+      lwerror("error computing azimuth of segment from closest point [%.15g %.15g,%.15g %.15g]",
+              closestPointOnEdge->x, closestPointOnEdge->y,
+              nextVertex->x, nextVertex->y);
+      _lwt_release_edges(closestEdge, 1);
+      return -1;
+    }
+    if ( ! azimuth_pt_pt(closestPointOnEdge, queryPoint, &azSL) ) {
+      lwerror("error computing azimuth of queryPoint [%.15g %.15g,%.15g %.15g]",
+              closestPointOnEdge->x, closestPointOnEdge->y,
+              queryPoint->x, queryPoint->y);
+      _lwt_release_edges(closestEdge, 1);
+      return -1;
+    }
+
+    double angle_S0_S1 = azS1 - azS0;
+    if ( angle_S0_S1 < 0 ) angle_S0_S1 += 2 * M_PI;
+
+    double angle_S0_SL = azSL - azS0;
+    if ( angle_S0_SL < 0 ) angle_S0_SL += 2 * M_PI;
+
+    LWDEBUGF(1, "Azimuths from closest (vertex) point: P:%g, N:%g (+%g), Q:%g (+%g)",
+      azS0,
+      azS1, angle_S0_S1,
+      azSL, angle_S0_SL
+    );
+    if ( angle_S0_SL < angle_S0_S1 )
+    {
+      /* line to query point was encountered first, is on the left */
+      containingFace = closestEdge->face_left;
+    }
+    else
+    {
+      /* line to query point was NOT encountered first, is on the right */
+      containingFace = closestEdge->face_right;
+    }
+  }
+  else
+  {
+    /* Closest point is internal to closest segment, we can use
+     * lw_segment_side */
+
+    LWDEBUGF(1, "Closest point is internal to closest segment, calling lw_segment_side((%g,%g),(%g,%g),(%g,%g)",
+      closestSegmentP0->x,
+      closestSegmentP0->y,
+      closestSegmentP1->x,
+      closestSegmentP1->y,
+      queryPoint->x,
+      queryPoint->y
+    );
+
+    closestSegmentSide = lw_segment_side(closestSegmentP0, closestSegmentP1, queryPoint);
+    LWDEBUGF(1, "Side of closest segment query point falls on: %d", closestSegmentSide);
+
+    if ( closestSegmentSide == -1 ) /* left */
+    {
+      containingFace = closestEdge->face_left;
+    }
+    else if ( closestSegmentSide == 1 ) /* right */
+    {
+      containingFace = closestEdge->face_right;
+    }
+    else
+    {
+      lwerror("Unexpected collinearity reported from lw_segment_side");
+      _lwt_release_edges(closestEdge, 1);
+      return -1;
+    }
+
+  }
+
+  _lwt_release_edges(closestEdge, 1);
+  return containingFace;
+}
+
+/*
+ *---- validator
+ */
+
+/* An edge known to the validator */
+typedef struct LWT_VALIDATOR_EDGE_T {
+  LWT_ISO_EDGE *edge;
+  /* Exact 2d bounding box of the edge geometry, if not empty */
+  GBOX box;
+  uint8_t empty;
+  /* 1 if the edge was found by the partition box query */
+  uint8_t in_partition;
+  /* 1 if the edge geometry is invalid */
+  uint8_t invalid;
+  /* Sides already walked by the ring check (1: left, 2: right) */
+  uint8_t ring_walked;
+  /* Sides already walked looking for face shells (1: left, 2: right) */
+  uint8_t shell_walked;
+  /* Serial of the last ring walk through the left and right side */
+  uint32_t walk[2];
+  /* GEOS version of the edge geometry, converted on first use */
+  GEOSGeometry *gg;
+} LWT_VALIDATOR_EDGE;
+
+/* Open addressing map of element identifiers to array indexes */
+typedef struct LWT_ELEMID_MAP_T {
+  LWT_ELEMID *keys;
+  uint32_t *vals; /* UINT32_MAX marks empty slots */
+  uint32_t size; /* power of 2, 0 until first insert */
+  uint32_t count;
+} LWT_ELEMID_MAP;
+
+/* A node known to the validator */
+typedef struct LWT_VALIDATOR_NODE_T {
+  LWT_ISO_NODE *node;
+  /* 1 if the node is checked by this partition */
+  uint8_t owned;
+  /* 1 if any edge starts or ends at the node */
+  uint8_t incident;
+} LWT_VALIDATOR_NODE;
+
+/* The shell of a face, as found by walking the rings of its edges */
+typedef struct LWT_VALIDATOR_FACE_T {
+  LWT_ELEMID face_id;
+  /* 1 if any edge advertises the face on one of its sides */
+  int has_edges;
+  /* 1 while the face shell is being searched */
+  int loading;
+  /* Smallest identifier of the shell rings, 0 if no shell was found */
+  LWT_ELEMID ring_id;
+  POINTARRAY *shell;
+  GBOX box;
+  double area;
+} LWT_VALIDATOR_FACE;
+
+/* A ring which is not a shell, to be checked against the shells */
+typedef struct LWT_VALIDATOR_HOLE_T {
+  LWT_ELEMID ring_id;
+  LWT_ELEMID face;
+  GBOX box;
+  POINT2D pt;
+} LWT_VALIDATOR_HOLE;
+
+/* An edge end around a node, for the edge linking check */
+typedef struct LWT_VALIDATOR_EDGEEND_T {
+  LWT_ELEMID node;
+  /* Positive for edges starting at the node, negative for ending ones */
+  LWT_ELEMID edge;
+  LWT_ELEMID next_left;
+  LWT_ELEMID next_right;
+  double az;
+  int has_az;
+} LWT_VALIDATOR_EDGEEND;
+
+/* An array of edges or nodes returned by the backend */
+typedef struct LWT_VALIDATOR_CHUNK_T {
+  LWT_ISO_EDGE *edges;
+  LWT_ISO_NODE *nodes;
+  uint64_t size;
+} LWT_VALIDATOR_CHUNK;
+
+typedef struct LWT_VALIDATOR_T {
+  LWT_TOPOLOGY *topo;
+  /* NULL when validating the whole topology */
+  const GBOX *partition;
+  LWT_VALIDATOR_EDGE *edges;
+  uint32_t nedges, maxedges;
+  LWT_ELEMID_MAP edgemap;
+  LWT_VALIDATOR_NODE *nodes;
+  uint32_t nnodes, maxnodes;
+  LWT_ELEMID_MAP nodemap;
+  LWT_VALIDATOR_FACE *faces;
+  uint32_t nfaces, maxfaces;
+  LWT_ELEMID_MAP facemap;
+  /* Faces checked by this partition */
+  LWT_ISO_FACE *owned_faces;
+  uint64_t nowned_faces;
+  /* Arrays returned by the backend, the records above point into them */
+  LWT_VALIDATOR_CHUNK *chunks;
+  uint32_t nchunks, maxchunks;
+  LWT_VALIDATOR_HOLE *holes;
+  uint32_t nholes, maxholes;
+  uint32_t walk_serial;
+  LWT_VALIDATION_ERROR *errors;
+  uint32_t nerrors, maxerrors;
+} LWT_VALIDATOR;
+
+#define LWT_VALIDATOR_GROW(ary, num, max) { \
+  if ( (num) == (max) ) { \
+    (max) = (max) ? (max) * 2 : 16; \
+    (ary) = lwrealloc((ary), sizeof(*(ary)) * (max)); \
+  } \
+}
+
+static uint32_t
+_lwt_ElemidMapGet(const LWT_ELEMID_MAP *map, LWT_ELEMID id)
+{
+  uint32_t mask = map->size - 1;
+  uint32_t i;
+
+  if ( ! map->size ) return UINT32_MAX;
+  i = (uint32_t)(((uint64_t)id * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & mask;
+  while ( map->vals[i] != UINT32_MAX )
+  {
+    if ( map->keys[i] == id ) return map->vals[i];
+    i = (i + 1) & mask;
+  }
+  return UINT32_MAX;
+}
+
+static void
+_lwt_ElemidMapPut(LWT_ELEMID_MAP *map, LWT_ELEMID id, uint32_t val)
+{
+  uint32_t mask, i;
+
+  /* Keep the load factor under one half */
+  if ( ( map->count + 1 ) * 2 > map->size )
+  {
+    LWT_ELEMID_MAP grown;
+    grown.size = map->size ? map->size * 2 : 64;
+    grown.count = 0;
+    grown.keys = lwalloc(sizeof(LWT_ELEMID) * grown.size);
+    grown.vals = lwalloc(sizeof(uint32_t) * grown.size);
+    memset(grown.vals, 0xFF, sizeof(uint32_t) * grown.size);
+    for ( i=0; i<map->size; ++i )
+    {
+      if ( map->vals[i] != UINT32_MAX )
+        _lwt_ElemidMapPut(&grown, map->keys[i], map->vals[i]);
+    }
+    if ( map->size )
+    {
+      lwfree(map->keys);
+      lwfree(map->vals);
+    }
+    *map = grown;
+  }
+
+  mask = map->size - 1;
+  i = (uint32_t)(((uint64_t)id * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & mask;
+  while ( map->vals[i] != UINT32_MAX )
+  {
+    if ( map->keys[i] == id )
+    {
+      map->vals[i] = val;
+      return;
+    }
+    i = (i + 1) & mask;
+  }
+  map->keys[i] = id;
+  map->vals[i] = val;
+  map->count++;
+}
+
+static void
+_lwt_ElemidMapFree(LWT_ELEMID_MAP *map)
+{
+  if ( ! map->size ) return;
+  lwfree(map->keys);
+  lwfree(map->vals);
+}
+
+static void
+_lwt_ValidatorFree(LWT_VALIDATOR *v)
+{
+  uint32_t i;
+
+  for ( i=0; i<v->nedges; ++i )
+  {
+    if ( v->edges[i].gg ) GEOSGeom_destroy(v->edges[i].gg);
+  }
+  for ( i=0; i<v->nfaces; ++i )
+  {
+    if ( v->faces[i].shell ) ptarray_free(v->faces[i].shell);
+  }
+  for ( i=0; i<v->nchunks; ++i )
+  {
+    if ( v->chunks[i].edges ) _lwt_release_edges(v->chunks[i].edges, v->chunks[i].size);
+    if ( v->chunks[i].nodes ) _lwt_release_nodes(v->chunks[i].nodes, v->chunks[i].size);
+  }
+  if ( v->owned_faces ) _lwt_release_faces(v->owned_faces, v->nowned_faces);
+  if ( v->edges ) lwfree(v->edges);
+  if ( v->nodes ) lwfree(v->nodes);
+  if ( v->faces ) lwfree(v->faces);
+  if ( v->chunks ) lwfree(v->chunks);
+  if ( v->holes ) lwfree(v->holes);
+  _lwt_ElemidMapFree(&v->edgemap);
+  _lwt_ElemidMapFree(&v->nodemap);
+  _lwt_ElemidMapFree(&v->facemap);
+}
+
+/*
+ * Partitions own the half-open box [xmin,xmax) x [ymin,ymax), so that
+ * a grid of partitions assigns every point to exactly one of them
+ */
+static int
+_lwt_ValidatorOwns(const LWT_VALIDATOR *v, const POINT2D *p)
+{
+  const GBOX *b = v->partition;
+  if ( ! b ) return 1;
+  return p->x >= b->xmin && p->x < b->xmax &&
+         p->y >= b->ymin && p->y < b->ymax;
+}
+
+static void
+_lwt_ValidatorError(LWT_VALIDATOR *v, const char *error,
+                    LWT_ELEMID id1, LWT_ELEMID id2)
+{
+  LWT_VALIDATION_ERROR *e;
+  LWT_VALIDATOR_GROW(v->errors, v->nerrors, v->maxerrors);
+  e = &(v->errors[v->nerrors++]);
+  e->error = error;
+  e->id1 = id1;
+  e->id2 = id2;
+  LWDEBUGF(1, "Validation error: %s (%" LWTFMT_ELEMID ", %" LWTFMT_ELEMID ")",
+           error, id1, id2);
+}
+
+static int
+compare_validation_errors(const void *si1, const void *si2)
+{
+  const LWT_VALIDATION_ERROR *a = si1;
+  const LWT_VALIDATION_ERROR *b = si2;
+  if ( a->id1 != b->id1 ) return a->id1 < b->id1 ? -1 : 1;
+  if ( a->id2 != b->id2 ) return a->id2 < b->id2 ? -1 : 1;
+  return strcmp(a->error, b->error);
+}
+
+/* Sort the errors reported by a check, starting at the given offset */
+static void
+_lwt_ValidatorSortErrors(LWT_VALIDATOR *v, uint32_t from)
+{
+  if ( v->nerrors - from < 2 ) return;
+  qsort(v->errors + from, v->nerrors - from,
+        sizeof(LWT_VALIDATION_ERROR), compare_validation_errors);
+}
+
+static LWT_VALIDATOR_EDGE *
+_lwt_ValidatorGetEdge(LWT_VALIDATOR *v, LWT_ELEMID id)
+{
+  uint32_t idx = _lwt_ElemidMapGet(&v->edgemap, id);
+  return idx == UINT32_MAX ? NULL : &(v->edges[idx]);
+}
+
+static LWT_VALIDATOR_NODE *
+_lwt_ValidatorGetNode(LWT_VALIDATOR *v, LWT_ELEMID id)
+{
+  uint32_t idx = _lwt_ElemidMapGet(&v->nodemap, id);
+  return idx == UINT32_MAX ? NULL : &(v->nodes[idx]);
+}
+
+static LWT_VALIDATOR_FACE *
+_lwt_ValidatorGetFace(LWT_VALIDATOR *v, LWT_ELEMID id)
+{
+  uint32_t idx = _lwt_ElemidMapGet(&v->facemap, id);
+  return idx == UINT32_MAX ? NULL : &(v->faces[idx]);
+}
+
+/*
+ * Register edges returned by the backend, taking ownership of the array.
+ * Edges already known are not registered again.
+ */
+static void
+_lwt_ValidatorAddEdges(LWT_VALIDATOR *v, LWT_ISO_EDGE *edges, uint64_t num,
+                       int in_partition)
+{
+  uint64_t i;
+
+  if ( ! edges ) return;
+
+  LWT_VALIDATOR_GROW(v->chunks, v->nchunks, v->maxchunks);
+  v->chunks[v->nchunks].edges = edges;
+  v->chunks[v->nchunks].nodes = NULL;
+  v->chunks[v->nchunks++].size = num;
+
+  for ( i=0; i<num; ++i )
+  {
+    LWT_VALIDATOR_EDGE *ve;
+
+    if ( _lwt_ElemidMapGet(&v->edgemap, edges[i].edge_id) != UINT32_MAX )
+      continue;
+
+    LWT_VALIDATOR_GROW(v->edges, v->nedges, v->maxedges);
+    ve = &(v->edges[v->nedges]);
+    memset(ve, 0, sizeof(LWT_VALIDATOR_EDGE));
+    ve->edge = &(edges[i]);
+    ve->in_partition = in_partition;
+    if ( edges[i].geom && edges[i].geom->points->npoints )
+      ptarray_calculate_gbox_cartesian(edges[i].geom->points, &(ve->box));
+    else
+      ve->empty = 1;
+    _lwt_ElemidMapPut(&v->edgemap, edges[i].edge_id, v->nedges++);
+  }
+}
+
+/*
+ * Register nodes returned by the backend, taking ownership of the array.
+ * Nodes already known are not registered again.
+ */
+static void
+_lwt_ValidatorAddNodes(LWT_VALIDATOR *v, LWT_ISO_NODE *nodes, uint64_t num)
+{
+  uint64_t i;
+
+  if ( ! nodes ) return;
+
+  LWT_VALIDATOR_GROW(v->chunks, v->nchunks, v->maxchunks);
+  v->chunks[v->nchunks].edges = NULL;
+  v->chunks[v->nchunks].nodes = nodes;
+  v->chunks[v->nchunks++].size = num;
+
+  for ( i=0; i<num; ++i )
+  {
+    LWT_VALIDATOR_NODE *vn;
+
+    if ( _lwt_ElemidMapGet(&v->nodemap, nodes[i].node_id) != UINT32_MAX )
+      continue;
+
+    LWT_VALIDATOR_GROW(v->nodes, v->nnodes, v->maxnodes);
+    vn = &(v->nodes[v->nnodes]);
+    vn->node = &(nodes[i]);
+    vn->owned = 0;
+    vn->incident = 0;
+    _lwt_ElemidMapPut(&v->nodemap, nodes[i].node_id, v->nnodes++);
+  }
+}
+
+static int
+compare_elemids(const void *si1, const void *si2)
+{
+  LWT_ELEMID a = *(const LWT_ELEMID *)si1;
+  LWT_ELEMID b = *(const LWT_ELEMID *)si2;
+  if ( a != b ) return a < b ? -1 : 1;
+  return 0;
+}
+
+/*
+ * Fetch the edges with the given identifiers which are not known yet.
+ * The ids array is sorted in place.
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorFetchEdges(LWT_VALIDATOR *v, LWT_ELEMID *ids, uint64_t num)
+{
+  LWT_ISO_EDGE *edges;
+  uint64_t i, n = 0;
+
+  qsort(ids, num, sizeof(LWT_ELEMID), compare_elemids);
+  for ( i=0; i<num; ++i )
+  {
+    if ( n && ids[n-1] == ids[i] ) continue;
+    if ( _lwt_ValidatorGetEdge(v, ids[i]) ) continue;
+    ids[n++] = ids[i];
+  }
+  if ( ! n ) return 0;
+
+  edges = lwt_be_getEdgeById(v->topo, ids, &n, LWT_COL_EDGE_ALL);
+  if ( n == UINT64_MAX )
+  {
+    lwerror("Backend error: %s", lwt_be_lastErrorMessage(v->topo->be_iface));
+    return -1;
+  }
+  _lwt_ValidatorAddEdges(v, edges, n, 0);
+  return 0;
+}
+
+/*
+ * Fetch the edges met walking the ring on the given edge side, or just
+ * the edge itself when the backend cannot walk the ring (because it
+ * does not close, for example).
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorFetchRing(LWT_VALIDATOR *v, LWT_ELEMID sedge, int whole_ring)
+{
+  LWT_ELEMID *ids;
+  LWT_ELEMID id;
+  uint64_t i, num;
+  int ret;
+
+  if ( whole_ring )
+  {
+    ids = lwt_be_getRingEdges(v->topo, sedge, &num, 0);
+    if ( num != UINT64_MAX && ids )
+    {
+      for ( i=0; i<num; ++i ) ids[i] = llabs(ids[i]);
+      ret = _lwt_ValidatorFetchEdges(v, ids, num);
+      lwfree(ids);
+      return ret;
+    }
+    LWDEBUGF(1, "Could not walk ring of edge %" LWTFMT_ELEMID " in backend: %s",
+             sedge, lwt_be_lastErrorMessage(v->topo->be_iface));
+  }
+
+  id = llabs(sedge);
+  return _lwt_ValidatorFetchEdges(v, &id, 1);
+}
+
+/*
+ * Walk the ring on the given edge side following next_left_edge and
+ * next_right_edge, as GetRingEdges does, until a signed edge repeats or
+ * a link leads to a missing edge. Edges not known yet are fetched.
+ *
+ * The walk serial stamps the sides found, see _lwt_ValidatorAnalyzeRing.
+ *
+ * @return number of signed edge identifiers written to *ring, which
+ *         is to be released with lwfree, or -1 on error
+ *         (lwerror is invoked)
+ */
+static int64_t
+_lwt_ValidatorWalkRing(LWT_VALIDATOR *v, LWT_ELEMID sedge, LWT_ELEMID **ring)
+{
+  LWT_ELEMID *ids;
+  LWT_ELEMID cur = sedge;
+  uint64_t num = 0, max = 16;
+  uint32_t serial = ++v->walk_serial;
+  int fetched = 0;
+
+  ids = lwalloc(sizeof(LWT_ELEMID) * max);
+  while ( cur )
+  {
+    LWT_VALIDATOR_EDGE *ve = _lwt_ValidatorGetEdge(v, llabs(cur));
+    int side = cur < 0 ? 1 : 0;
+
+    if ( ! ve )
+    {
+      /* The whole ring is fetched on first miss, single edges after */
+      if ( _lwt_ValidatorFetchRing(v, cur, ! fetched) == -1 )
+      {
+        lwfree(ids);
+        return -1;
+      }
+      fetched = 1;
+      ve = _lwt_ValidatorGetEdge(v, llabs(cur));
+      if ( ! ve ) break; /* link to a missing edge */
+    }
+
+    if ( ve->walk[side] == serial ) break;
+    ve->walk[side] = serial;
+
+    if ( num == max )
+    {
+      max *= 2;
+      ids = lwrealloc(ids, sizeof(LWT_ELEMID) * max);
+    }
+    ids[num++] = cur;
+    cur = cur < 0 ? ve->edge->next_right : ve->edge->next_left;
+  }
+
+  *ring = ids;
+  return num;
+}
+
+/* Start point of an edge side, return 0 if the edge is empty */
+static int
+_lwt_ValidatorSideStart(const LWT_VALIDATOR_EDGE *ve, LWT_ELEMID sedge,
+                        POINT2D *pt)
+{
+  const POINTARRAY *pa;
+  if ( ve->empty ) return 0;
+  pa = ve->edge->geom->points;
+  getPoint2d_p(pa, sedge > 0 ? 0 : pa->npoints - 1, pt);
+  return 1;
+}
+
+typedef struct LWT_VALIDATOR_RING_T {
+  /* Smallest signed edge identifier in the ring */
+  LWT_ELEMID ring_id;
+  /* Face on the walking side of the first edge */
+  LWT_ELEMID face;
+  int mixed;
+  int closed;
+  int shell;
+  /* Ring vertices, 2d, with no duplicates at edge joints */
+  POINTARRAY *pa;
+} LWT_VALIDATOR_RING;
+
+/*
+ * Build and classify a ring as the SQL ValidateTopology does: a closed
+ * ring with more than 3 points, not made only of dangling edges, is a
+ * shell when counterclockwise.
+ *
+ * Must be called right after the _lwt_ValidatorWalkRing call which
+ * returned the ring.
+ */
+static void
+_lwt_ValidatorAnalyzeRing(LWT_VALIDATOR *v, const LWT_ELEMID *ring,
+                          uint64_t num, LWT_VALIDATOR_RING *r)
+{
+  uint64_t i;
+  uint32_t k;
+  int dangling = 1;
+
+  r->ring_id = ring[0];
+  r->mixed = 0;
+  r->pa = ptarray_construct_empty(0, 0, 32);
+  for ( i=0; i<num; ++i )
+  {
+    LWT_VALIDATOR_EDGE *ve = _lwt_ValidatorGetEdge(v, llabs(ring[i]));
+    LWT_ELEMID face = ring[i] > 0 ? ve->edge->face_left : ve->edge->face_right;
+    const POINTARRAY *epa;
+
+    if ( ring[i] < r->ring_id ) r->ring_id = ring[i];
+    if ( i == 0 ) r->face = face;
+    else if ( face != r->face ) r->mixed = 1;
+    /* Edges walked on both sides are dangling */
+    if ( ve->walk[0] != v->walk_serial || ve->walk[1] != v->walk_serial )
+      dangling = 0;
+
+    if ( ve->empty ) continue;
+    epa = ve->edge->geom->points;
+    for ( k=0; k<epa->npoints; ++k )
+    {
+      POINT4D p;
+      getPoint4d_p(epa, ring[i] > 0 ? k : epa->npoints - 1 - k, &p);
+      if ( k == 0 && r->pa->npoints &&
+           p2d_same(getPoint2d_cp(r->pa, r->pa->npoints - 1), (POINT2D *)&p) )
+        continue;
+      ptarray_append_point(r->pa, &p, LW_TRUE);
+    }
+  }
+
+  r->closed = r->pa->npoints && p2d_same(getPoint2d_cp(r->pa, 0),
+                                 getPoint2d_cp(r->pa, r->pa->npoints - 1));
+  r->shell = r->closed && ! dangling && r->pa->npoints > 3 &&
+             ptarray_signed_area(r->pa) < 0;
+}
+
+/*
+ * Find the shells of the given faces, walking the rings on the sides
+ * of the edges advertising them. Faces already known are skipped.
+ * When a face has multiple shells, the one with the smallest ring
+ * identifier is kept.
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorLoadFaces(LWT_VALIDATOR *v, const LWT_ELEMID *faceids, uint64_t num)
+{
+  LWT_ELEMID *ids;
+  LWT_ISO_EDGE *edges;
+  uint64_t i, n = 0, nedges;
+  int side;
+
+  ids = lwalloc(sizeof(LWT_ELEMID) * (num ? num : 1));
+  for ( i=0; i<num; ++i )
+  {
+    LWT_VALIDATOR_FACE *vf;
+    if ( faceids[i] == 0 ) continue; /* universe has no shell */
+    if ( _lwt_ValidatorGetFace(v, faceids[i]) ) continue;
+    LWT_VALIDATOR_GROW(v->faces, v->nfaces, v->maxfaces);
+    vf = &(v->faces[v->nfaces]);
+    memset(vf, 0, sizeof(LWT_VALIDATOR_FACE));
+    vf->face_id = faceids[i];
+    vf->loading = 1;
+    _lwt_ElemidMapPut(&v->facemap, faceids[i], v->nfaces++);
+    ids[n++] = faceids[i];
+  }
+  if ( ! n )
+  {
+    lwfree(ids);
+    return 0;
+  }
+
+  nedges = n;
+  edges = lwt_be_getEdgeByFace(v->topo, ids, &nedges, LWT_COL_EDGE_ALL, NULL);
+  lwfree(ids);
+  if ( nedges == UINT64_MAX )
+  {
+    lwerror("Backend error: %s", lwt_be_lastErrorMessage(v->topo->be_iface));
+    return -1;
+  }
+  _lwt_ValidatorAddEdges(v, edges, nedges, 0);
+
+  for ( i=0; i<nedges; ++i )
+  {
+    for ( side=0; side<2; ++side )
+    {
+      LWT_ELEMID sedge = side ? -edges[i].edge_id : edges[i].edge_id;
+      LWT_ELEMID face = side ? edges[i].face_right : edges[i].face_left;
+      LWT_VALIDATOR_FACE *vf = _lwt_ValidatorGetFace(v, face);
+      LWT_VALIDATOR_EDGE *ve;
+      LWT_VALIDATOR_RING r;
+      LWT_ELEMID *ring;
+      int64_t nring, j;
+
+      if ( ! vf || ! vf->loading ) continue;
+      vf->has_edges = 1;
+
+      ve = _lwt_ValidatorGetEdge(v, edges[i].edge_id);
+      if ( ve->shell_walked & (1 << side) ) continue;
+
+      nring = _lwt_ValidatorWalkRing(v, sedge, &ring);
+      if ( nring == -1 ) return -1;
+      _lwt_ValidatorAnalyzeRing(v, ring, nring, &r);
+      for ( j=0; j<nring; ++j )
+      {
+        ve = _lwt_ValidatorGetEdge(v, llabs(ring[j]));
+        ve->shell_walked |= ring[j] > 0 ? 1 : 2;
+      }
+      lwfree(ring);
+
+      /* the face array may have been reallocated by the walk */
+      vf = _lwt_ValidatorGetFace(v, face);
+      if ( r.shell && ! r.mixed && ( ! vf->ring_id || r.ring_id < vf->ring_id ) )
+      {
+        if ( vf->shell ) ptarray_free(vf->shell);
+        vf->shell = r.pa;
+        vf->ring_id = r.ring_id;
+        ptarray_calculate_gbox_cartesian(r.pa, &(vf->box));
+        vf->area = -ptarray_signed_area(r.pa);
+      }
+      else ptarray_free(r.pa);
+    }
+  }
+
+  for ( i=0; i<v->nfaces; ++i ) v->faces[i].loading = 0;
+
+  return 0;
+}
+
+/*
+ * Find the face with the smallest shell containing the given point
+ * in its interior and the given box in its bounding box, as the SQL
+ * ValidateTopology does for holes. Sets *face to 0 if none is found.
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorFaceContaining(LWT_VALIDATOR *v, const GBOX *box,
+                             const POINT2D *pt, LWT_ELEMID *face)
+{
+  LWT_ISO_FACE *faces;
+  LWT_ELEMID *ids;
+  const LWT_VALIDATOR_FACE *best = NULL;
+  uint64_t i, num, n = 0;
+
+  faces = lwt_be_getFaceWithinBox2D(v->topo, box, &num, LWT_COL_FACE_ALL, 0);
+  if ( num == UINT64_MAX )
+  {
+    lwerror("Backend error: %s", lwt_be_lastErrorMessage(v->topo->be_iface));
+    return -1;
+  }
+  ids = lwalloc(sizeof(LWT_ELEMID) * (num ? num : 1));
+  for ( i=0; i<num; ++i )
+  {
+    if ( faces[i].mbr && gbox_contains_2d(faces[i].mbr, box) )
+      ids[n++] = faces[i].face_id;
+  }
+  if ( faces ) _lwt_release_faces(faces, num);
+
+  if ( _lwt_ValidatorLoadFaces(v, ids, n) == -1 )
+  {
+    lwfree(ids);
+    return -1;
+  }
+
+  for ( i=0; i<n; ++i )
+  {
+    const LWT_VALIDATOR_FACE *vf = _lwt_ValidatorGetFace(v, ids[i]);
+    if ( ! vf || ! vf->shell ) continue;
+    if ( ! gbox_contains_2d(&(vf->box), box) ) continue;
+    if ( ptarray_contains_point(vf->shell, pt) != LW_INSIDE ) continue;
+    if ( ! best || vf->area < best->area ) best = vf;
+  }
+  lwfree(ids);
+
+  *face = best ? best->face_id : 0;
+  return 0;
+}
+
+/*
+ * Load nodes, edges and faces found in the partition box
+ * and mark the nodes owned by the partition.
+ */
+static int
+_lwt_ValidatorLoad(LWT_VALIDATOR *v)
+{
+  LWT_ISO_NODE *nodes;
+  LWT_ISO_EDGE *edges;
+  LWT_ISO_FACE *faces;
+  uint64_t i, num, n;
+  GBOX qbox;
+
+  if ( v->partition ) qbox = *(v->partition);
+  else
+  {
+    qbox.xmin = qbox.ymin = -DBL_MAX;
+    qbox.xmax = qbox.ymax = DBL_MAX;
+  }
+
+  nodes = lwt_be_getNodeWithinBox2D(v->topo, &qbox, &num, LWT_COL_NODE_ALL, 0);
+  if ( num == UINT64_MAX )
+  {
+    lwerror("Backend error: %s", lwt_be_lastErrorMessage(v->topo->be_iface));
+    return -1;
+  }
+  _lwt_ValidatorAddNodes(v, nodes, num);
+  for ( i=0; i<v->nnodes; ++i )
+  {
+    LWT_VALIDATOR_NODE *vn = &(v->nodes[i]);
+    if ( vn->node->geom && ! lwpoint_is_empty(vn->node->geom) &&
+         _lwt_ValidatorOwns(v, getPoint2d_cp(vn->node->geom->point, 0)) )
+      vn->owned = 1;
+  }
+
+  edges = lwt_be_getEdgeWithinBox2D(v->topo, &qbox, &num, LWT_COL_EDGE_ALL, 0);
+  if ( num == UINT64_MAX )
+  {
+    lwerror("Backend error: %s", lwt_be_lastErrorMessage(v->topo->be_iface));
+    return -1;
+  }
+  _lwt_ValidatorAddEdges(v, edges, num, 1);
+
+  faces = lwt_be_getFaceWithinBox2D(v->topo, &qbox, &num, LWT_COL_FACE_ALL, 0);
+  if ( num == UINT64_MAX )
+  {
+    lwerror("Backend error: %s", lwt_be_lastErrorMessage(v->topo->be_iface));
+    return -1;
+  }
+  /* Keep the faces whose mbr lower left corner is in the partition */
+  for ( i=0, n=0; i<num; ++i )
+  {
+    POINT2D p;
+    if ( faces[i].face_id == 0 || ! faces[i].mbr ) continue;
+    p.x = faces[i].mbr->xmin;
+    p.y = faces[i].mbr->ymin;
+    if ( ! _lwt_ValidatorOwns(v, &p) ) continue;
+    if ( n != i )
+    {
+      LWT_ISO_FACE tmp = faces[n];
+      faces[n] = faces[i];
+      faces[i] = tmp;
+    }
+    ++n;
+  }
+  if ( n < num )
+  {
+    /* release the mbr of the faces we don't own */
+    for ( i=n; i<num; ++i )
+      if ( faces[i].mbr ) lwfree(faces[i].mbr);
+  }
+  v->owned_faces = faces;
+  v->nowned_faces = n;
+
+  return 0;
+}
+
+static int
+compare_validator_nodes_by_point(const void *si1, const void *si2)
+{
+  const LWT_ISO_NODE *a = *(LWT_ISO_NODE * const *)si1;
+  const LWT_ISO_NODE *b = *(LWT_ISO_NODE * const *)si2;
+  const POINT2D *pa = getPoint2d_cp(a->geom->point, 0);
+  const POINT2D *pb = getPoint2d_cp(b->geom->point, 0);
+  if ( pa->x != pb->x ) return pa->x < pb->x ? -1 : 1;
+  if ( pa->y != pb->y ) return pa->y < pb->y ? -1 : 1;
+  if ( a->node_id != b->node_id ) return a->node_id < b->node_id ? -1 : 1;
+  return 0;
+}
+
+/*
+ * Check for coincident nodes and for nodes in the interior of edges.
+ *
+ * Nodes are sorted by x and the edges found in the partition box are
+ * matched against the nodes falling in their x range.
+ */
+static void
+_lwt_ValidatorCheckNodes(LWT_VALIDATOR *v)
+{
+  LWT_ISO_NODE **nodes;
+  uint32_t i, j, n = 0, from;
+
+  nodes = lwalloc(sizeof(LWT_ISO_NODE *) * (v->nnodes ? v->nnodes : 1));
+  for ( i=0; i<v->nnodes; ++i )
+  {
+    if ( v->nodes[i].owned ) nodes[n++] = v->nodes[i].node;
+  }
+  qsort(nodes, n, sizeof(LWT_ISO_NODE *), compare_validator_nodes_by_point);
+
+  from = v->nerrors;
+  for ( i=0; i<n; ++i )
+  {
+    const POINT2D *p = getPoint2d_cp(nodes[i]->geom->point, 0);
+    for ( j=i+1; j<n; ++j )
+    {
+      const POINT2D *q = getPoint2d_cp(nodes[j]->geom->point, 0);
+      if ( ! p2d_same(p, q) ) break;
+      _lwt_ValidatorError(v, "coincident nodes",
+                          FP_MIN(nodes[i]->node_id, nodes[j]->node_id),
+                          FP_MAX(nodes[i]->node_id, nodes[j]->node_id));
+    }
+  }
+  _lwt_ValidatorSortErrors(v, from);
+
+  from = v->nerrors;
+  for ( i=0; i<v->nedges; ++i )
+  {
+    const LWT_VALIDATOR_EDGE *ve = &(v->edges[i]);
+    const POINTARRAY *pa;
+    int closed;
+    uint32_t lo = 0, hi = n;
+
+    if ( ! ve->in_partition || ve->empty ) continue;
+    pa = ve->edge->geom->points;
+    closed = ptarray_is_closed_2d(pa);
+
+    /* first node with x >= box xmin */
+    while ( lo < hi )
+    {
+      uint32_t mid = lo + ( hi - lo ) / 2;
+      if ( getPoint2d_cp(nodes[mid]->geom->point, 0)->x < ve->box.xmin ) lo = mid + 1;
+      else hi = mid;
+    }
+    for ( j=lo; j<n; ++j )
+    {
+      const LWT_ISO_NODE *node = nodes[j];
+      const POINT2D *p = getPoint2d_cp(node->geom->point, 0);
+      if ( p->x > ve->box.xmax ) break;
+      if ( p->y < ve->box.ymin || p->y > ve->box.ymax ) continue;
+      if ( node->node_id == ve->edge->start_node ) continue;
+      if ( node->node_id == ve->edge->end_node ) continue;
+      if ( ptarray_contains_point_partial(pa, p, LW_FALSE, NULL) != LW_BOUNDARY )
+        continue;
+      /* The endpoints of open lines are on their boundary */
+      if ( ! closed && ( p2d_same(p, getPoint2d_cp(pa, 0)) ||
+                         p2d_same(p, getPoint2d_cp(pa, pa->npoints - 1)) ) )
+        continue;
+      _lwt_ValidatorError(v, "edge crosses node", ve->edge->edge_id, node->node_id);
+    }
+  }
+  _lwt_ValidatorSortErrors(v, from);
+
+  lwfree(nodes);
+}
+
+/* A valid line has finite coordinates and two distinct points */
+static int
+_lwt_ValidatorEdgeIsValid(const LWT_VALIDATOR_EDGE *ve)
+{
+  const POINTARRAY *pa;
+  const POINT2D *first;
+  uint32_t i;
+  int distinct = 0;
+
+  if ( ve->empty ) return 0;
+  pa = ve->edge->geom->points;
+  first = getPoint2d_cp(pa, 0);
+  for ( i=0; i<pa->npoints; ++i )
+  {
+    const POINT2D *p = getPoint2d_cp(pa, i);
+    if ( ! isfinite(p->x) || ! isfinite(p->y) ) return 0;
+    if ( ! p2d_same(p, first) ) distinct = 1;
+  }
+  return distinct;
+}
+
+static int
+_lwt_ValidatorEdgeIsOwned(const LWT_VALIDATOR *v, const LWT_VALIDATOR_EDGE *ve)
+{
+  return ve->in_partition && ! ve->empty &&
+         _lwt_ValidatorOwns(v, getPoint2d_cp(ve->edge->geom->points, 0));
+}
+
+/*
+ * Check for invalid and not simple edges
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorCheckEdges(LWT_VALIDATOR *v)
+{
+  uint32_t i, from = v->nerrors;
+
+  for ( i=0; i<v->nedges; ++i )
+  {
+    LWT_VALIDATOR_EDGE *ve = &(v->edges[i]);
+    int simple;
+
+    if ( ! ve->in_partition ) continue;
+
+    /* Invalid edges found in the box are excluded from the
+     * crossing check even when owned by another partition */
+    ve->invalid = ! _lwt_ValidatorEdgeIsValid(ve);
+    if ( ! _lwt_ValidatorEdgeIsOwned(v, ve) ) continue;
+
+    if ( ve->invalid )
+    {
+      _lwt_ValidatorError(v, "invalid edge", ve->edge->edge_id, 0);
+      continue;
+    }
+
+    simple = lwgeom_is_simple(lwline_as_lwgeom(ve->edge->geom));
+    if ( simple == -1 ) return -1;
+    if ( ! simple )
+      _lwt_ValidatorError(v, "edge not simple", ve->edge->edge_id, 0);
+  }
+  _lwt_ValidatorSortErrors(v, from);
+
+  return 0;
+}
+
+static GEOSGeometry *
+_lwt_ValidatorEdgeGEOS(LWT_VALIDATOR_EDGE *ve)
+{
+  if ( ! ve->gg )
+  {
+    ve->gg = LWGEOM2GEOS(lwline_as_lwgeom(ve->edge->geom), 0);
+    if ( ! ve->gg )
+      lwerror("Could not convert edge geometry to GEOS: %s", lwgeom_geos_errmsg);
+  }
+  return ve->gg;
+}
+
+/*
+ * Return 1 if the intersection of the given geometries is the given
+ * point, 0 if not, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorIntersectionIsPoint(const GEOSGeometry *g1,
+                                  const GEOSGeometry *g2, const POINT2D *p)
+{
+  GEOSGeometry *gi;
+  LWGEOM *i;
+  int ret;
+
+  gi = GEOSIntersection(g1, g2);
+  if ( ! gi )
+  {
+    lwerror("GEOSIntersection error: %s", lwgeom_geos_errmsg);
+    return -1;
+  }
+  i = GEOS2LWGEOM(gi, 0);
+  GEOSGeom_destroy(gi);
+  if ( ! i )
+  {
+    lwerror("Could not convert intersection from GEOS");
+    return -1;
+  }
+  ret = i->type == POINTTYPE && ! lwgeom_is_empty(i) &&
+        p2d_same(getPoint2d_cp(lwgeom_as_lwpoint(i)->point, 0), p);
+  lwgeom_free(i);
+  return ret;
+}
+
+/*
+ * Return 1 if the edges have an interior intersection not allowed
+ * in a topology, 0 if not, -1 on error (lwerror is invoked).
+ * Follows the exceptions made by the SQL ValidateTopology for
+ * endpoints of closed edges, e1 is the edge with smaller identifier.
+ */
+static int
+_lwt_ValidatorEdgesCross(LWT_VALIDATOR_EDGE *e1, LWT_VALIDATOR_EDGE *e2)
+{
+  const GEOSGeometry *g1, *g2;
+  const POINT2D *s1, *s2;
+  char *im;
+  int ret = 1;
+
+  g1 = _lwt_ValidatorEdgeGEOS(e1);
+  if ( ! g1 ) return -1;
+  g2 = _lwt_ValidatorEdgeGEOS(e2);
+  if ( ! g2 ) return -1;
+
+  im = GEOSRelate(g1, g2);
+  if ( ! im )
+  {
+    lwerror("GEOSRelate error: %s", lwgeom_geos_errmsg);
+    return -1;
+  }
+
+  s1 = getPoint2d_cp(e1->edge->geom->points, 0);
+  s2 = getPoint2d_cp(e2->edge->geom->points, 0);
+
+  if ( GEOSRelatePatternMatch(im, "FF1F**1*2") )
+  {
+    /* no interior intersection */
+    ret = 0;
+  }
+  else if ( GEOSRelatePatternMatch(im, "FF10F01F2") )
+  {
+    /* first line is open, second is closed, intersection must be
+     * the second endpoint (closed lines have no boundary) */
+    ret = _lwt_ValidatorIntersectionIsPoint(g2, g1, s2);
+    if ( ret != -1 ) ret = ! ret;
+  }
+  else if ( GEOSRelatePatternMatch(im, "F01FFF102") )
+  {
+    /* second line is open, first is closed */
+    ret = _lwt_ValidatorIntersectionIsPoint(g2, g1, s1);
+    if ( ret != -1 ) ret = ! ret;
+  }
+  else if ( GEOSRelatePatternMatch(im, "0F1FFF1F2") )
+  {
+    /* both lines are closed, they must only share their endpoint */
+    ret = _lwt_ValidatorIntersectionIsPoint(g1, g2, s1);
+    if ( ret != -1 ) ret = ! ( ret && p2d_same(s1, s2) );
+  }
+
+  GEOSFree(im);
+  return ret;
+}
+
+static int
+compare_validator_edges_by_xmin(const void *si1, const void *si2)
+{
+  const LWT_VALIDATOR_EDGE *a = *(LWT_VALIDATOR_EDGE * const *)si1;
+  const LWT_VALIDATOR_EDGE *b = *(LWT_VALIDATOR_EDGE * const *)si2;
+  if ( a->box.xmin != b->box.xmin ) return a->box.xmin < b->box.xmin ? -1 : 1;
+  return 0;
+}
+
+/*
+ * Check for crossing edges, sweeping the edges found in the partition
+ * box by x. A pair is checked by the partition owning the lower left
+ * corner of the intersection of the edge boxes, which both edges
+ * always reach.
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorCheckCrossings(LWT_VALIDATOR *v)
+{
+  LWT_VALIDATOR_EDGE **edges;
+  uint32_t i, j, n = 0, from = v->nerrors;
+
+  edges = lwalloc(sizeof(LWT_VALIDATOR_EDGE *) * (v->nedges ? v->nedges : 1));
+  for ( i=0; i<v->nedges; ++i )
+  {
+    LWT_VALIDATOR_EDGE *ve = &(v->edges[i]);
+    if ( ve->in_partition && ! ve->invalid ) edges[n++] = ve;
+  }
+  qsort(edges, n, sizeof(LWT_VALIDATOR_EDGE *), compare_validator_edges_by_xmin);
+
+  for ( i=0; i<n; ++i )
+  {
+    LWT_VALIDATOR_EDGE *a = edges[i];
+    for ( j=i+1; j<n; ++j )
+    {
+      LWT_VALIDATOR_EDGE *b = edges[j];
+      POINT2D corner;
+      int crosses;
+
+      if ( b->box.xmin > a->box.xmax ) break;
+      if ( b->box.ymin > a->box.ymax || b->box.ymax < a->box.ymin ) continue;
+
+      corner.x = FP_MAX(a->box.xmin, b->box.xmin);
+      corner.y = FP_MAX(a->box.ymin, b->box.ymin);
+      if ( ! _lwt_ValidatorOwns(v, &corner) ) continue;
+
+      if ( a->edge->edge_id < b->edge->edge_id )
+        crosses = _lwt_ValidatorEdgesCross(a, b);
+      else
+        crosses = _lwt_ValidatorEdgesCross(b, a);
+      if ( crosses == -1 )
+      {
+        lwfree(edges);
+        return -1;
+      }
+      if ( crosses )
+        _lwt_ValidatorError(v, "edge crosses edge",
+                            FP_MIN(a->edge->edge_id, b->edge->edge_id),
+                            FP_MAX(a->edge->edge_id, b->edge->edge_id));
+    }
+  }
+  lwfree(edges);
+  _lwt_ValidatorSortErrors(v, from);
+
+  return 0;
+}
+
+/*
+ * Check that the edge endpoints match the geometry of their nodes,
+ * fetching the nodes not found in the partition box
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorCheckEdgeNodes(LWT_VALIDATOR *v)
+{
+  LWT_ELEMID *ids;
+  LWT_ISO_NODE *nodes;
+  uint64_t num = 0;
+  uint32_t i, from;
+  int end;
+
+  ids = lwalloc(sizeof(LWT_ELEMID) * ( v->nedges ? v->nedges * 2 : 1 ));
+  for ( i=0; i<v->nedges; ++i )
+  {
+    const LWT_VALIDATOR_EDGE *ve = &(v->edges[i]);
+    if ( ! _lwt_ValidatorEdgeIsOwned(v, ve) ) continue;
+    if ( ! _lwt_ValidatorGetNode(v, ve->edge->start_node) )
+      ids[num++] = ve->edge->start_node;
+    if ( ! _lwt_ValidatorGetNode(v, ve->edge->end_node) )
+      ids[num++] = ve->edge->end_node;
+  }
+  if ( num )
+  {
+    nodes = lwt_be_getNodeById(v->topo, ids, &num, LWT_COL_NODE_ALL);
+    if ( num == UINT64_MAX )
+    {
+      lwfree(ids);
+      lwerror("Backend error: %s", lwt_be_lastErrorMessage(v->topo->be_iface));
+      return -1;
+    }
+    _lwt_ValidatorAddNodes(v, nodes, num);
+  }
+  lwfree(ids);
+
+  for ( end=0; end<2; ++end )
+  {
+    from = v->nerrors;
+    for ( i=0; i<v->nedges; ++i )
+    {
+      const LWT_VALIDATOR_EDGE *ve = &(v->edges[i]);
+      const LWT_VALIDATOR_NODE *vn;
+      const POINTARRAY *pa;
+
+      if ( ! _lwt_ValidatorEdgeIsOwned(v, ve) ) continue;
+      vn = _lwt_ValidatorGetNode(v, end ? ve->edge->end_node : ve->edge->start_node);
+      if ( ! vn || ! vn->node->geom || lwpoint_is_empty(vn->node->geom) ) continue;
+      pa = ve->edge->geom->points;
+      if ( p2d_same(getPoint2d_cp(vn->node->geom->point, 0),
+                    getPoint2d_cp(pa, end ? pa->npoints - 1 : 0)) )
+        continue;
+      _lwt_ValidatorError(v, end ? "edge end node geometry mis-match" :
+                                   "edge start node geometry mis-match",
+                          ve->edge->edge_id, vn->node->node_id);
+    }
+    _lwt_ValidatorSortErrors(v, from);
+  }
+
+  return 0;
+}
+
+/*
+ * Check for faces without edges, loading the shells of owned faces
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorCheckFaceEdges(LWT_VALIDATOR *v)
+{
+  LWT_ELEMID *ids;
+  uint64_t i;
+  uint32_t from = v->nerrors;
+
+  ids = lwalloc(sizeof(LWT_ELEMID) * ( v->nowned_faces ? v->nowned_faces : 1 ));
+  for ( i=0; i<v->nowned_faces; ++i ) ids[i] = v->owned_faces[i].face_id;
+  if ( _lwt_ValidatorLoadFaces(v, ids, v->nowned_faces) == -1 )
+  {
+    lwfree(ids);
+    return -1;
+  }
+  lwfree(ids);
+
+  for ( i=0; i<v->nowned_faces; ++i )
+  {
+    const LWT_VALIDATOR_FACE *vf = _lwt_ValidatorGetFace(v, v->owned_faces[i].face_id);
+    if ( ! vf->has_edges )
+      _lwt_ValidatorError(v, "face without edges", vf->face_id, 0);
+  }
+  _lwt_ValidatorSortErrors(v, from);
+
+  return 0;
+}
+
+static int
+compare_validator_edgeends(const void *si1, const void *si2)
+{
+  const LWT_VALIDATOR_EDGEEND *a = si1;
+  const LWT_VALIDATOR_EDGEEND *b = si2;
+  if ( a->node != b->node ) return a->node < b->node ? -1 : 1;
+  /* edges without an azimuth go last, as NULLs would */
+  if ( a->has_az != b->has_az ) return a->has_az ? -1 : 1;
+  if ( a->has_az && a->az != b->az ) return a->az < b->az ? -1 : 1;
+  if ( a->edge != b->edge ) return a->edge < b->edge ? -1 : 1;
+  return 0;
+}
+
+/*
+ * Check edge linking around the owned nodes, which are also marked
+ * as isolated or not.
+ *
+ * The star of edges around each node is sorted by azimuth, each
+ * edge end must then link to the following one on its side.
+ *
+ * @return number of linking errors found, or -1 on error
+ *         (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorCheckLinking(LWT_VALIDATOR *v)
+{
+  LWT_ELEMID *ids;
+  LWT_ISO_EDGE *edges;
+  LWT_VALIDATOR_EDGEEND *ends;
+  uint64_t i, j, num = 0, nends = 0;
+  uint32_t from = v->nerrors;
+
+  ids = lwalloc(sizeof(LWT_ELEMID) * ( v->nnodes ? v->nnodes : 1 ));
+  for ( i=0; i<v->nnodes; ++i )
+  {
+    if ( v->nodes[i].owned ) ids[num++] = v->nodes[i].node->node_id;
+  }
+  if ( ! num )
+  {
+    lwfree(ids);
+    return 0;
+  }
+  edges = lwt_be_getEdgeByNode(v->topo, ids, &num, LWT_COL_EDGE_ALL);
+  lwfree(ids);
+  if ( num == UINT64_MAX )
+  {
+    lwerror("Backend error: %s", lwt_be_lastErrorMessage(v->topo->be_iface));
+    return -1;
+  }
+  _lwt_ValidatorAddEdges(v, edges, num, 0);
+
+  ends = lwalloc(sizeof(LWT_VALIDATOR_EDGEEND) * ( num ? num * 2 : 1 ));
+  for ( i=0; i<num; ++i )
+  {
+    const LWT_ISO_EDGE *e = &(edges[i]);
+    int end;
+
+    for ( end=0; end<2; ++end )
+    {
+      LWT_ELEMID node = end ? e->end_node : e->start_node;
+      LWT_VALIDATOR_NODE *vn = _lwt_ValidatorGetNode(v, node);
+      LWT_VALIDATOR_EDGEEND *ee;
+      const POINTARRAY *pa;
+      POINT2D p0, p1;
+
+      if ( ! vn || ! vn->owned ) continue;
+      vn->incident = 1;
+      /* only nodes advertised as not isolated are checked */
+      if ( vn->node->containing_face != -1 ) continue;
+
+      ee = &(ends[nends++]);
+      ee->node = node;
+      ee->edge = end ? -e->edge_id : e->edge_id;
+      ee->next_left = e->next_left;
+      ee->next_right = e->next_right;
+      ee->has_az = 0;
+      if ( ! e->geom || ! e->geom->points->npoints ) continue;
+      pa = e->geom->points;
+      getPoint2d_p(pa, end ? pa->npoints - 1 : 0, &p0);
+      if ( _lwt_FirstDistinctVertex2D(pa, &p0, end ? pa->npoints - 1 : 0,
+                                      end ? -1 : 1, &p1) )
+        ee->has_az = azimuth_pt_pt(&p0, &p1, &(ee->az));
+    }
+  }
+  qsort(ends, nends, sizeof(LWT_VALIDATOR_EDGEEND), compare_validator_edgeends);
+
+  for ( i=0; i<nends; i=j )
+  {
+    uint64_t k;
+    for ( j=i+1; j<nends && ends[j].node == ends[i].node; ++j ) {}
+    for ( k=i; k<j; ++k )
+    {
+      const LWT_VALIDATOR_EDGEEND *prev = &(ends[k]);
+      const LWT_VALIDATOR_EDGEEND *cur = &(ends[k+1 < j ? k+1 : i]);
+      if ( prev->edge > 0 )
+      {
+        /* previous was outgoing, this one should be next-right */
+        if ( prev->next_right != cur->edge )
+          _lwt_ValidatorError(v, "invalid next_right_edge",
+                              llabs(prev->edge), cur->edge);
+      }
+      else
+      {
+        /* previous was incoming, this one should be next-left */
+        if ( prev->next_left != cur->edge )
+          _lwt_ValidatorError(v, "invalid next_left_edge",
+                              llabs(prev->edge), cur->edge);
+      }
+    }
+  }
+  lwfree(ends);
+  _lwt_ValidatorSortErrors(v, from);
+
+  return v->nerrors - from;
+}
+
+/*
+ * Walk the rings on both sides of the edges starting in the partition
+ * and check those whose identifying edge side starts in it.
+ *
+ * @return number of ring errors found, or -1 on error
+ *         (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorCheckRings(LWT_VALIDATOR *v)
+{
+  uint32_t i, nedges = v->nedges, from = v->nerrors;
+  int side;
+
+  for ( i=0; i<nedges; ++i )
+  {
+    for ( side=0; side<2; ++side )
+    {
+      LWT_VALIDATOR_EDGE *ve = &(v->edges[i]);
+      LWT_ELEMID sedge = side ? -ve->edge->edge_id : ve->edge->edge_id;
+      LWT_VALIDATOR_RING r;
+      LWT_ELEMID *ring;
+      int64_t nring, j;
+      POINT2D p;
+
+      if ( ! ve->in_partition || ( ve->ring_walked & (1 << side) ) ) continue;
+      if ( ! _lwt_ValidatorSideStart(ve, sedge, &p) ) continue;
+      if ( ! _lwt_ValidatorOwns(v, &p) ) continue;
+
+      nring = _lwt_ValidatorWalkRing(v, sedge, &ring);
+      if ( nring == -1 ) return -1;
+      for ( j=0; j<nring; ++j )
+      {
+        ve = _lwt_ValidatorGetEdge(v, llabs(ring[j]));
+        ve->ring_walked |= ring[j] > 0 ? 1 : 2;
+      }
+      r.ring_id = ring[0];
+      for ( j=1; j<nring; ++j ) if ( ring[j] < r.ring_id ) r.ring_id = ring[j];
+
+      /* The ring is checked by the partition where its
+       * identifying edge side starts */
+      ve = _lwt_ValidatorGetEdge(v, llabs(r.ring_id));
+      if ( ! _lwt_ValidatorSideStart(ve, r.ring_id, &p) ||
+           ! _lwt_ValidatorOwns(v, &p) )
+      {
+        lwfree(ring);
+        continue;
+      }
+
+      /* A walk not closing on its start may have a tail, walk
+       * again from the identifying side to get the same ring
+       * in all partitions */
+      if ( r.ring_id != sedge )
+      {
+        LWT_VALIDATOR_EDGE *last = _lwt_ValidatorGetEdge(v, llabs(ring[nring-1]));
+        LWT_ELEMID next = ring[nring-1] < 0 ? last->edge->next_right : last->edge->next_left;
+        if ( next != sedge )
+        {
+          lwfree(ring);
+          nring = _lwt_ValidatorWalkRing(v, r.ring_id, &ring);
+          if ( nring == -1 ) return -1;
+        }
+      }
+
+      _lwt_ValidatorAnalyzeRing(v, ring, nring, &r);
+      lwfree(ring);
+
+      if ( r.mixed )
+      {
+        _lwt_ValidatorError(v, "mixed face labeling in ring", r.ring_id, 0);
+      }
+      else if ( ! r.closed )
+      {
+        _lwt_ValidatorError(v, "non-closed ring", r.ring_id, 0);
+      }
+      else if ( r.shell )
+      {
+        /* The face keeps the shell with the smallest identifier */
+        if ( r.face != 0 )
+        {
+          const LWT_VALIDATOR_FACE *vf;
+          if ( _lwt_ValidatorLoadFaces(v, &(r.face), 1) == -1 )
+          {
+            ptarray_free(r.pa);
+            return -1;
+          }
+          vf = _lwt_ValidatorGetFace(v, r.face);
+          if ( vf->ring_id != r.ring_id )
+            _lwt_ValidatorError(v, "face has multiple shells", r.face, r.ring_id);
+        }
+      }
+      else
+      {
+        LWT_VALIDATOR_HOLE *h;
+        LWT_VALIDATOR_GROW(v->holes, v->nholes, v->maxholes);
+        h = &(v->holes[v->nholes++]);
+        h->ring_id = r.ring_id;
+        h->face = r.face;
+        ptarray_calculate_gbox_cartesian(r.pa, &(h->box));
+        getPoint2d_p(r.pa, 0, &(h->pt));
+      }
+      ptarray_free(r.pa);
+    }
+  }
+  _lwt_ValidatorSortErrors(v, from);
+
+  return v->nerrors - from;
+}
+
+/*
+ * Check the shells and mbr of the owned faces, the faces containing
+ * the holes found by the ring check and the containing face of
+ * the owned nodes.
+ *
+ * @return 0 on success, -1 on error (lwerror is invoked)
+ */
+static int
+_lwt_ValidatorCheckFaces(LWT_VALIDATOR *v)
+{
+  uint64_t i;
+  uint32_t from = v->nerrors;
+
+  for ( i=0; i<v->nowned_faces; ++i )
+  {
+    const LWT_ISO_FACE *face = &(v->owned_faces[i]);
+    const LWT_VALIDATOR_FACE *vf = _lwt_ValidatorGetFace(v, face->face_id);
+
+    if ( ! vf->shell )
+    {
+      /* faces without edges were reported already */
+      if ( vf->has_edges )
+        _lwt_ValidatorError(v, "face has no rings", face->face_id, 0);
+      continue;
+    }
+    if ( vf->box.xmin != face->mbr->xmin || vf->box.ymin != face->mbr->ymin ||
+         vf->box.xmax != face->mbr->xmax || vf->box.ymax != face->mbr->ymax )
+      _lwt_ValidatorError(v, "face has wrong mbr", face->face_id, 0);
+  }
+  _lwt_ValidatorSortErrors(v, from);
+
+  from = v->nerrors;
+  for ( i=0; i<v->nholes; ++i )
+  {
+    LWT_VALIDATOR_HOLE *h = &(v->holes[i]);
+    LWT_ELEMID face;
+    if ( _lwt_ValidatorFaceContaining(v, &(h->box), &(h->pt), &face) == -1 )
+      return -1;
+    if ( face != h->face )
+      _lwt_ValidatorError(v, "hole not in advertised face", h->ring_id, 0);
+  }
+  _lwt_ValidatorSortErrors(v, from);
+
+  from = v->nerrors;
+  for ( i=0; i<v->nnodes; ++i )
+  {
+    const LWT_VALIDATOR_NODE *vn = &(v->nodes[i]);
+    const POINT2D *p;
+    LWT_ELEMID face;
+    GBOX box;
+
+    if ( ! vn->owned ) continue;
+    if ( vn->incident )
+    {
+      if ( vn->node->containing_face != -1 )
+        _lwt_ValidatorError(v, "not-isolated node has not-null containing_face",
+                            vn->node->node_id, 0);
+      continue;
+    }
+    if ( vn->node->containing_face == -1 )
+    {
+      _lwt_ValidatorError(v, "isolated node has null containing_face",
+                          vn->node->node_id, 0);
+      continue;
+    }
+    p = getPoint2d_cp(vn->node->geom->point, 0);
+    box.flags = 0;
+    box.xmin = box.xmax = p->x;
+    box.ymin = box.ymax = p->y;
+    if ( _lwt_ValidatorFaceContaining(v, &box, p, &face) == -1 )
+      return -1;
+    if ( face != vn->node->containing_face )
+      _lwt_ValidatorError(v, "isolated node has wrong containing_face",
+                          vn->node->node_id, 0);
+  }
+  _lwt_ValidatorSortErrors(v, from);
+
+  return 0;
+}
+
+static int
+_lwt_ValidatorRun(LWT_VALIDATOR *v)
+{
+  int ret;
+
+  if ( _lwt_ValidatorLoad(v) == -1 ) return -1;
+
+  LWDEBUGF(1, "Validating %u nodes, %u edges, %" PRIu64 " faces",
+           v->nnodes, v->nedges, v->nowned_faces);
+
+  _lwt_ValidatorCheckNodes(v);
+  if ( _lwt_ValidatorCheckEdges(v) == -1 ) return -1;
+  if ( _lwt_ValidatorCheckCrossings(v) == -1 ) return -1;
+  if ( _lwt_ValidatorCheckEdgeNodes(v) == -1 ) return -1;
+  if ( _lwt_ValidatorCheckFaceEdges(v) == -1 ) return -1;
+
+  /* Ring and face checks make no sense with broken linking */
+  ret = _lwt_ValidatorCheckLinking(v);
+  if ( ret ) return ret == -1 ? -1 : 0;
+
+  ret = _lwt_ValidatorCheckRings(v);
+  if ( ret ) return ret == -1 ? -1 : 0;
+
+  return _lwt_ValidatorCheckFaces(v);
+}
+
+int
+lwt_ValidateTopology(LWT_TOPOLOGY *topo, const GBOX *partition,
+                     LWT_VALIDATION_ERROR **errors)
+{
+  LWT_VALIDATOR v;
+  int ret;
+
+  memset(&v, 0, sizeof(LWT_VALIDATOR));
+  v.topo = topo;
+  v.partition = partition;
+
+  initGEOS(lwnotice, lwgeom_geos_error);
+
+  ret = _lwt_ValidatorRun(&v);
+  _lwt_ValidatorFree(&v);
+  if ( ret == -1 )
+  {
+    if ( v.errors ) lwfree(v.errors);
+    *errors = NULL;
+    return -1;
+  }
+
+  *errors = v.errors;
+  return v.nerrors;
 }
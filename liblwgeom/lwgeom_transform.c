@@ -28,20 +28,515 @@
 #include "lwgeom_log.h"
 #include <string.h>
 
-/** convert decimal degress to radians */
+/** multiply the X and Y of every point by factor, to convert degrees and radians */
 static void
-to_rad(POINT4D *pt)
+ptarray_scale_xy(POINTARRAY *pa, double factor)
 {
-	pt->x *= M_PI/180.0;
-	pt->y *= M_PI/180.0;
+	uint32_t i;
+	size_t stride = ptarray_point_size(pa) / sizeof(double);
+	double *d = (double*)(pa->serialized_pointlist);
+
+	for (i = 0; i < pa->npoints; i++, d += stride)
+	{
+		d[0] *= factor;
+		d[1] *= factor;
+	}
+}
+
+/***************************************************************************
+ * Native transforms
+ *
+ * Serving tiles from lon/lat storage spends most of its time in
+ * PROJ dispatch. The coordinate operations between lon/lat degrees
+ * and Web Mercator or Transverse Mercator (UTM) are simple enough
+ * to compute here, so we recognize them in the PROJ definition of
+ * the operation and run a plain loop over the coordinates instead.
+ * Anything we do not recognize exactly, and any point array with
+ * coordinates outside of the safe domain of our formulas, goes to
+ * PROJ as before.
+ *
+ * Transverse Mercator uses the 6th order series of Kruger in n,
+ * as in Karney, "Transverse Mercator with an accuracy of a few
+ * nanometers", J. Geodesy 85 (2011). Within the longitude range
+ * we accept it agrees with PROJ's exact algorithm to well below
+ * a millimetre.
+ */
+
+/* Longest pipeline we need to look at */
+#define NATIVE_MAX_STEPS 3
+#define NATIVE_MAX_PARAMS 16
+
+/*
+ * Transverse Mercator is only computed natively this close to the
+ * central meridian (radians), or for easting offsets up to this
+ * many times the scaled rectifying radius (about 33 degrees on
+ * the equator), where the series is still good to nanometres.
+ */
+#define NATIVE_TMERC_MAX_LON (30.0 * M_PI / 180.0)
+#define NATIVE_TMERC_MAX_ETA 0.6
+
+typedef struct
+{
+	bool inverse;
+	const char *proj;
+	uint32_t nparams;
+	const char *key[NATIVE_MAX_PARAMS];
+	const char *value[NATIVE_MAX_PARAMS];
+} NATIVE_STEP;
+
+/** PROJ's adjlon, bring a longitude into [-pi, pi] */
+static inline double
+native_adjlon(double lon)
+{
+	if (fabs(lon) < M_PI + 1e-12)
+		return lon;
+	lon += M_PI;
+	lon -= 2 * M_PI * floor(lon / (2 * M_PI));
+	return lon - M_PI;
+}
+
+/** Value of +key in a step, "" for a flag, NULL when missing */
+static const char *
+native_step_param(const NATIVE_STEP *step, const char *key)
+{
+	uint32_t i;
+	for (i = 0; i < step->nparams; i++)
+	{
+		if (strcmp(step->key[i], key) == 0)
+			return step->value[i] ? step->value[i] : "";
+	}
+	return NULL;
+}
+
+/** Does the step only have parameters from the NULL terminated list? */
+static int
+native_step_known(const NATIVE_STEP *step, const char **keys)
+{
+	uint32_t i, j;
+	for (i = 0; i < step->nparams; i++)
+	{
+		for (j = 0; keys[j]; j++)
+		{
+			if (strcmp(step->key[i], keys[j]) == 0)
+				break;
+		}
+		if (!keys[j])
+			return LW_FALSE;
+	}
+	return LW_TRUE;
 }
 
-/** convert radians to decimal degress */
+/** Read a numeric parameter, def if it is missing */
+static int
+native_step_number(const NATIVE_STEP *step, const char *key, double def, double *value)
+{
+	char *end;
+	const char *str = native_step_param(step, key);
+	if (!str)
+	{
+		*value = def;
+		return LW_TRUE;
+	}
+	*value = strtod(str, &end);
+	return *str && *end == '\0' && isfinite(*value);
+}
+
+/** Read the ellipsoid of a projection step */
+static int
+native_step_ellipsoid(const NATIVE_STEP *step, double *a, double *e)
+{
+	const char *ellps = native_step_param(step, "ellps");
+	double rf = 0.0, b = 0.0, f;
+
+	if (ellps)
+	{
+		if (native_step_param(step, "a") || native_step_param(step, "rf") ||
+		    native_step_param(step, "b") || native_step_param(step, "R"))
+			return LW_FALSE;
+		*a = 6378137.0;
+		if (strcmp(ellps, "WGS84") == 0)
+			rf = 298.257223563;
+		else if (strcmp(ellps, "GRS80") == 0)
+			rf = 298.257222101;
+		else
+			return LW_FALSE;
+	}
+	else if (native_step_param(step, "R"))
+	{
+		if (native_step_param(step, "a") || native_step_param(step, "rf") || native_step_param(step, "b") ||
+		    !native_step_number(step, "R", 0.0, a))
+			return LW_FALSE;
+	}
+	else
+	{
+		if (!native_step_param(step, "a") || !native_step_number(step, "a", 0.0, a) ||
+		    !native_step_number(step, "rf", 0.0, &rf) || !native_step_number(step, "b", 0.0, &b))
+			return LW_FALSE;
+		/* Exactly one of rf and b */
+		if ((rf > 0.0) == (b > 0.0))
+			return LW_FALSE;
+	}
+
+	if (!(*a > 0.0))
+		return LW_FALSE;
+	f = rf > 0.0 ? 1.0 / rf : (b > 0.0 ? (*a - b) / *a : 0.0);
+	if (f < 0.0 || f >= 0.5)
+		return LW_FALSE;
+	*e = sqrt(f * (2.0 - f));
+	return LW_TRUE;
+}
+
+/** Series coefficients of Transverse Mercator, see Karney (2011) eq. 35 and 36 */
 static void
-to_dec(POINT4D *pt)
+native_tmerc_setup(LWPROJ_NATIVE *n, double lat_0)
 {
-	pt->x *= 180.0/M_PI;
-	pt->y *= 180.0/M_PI;
+	double f = 1.0 - sqrt(1.0 - n->e * n->e);
+	double n1 = f / (2.0 - f);
+	double n2 = n1 * n1, n3 = n2 * n1, n4 = n3 * n1, n5 = n4 * n1, n6 = n5 * n1;
+	double chi, xi;
+	int j;
+
+	n->kA = n->k_0 * n->a / (1.0 + n1) * (1.0 + n2 / 4.0 + n4 / 64.0 + n6 / 256.0);
+
+	n->alpha[0] = n1 / 2.0 - 2.0 * n2 / 3.0 + 5.0 * n3 / 16.0 + 41.0 * n4 / 180.0 - 127.0 * n5 / 288.0 + 7891.0 * n6 / 37800.0;
+	n->alpha[1] = 13.0 * n2 / 48.0 - 3.0 * n3 / 5.0 + 557.0 * n4 / 1440.0 + 281.0 * n5 / 630.0 - 1983433.0 * n6 / 1935360.0;
+	n->alpha[2] = 61.0 * n3 / 240.0 - 103.0 * n4 / 140.0 + 15061.0 * n5 / 26880.0 + 167603.0 * n6 / 181440.0;
+	n->alpha[3] = 49561.0 * n4 / 161280.0 - 179.0 * n5 / 168.0 + 6601661.0 * n6 / 7257600.0;
+	n->alpha[4] = 34729.0 * n5 / 80640.0 - 3418889.0 * n6 / 1995840.0;
+	n->alpha[5] = 212378941.0 * n6 / 319334400.0;
+
+	n->beta[0] = n1 / 2.0 - 2.0 * n2 / 3.0 + 37.0 * n3 / 96.0 - n4 / 360.0 - 81.0 * n5 / 512.0 + 96199.0 * n6 / 604800.0;
+	n->beta[1] = n2 / 48.0 + n3 / 15.0 - 437.0 * n4 / 1440.0 + 46.0 * n5 / 105.0 - 1118711.0 * n6 / 3870720.0;
+	n->beta[2] = 17.0 * n3 / 480.0 - 37.0 * n4 / 840.0 - 209.0 * n5 / 4480.0 + 5569.0 * n6 / 90720.0;
+	n->beta[3] = 4397.0 * n4 / 161280.0 - 11.0 * n5 / 504.0 - 830251.0 * n6 / 7257600.0;
+	n->beta[4] = 4583.0 * n5 / 161280.0 - 108847.0 * n6 / 3991680.0;
+	n->beta[5] = 20648693.0 * n6 / 638668800.0;
+
+	/* Northing of the origin, on the central meridian */
+	chi = atan(sinh(asinh(tan(lat_0)) - n->e * atanh(n->e * sin(lat_0))));
+	xi = chi;
+	for (j = 0; j < 6; j++)
+		xi += n->alpha[j] * sin(2 * (j + 1) * chi);
+	n->m_0 = n->kA * xi;
+}
+
+/** Fill in the native transform of a projection step, if we can do it */
+static int
+native_from_step(const NATIVE_STEP *step, LWPROJ_NATIVE *n)
+{
+	static const char *webmerc_keys[] = {"lat_0", "lon_0", "x_0", "y_0", "ellps", "a", "b", "rf", "R", "units", "no_defs", NULL};
+	static const char *utm_keys[] = {"zone", "south", "ellps", "a", "b", "rf", "R", "units", "no_defs", NULL};
+	static const char *tmerc_keys[] = {"lat_0", "lon_0", "k", "k_0", "x_0", "y_0", "ellps", "a", "b", "rf", "R", "units", "no_defs", "algo", NULL};
+	const char *units = native_step_param(step, "units");
+	double lat_0 = 0.0, lon_0 = 0.0, k = 1.0;
+
+	if (units && strcmp(units, "m") != 0)
+		return LW_FALSE;
+
+	if (strcmp(step->proj, "webmerc") == 0)
+	{
+		if (!native_step_known(step, webmerc_keys) ||
+		    !native_step_number(step, "lat_0", 0.0, &lat_0) || lat_0 != 0.0 ||
+		    !native_step_number(step, "lon_0", 0.0, &lon_0) ||
+		    !native_step_number(step, "x_0", 0.0, &n->x_0) ||
+		    !native_step_number(step, "y_0", 0.0, &n->y_0) ||
+		    !native_step_ellipsoid(step, &n->a, &n->e))
+			return LW_FALSE;
+		n->type = LWPROJ_NATIVE_WEBMERC;
+		n->lon_0 = lon_0 * M_PI / 180.0;
+		n->k_0 = 1.0;
+		return LW_TRUE;
+	}
+
+	if (strcmp(step->proj, "utm") == 0)
+	{
+		double zone;
+		if (!native_step_known(step, utm_keys) ||
+		    !native_step_param(step, "zone") || !native_step_number(step, "zone", 0.0, &zone) ||
+		    zone < 1 || zone > 60 || zone != floor(zone) ||
+		    !native_step_ellipsoid(step, &n->a, &n->e))
+			return LW_FALSE;
+		n->type = LWPROJ_NATIVE_TMERC;
+		n->lon_0 = (zone - 0.5) * M_PI / 30.0 - M_PI;
+		n->k_0 = 0.9996;
+		n->x_0 = 500000.0;
+		n->y_0 = native_step_param(step, "south") ? 10000000.0 : 0.0;
+		native_tmerc_setup(n, 0.0);
+		return LW_TRUE;
+	}
+
+	if (strcmp(step->proj, "tmerc") == 0 || strcmp(step->proj, "etmerc") == 0)
+	{
+		const char *algo = native_step_param(step, "algo");
+		/* Other algorithms give (slightly) different results */
+		if (algo && strcmp(algo, "poder_engsager") != 0)
+			return LW_FALSE;
+		if (!native_step_known(step, tmerc_keys) ||
+		    (native_step_param(step, "k") && native_step_param(step, "k_0")) ||
+		    !native_step_number(step, "lat_0", 0.0, &lat_0) || fabs(lat_0) > 90.0 ||
+		    !native_step_number(step, "lon_0", 0.0, &lon_0) ||
+		    !native_step_number(step, native_step_param(step, "k_0") ? "k_0" : "k", 1.0, &k) || !(k > 0.0) ||
+		    !native_step_number(step, "x_0", 0.0, &n->x_0) ||
+		    !native_step_number(step, "y_0", 0.0, &n->y_0) ||
+		    !native_step_ellipsoid(step, &n->a, &n->e))
+			return LW_FALSE;
+		n->type = LWPROJ_NATIVE_TMERC;
+		n->lon_0 = lon_0 * M_PI / 180.0;
+		n->k_0 = k;
+		native_tmerc_setup(n, lat_0 * M_PI / 180.0);
+		return LW_TRUE;
+	}
+
+	return LW_FALSE;
+}
+
+/**
+* Look at the PROJ definition of the operation and set up
+* a native transform if it is a lon/lat degrees to Mercator
+* or Transverse Mercator metres conversion, or the inverse.
+*/
+static void
+lwproj_native_init(LWPROJ *lp)
+{
+	NATIVE_STEP steps[NATIVE_MAX_STEPS];
+	const NATIVE_STEP *units, *proj;
+	LWPROJ_NATIVE n;
+	int nsteps = -1;
+	char *def, *token;
+	const char *str;
+
+	memset(&lp->native, 0, sizeof(LWPROJ_NATIVE));
+	memset(&n, 0, sizeof(LWPROJ_NATIVE));
+	memset(steps, 0, sizeof(steps));
+
+	str = proj_as_proj_string(PJ_DEFAULT_CTX, lp->pj, PJ_PROJ_5, NULL);
+	if (!str)
+	{
+		proj_errno_reset(lp->pj);
+		return;
+	}
+
+	/* Split "+proj=pipeline +step ... +step ..." into steps of parameters */
+	def = lwstrdup(str);
+	for (token = strtok(def, " "); token; token = strtok(NULL, " "))
+	{
+		NATIVE_STEP *step;
+		char *eq;
+
+		if (token[0] != '+')
+			goto done;
+		token++;
+
+		if (strcmp(token, "step") == 0)
+		{
+			if (++nsteps >= NATIVE_MAX_STEPS)
+				goto done;
+			continue;
+		}
+		/* Nothing but the pipeline itself before the first step */
+		if (nsteps < 0)
+		{
+			if (strcmp(token, "proj=pipeline") != 0)
+				goto done;
+			continue;
+		}
+
+		step = &steps[nsteps];
+		if (strcmp(token, "inv") == 0)
+		{
+			step->inverse = true;
+			continue;
+		}
+		eq = strchr(token, '=');
+		if (eq)
+			*eq++ = '\0';
+		if (strcmp(token, "proj") == 0)
+		{
+			if (step->proj || !eq)
+				goto done;
+			step->proj = eq;
+			continue;
+		}
+		if (step->nparams >= NATIVE_MAX_PARAMS)
+			goto done;
+		step->key[step->nparams] = token;
+		step->value[step->nparams] = eq;
+		step->nparams++;
+	}
+
+	/* Degrees to radians then projection, or inverse projection then radians to degrees */
+	if (nsteps != 1 || !steps[0].proj || !steps[1].proj || steps[1].inverse)
+		goto done;
+	n.inverse = steps[0].inverse;
+	units = n.inverse ? &steps[1] : &steps[0];
+	proj = n.inverse ? &steps[0] : &steps[1];
+
+	if (strcmp(units->proj, "unitconvert") != 0 || units->nparams != 2 || units->inverse ||
+	    !native_step_param(units, "xy_in") || !native_step_param(units, "xy_out") ||
+	    strcmp(native_step_param(units, "xy_in"), n.inverse ? "rad" : "deg") != 0 ||
+	    strcmp(native_step_param(units, "xy_out"), n.inverse ? "deg" : "rad") != 0)
+		goto done;
+
+	if (native_from_step(proj, &n))
+		lp->native = n;
+
+done:
+	lwfree(def);
+}
+
+/** Lon/lat degrees to Web Mercator metres */
+static void
+native_webmerc_fwd(const LWPROJ_NATIVE *n, double *d, uint32_t npoints, size_t stride)
+{
+	uint32_t i;
+	for (i = 0; i < npoints; i++, d += stride)
+	{
+		double lam = native_adjlon(d[0] * M_PI / 180.0 - n->lon_0);
+		double phi = d[1] * M_PI / 180.0;
+		d[0] = n->a * lam + n->x_0;
+		d[1] = n->a * asinh(tan(phi)) + n->y_0;
+	}
+}
+
+/** Web Mercator metres to lon/lat degrees */
+static void
+native_webmerc_inv(const LWPROJ_NATIVE *n, double *d, uint32_t npoints, size_t stride)
+{
+	uint32_t i;
+	for (i = 0; i < npoints; i++, d += stride)
+	{
+		double lam = (d[0] - n->x_0) / n->a;
+		double phi = atan(sinh((d[1] - n->y_0) / n->a));
+		d[0] = native_adjlon(lam + n->lon_0) * 180.0 / M_PI;
+		d[1] = phi * 180.0 / M_PI;
+	}
+}
+
+/** Lon/lat degrees to Transverse Mercator metres */
+static void
+native_tmerc_fwd(const LWPROJ_NATIVE *n, double *d, uint32_t npoints, size_t stride)
+{
+	uint32_t i;
+	int j;
+	for (i = 0; i < npoints; i++, d += stride)
+	{
+		double lam = native_adjlon(d[0] * M_PI / 180.0 - n->lon_0);
+		double phi = d[1] * M_PI / 180.0;
+		/* Tangent of the conformal latitude */
+		double tau = tan(phi);
+		double taup = sinh(asinh(tau) - n->e * atanh(n->e * sin(phi)));
+		double xip = atan2(taup, cos(lam));
+		double etap = asinh(sin(lam) / hypot(taup, cos(lam)));
+		double xi = xip, eta = etap;
+		for (j = 0; j < 6; j++)
+		{
+			double k2 = 2.0 * (j + 1);
+			xi += n->alpha[j] * sin(k2 * xip) * cosh(k2 * etap);
+			eta += n->alpha[j] * cos(k2 * xip) * sinh(k2 * etap);
+		}
+		d[0] = n->kA * eta + n->x_0;
+		d[1] = n->kA * xi - n->m_0 + n->y_0;
+	}
+}
+
+/** Transverse Mercator metres to lon/lat degrees */
+static void
+native_tmerc_inv(const LWPROJ_NATIVE *n, double *d, uint32_t npoints, size_t stride)
+{
+	uint32_t i;
+	int j, iter;
+	double e2m = 1.0 - n->e * n->e;
+	for (i = 0; i < npoints; i++, d += stride)
+	{
+		double xi = (d[1] - n->y_0 + n->m_0) / n->kA;
+		double eta = (d[0] - n->x_0) / n->kA;
+		double xip = xi, etap = eta;
+		double s, c, taup, tau, lam, phi;
+		for (j = 0; j < 6; j++)
+		{
+			double k2 = 2.0 * (j + 1);
+			xip -= n->beta[j] * sin(k2 * xi) * cosh(k2 * eta);
+			etap -= n->beta[j] * cos(k2 * xi) * sinh(k2 * eta);
+		}
+		s = sinh(etap);
+		c = cos(xip);
+		lam = atan2(s, c);
+		taup = sin(xip) / hypot(s, c);
+
+		/* Geodetic from conformal latitude, by Newton's method */
+		tau = taup;
+		for (iter = 0; iter < 5 && isfinite(tau); iter++)
+		{
+			double sig = sinh(n->e * atanh(n->e * tau / hypot(1.0, tau)));
+			double taupa = tau * hypot(1.0, sig) - sig * hypot(1.0, tau);
+			double dtau = (taup - taupa) / hypot(1.0, taupa) *
+			              (1.0 + e2m * tau * tau) / (e2m * hypot(1.0, tau));
+			tau += dtau;
+			if (fabs(dtau) < 1e-14 * fmax(1.0, fabs(tau)))
+				break;
+		}
+		phi = isfinite(tau) ? atan(tau) : copysign(M_PI / 2.0, taup);
+
+		d[0] = native_adjlon(lam + n->lon_0) * 180.0 / M_PI;
+		d[1] = phi * 180.0 / M_PI;
+	}
+}
+
+/**
+* Transform the point array with the native transform of pj.
+* Returns LW_FALSE, leaving the points untouched, when some
+* coordinates are outside the domain of the native formulas.
+*/
+static int
+ptarray_transform_native(POINTARRAY *pa, const LWPROJ *pj)
+{
+	const LWPROJ_NATIVE *n = &(pj->native);
+	size_t stride = ptarray_point_size(pa) / sizeof(double);
+	double *pa_double = (double*)(pa->serialized_pointlist);
+	const double *d = pa_double;
+	bool inverse = n->inverse != !pj->pipeline_is_forward;
+	uint32_t i;
+
+	/* Check the domain first, PROJ reports errors for the rest */
+	for (i = 0; i < pa->npoints; i++, d += stride)
+	{
+		if (!(isfinite(d[0]) && isfinite(d[1])))
+			return LW_FALSE;
+		if (!inverse)
+		{
+			/* Poles are at infinity in Mercator */
+			if (!(fabs(d[0]) <= 180.0 && fabs(d[1]) < 90.0))
+				return LW_FALSE;
+			if (n->type == LWPROJ_NATIVE_TMERC &&
+			    !(fabs(native_adjlon(d[0] * M_PI / 180.0 - n->lon_0)) <= NATIVE_TMERC_MAX_LON))
+				return LW_FALSE;
+		}
+		else
+		{
+			if (n->type == LWPROJ_NATIVE_WEBMERC && !(fabs(d[0] - n->x_0) <= M_PI * n->a))
+				return LW_FALSE;
+			if (n->type == LWPROJ_NATIVE_TMERC &&
+			    !(fabs(d[0] - n->x_0) <= NATIVE_TMERC_MAX_ETA * n->kA &&
+			      fabs(d[1] - n->y_0 + n->m_0) <= M_PI * n->kA))
+				return LW_FALSE;
+		}
+	}
+
+	if (n->type == LWPROJ_NATIVE_WEBMERC)
+	{
+		if (inverse)
+			native_webmerc_inv(n, pa_double, pa->npoints, stride);
+		else
+			native_webmerc_fwd(n, pa_double, pa->npoints, stride);
+	}
+	else
+	{
+		if (inverse)
+			native_tmerc_inv(n, pa_double, pa->npoints, stride);
+		else
+			native_tmerc_fwd(n, pa_double, pa->npoints, stride);
+	}
+	return LW_TRUE;
 }
 
 /***************************************************************************/
@@ -115,6 +610,7 @@ lwproj_from_str(const char* str_in, const char* str_out)
 	lp->source_is_latlong = source_is_latlong;
 	lp->source_semi_major_metre = semi_major_metre;
 	lp->source_semi_minor_metre = semi_minor_metre;
+	lwproj_native_init(lp);
 	return lp;
 }
 
@@ -150,6 +646,7 @@ lwproj_from_str_pipeline(const char* str_pipeline, bool is_forward)
 	lp->source_is_latlong = LW_FALSE;
 	lp->source_semi_major_metre = DBL_MAX;
 	lp->source_semi_minor_metre = DBL_MAX;
+	lwproj_native_init(lp);
 	return lp;
 }
 
@@ -208,8 +705,6 @@ lwgeom_transform_pipeline(LWGEOM *geom, const char* pipelinestr, bool is_forward
 int
 ptarray_transform(POINTARRAY *pa, LWPROJ *pj)
 {
-	uint32_t i;
-	POINT4D p;
 	size_t n_converted;
 	size_t n_points = pa->npoints;
 	size_t point_size = ptarray_point_size(pa);
@@ -218,16 +713,13 @@ ptarray_transform(POINTARRAY *pa, LWPROJ *pj)
 
 	PJ_DIRECTION direction = pj->pipeline_is_forward ? PJ_FWD : PJ_INV;
 
+	/* Web Mercator and UTM without going through PROJ */
+	if (pj->native.type != LWPROJ_NATIVE_NONE && ptarray_transform_native(pa, pj))
+		return LW_SUCCESS;
+
 	/* Convert to radians if necessary */
 	if (proj_angular_input(pj->pj, direction))
-	{
-		for (i = 0; i < pa->npoints; i++)
-		{
-			getPoint4d_p(pa, i, &p);
-			to_rad(&p);
-			ptarray_set_point4d(pa, i, &p);
-		}
-	}
+		ptarray_scale_xy(pa, M_PI / 180.0);
 
 	if (n_points == 1)
 	{
@@ -290,14 +782,7 @@ ptarray_transform(POINTARRAY *pa, LWPROJ *pj)
 
 	/* Convert radians to degrees if necessary */
 	if (proj_angular_output(pj->pj, direction))
-	{
-		for (i = 0; i < pa->npoints; i++)
-		{
-			getPoint4d_p(pa, i, &p);
-			to_dec(&p);
-			ptarray_set_point4d(pa, i, &p);
-		}
-	}
+		ptarray_scale_xy(pa, 180.0 / M_PI);
 
 	return LW_SUCCESS;
 }
@@ -6,6 +6,7 @@
  *------------------------------------------------------------------------*/
 
 #include "liblwgeom_internal.h"
+#include "lwrandom.h"
 
 /*
  * When clustering lists with NULL or EMPTY elements, they will get this as
@@ -19,13 +20,34 @@
  */
 #define KMEANS_MAX_ITERATIONS 1000
 
+/*
+ * Number of batches mini-batch mode refines the centers with before
+ * assigning all the inputs.
+ */
+#define KMEANS_BATCH_ITERATIONS 100
+
+/*
+ * Seeding picks centers at random, always from the same seed, so that a
+ * given input always gets the same clusters. The generator is local to
+ * each run, the shared one of lwrandom_uniform() is left alone.
+ */
+#define KMEANS_RANDOM_SEED 3965
+
+/*
+ * The bounds of kmeans_lloyd() pile up rounding errors, so an object is
+ * only left alone when its center is nearer than the bound by this
+ * fraction. Exact ties are scanned, to go to the lowest center number.
+ */
+#define KMEANS_BOUND_SLACK 1e-9
+
 static uint32_t kmeans(POINT4D *objs,
 		       uint32_t *clusters,
 		       uint32_t n,
 		       POINT4D *centers,
 		       double *radii,
 		       uint32_t min_k,
-		       double max_radius);
+		       double max_radius,
+		       uint32_t batch_size);
 
 inline static double
 distance3d_sqr_pt4d_pt4d(const POINT4D *p1, const POINT4D *p2)
@@ -82,7 +104,7 @@ improve_structure(POINT4D *objs,
 			continue;
 
 		/* run 2-means on the cluster */
-		kmeans(temp_objs, temp_clusters, cluster_size, temp_centers, temp_radii, 2, 0);
+		kmeans(temp_objs, temp_clusters, cluster_size, temp_centers, temp_radii, 2, 0, 0);
 
 		/* replace cluster with split */
 		uint32_t d = 0;
@@ -104,75 +126,395 @@ improve_structure(POINT4D *objs,
 	return new_k;
 }
 
-/* Refresh mapping of point to closest cluster */
-static uint8_t
-update_r(POINT4D *objs, uint32_t *clusters, uint32_t n, POINT4D *centers, double *radii, uint32_t k)
+/* Refresh cluster centroids based on all of their objects */
+static void
+update_means(POINT4D *objs, uint32_t *clusters, uint32_t n, POINT4D *centers, uint32_t k)
 {
-	uint8_t converged = LW_TRUE;
-	if (radii)
-		memset(radii, 0, sizeof(double) * k);
+	memset(centers, 0, sizeof(POINT4D) * k);
+	/* calculate weighted sum */
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint32_t cluster = clusters[i];
+		centers[cluster].x += objs[i].x * objs[i].m;
+		centers[cluster].y += objs[i].y * objs[i].m;
+		centers[cluster].z += objs[i].z * objs[i].m;
+		centers[cluster].m += objs[i].m;
+	}
+	/* divide by weight to get average */
+	for (uint32_t i = 0; i < k; i++)
+	{
+		if (centers[i].m)
+		{
+			centers[i].x /= centers[i].m;
+			centers[i].y /= centers[i].m;
+			centers[i].z /= centers[i].m;
+		}
+	}
+}
 
+/* Squared distance from each cluster center to its farthest object */
+static void
+update_radii(POINT4D *objs, uint32_t *clusters, uint32_t n, POINT4D *centers, double *radii, uint32_t k)
+{
+	memset(radii, 0, sizeof(double) * k);
 	for (uint32_t i = 0; i < n; i++)
 	{
-		POINT4D obj = objs[i];
+		double distance = distance3d_sqr_pt4d_pt4d(&objs[i], &centers[clusters[i]]);
+		if (radii[clusters[i]] < distance)
+			radii[clusters[i]] = distance;
+	}
+}
+
+/*
+ * Static k-d tree over the cluster centers, so that finding the nearest
+ * center does not take a scan of all of them. Each range of the order
+ * array has its median center in the middle, split on the axis of widest
+ * spread. Below KMEANS_TREE_MIN_K centers a plain scan is faster.
+ */
+#define KMEANS_TREE_MIN_K 16
+
+typedef struct
+{
+	const POINT4D *centers;
+	uint32_t k;
+	uint32_t *order; /* NULL to scan */
+	uint8_t *axis;
+} KMEANS_TREE;
 
-		/* Initialize with distance to first cluster */
-		double curr_distance = distance3d_sqr_pt4d_pt4d(&obj, &centers[0]);
-		uint32_t curr_cluster = 0;
+inline static double
+pt4d_axis(const POINT4D *p, uint8_t axis)
+{
+	return axis == 0 ? p->x : axis == 1 ? p->y : p->z;
+}
 
-		/* Check all other cluster centers and find the nearest */
-		for (uint32_t cluster = 1; cluster < k; cluster++)
+static void
+kmeans_tree_build_range(KMEANS_TREE *tree, uint32_t lo, uint32_t hi)
+{
+	while (hi - lo > 1)
+	{
+		double min[3] = {DBL_MAX, DBL_MAX, DBL_MAX}, max[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+		uint32_t mid = lo + (hi - lo) / 2;
+		uint32_t left = lo, right = hi - 1;
+		uint8_t axis = 0;
+
+		for (uint32_t i = lo; i < hi; i++)
+			for (uint8_t a = 0; a < 3; a++)
+			{
+				double v = pt4d_axis(&tree->centers[tree->order[i]], a);
+				min[a] = FP_MIN(min[a], v);
+				max[a] = FP_MAX(max[a], v);
+			}
+		for (uint8_t a = 1; a < 3; a++)
+			if (max[a] - min[a] > max[axis] - min[axis])
+				axis = a;
+
+		/* Quickselect the median into mid, partitioning three ways around each pivot */
+		while (left < right)
 		{
-			double distance = distance3d_sqr_pt4d_pt4d(&obj, &centers[cluster]);
-			if (distance < curr_distance)
+			double pivot = pt4d_axis(&tree->centers[tree->order[mid]], axis);
+			uint32_t lt = left, gt = right, i = left;
+			while (i <= gt)
 			{
-				curr_distance = distance;
-				curr_cluster = cluster;
+				double v = pt4d_axis(&tree->centers[tree->order[i]], axis);
+				uint32_t swap = tree->order[i];
+				if (v < pivot)
+				{
+					tree->order[i++] = tree->order[lt];
+					tree->order[lt++] = swap;
+				}
+				else if (v > pivot)
+				{
+					/* the pivot value is still to the left, so gt stays >= lt */
+					tree->order[i] = tree->order[gt];
+					tree->order[gt--] = swap;
+				}
+				else
+					i++;
 			}
+			if (mid < lt)
+				right = lt - 1;
+			else if (mid > gt)
+				left = gt + 1;
+			else
+				break;
 		}
+		tree->axis[mid] = axis;
+
+		kmeans_tree_build_range(tree, lo, mid);
+		lo = mid + 1;
+	}
+}
+
+static void
+kmeans_tree_build(KMEANS_TREE *tree, const POINT4D *centers, uint32_t k)
+{
+	tree->centers = centers;
+	tree->k = k;
+	tree->order = NULL;
+	tree->axis = NULL;
+	if (k < KMEANS_TREE_MIN_K)
+		return;
+
+	tree->order = lwalloc(sizeof(uint32_t) * k);
+	tree->axis = lwalloc(sizeof(uint8_t) * k);
+	for (uint32_t i = 0; i < k; i++)
+		tree->order[i] = i;
+	kmeans_tree_build_range(tree, 0, k);
+}
+
+static void
+kmeans_tree_free(KMEANS_TREE *tree)
+{
+	if (tree->order)
+	{
+		lwfree(tree->order);
+		lwfree(tree->axis);
+	}
+}
+
+/* Keep the nearest and second nearest squared distances, ties going to the lowest center number */
+inline static void
+nearest_update(uint32_t cluster, double distance, uint32_t *best, double *d1, double *d2)
+{
+	if (distance < *d1 || (distance == *d1 && cluster < *best))
+	{
+		*d2 = *d1;
+		*d1 = distance;
+		*best = cluster;
+	}
+	else if (distance < *d2)
+		*d2 = distance;
+}
+
+static void
+kmeans_tree_nearest(const KMEANS_TREE *tree, uint32_t lo, uint32_t hi, const POINT4D *obj, uint32_t *best, double *d1, double *d2)
+{
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		uint32_t cluster = tree->order[mid];
+		double diff;
+
+		nearest_update(cluster, distance3d_sqr_pt4d_pt4d(obj, &tree->centers[cluster]), best, d1, d2);
+		if (hi - lo == 1)
+			return;
 
-		/* Store the nearest cluster this object is in */
-		if (clusters[i] != curr_cluster)
+		/* Nearer half first, the other one only if it can hold something nearer */
+		diff = pt4d_axis(obj, tree->axis[mid]) - pt4d_axis(&tree->centers[cluster], tree->axis[mid]);
+		if (diff < 0)
+		{
+			kmeans_tree_nearest(tree, lo, mid, obj, best, d1, d2);
+			if (diff * diff > *d2)
+				return;
+			lo = mid + 1;
+		}
+		else
 		{
-			converged = LW_FALSE;
-			clusters[i] = curr_cluster;
+			kmeans_tree_nearest(tree, mid + 1, hi, obj, best, d1, d2);
+			if (diff * diff > *d2)
+				return;
+			hi = mid;
 		}
-		if (radii)
-			if (radii[curr_cluster] < curr_distance)
-				radii[curr_cluster] = curr_distance;
 	}
-	return converged;
 }
 
-/* Refresh cluster centroids based on all of their objects */
+/* Nearest cluster center to obj, and the distances to the nearest and second nearest */
+static uint32_t
+nearest_center(const POINT4D *obj, const KMEANS_TREE *tree, double *nearest, double *second)
+{
+	double d1 = DBL_MAX, d2 = DBL_MAX;
+	uint32_t curr_cluster = 0;
+
+	if (tree->order)
+		kmeans_tree_nearest(tree, 0, tree->k, obj, &curr_cluster, &d1, &d2);
+	else
+		for (uint32_t cluster = 0; cluster < tree->k; cluster++)
+			nearest_update(cluster, distance3d_sqr_pt4d_pt4d(obj, &tree->centers[cluster]), &curr_cluster, &d1, &d2);
+
+	if (nearest)
+		*nearest = sqrt(d1);
+	if (second)
+		*second = d2 == DBL_MAX ? DBL_MAX : sqrt(d2);
+	return curr_cluster;
+}
+
+/* Refresh mapping of point to closest cluster */
 static void
-update_means(POINT4D *objs, uint32_t *clusters, uint32_t n, POINT4D *centers, uint32_t k)
+update_r(POINT4D *objs, uint32_t *clusters, uint32_t n, POINT4D *centers, double *radii, uint32_t k)
 {
-	memset(centers, 0, sizeof(POINT4D) * k);
-	/* calculate weighted sum */
+	KMEANS_TREE tree;
+
+	kmeans_tree_build(&tree, centers, k);
+	for (uint32_t i = 0; i < n; i++)
+		clusters[i] = nearest_center(&objs[i], &tree, NULL, NULL);
+	kmeans_tree_free(&tree);
+
+	update_radii(objs, clusters, n, centers, radii, k);
+}
+
+/*
+ * Lloyd iterations, pruned with Hamerly's bounds: every object keeps an
+ * upper bound of the distance to its center and a lower bound of the
+ * distance to any other one, both moved by how far the centers move. The
+ * centers are only scanned for objects whose bounds overlap, which after
+ * the first few iterations are few. Centers also keep half the distance to
+ * the nearest other center, under which an object can't change cluster;
+ * that costs k^2 distances per iteration, so is only done when k^2 <= n.
+ */
+static uint8_t
+kmeans_lloyd(POINT4D *objs, uint32_t *clusters, uint32_t n, POINT4D *centers, uint32_t k)
+{
+	uint8_t converged = LW_FALSE;
+	uint8_t use_separation = (uint64_t)k * k <= n;
+	double *upper = lwalloc(sizeof(double) * n);
+	double *lower = lwalloc(sizeof(double) * n);
+	double *moved = lwalloc(sizeof(double) * k);
+	double *separation = lwalloc(sizeof(double) * k);
+	POINT4D *old_centers = lwalloc(sizeof(POINT4D) * k);
+	KMEANS_TREE tree;
+
+	kmeans_tree_build(&tree, centers, k);
 	for (uint32_t i = 0; i < n; i++)
+		clusters[i] = nearest_center(&objs[i], &tree, &upper[i], &lower[i]);
+	kmeans_tree_free(&tree);
+
+	for (uint32_t t = 0; t < KMEANS_MAX_ITERATIONS; t++)
 	{
-		uint32_t cluster = clusters[i];
-		centers[cluster].x += objs[i].x * objs[i].m;
-		centers[cluster].y += objs[i].y * objs[i].m;
-		centers[cluster].z += objs[i].z * objs[i].m;
-		centers[cluster].m += objs[i].m;
+		uint32_t farthest = 0;
+		double max_moved = 0, second_moved = 0;
+
+		LW_ON_INTERRUPT(break);
+
+		/* Move the centers, and the bounds by as much */
+		memcpy(old_centers, centers, sizeof(POINT4D) * k);
+		update_means(objs, clusters, n, centers, k);
+		for (uint32_t c = 0; c < k; c++)
+		{
+			moved[c] = sqrt(distance3d_sqr_pt4d_pt4d(&old_centers[c], &centers[c]));
+			if (moved[c] > max_moved)
+			{
+				second_moved = max_moved;
+				max_moved = moved[c];
+				farthest = c;
+			}
+			else if (moved[c] > second_moved)
+				second_moved = moved[c];
+		}
+		for (uint32_t i = 0; i < n; i++)
+		{
+			upper[i] += moved[clusters[i]];
+			lower[i] -= clusters[i] == farthest ? second_moved : max_moved;
+		}
+
+		if (use_separation)
+		{
+			for (uint32_t c = 0; c < k; c++)
+				separation[c] = DBL_MAX;
+			for (uint32_t c = 0; c < k; c++)
+				for (uint32_t d = c + 1; d < k; d++)
+				{
+					double distance = distance3d_sqr_pt4d_pt4d(&centers[c], &centers[d]);
+					if (distance < separation[c])
+						separation[c] = distance;
+					if (distance < separation[d])
+						separation[d] = distance;
+				}
+			for (uint32_t c = 0; c < k; c++)
+				separation[c] = separation[c] == DBL_MAX ? DBL_MAX : sqrt(separation[c]) / 2;
+		}
+
+		/* Reassign the objects whose bounds no longer tell their center */
+		kmeans_tree_build(&tree, centers, k);
+		converged = LW_TRUE;
+		for (uint32_t i = 0; i < n; i++)
+		{
+			double bound = lower[i];
+			uint32_t cluster;
+
+			if (use_separation && separation[clusters[i]] > bound)
+				bound = separation[clusters[i]];
+			bound -= bound * KMEANS_BOUND_SLACK;
+			if (upper[i] < bound)
+				continue;
+
+			upper[i] = sqrt(distance3d_sqr_pt4d_pt4d(&objs[i], &centers[clusters[i]]));
+			if (upper[i] < bound)
+				continue;
+
+			cluster = nearest_center(&objs[i], &tree, &upper[i], &lower[i]);
+			if (cluster != clusters[i])
+			{
+				converged = LW_FALSE;
+				clusters[i] = cluster;
+			}
+		}
+		kmeans_tree_free(&tree);
+		if (converged)
+			break;
 	}
-	/* divide by weight to get average */
-	for (uint32_t i = 0; i < k; i++)
+
+	lwfree(old_centers);
+	lwfree(separation);
+	lwfree(moved);
+	lwfree(lower);
+	lwfree(upper);
+	return converged;
+}
+
+/*
+ * Mini-batch k-means (Sculley, 2010): each batch of randomly picked
+ * objects moves its nearest centers towards them, by a step that shrinks
+ * as the centers gather weight. Only the final assignment looks at every
+ * object.
+ */
+static void
+kmeans_minibatch(POINT4D *objs,
+		 uint32_t n,
+		 POINT4D *centers,
+		 uint32_t k,
+		 uint32_t batch_size,
+		 LWRANDOM_STATE *rng)
+{
+	double *weights = lwalloc(sizeof(double) * k);
+	uint32_t *batch = lwalloc(sizeof(uint32_t) * batch_size);
+	uint32_t *batch_clusters = lwalloc(sizeof(uint32_t) * batch_size);
+	KMEANS_TREE tree;
+
+	memset(weights, 0, sizeof(double) * k);
+	for (uint32_t t = 0; t < KMEANS_BATCH_ITERATIONS; t++)
 	{
-		if (centers[i].m)
+		LW_ON_INTERRUPT(break);
+
+		/* Centers are looked up before any of them moves */
+		kmeans_tree_build(&tree, centers, k);
+		for (uint32_t b = 0; b < batch_size; b++)
 		{
-			centers[i].x /= centers[i].m;
-			centers[i].y /= centers[i].m;
-			centers[i].z /= centers[i].m;
+			batch[b] = (uint32_t)(lwrandom_state_uniform(rng) * n) % n;
+			batch_clusters[b] = nearest_center(&objs[batch[b]], &tree, NULL, NULL);
+		}
+		kmeans_tree_free(&tree);
+		for (uint32_t b = 0; b < batch_size; b++)
+		{
+			const POINT4D *obj = &objs[batch[b]];
+			POINT4D *center = &centers[batch_clusters[b]];
+			double step;
+
+			weights[batch_clusters[b]] += obj->m;
+			step = obj->m / weights[batch_clusters[b]];
+			center->x += (obj->x - center->x) * step;
+			center->y += (obj->y - center->y) * step;
+			center->z += (obj->z - center->z) * step;
 		}
 	}
+
+	lwfree(batch_clusters);
+	lwfree(batch);
+	lwfree(weights);
 }
 
 /* Assign initial clusters centroids heuristically */
 static void
-kmeans_init(POINT4D *objs, uint32_t n, POINT4D *centers, uint32_t k)
+kmeans_init(POINT4D *objs, uint32_t n, POINT4D *centers, uint32_t k, LWRANDOM_STATE *rng)
 {
 	double *distances;
 	uint32_t p1 = 0, p2 = 0;
@@ -227,51 +569,107 @@ kmeans_init(POINT4D *objs, uint32_t n, POINT4D *centers, uint32_t k)
 		/* array of minimum distance to a point from accepted cluster centers */
 		distances = lwalloc(sizeof(double) * n);
 
-		/* initialize array with distance to first object */
+		/* initialize array with distance to the first two centers */
 		for (uint32_t j = 0; j < n; j++)
-			distances[j] = distance3d_sqr_pt4d_pt4d(&objs[j], &centers[0]);
+			distances[j] = FP_MIN(distance3d_sqr_pt4d_pt4d(&objs[j], &centers[0]),
+					      distance3d_sqr_pt4d_pt4d(&objs[j], &centers[1]));
 		distances[p1] = -1;
 		distances[p2] = -1;
 
-		/* loop i on clusters, skip 0 and 1 as found already */
+		/*
+		 * k-means++ (Arthur and Vassilvitskii, 2007): take the next center at
+		 * random, with a probability that grows with the weight of the point
+		 * and the square of its distance to the accepted centers. Unlike
+		 * taking the farthest point, this does not favour outliers. The
+		 * generator restarts here, so sampling does not change the draws.
+		 */
+		lwrandom_state_set_seed(rng, KMEANS_RANDOM_SEED);
 		for (uint32_t i = 2; i < k; i++)
 		{
-			uint32_t candidate_center = 0;
-			double max_distance = -DBL_MAX;
+			uint32_t candidate_center = n;
+			double total = 0;
 
 			/* loop j on objs */
 			for (uint32_t j = 0; j < n; j++)
 			{
-				/* empty objs and accepted clusters are already marked with distance = -1 */
+				/* accepted clusters are already marked with distance = -1 */
 				if (distances[j] < 0)
 					continue;
 
 				/* update minimal distance with previosuly accepted cluster */
-				double current_distance = distance3d_sqr_pt4d_pt4d(&objs[j], &centers[i - 1]);
-				if (current_distance < distances[j])
-					distances[j] = current_distance;
+				if (i > 2)
+				{
+					double current_distance = distance3d_sqr_pt4d_pt4d(&objs[j], &centers[i - 1]);
+					if (current_distance < distances[j])
+						distances[j] = current_distance;
+				}
+				total += distances[j] * objs[j].m;
+			}
 
-				/* greedily take a point that's farthest from any of accepted clusters */
-				if (distances[j] > max_distance)
+			if (total > 0)
+			{
+				double target = lwrandom_state_uniform(rng) * total;
+				for (uint32_t j = 0; j < n; j++)
 				{
+					if (distances[j] <= 0)
+						continue;
 					candidate_center = j;
-					max_distance = distances[j];
+					target -= distances[j] * objs[j].m;
+					if (target < 0)
+						break;
 				}
 			}
+			else
+			{
+				/* only duplicates of accepted centers are left */
+				for (uint32_t j = 0; j < n && candidate_center == n; j++)
+					if (distances[j] >= 0)
+						candidate_center = j;
+			}
 
 			/* Checked earlier by counting entries on input, just in case */
-			assert(max_distance >= 0);
+			assert(candidate_center < n);
 
 			/* accept candidate to centers */
 			distances[candidate_center] = -1;
-			/* Copy the point coordinates into the initial centers array
-			 * Centers array is an array of pointers to points, not an array of points */
 			centers[i] = objs[candidate_center];
 		}
 		lwfree(distances);
 	}
 }
 
+/*
+ * Seed centers on a random sample of objects instead of all of them.
+ * The sample is taken without repeats, so that its distinct points
+ * stay distinct centers.
+ */
+static void
+kmeans_init_sample(POINT4D *objs,
+		   uint32_t n,
+		   POINT4D *centers,
+		   uint32_t k,
+		   uint32_t sample_size,
+		   LWRANDOM_STATE *rng)
+{
+	uint32_t *order = lwalloc(sizeof(uint32_t) * n);
+	POINT4D *sample = lwalloc(sizeof(POINT4D) * sample_size);
+
+	for (uint32_t i = 0; i < n; i++)
+		order[i] = i;
+	for (uint32_t i = 0; i < sample_size; i++)
+	{
+		uint32_t j = i + (uint32_t)(lwrandom_state_uniform(rng) * (n - i)) % (n - i);
+		uint32_t swap = order[i];
+		order[i] = order[j];
+		order[j] = swap;
+		sample[i] = objs[order[i]];
+	}
+	kmeans_init(sample, sample_size, centers, k, rng);
+
+	lwfree(sample);
+	lwfree(order);
+}
+
 static uint32_t
 kmeans(POINT4D *objs,
        uint32_t *clusters,
@@ -279,25 +677,39 @@ kmeans(POINT4D *objs,
        POINT4D *centers,
        double *radii,
        uint32_t min_k,
-       double max_radius)
+       double max_radius,
+       uint32_t batch_size)
 {
 	uint8_t converged = LW_FALSE;
 	uint32_t cur_k = min_k;
+	LWRANDOM_STATE rng;
+
+	lwrandom_state_set_seed(&rng, KMEANS_RANDOM_SEED);
+
+	/* Batches smaller than k would leave centers that never move */
+	if (batch_size && batch_size < min_k)
+		batch_size = min_k;
+	if (batch_size >= n)
+		batch_size = 0;
+
+	if (batch_size)
+		kmeans_init_sample(objs, n, centers, cur_k, batch_size, &rng);
+	else
+		kmeans_init(objs, n, centers, cur_k, &rng);
 
-	kmeans_init(objs, n, centers, cur_k);
-	/* One iteration of kmeans needs to happen without shortcuts to fully initialize structures */
-	update_r(objs, clusters, n, centers, radii, cur_k);
-	update_means(objs, clusters, n, centers, cur_k);
 	for (uint32_t t = 0; t < KMEANS_MAX_ITERATIONS; t++)
 	{
-		/* Standard KMeans loop */
-		for (uint32_t i = 0; i < KMEANS_MAX_ITERATIONS; i++)
+		if (batch_size)
 		{
-			LW_ON_INTERRUPT(break);
-			converged = update_r(objs, clusters, n, centers, radii, cur_k);
-			if (converged)
-				break;
+			kmeans_minibatch(objs, n, centers, cur_k, batch_size, &rng);
+			converged = LW_TRUE;
+			update_r(objs, clusters, n, centers, radii, cur_k);
+		}
+		else
+		{
+			converged = kmeans_lloyd(objs, clusters, n, centers, cur_k);
 			update_means(objs, clusters, n, centers, cur_k);
+			update_radii(objs, clusters, n, centers, radii, cur_k);
 		}
 		if (!converged || !max_radius)
 			break;
@@ -319,6 +731,12 @@ kmeans(POINT4D *objs,
 
 int *
 lwgeom_cluster_kmeans(const LWGEOM **geoms, uint32_t n, uint32_t k, double max_radius)
+{
+	return lwgeom_cluster_kmeans_batch(geoms, n, k, max_radius, 0);
+}
+
+int *
+lwgeom_cluster_kmeans_batch(const LWGEOM **geoms, uint32_t n, uint32_t k, double max_radius, uint32_t batch_size)
 {
 	uint32_t num_non_empty = 0;
 
@@ -426,7 +844,8 @@ lwgeom_cluster_kmeans(const LWGEOM **geoms, uint32_t n, uint32_t k, double max_r
 	{
 		uint32_t *clusters_dense = lwalloc(sizeof(uint32_t) * num_non_empty);
 		memset(clusters_dense, 0, sizeof(uint32_t) * num_non_empty);
-		uint32_t output_cluster_count = kmeans(objs_dense, clusters_dense, num_non_empty, centers, radii, k, max_radius);
+		uint32_t output_cluster_count =
+		    kmeans(objs_dense, clusters_dense, num_non_empty, centers, radii, k, max_radius, batch_size);
 
 		uint32_t d = 0;
 		for (uint32_t i = 0; i < n; i++)
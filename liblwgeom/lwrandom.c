@@ -39,6 +39,15 @@
 static unsigned char _lwrandom_seed_set = 0;
 static int32_t _lwrandom_seed[3] = {0x330e, 0xabcd, 0x1234};
 
+static void
+_lwrandom_seeds_from(int32_t seed, int32_t *s1, int32_t *s2)
+{
+	/* s1 value between 1 and 2147483562 */
+	*s1 = (((int64_t)seed + 0xfeed) % 2147483562) + 1;
+	/* s2 value between 1 and 2147483398 */
+	*s2 = ((((int64_t)seed + 0xdefeb) << 5) % 2147483398) + 1;
+}
+
 /*
  * Set seed for a random number generator.
  * Repeatable numbers are generated with seed values >= 1.
@@ -54,13 +63,17 @@ lwrandom_set_seed(int32_t seed)
 		else
 			return;
 	}
-	/* s1 value between 1 and 2147483562 */
-	_lwrandom_seed[1] = (((int64_t)seed + 0xfeed) % 2147483562) + 1;
-	/* s2 value between 1 and 2147483398 */
-	_lwrandom_seed[2] = ((((int64_t)seed + 0xdefeb) << 5) % 2147483398) + 1;
+	_lwrandom_seeds_from(seed, &_lwrandom_seed[1], &_lwrandom_seed[2]);
 	_lwrandom_seed_set = 1;
 }
 
+/* Set the seed of a caller-owned generator, repeatable for any seed */
+void
+lwrandom_state_set_seed(LWRANDOM_STATE *state, int32_t seed)
+{
+	_lwrandom_seeds_from(seed, &state->s1, &state->s2);
+}
+
 /* for low-level external debugging */
 void
 _lwrandom_set_seeds(int32_t s1, int32_t s2)
@@ -90,14 +103,12 @@ _lwrandom_get_seed(size_t idx)
  *   Communications of the ACM, Volume 31, Number 6, June 1988,
  *   pages 742-751. doi:10.1145/62959.62969
  */
-double
-lwrandom_uniform(void)
+static double
+_lwrandom_uniform(int32_t *s1, int32_t *s2)
 {
 	double value;
 	int32_t k;
 	int32_t z;
-	int32_t *s1 = &_lwrandom_seed[1];
-	int32_t *s2 = &_lwrandom_seed[2];
 
 	k = *s1 / 53668;
 	*s1 = 40014 * (*s1 - k * 53668) - k * 12211;
@@ -117,3 +128,15 @@ lwrandom_uniform(void)
 
 	return value;
 }
+
+double
+lwrandom_uniform(void)
+{
+	return _lwrandom_uniform(&_lwrandom_seed[1], &_lwrandom_seed[2]);
+}
+
+double
+lwrandom_state_uniform(LWRANDOM_STATE *state)
+{
+	return _lwrandom_uniform(&state->s1, &state->s2);
+}
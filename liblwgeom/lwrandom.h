@@ -28,6 +28,19 @@
 void lwrandom_set_seed(int32_t seed);
 double lwrandom_uniform(void);
 
+/*
+ * Generator with caller-owned state, for algorithms that need
+ * repeatable numbers without touching the shared seed above.
+ */
+typedef struct
+{
+	int32_t s1;
+	int32_t s2;
+} LWRANDOM_STATE;
+
+void lwrandom_state_set_seed(LWRANDOM_STATE *state, int32_t seed);
+double lwrandom_state_uniform(LWRANDOM_STATE *state);
+
 /* for low-level external debugging */
 void _lwrandom_set_seeds(int32_t s1, int32_t s2);
 int32_t _lwrandom_get_seed(size_t idx);
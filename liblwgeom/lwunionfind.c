@@ -109,6 +109,67 @@ UF_union(UNIONFIND* uf, uint32_t i, uint32_t j)
 	uf->num_clusters--;
 }
 
+/* Find with path halving. Parents only ever move towards the root, so a
+ * failed or stale compare-and-swap leaves a valid, if longer, path. */
+uint32_t
+UF_find_concurrent(UNIONFIND* uf, uint32_t i)
+{
+	for (;;)
+	{
+		uint32_t parent = __atomic_load_n(&uf->clusters[i], __ATOMIC_ACQUIRE);
+		uint32_t grandparent;
+
+		if (parent == i)
+			return i;
+
+		grandparent = __atomic_load_n(&uf->clusters[parent], __ATOMIC_ACQUIRE);
+		if (grandparent != parent)
+			__atomic_compare_exchange_n(&uf->clusters[i], &parent, grandparent, LW_TRUE,
+			                            __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+		i = grandparent;
+	}
+}
+
+void
+UF_union_concurrent(UNIONFIND* uf, uint32_t i, uint32_t j)
+{
+	for (;;)
+	{
+		uint32_t a = UF_find_concurrent(uf, i);
+		uint32_t b = UF_find_concurrent(uf, j);
+
+		if (a == b)
+			return;
+
+		/* Link the larger root under the smaller one, if it still is a root */
+		if (a < b)
+		{
+			uint32_t tmp = a;
+			a = b;
+			b = tmp;
+		}
+		if (__atomic_compare_exchange_n(&uf->clusters[a], &a, b, LW_FALSE,
+		                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return;
+	}
+}
+
+void
+UF_recount(UNIONFIND* uf)
+{
+	uint32_t i;
+
+	memset(uf->cluster_sizes, 0, uf->N * sizeof(uint32_t));
+	uf->num_clusters = 0;
+	for (i = 0; i < uf->N; i++)
+	{
+		uint32_t root = UF_find(uf, i);
+		if (root == i)
+			uf->num_clusters++;
+		uf->cluster_sizes[root]++;
+	}
+}
+
 uint32_t*
 UF_ordered_by_cluster(UNIONFIND* uf)
 {
@@ -51,6 +51,16 @@ uint32_t UF_size(UNIONFIND* uf, uint32_t i);
 /* Merge the clusters that contain the two specified component ids */
 void UF_union(UNIONFIND* uf, uint32_t i, uint32_t j);
 
+/* Thread-safe variants of UF_find and UF_union, for use by several threads
+ * at once. Clusters are always rooted at their smallest component id.
+ * They do not maintain cluster sizes or counts, call UF_recount once the
+ * threads are done. */
+uint32_t UF_find_concurrent(UNIONFIND* uf, uint32_t i);
+void UF_union_concurrent(UNIONFIND* uf, uint32_t i, uint32_t j);
+
+/* Recompute cluster sizes and count after UF_union_concurrent calls */
+void UF_recount(UNIONFIND* uf);
+
 /* Return an array of component ids, where components that are in the
  * same cluster are contiguous in the array */
 uint32_t* UF_ordered_by_cluster(UNIONFIND* uf);
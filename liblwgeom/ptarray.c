@@ -1810,25 +1810,7 @@ ptarray_arc_length_2d(const POINTARRAY *pts)
 double
 ptarray_length_2d(const POINTARRAY *pts)
 {
-	double dist = 0.0;
-	uint32_t i;
-	const POINT2D *frm;
-	const POINT2D *to;
-
-	if ( pts->npoints < 2 ) return 0.0;
-
-	frm = getPoint2d_cp(pts, 0);
-
-	for ( i=1; i < pts->npoints; i++ )
-	{
-		to = getPoint2d_cp(pts, i);
-
-		dist += sqrt( ((frm->x - to->x)*(frm->x - to->x))  +
-		              ((frm->y - to->y)*(frm->y - to->y)) );
-
-		frm = to;
-	}
-	return dist;
+	return ptarray_length_2d_simd(pts);
 }
 
 /**
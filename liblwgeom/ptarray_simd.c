@@ -0,0 +1,585 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************/
+
+/*
+ * SIMD kernels for the point array reductions: the per-ordinate
+ * minimum and maximum behind the cartesian bounding box, and the
+ * 2D length.
+ *
+ * The kernel set is picked at first use from what the CPU supports
+ * (SSE2 and AVX on x86_64, NEON on aarch64), and can be forced with
+ * lw_simd_set_level(). Every level gives the results of the scalar
+ * loops bit for bit:
+ *
+ *  - min/max keep several accumulators, which is only exact when the
+ *    order the points are visited in does not matter. It does when a
+ *    NaN or a -0.0 shows up (FP_MIN keeps whichever came first), so
+ *    the kernels watch for those and leave such arrays to the scalar
+ *    loop;
+ *  - lengths compute several segments at once but add them to the
+ *    total one at a time, in order. On aarch64 the scalar expression
+ *    may be contracted into fused multiply-adds, so there it stays
+ *    scalar.
+ */
+
+#include "liblwgeom_internal.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LW_SIMD_HAVE_X86 1
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#define LW_SIMD_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+typedef void (*lw_minmax_kernel)(const double *p, uint32_t n, uint32_t ndims, double *min, double *max);
+typedef double (*lw_length_kernel)(const double *p, uint32_t n, uint32_t ndims);
+
+static int lw_simd_level = LW_SIMD_AUTO;
+static lw_minmax_kernel lw_minmax = NULL;
+static lw_length_kernel lw_length_2d = NULL;
+
+/*
+ * Scalar kernels, the reference for all the others.
+ */
+
+static inline void
+minmax_scalar_n(const double *p, uint32_t n, uint32_t ndims, double *min, double *max)
+{
+	double lo[4], hi[4];
+	uint32_t i, d;
+
+	for (d = 0; d < ndims; d++)
+		lo[d] = hi[d] = p[d];
+
+	for (i = 1; i < n; i++)
+	{
+		p += ndims;
+		for (d = 0; d < ndims; d++)
+		{
+			lo[d] = FP_MIN(lo[d], p[d]);
+			hi[d] = FP_MAX(hi[d], p[d]);
+		}
+	}
+
+	for (d = 0; d < ndims; d++)
+	{
+		min[d] = lo[d];
+		max[d] = hi[d];
+	}
+}
+
+static void
+minmax_scalar(const double *p, uint32_t n, uint32_t ndims, double *min, double *max)
+{
+	/* Constant strides let the compiler unroll the ordinate loops */
+	switch (ndims)
+	{
+	case 2:
+		minmax_scalar_n(p, n, 2, min, max);
+		break;
+	case 3:
+		minmax_scalar_n(p, n, 3, min, max);
+		break;
+	default:
+		minmax_scalar_n(p, n, 4, min, max);
+		break;
+	}
+}
+
+static double
+length_2d_scalar(const double *p, uint32_t n, uint32_t ndims)
+{
+	double dist = 0.0;
+	uint32_t i;
+
+	for (i = 1; i < n; i++, p += ndims)
+	{
+		const double *q = p + ndims;
+		dist += sqrt(((p[0] - q[0]) * (p[0] - q[0])) + ((p[1] - q[1]) * (p[1] - q[1])));
+	}
+	return dist;
+}
+
+#ifdef LW_SIMD_HAVE_X86
+
+/*
+ * Flag NaN and -0.0 lanes of v in the sign bits of odd.
+ */
+static inline __m128d
+sse2_odd(__m128d odd, __m128d v)
+{
+	__m128d nan = _mm_cmpunord_pd(v, v);
+	__m128d negzero = _mm_and_pd(_mm_cmpeq_pd(v, _mm_setzero_pd()), v);
+	return _mm_or_pd(odd, _mm_or_pd(nan, negzero));
+}
+
+/* Z and/or M of a point, lane 1 is zero for three ordinates */
+static inline __m128d
+sse2_load_zm(const double *p, uint32_t ndims)
+{
+	return ndims == 4 ? _mm_loadu_pd(p + 2) : _mm_load_sd(p + 2);
+}
+
+static void
+minmax_sse2(const double *p, uint32_t n, uint32_t ndims, double *min, double *max)
+{
+	const double *q = p;
+	int zm = ndims > 2;
+	__m128d v, w;
+	__m128d lo0, hi0, lo1, hi1, odd;
+	__m128d zlo0, zhi0, zlo1, zhi1;
+	uint32_t i;
+
+	v = _mm_loadu_pd(q);
+	lo0 = hi0 = lo1 = hi1 = v;
+	odd = sse2_odd(_mm_setzero_pd(), v);
+	zlo0 = zhi0 = zlo1 = zhi1 = _mm_setzero_pd();
+	if (zm)
+	{
+		v = sse2_load_zm(q, ndims);
+		zlo0 = zhi0 = zlo1 = zhi1 = v;
+		odd = sse2_odd(odd, v);
+	}
+
+	/* Even and odd points go to their own accumulators */
+	for (i = 1; i + 1 < n; i += 2)
+	{
+		q += ndims;
+		v = _mm_loadu_pd(q);
+		w = _mm_loadu_pd(q + ndims);
+		lo0 = _mm_min_pd(lo0, v);
+		hi0 = _mm_max_pd(hi0, v);
+		lo1 = _mm_min_pd(lo1, w);
+		hi1 = _mm_max_pd(hi1, w);
+		odd = sse2_odd(sse2_odd(odd, v), w);
+		if (zm)
+		{
+			v = sse2_load_zm(q, ndims);
+			w = sse2_load_zm(q + ndims, ndims);
+			zlo0 = _mm_min_pd(zlo0, v);
+			zhi0 = _mm_max_pd(zhi0, v);
+			zlo1 = _mm_min_pd(zlo1, w);
+			zhi1 = _mm_max_pd(zhi1, w);
+			odd = sse2_odd(sse2_odd(odd, v), w);
+		}
+		q += ndims;
+	}
+	if (i < n)
+	{
+		q += ndims;
+		v = _mm_loadu_pd(q);
+		lo0 = _mm_min_pd(lo0, v);
+		hi0 = _mm_max_pd(hi0, v);
+		odd = sse2_odd(odd, v);
+		if (zm)
+		{
+			v = sse2_load_zm(q, ndims);
+			zlo0 = _mm_min_pd(zlo0, v);
+			zhi0 = _mm_max_pd(zhi0, v);
+			odd = sse2_odd(odd, v);
+		}
+	}
+
+	if (_mm_movemask_pd(odd))
+	{
+		minmax_scalar(p, n, ndims, min, max);
+		return;
+	}
+
+	_mm_storeu_pd(min, _mm_min_pd(lo0, lo1));
+	_mm_storeu_pd(max, _mm_max_pd(hi0, hi1));
+	if (ndims == 4)
+	{
+		_mm_storeu_pd(min + 2, _mm_min_pd(zlo0, zlo1));
+		_mm_storeu_pd(max + 2, _mm_max_pd(zhi0, zhi1));
+	}
+	else if (ndims == 3)
+	{
+		_mm_store_sd(min + 2, _mm_min_pd(zlo0, zlo1));
+		_mm_store_sd(max + 2, _mm_max_pd(zhi0, zhi1));
+	}
+}
+
+static double
+length_2d_sse2(const double *p, uint32_t n, uint32_t ndims)
+{
+	double dist = 0.0;
+	double seg[2];
+	const double *q = p;
+	uint32_t i;
+
+	/* Segments ending at points i and i+1 */
+	for (i = 1; i + 1 < n; i += 2)
+	{
+		__m128d p0 = _mm_loadu_pd(q);
+		__m128d p1 = _mm_loadu_pd(q + ndims);
+		__m128d p2 = _mm_loadu_pd(q + 2 * ndims);
+		__m128d d0 = _mm_sub_pd(p0, p1);
+		__m128d d1 = _mm_sub_pd(p1, p2);
+		d0 = _mm_mul_pd(d0, d0);
+		d1 = _mm_mul_pd(d1, d1);
+		_mm_storeu_pd(seg, _mm_sqrt_pd(_mm_add_pd(_mm_unpacklo_pd(d0, d1), _mm_unpackhi_pd(d0, d1))));
+		dist += seg[0];
+		dist += seg[1];
+		q += 2 * ndims;
+	}
+	for (; i < n; i++, q += ndims)
+	{
+		const double *r = q + ndims;
+		dist += sqrt(((q[0] - r[0]) * (q[0] - r[0])) + ((q[1] - r[1]) * (q[1] - r[1])));
+	}
+	return dist;
+}
+
+__attribute__((target("avx")))
+static inline __m256d
+avx_odd(__m256d odd, __m256d v)
+{
+	__m256d nan = _mm256_cmp_pd(v, v, _CMP_UNORD_Q);
+	__m256d negzero = _mm256_and_pd(_mm256_cmp_pd(v, _mm256_setzero_pd(), _CMP_EQ_OQ), v);
+	return _mm256_or_pd(odd, _mm256_or_pd(nan, negzero));
+}
+
+/*
+ * Two XY points, or one XYZ or XYZM point. Three ordinates are read
+ * through a mask, so the last point never reads past the array.
+ */
+__attribute__((target("avx")))
+static inline __m256d
+avx_load(const double *p, uint32_t ndims)
+{
+	if (ndims == 3)
+		return _mm256_maskload_pd(p, _mm256_set_epi64x(0, -1, -1, -1));
+	return _mm256_loadu_pd(p);
+}
+
+__attribute__((target("avx")))
+static void
+minmax_avx(const double *p, uint32_t n, uint32_t ndims, double *min, double *max)
+{
+	uint32_t step = ndims == 2 ? 4 : ndims;
+	uint32_t nvec = ndims == 2 ? n / 2 : n;
+	const double *q = p;
+	__m256d v, w, lo0, hi0, lo1, hi1, odd;
+	__m128d odd2 = _mm_setzero_pd();
+	uint32_t i;
+
+	if (nvec < 2)
+	{
+		minmax_sse2(p, n, ndims, min, max);
+		return;
+	}
+
+	v = avx_load(q, ndims);
+	lo0 = hi0 = lo1 = hi1 = v;
+	odd = avx_odd(_mm256_setzero_pd(), v);
+
+	for (i = 1; i + 1 < nvec; i += 2)
+	{
+		q += step;
+		v = avx_load(q, ndims);
+		w = avx_load(q + step, ndims);
+		lo0 = _mm256_min_pd(lo0, v);
+		hi0 = _mm256_max_pd(hi0, v);
+		lo1 = _mm256_min_pd(lo1, w);
+		hi1 = _mm256_max_pd(hi1, w);
+		odd = avx_odd(avx_odd(odd, v), w);
+		q += step;
+	}
+	if (i < nvec)
+	{
+		q += step;
+		v = avx_load(q, ndims);
+		lo0 = _mm256_min_pd(lo0, v);
+		hi0 = _mm256_max_pd(hi0, v);
+		odd = avx_odd(odd, v);
+	}
+	lo0 = _mm256_min_pd(lo0, lo1);
+	hi0 = _mm256_max_pd(hi0, hi1);
+
+	if (ndims == 2)
+	{
+		/* Fold the two points of the vectors, then the odd one out */
+		__m128d lo = _mm_min_pd(_mm256_castpd256_pd128(lo0), _mm256_extractf128_pd(lo0, 1));
+		__m128d hi = _mm_max_pd(_mm256_castpd256_pd128(hi0), _mm256_extractf128_pd(hi0, 1));
+		if (n & 1)
+		{
+			__m128d t = _mm_loadu_pd(p + 2 * (n - 1));
+			lo = _mm_min_pd(lo, t);
+			hi = _mm_max_pd(hi, t);
+			odd2 = sse2_odd(odd2, t);
+		}
+		if (_mm256_movemask_pd(odd) || _mm_movemask_pd(odd2))
+		{
+			minmax_scalar(p, n, ndims, min, max);
+			return;
+		}
+		_mm_storeu_pd(min, lo);
+		_mm_storeu_pd(max, hi);
+		return;
+	}
+
+	if (_mm256_movemask_pd(odd))
+	{
+		minmax_scalar(p, n, ndims, min, max);
+		return;
+	}
+	_mm256_storeu_pd(min, lo0);
+	_mm256_storeu_pd(max, hi0);
+}
+
+__attribute__((target("avx")))
+static double
+length_2d_avx(const double *p, uint32_t n, uint32_t ndims)
+{
+	double dist = 0.0;
+	double seg[4];
+	const double *q = p;
+	uint32_t i;
+
+	/* Segments ending at points i to i+3 */
+	for (i = 1; i + 3 < n; i += 4)
+	{
+		__m128d p0 = _mm_loadu_pd(q);
+		__m128d p1 = _mm_loadu_pd(q + ndims);
+		__m128d p2 = _mm_loadu_pd(q + 2 * ndims);
+		__m128d p3 = _mm_loadu_pd(q + 3 * ndims);
+		__m128d p4 = _mm_loadu_pd(q + 4 * ndims);
+		__m256d d01 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_sub_pd(p0, p1)), _mm_sub_pd(p1, p2), 1);
+		__m256d d23 = _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_sub_pd(p2, p3)), _mm_sub_pd(p3, p4), 1);
+		__m256d s = _mm256_hadd_pd(_mm256_mul_pd(d01, d01), _mm256_mul_pd(d23, d23));
+		_mm256_storeu_pd(seg, _mm256_sqrt_pd(s));
+		/* hadd interleaves its inputs: segments 0, 2, 1, 3 */
+		dist += seg[0];
+		dist += seg[2];
+		dist += seg[1];
+		dist += seg[3];
+		q += 4 * ndims;
+	}
+	for (; i < n; i++, q += ndims)
+	{
+		const double *r = q + ndims;
+		dist += sqrt(((q[0] - r[0]) * (q[0] - r[0])) + ((q[1] - r[1]) * (q[1] - r[1])));
+	}
+	return dist;
+}
+
+#endif /* LW_SIMD_HAVE_X86 */
+
+#ifdef LW_SIMD_HAVE_NEON
+
+/* Z and/or M of a point, lane 1 is zero for three ordinates */
+static inline float64x2_t
+neon_load_zm(const double *p, uint32_t ndims)
+{
+	return ndims == 4 ? vld1q_f64(p + 2) : vcombine_f64(vld1_f64(p + 2), vdup_n_f64(0.0));
+}
+
+/*
+ * NEON keeps the NaN lanes apart from the -0.0 ones: a lane of
+ * notnan is cleared by a NaN, a lane of negzero gets its sign bit
+ * set by a -0.0.
+ */
+static inline void
+neon_odd(uint64x2_t *notnan, uint64x2_t *negzero, float64x2_t v)
+{
+	*notnan = vandq_u64(*notnan, vceqq_f64(v, v));
+	*negzero = vorrq_u64(*negzero, vandq_u64(vceqzq_f64(v), vreinterpretq_u64_f64(v)));
+}
+
+static void
+minmax_neon(const double *p, uint32_t n, uint32_t ndims, double *min, double *max)
+{
+	const double *q = p;
+	int zm = ndims > 2;
+	float64x2_t v, w;
+	float64x2_t lo0, hi0, lo1, hi1;
+	float64x2_t zlo0, zhi0, zlo1, zhi1;
+	uint64x2_t notnan = vdupq_n_u64(~UINT64_C(0));
+	uint64x2_t negzero = vdupq_n_u64(0);
+	uint32_t i;
+
+	v = vld1q_f64(q);
+	lo0 = hi0 = lo1 = hi1 = v;
+	neon_odd(&notnan, &negzero, v);
+	zlo0 = zhi0 = zlo1 = zhi1 = vdupq_n_f64(0.0);
+	if (zm)
+	{
+		v = neon_load_zm(q, ndims);
+		zlo0 = zhi0 = zlo1 = zhi1 = v;
+		neon_odd(&notnan, &negzero, v);
+	}
+
+	for (i = 1; i + 1 < n; i += 2)
+	{
+		q += ndims;
+		v = vld1q_f64(q);
+		w = vld1q_f64(q + ndims);
+		lo0 = vminq_f64(lo0, v);
+		hi0 = vmaxq_f64(hi0, v);
+		lo1 = vminq_f64(lo1, w);
+		hi1 = vmaxq_f64(hi1, w);
+		neon_odd(&notnan, &negzero, v);
+		neon_odd(&notnan, &negzero, w);
+		if (zm)
+		{
+			v = neon_load_zm(q, ndims);
+			w = neon_load_zm(q + ndims, ndims);
+			zlo0 = vminq_f64(zlo0, v);
+			zhi0 = vmaxq_f64(zhi0, v);
+			zlo1 = vminq_f64(zlo1, w);
+			zhi1 = vmaxq_f64(zhi1, w);
+			neon_odd(&notnan, &negzero, v);
+			neon_odd(&notnan, &negzero, w);
+		}
+		q += ndims;
+	}
+	if (i < n)
+	{
+		q += ndims;
+		v = vld1q_f64(q);
+		lo0 = vminq_f64(lo0, v);
+		hi0 = vmaxq_f64(hi0, v);
+		neon_odd(&notnan, &negzero, v);
+		if (zm)
+		{
+			v = neon_load_zm(q, ndims);
+			zlo0 = vminq_f64(zlo0, v);
+			zhi0 = vmaxq_f64(zhi0, v);
+			neon_odd(&notnan, &negzero, v);
+		}
+	}
+
+	if (vminvq_u32(vreinterpretq_u32_u64(notnan)) == 0 ||
+	    vmaxvq_u32(vreinterpretq_u32_u64(negzero)) != 0)
+	{
+		minmax_scalar(p, n, ndims, min, max);
+		return;
+	}
+
+	vst1q_f64(min, vminq_f64(lo0, lo1));
+	vst1q_f64(max, vmaxq_f64(hi0, hi1));
+	if (ndims == 4)
+	{
+		vst1q_f64(min + 2, vminq_f64(zlo0, zlo1));
+		vst1q_f64(max + 2, vmaxq_f64(zhi0, zhi1));
+	}
+	else if (ndims == 3)
+	{
+		vst1_f64(min + 2, vget_low_f64(vminq_f64(zlo0, zlo1)));
+		vst1_f64(max + 2, vget_low_f64(vmaxq_f64(zhi0, zhi1)));
+	}
+}
+
+#endif /* LW_SIMD_HAVE_NEON */
+
+static int
+lw_simd_best(void)
+{
+#ifdef LW_SIMD_HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx"))
+		return LW_SIMD_AVX;
+	return LW_SIMD_SSE2;
+#elif defined(LW_SIMD_HAVE_NEON)
+	return LW_SIMD_NEON;
+#else
+	return LW_SIMD_SCALAR;
+#endif
+}
+
+/**
+* Use the kernels of the given level, LW_SIMD_AUTO for the best
+* the CPU supports. Returns LW_FAILURE, keeping the current kernels,
+* if the level is not available on this CPU.
+*/
+int
+lw_simd_set_level(int level)
+{
+	if (level == LW_SIMD_AUTO)
+		level = lw_simd_best();
+
+	switch (level)
+	{
+	case LW_SIMD_SCALAR:
+		lw_minmax = minmax_scalar;
+		lw_length_2d = length_2d_scalar;
+		break;
+#ifdef LW_SIMD_HAVE_X86
+	case LW_SIMD_SSE2:
+		lw_minmax = minmax_sse2;
+		lw_length_2d = length_2d_sse2;
+		break;
+	case LW_SIMD_AVX:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx"))
+			return LW_FAILURE;
+		lw_minmax = minmax_avx;
+		lw_length_2d = length_2d_avx;
+		break;
+#endif
+#ifdef LW_SIMD_HAVE_NEON
+	case LW_SIMD_NEON:
+		lw_minmax = minmax_neon;
+		lw_length_2d = length_2d_scalar;
+		break;
+#endif
+	default:
+		return LW_FAILURE;
+	}
+
+	lw_simd_level = level;
+	return LW_SUCCESS;
+}
+
+int
+lw_simd_get_level(void)
+{
+	if (lw_simd_level == LW_SIMD_AUTO)
+		lw_simd_set_level(LW_SIMD_AUTO);
+	return lw_simd_level;
+}
+
+/**
+* Minimum and maximum of every ordinate of a non-empty #POINTARRAY,
+* in x, y, z, m order for the ordinates it has. Both min and max
+* need room for four ordinates.
+*/
+void
+ptarray_minmax_simd(const POINTARRAY *pa, double *min, double *max)
+{
+	if (!lw_minmax)
+		lw_simd_set_level(LW_SIMD_AUTO);
+	lw_minmax((const double *)pa->serialized_pointlist, pa->npoints, FLAGS_NDIMS(pa->flags), min, max);
+}
+
+/**
+* 2D length of a #POINTARRAY, as ptarray_length_2d
+*/
+double
+ptarray_length_2d_simd(const POINTARRAY *pa)
+{
+	if (pa->npoints < 2)
+		return 0.0;
+	if (!lw_length_2d)
+		lw_simd_set_level(LW_SIMD_AUTO);
+	return lw_length_2d((const double *)pa->serialized_pointlist, pa->npoints, FLAGS_NDIMS(pa->flags));
+}
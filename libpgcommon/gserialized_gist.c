@@ -16,6 +16,13 @@
 
 #include "../postgis_config.h"
 
+/* Include for toast_raw_datum_size */
+#if POSTGIS_PGSQL_VERSION < 130
+#include "access/tuptoaster.h"
+#else
+#include "access/detoast.h"
+#endif
+
 /*#define POSTGIS_DEBUG_LEVEL 4*/
 
 #include "liblwgeom.h"         /* For standard geometry types. */
@@ -28,6 +35,57 @@
                               FLAGS_GET_Z(f) ? 3 : 2 )
 
 
+/* Order of the sorted GiST build, set by postgis.gist_build_order */
+int postgis_gist_build_order = GIST_BUILD_ORDER_SIZE;
+
+/*
+ * Size above which boxes are large for the sorted GiST build, set by
+ * postgis.gist_build_large_size. The key of a single box is all the sort
+ * sees, so the threshold is in the units of the data.
+ */
+double postgis_gist_build_large_size = GIST_BUILD_LARGE_SIZE_DEFAULT;
+
+static inline bool
+gist_sort_range_is_large(float min, float max)
+{
+	return (double)max - (double)min > postgis_gist_build_large_size;
+}
+
+/*
+ * The sorted GiST build fills the index pages with the keys in sort
+ * order, so pages hold boxes that are close on the Hilbert curve of
+ * their centers. Taken alone, the centers of a few large boxes (long
+ * roads, administrative areas) fall between small ones, and stretch
+ * their pages over the whole extent of the large box. With the size
+ * order, large boxes are sorted after all the others, along the same
+ * curve, so that they share pages with each other instead.
+ *
+ * The curve runs on the bit patterns of the float coordinates, which
+ * sort like the values for each sign. Keys of points are the same in
+ * both orders, but for the lowest bit.
+ */
+uint64_t
+gserialized_gist_sort_key(float xmin, float xmax, float ymin, float ymax)
+{
+	union floatuint {
+		uint32_t u;
+		float f;
+	} x, y;
+	uint64_t hash;
+
+	x.f = (xmax + xmin) / 2;
+	y.f = (ymax + ymin) / 2;
+	hash = uint32_hilbert(y.u, x.u);
+
+	if (postgis_gist_build_order != GIST_BUILD_ORDER_SIZE)
+		return hash;
+
+	hash >>= 1;
+	if (gist_sort_range_is_large(xmin, xmax) || gist_sort_range_is_large(ymin, ymax))
+		hash |= UINT64_C(1) << 63;
+	return hash;
+}
+
 /* Generate human readable form for GIDX. */
 char* gidx_to_string(GIDX *a)
 {
@@ -138,6 +196,49 @@ void gbox_from_gidx(GIDX *a, GBOX *gbox, int flags)
 }
 
 
+/* Box reads from toasted geometries, reported by _postgis_cache_stats */
+GSERIALIZEDDetoastStats gserialized_detoast_stats = {0, 0, 0};
+
+/*
+ * Serializations without a box (see lwgeom_needs_bbox) are two point
+ * lines at most: 8 bytes of header, 8 of extended flags, 16 of types
+ * and counts and 2 XYZM points.
+ */
+#define GSERIALIZED_BOXLESS_MAX_SIZE 96
+
+/**
+* Read enough of a #GSERIALIZED datum to get its bounding box: the serialized
+* box if there is one, else the whole object, which is small when it has no
+* box. Only large objects stripped of their box (see postgis_dropbbox) need
+* to be read whole, which is only done when detoast is true, otherwise NULL is
+* returned. Free the result with POSTGIS_FREE_IF_COPY_P.
+*/
+GSERIALIZED *
+gserialized_datum_get_box_part(Datum gsdatum, bool detoast)
+{
+	GSERIALIZED *gpart;
+	struct varlena *datum = (struct varlena *)DatumGetPointer(gsdatum);
+	bool toasted = PG_GSERIALIZED_DATUM_IS_TOASTED(datum);
+
+	if (!PG_GSERIALIZED_DATUM_NEEDS_DETOAST(datum))
+		return (GSERIALIZED *)datum;
+
+	gpart = (GSERIALIZED *)PG_DETOAST_DATUM_SLICE(gsdatum, 0, GSERIALIZED_BOXLESS_MAX_SIZE);
+	if (gserialized_has_bbox(gpart) || VARSIZE(gpart) >= toast_raw_datum_size(gsdatum))
+	{
+		if (toasted && detoast)
+			gserialized_detoast_stats.box_sliced++;
+		return gpart;
+	}
+
+	POSTGIS_FREE_IF_COPY_P(gpart, gsdatum);
+	if (!detoast)
+		return NULL;
+	if (toasted)
+		gserialized_detoast_stats.box_detoasted++;
+	return (GSERIALIZED *)PG_DETOAST_DATUM(gsdatum);
+}
+
 /**
 * Peak into a #GSERIALIZED datum to find the bounding box. If the
 * box is there, copy it out and return it. If not, calculate the box from the
@@ -147,16 +248,7 @@ void gbox_from_gidx(GIDX *a, GBOX *gbox, int flags)
 int
 gserialized_datum_get_gidx_p(Datum gsdatum, GIDX *gidx)
 {
-	GSERIALIZED *gpart = NULL;
-	int need_detoast = PG_GSERIALIZED_DATUM_NEEDS_DETOAST((struct varlena *)gsdatum);
-	if (need_detoast)
-	{
-		gpart = (GSERIALIZED *)PG_DETOAST_DATUM_SLICE(gsdatum, 0, gserialized_max_header_size());
-	}
-	else
-	{
-		gpart = (GSERIALIZED *)gsdatum;
-	}
+	GSERIALIZED *gpart = gserialized_datum_get_box_part(gsdatum, true);
 
 	/* Do we even have a serialized bounding box? */
 	if (gserialized_has_bbox(gpart))
@@ -188,13 +280,6 @@ gserialized_datum_get_gidx_p(Datum gsdatum, GIDX *gidx)
 		/* No, we need to calculate it from the full object. */
 		LWGEOM *lwgeom;
 		GBOX gbox;
-		if (need_detoast && LWSIZE_GET(gpart->size) >= gserialized_max_header_size())
-		{
-			/* If we haven't, read the whole gserialized object */
-			POSTGIS_FREE_IF_COPY_P(gpart, gsdatum);
-			gpart = (GSERIALIZED *)PG_DETOAST_DATUM(gsdatum);
-		}
-
 		lwgeom = lwgeom_from_gserialized(gpart);
 		if (lwgeom_calculate_gbox(lwgeom, &gbox) == LW_FAILURE)
 		{
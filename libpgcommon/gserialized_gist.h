@@ -96,6 +96,19 @@ int box2df_to_gbox_p(BOX2DF *a, GBOX *box);
 ** Fast functions for pulling boxes out of serializations.
 */
 
+/* Counts of the boxes read from toasted datums */
+typedef struct
+{
+	uint64_t box_sliced;         /* Read from a slice of the datum */
+	uint64_t box_detoasted;      /* Read from the whole datum, which had no box */
+	uint64_t predicates_skipped; /* Predicates answered by the boxes alone */
+} GSERIALIZEDDetoastStats;
+
+extern GSERIALIZEDDetoastStats gserialized_detoast_stats;
+
+/* Read the part of a datum holding its bounding box, NULL if it must be read whole and detoast is false */
+GSERIALIZED *gserialized_datum_get_box_part(Datum gsdatum, bool detoast);
+
 /* Pull out the #GIDX bounding box and flags with a absolute minimum system overhead */
 int gserialized_datum_get_gidx_p(Datum gserialized_datum, GIDX *gidx);
 int gserialized_datum_get_box2df_p(Datum gsdatum, BOX2DF *box2df);
@@ -114,9 +127,26 @@ bool box2df_overbelow(const BOX2DF *a, const BOX2DF *b);
 bool box2df_below(const BOX2DF *a, const BOX2DF *b);
 bool box2df_above(const BOX2DF *a, const BOX2DF *b);
 bool box2df_overabove(const BOX2DF *a, const BOX2DF *b);
+double box2df_distance(const BOX2DF *a, const BOX2DF *b);
 
 void gidx_validate(GIDX *b);
 void gidx_set_unknown(GIDX *a);
 bool gidx_overlaps(GIDX *a, GIDX *b);
 bool gidx_equals(GIDX *a, GIDX *b);
 bool gidx_contains(GIDX *a, GIDX *b);
+
+/* Order of the boxes in a sorted GiST index build */
+typedef enum
+{
+	GIST_BUILD_ORDER_CENTER = 0, /* Hilbert curve of the box centers */
+	GIST_BUILD_ORDER_SIZE = 1    /* Same, with large boxes after the others */
+} gistBuildOrder;
+
+extern int postgis_gist_build_order;
+
+/* Boxes wider or taller than this are large for the size order */
+#define GIST_BUILD_LARGE_SIZE_DEFAULT 1000.0
+extern double postgis_gist_build_large_size;
+
+/* Sort key of a box for the sorted GiST build */
+uint64_t gserialized_gist_sort_key(float xmin, float xmax, float ymin, float ymax);
@@ -15,6 +15,8 @@
 #include "catalog/pg_type.h" /* for CSTRINGOID */
 #include "executor/spi.h"
 #include "fmgr.h"
+#include "lib/ilist.h"
+#include "utils/hsearch.h"
 #include "utils/memutils.h"
 
 #include "../postgis_config.h"
@@ -87,6 +89,344 @@ GetGenericCacheCollection(FunctionCallInfo fcinfo)
 }
 
 
+/******************************************************************************/
+
+/*
+* Backend geometry cache.
+*
+* The GeomCache above lives in the fn_extra of a single call site, so
+* every new query builds the indexes of its reference geometries again.
+* Indexes built on geometries that were TOASTed to disk are instead kept
+* in a backend-lifetime LRU keyed by their TOAST pointer, bounded by
+* postgis.backend_geometry_cache_size.
+*
+* Each entry owns a memory context holding a copy of the geometry, the
+* GeomCache and its index. Deleting the context frees everything, GEOS
+* objects included (through the callback PrepGeomCache registers).
+*/
+int postgis_backend_geometry_cache_size = 0;
+
+/* GEOS allocates outside of PostgreSQL, so account for it by vertex */
+#define BACKEND_CACHE_GEOS_BYTES_PER_VERTEX 64
+
+typedef struct
+{
+	Oid toastrelid;
+	Oid valueid;
+	uint32 entry_number;
+} BackendGeomCacheKey;
+
+typedef struct
+{
+	BackendGeomCacheKey key; /* hash key, must be first */
+	MemoryContext context;
+	GSERIALIZED *geom;
+	GeomCache *cache;
+	Size size;
+	uint64 build; /* tells an entry from a later one under the same key */
+	dlist_node lru_node;
+} BackendGeomCacheEntry;
+
+/*
+* Argument of a call site last found equal to a backend cache entry.
+* The reference keeps it alive, so the same pointer holds the same
+* geometry and the entry can be trusted without comparing it again.
+*/
+typedef struct
+{
+	SHARED_GSERIALIZED *geom;
+	uint64 build;
+} BackendGeomCacheCheck;
+
+/* Counters reported by _postgis_cache_stats() */
+static GeomCacheStats CacheStats[NUM_CACHE_ENTRIES];
+static GeomCacheStats BackendCacheStats;
+
+static HTAB *BackendGeomCacheHash = NULL;
+static MemoryContext BackendGeomCacheContext = NULL;
+static dlist_head BackendGeomCacheLRU = DLIST_STATIC_INIT(BackendGeomCacheLRU);
+static Size BackendGeomCacheUsed = 0;
+static uint64 BackendGeomCacheBuilds = 0;
+
+static inline Size
+BackendGeomCacheLimit(void)
+{
+	return (Size)postgis_backend_geometry_cache_size * 1024 * 1024;
+}
+
+static void
+BackendGeomCacheInit(void)
+{
+	HASHCTL ctl;
+
+	BackendGeomCacheContext = AllocSetContextCreate(TopMemoryContext,
+							"PostGIS Backend Geometry Cache",
+							ALLOCSET_DEFAULT_SIZES);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(BackendGeomCacheKey);
+	ctl.entrysize = sizeof(BackendGeomCacheEntry);
+	ctl.hcxt = BackendGeomCacheContext;
+	BackendGeomCacheHash = hash_create("PostGIS Backend Geometry Cache Hash",
+					   64,
+					   &ctl,
+					   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+}
+
+static inline void
+BackendGeomCacheKeyInit(BackendGeomCacheKey *key, uint32 entry_number, const SHARED_GSERIALIZED *g)
+{
+	memset(key, 0, sizeof(BackendGeomCacheKey));
+	key->toastrelid = g->toastrelid;
+	key->valueid = g->valueid;
+	key->entry_number = entry_number;
+}
+
+static void
+BackendGeomCacheRemove(BackendGeomCacheEntry *entry)
+{
+	BackendGeomCacheKey key = entry->key;
+	dlist_delete(&entry->lru_node);
+	BackendGeomCacheUsed -= entry->size;
+	MemoryContextDelete(entry->context);
+	hash_search(BackendGeomCacheHash, &key, HASH_REMOVE, NULL);
+}
+
+/* Drop least recently used entries until the cache fits in limit */
+static void
+BackendGeomCacheEvict(Size limit)
+{
+	while (BackendGeomCacheUsed > limit && !dlist_is_empty(&BackendGeomCacheLRU))
+		BackendGeomCacheRemove(dlist_tail_element(BackendGeomCacheEntry, lru_node, &BackendGeomCacheLRU));
+}
+
+static GeomCache *
+BackendGeomCacheGet(FunctionCallInfo fcinfo, uint32 entry_number, SHARED_GSERIALIZED *g, BackendGeomCacheCheck *check)
+{
+	BackendGeomCacheKey key;
+	BackendGeomCacheEntry *entry;
+
+	if (!g->valueid)
+		return NULL;
+
+	BackendGeomCacheKeyInit(&key, entry_number, g);
+	entry = BackendGeomCacheHash ? hash_search(BackendGeomCacheHash, &key, HASH_FIND, NULL) : NULL;
+	if (!entry)
+	{
+		BackendCacheStats.misses++;
+		return NULL;
+	}
+
+	/* TOAST value ids can be reused once the original row is gone */
+	if (check->geom != g || check->build != entry->build)
+	{
+		if (VARSIZE(entry->geom) != VARSIZE(g->geom) ||
+		    memcmp(entry->geom, g->geom, VARSIZE(g->geom)) != 0)
+		{
+			BackendGeomCacheRemove(entry);
+			BackendCacheStats.misses++;
+			return NULL;
+		}
+		if (check->geom)
+			shared_gserialized_unref(fcinfo, check->geom);
+		check->geom = shared_gserialized_ref(fcinfo, g);
+		check->build = entry->build;
+	}
+
+	dlist_move_head(&BackendGeomCacheLRU, &entry->lru_node);
+	BackendCacheStats.hits++;
+	return entry->cache;
+}
+
+/*
+* Build the index of a TOASTed geometry into a new backend cache entry.
+* Returns NULL if it could not be built or does not fit in the cache.
+*/
+static GeomCache *
+BackendGeomCacheAdd(const GeomCacheMethods *cache_methods, SHARED_GSERIALIZED *g)
+{
+	BackendGeomCacheKey key;
+	BackendGeomCacheEntry *entry;
+	MemoryContext context, old_context;
+	GSERIALIZED *geom;
+	GeomCache *cache;
+	LWGEOM *lwgeom;
+	Size size, limit = BackendGeomCacheLimit();
+	bool found;
+	int rv = LW_FAILURE;
+
+	if (!BackendGeomCacheHash)
+		BackendGeomCacheInit();
+
+	/* Build under the current context, so errors clean up after themselves */
+	context = AllocSetContextCreate(CurrentMemoryContext,
+					"PostGIS Backend Geometry Cache Entry",
+					ALLOCSET_SMALL_SIZES);
+	old_context = MemoryContextSwitchTo(context);
+	geom = palloc(VARSIZE(g->geom));
+	memcpy(geom, g->geom, VARSIZE(g->geom));
+	cache = cache_methods->GeomCacheAllocator();
+	cache->type = cache_methods->entry_number;
+	lwgeom = lwgeom_from_gserialized(geom);
+	if (lwgeom && !lwgeom_is_empty(lwgeom))
+		rv = cache_methods->GeomIndexBuilder(lwgeom, cache);
+	MemoryContextSwitchTo(old_context);
+
+	if (rv == LW_FAILURE)
+	{
+		MemoryContextDelete(context);
+		return NULL;
+	}
+
+#if POSTGIS_PGSQL_VERSION >= 130
+	size = MemoryContextMemAllocated(context, true);
+#else
+	size = 2 * VARSIZE(geom);
+#endif
+	if (cache_methods->entry_number == PREP_CACHE_ENTRY)
+		size += lwgeom_count_vertices(lwgeom) * BACKEND_CACHE_GEOS_BYTES_PER_VERTEX;
+
+	if (size > limit)
+	{
+		MemoryContextDelete(context);
+		return NULL;
+	}
+	BackendGeomCacheEvict(limit - size);
+
+	BackendGeomCacheKeyInit(&key, cache_methods->entry_number, g);
+	entry = hash_search(BackendGeomCacheHash, &key, HASH_ENTER, &found);
+	if (found)
+	{
+		/* Stale entry that failed the check in BackendGeomCacheGet */
+		dlist_delete(&entry->lru_node);
+		BackendGeomCacheUsed -= entry->size;
+		MemoryContextDelete(entry->context);
+	}
+	MemoryContextSetParent(context, BackendGeomCacheContext);
+	entry->context = context;
+	entry->geom = geom;
+	entry->cache = cache;
+	entry->size = size;
+	entry->build = ++BackendGeomCacheBuilds;
+	dlist_push_head(&BackendGeomCacheLRU, &entry->lru_node);
+	BackendGeomCacheUsed += size;
+	BackendCacheStats.builds++;
+
+	return cache;
+}
+
+/*
+* Statement geometry caches.
+*
+* Each call site keeps postgis.geometry_cache_ways GeomCache entries
+* per cache type, so joins that cycle through a few reference
+* geometries don't throw away and rebuild an index on every switch.
+* A way holds either just a key (geometry seen once) or a key and the
+* index built on it (geometry seen again). Replacement is least
+* recently used.
+*/
+int postgis_geometry_cache_ways = GEOMETRY_CACHE_WAYS_DEFAULT;
+
+typedef struct {
+	int type;
+	uint32 nways;
+	uint64 clock;
+	BackendGeomCacheCheck checked[2]; /* per argument */
+	GeomCache *way[FLEXIBLE_ARRAY_MEMBER];
+} GeomCacheWays;
+
+void
+GetGeomCacheStats(uint32_t entry_number, GeomCacheStats *stats)
+{
+	Assert(entry_number < NUM_CACHE_ENTRIES);
+	*stats = CacheStats[entry_number];
+}
+
+void
+GetBackendGeomCacheStats(GeomCacheStats *stats, uint64 *entries, uint64 *bytes)
+{
+	*stats = BackendCacheStats;
+	*entries = BackendGeomCacheHash ? hash_get_num_entries(BackendGeomCacheHash) : 0;
+	*bytes = BackendGeomCacheUsed;
+}
+
+static GeomCacheWays *
+GeomCacheWaysGet(FunctionCallInfo fcinfo, const GeomCacheMethods *cache_methods)
+{
+	uint32_t entry_number = cache_methods->entry_number;
+	GenericCacheCollection *generic_cache = GetGenericCacheCollection(fcinfo);
+	GeomCacheWays *ways = (GeomCacheWays *)(generic_cache->entry[entry_number]);
+	if (!ways)
+	{
+		uint32 nways = Max(postgis_geometry_cache_ways, 2);
+		ways = MemoryContextAllocZero(PostgisCacheContext(fcinfo),
+					      offsetof(GeomCacheWays, way) + nways * sizeof(GeomCache *));
+		ways->type = entry_number;
+		ways->nways = nways;
+		generic_cache->entry[entry_number] = (GenericCache *)ways;
+	}
+	return ways;
+}
+
+/* Find the way keyed on g, either with an index built (built) or without */
+static GeomCache *
+GeomCacheWaysFind(GeomCacheWays *ways, SHARED_GSERIALIZED *g, bool built)
+{
+	uint32 i;
+	if (!g)
+		return NULL;
+	for (i = 0; i < ways->nways; i++)
+	{
+		GeomCache *cache = ways->way[i];
+		if (cache && cache->geom && (cache->argnum != 0) == built && shared_gserialized_equal(g, cache->geom))
+			return cache;
+	}
+	return NULL;
+}
+
+/* Remember g as seen once, in place of the least recently used way */
+static void
+GeomCacheWaysRemember(FunctionCallInfo fcinfo,
+		      const GeomCacheMethods *cache_methods,
+		      GeomCacheWays *ways,
+		      SHARED_GSERIALIZED *g)
+{
+	GeomCache *cache = NULL;
+	uint32 i;
+
+	for (i = 0; i < ways->nways; i++)
+	{
+		GeomCache *way = ways->way[i];
+		if (!way || !way->geom)
+		{
+			cache = way;
+			break;
+		}
+		if (!cache || way->last_used < cache->last_used)
+			cache = way;
+	}
+
+	/* First use of this way */
+	if (i < ways->nways && !cache)
+	{
+		MemoryContext old_context = MemoryContextSwitchTo(PostgisCacheContext(fcinfo));
+		cache = cache_methods->GeomCacheAllocator();
+		MemoryContextSwitchTo(old_context);
+		cache->type = cache_methods->entry_number;
+		ways->way[i] = cache;
+	}
+
+	if (cache->argnum)
+	{
+		cache_methods->GeomIndexFreer(cache);
+		cache->argnum = 0;
+	}
+	if (cache->geom)
+		shared_gserialized_unref(fcinfo, cache->geom);
+	cache->geom = shared_gserialized_ref(fcinfo, g);
+	cache->last_used = ++ways->clock;
+}
+
 /**
 * Get an appropriate (based on the entry type number)
 * GeomCache entry from the generic cache if one exists.
@@ -102,63 +442,81 @@ GetGeomCache(FunctionCallInfo fcinfo,
 	GeomCache* cache;
 	int cache_hit = 0;
 	MemoryContext old_context;
-	const GSERIALIZED *geom;
-	GenericCacheCollection* generic_cache = GetGenericCacheCollection(fcinfo);
+	GeomCacheWays *ways;
 	uint32_t entry_number = cache_methods->entry_number;
+	GeomCacheStats *stats = &CacheStats[entry_number];
 
 	Assert(entry_number < NUM_CACHE_ENTRIES);
 
-	cache = (GeomCache*)(generic_cache->entry[entry_number]);
-	if ( ! cache )
+	ways = GeomCacheWaysGet(fcinfo, cache_methods);
+
+	/* Indexes of TOASTed geometries may be in the backend cache already */
+	BackendGeomCacheEvict(BackendGeomCacheLimit());
+	if (postgis_backend_geometry_cache_size > 0)
 	{
-		old_context = MemoryContextSwitchTo(PostgisCacheContext(fcinfo));
-		/* Allocate in the upper context */
-		cache = cache_methods->GeomCacheAllocator();
-		MemoryContextSwitchTo(old_context);
-		/* Store the pointer in GenericCache */
-		cache->type = entry_number;
-		generic_cache->entry[entry_number] = (GenericCache*)cache;
+		if (g1 && (cache = BackendGeomCacheGet(fcinfo, entry_number, g1, &ways->checked[0])))
+		{
+			cache->argnum = 1;
+			stats->hits++;
+			return cache;
+		}
+		if (g2 && (cache = BackendGeomCacheGet(fcinfo, entry_number, g2, &ways->checked[1])))
+		{
+			cache->argnum = 2;
+			stats->hits++;
+			return cache;
+		}
 	}
 
-	/* Cache hit on the first argument */
-	if (g1 && cache->geom1 && cache->argnum != 2 && shared_gserialized_equal(g1, cache->geom1))
-	{
+	/* Index already built on one of the arguments */
+	if ((cache = GeomCacheWaysFind(ways, g1, true)))
 		cache_hit = 1;
-		geom = shared_gserialized_get(cache->geom1);
-	}
-	/* Cache hit on second argument */
-	else if (g2 && cache->geom2 && cache->argnum != 1 && shared_gserialized_equal(g2, cache->geom2))
-	{
+	else if ((cache = GeomCacheWaysFind(ways, g2, true)))
 		cache_hit = 2;
-		geom = shared_gserialized_get(cache->geom2);
-	}
-	/* No cache hit. If we have a tree, free it. */
-	else
+	if (cache_hit)
 	{
-		cache_hit = 0;
-		if ( cache->argnum )
-		{
-			cache_methods->GeomIndexFreer(cache);
-			cache->argnum = 0;
-		}
+		cache->argnum = cache_hit;
+		cache->last_used = ++ways->clock;
+		stats->hits++;
+		return cache;
 	}
 
-	/* Cache hit, but no tree built yet, build it! */
-	if ( cache_hit && ! cache->argnum )
+	/* Argument seen before, but no tree built yet, build it! */
+	if ((cache = GeomCacheWaysFind(ways, g1, false)))
+		cache_hit = 1;
+	else if ((cache = GeomCacheWaysFind(ways, g2, false)))
+		cache_hit = 2;
+	if (cache_hit)
 	{
 		int rv;
 		LWGEOM *lwgeom;
+		SHARED_GSERIALIZED *g = cache_hit == 1 ? g1 : g2;
+
+		cache->last_used = ++ways->clock;
+
+		/* TOASTed geometries get their tree in the backend cache */
+		if (postgis_backend_geometry_cache_size > 0 && g->valueid)
+		{
+			GeomCache *backend_cache = BackendGeomCacheAdd(cache_methods, g);
+			if (backend_cache)
+			{
+				backend_cache->argnum = cache_hit;
+				stats->builds++;
+				return backend_cache;
+			}
+		}
 
 		/* Save the tree and supporting geometry in the cache */
 		/* memory context */
 		old_context = MemoryContextSwitchTo(PostgisCacheContext(fcinfo));
-		lwgeom = lwgeom_from_gserialized(geom);
+		lwgeom = lwgeom_from_gserialized(shared_gserialized_get(cache->geom));
 		cache->argnum = 0;
 
 		/* Can't build a tree on a NULL or empty */
 		if ((!lwgeom) || lwgeom_is_empty(lwgeom))
 		{
 			MemoryContextSwitchTo(old_context);
+			stats->misses++;
 			return NULL;
 		}
 		rv = cache_methods->GeomIndexBuilder(lwgeom, cache);
@@ -166,37 +524,33 @@ GetGeomCache(FunctionCallInfo fcinfo,
 
 		/* Something went awry in the tree build phase */
 		if ( ! rv )
+		{
+			stats->misses++;
 			return NULL;
+		}
 
 		/* Only set an argnum if everything completely successfully */
 		cache->argnum = cache_hit;
-	}
-
-	/* We have a hit and a calculated tree, we're done */
-	if ( cache_hit && cache->argnum )
+		stats->builds++;
 		return cache;
-
-	/* Argument one didn't match, so copy the new value in. */
-	if ( g1 && cache_hit != 1 )
-	{
-		if (cache->geom1)
-			shared_gserialized_unref(fcinfo, cache->geom1);
-		cache->geom1 = shared_gserialized_ref(fcinfo, g1);
 	}
 
-	/* Argument two didn't match, so copy the new value in. */
-	if ( g2 && cache_hit != 2 )
-	{
-		if (cache->geom2)
-			shared_gserialized_unref(fcinfo, cache->geom2);
-		cache->geom2 = shared_gserialized_ref(fcinfo, g2);
-	}
+	/* No argument seen before, remember them for next time */
+	stats->misses++;
+	if (g1)
+		GeomCacheWaysRemember(fcinfo, cache_methods, ways, g1);
+	if (g2 && !(g1 && shared_gserialized_equal(g1, g2)))
+		GeomCacheWaysRemember(fcinfo, cache_methods, ways, g2);
 
 	return NULL;
 }
 
 /******************************************************************************/
 
+/*
+* Like the GeomCache, the ToastCache keeps postgis.geometry_cache_ways
+* detoasted geometries per argument, replaced least recently used.
+*/
 inline static ToastCache*
 ToastCacheGet(FunctionCallInfo fcinfo)
 {
@@ -205,8 +559,13 @@ ToastCacheGet(FunctionCallInfo fcinfo)
 	ToastCache* cache = (ToastCache*)(generic_cache->entry[entry_number]);
 	if (!cache)
 	{
+		uint32 i, nways = Max(postgis_geometry_cache_ways, 2);
 		cache = MemoryContextAllocZero(PostgisCacheContext(fcinfo), sizeof(ToastCache));
 		cache->type = entry_number;
+		cache->nways = nways;
+		for (i = 0; i < ToastCacheSize; i++)
+			cache->arg[i] = MemoryContextAllocZero(PostgisCacheContext(fcinfo),
+							       nways * sizeof(ToastCacheArgument));
 		generic_cache->entry[entry_number] = (GenericCache*)cache;
 	}
 	return cache;
@@ -217,7 +576,10 @@ ToastCacheGetGeometry(FunctionCallInfo fcinfo, uint32_t argnum)
 {
 	Assert(argnum < ToastCacheSize);
 	ToastCache* cache = ToastCacheGet(fcinfo);
-	ToastCacheArgument* arg = &(cache->arg[argnum]);
+	ToastCacheArgument* args = cache->arg[argnum];
+	ToastCacheArgument* arg = NULL;
+	GeomCacheStats *stats = &CacheStats[TOAST_CACHE_ENTRY];
+	uint32 i;
 
 	Datum datum = PG_GETARG_DATUM(argnum);
 	struct varlena *attr = (struct varlena *) DatumGetPointer(datum);
@@ -241,22 +603,56 @@ ToastCacheGetGeometry(FunctionCallInfo fcinfo, uint32_t argnum)
 	Oid valueid = ve.va_valueid;
 	Oid toastrelid = ve.va_toastrelid;
 
-	/* We've seen this object before? */
-	if (arg->valueid == valueid && arg->toastrelid == toastrelid)
+	/* We've seen this object before? Otherwise pick the oldest slot */
+	for (i = 0; i < cache->nways; i++)
 	{
-		return arg->geom;
+		if (args[i].geom && args[i].valueid == valueid && args[i].toastrelid == toastrelid)
+		{
+			args[i].last_used = ++cache->clock;
+			stats->hits++;
+			return args[i].geom;
+		}
+		if (!arg || (arg->geom && (!args[i].geom || args[i].last_used < arg->last_used)))
+			arg = &args[i];
 	}
-	/* New object, clear our old copies and see if it */
-	/* shows up a second time before taking a copy */
-	else
+
+	/* New object, replace the least recently used copy */
+	stats->misses++;
+	if (arg->geom)
+		shared_gserialized_unref(fcinfo, arg->geom);
+	arg->valueid = valueid;
+	arg->toastrelid = toastrelid;
+	arg->last_used = ++cache->clock;
+	arg->geom = shared_gserialized_new_cached(fcinfo, datum);
+	arg->geom->valueid = valueid;
+	arg->geom->toastrelid = toastrelid;
+	return arg->geom;
+}
+
+/*
+ * The copy of an argument in the toast cache, without counting
+ * a hit or a miss, or NULL when it is not there.
+ */
+const GSERIALIZED *
+ToastCacheFindGeometry(FunctionCallInfo fcinfo, uint32_t argnum)
+{
+	Assert(argnum < ToastCacheSize);
+	ToastCache* cache = ToastCacheGet(fcinfo);
+	ToastCacheArgument* args = cache->arg[argnum];
+	struct varlena *attr = (struct varlena *) DatumGetPointer(PG_GETARG_DATUM(argnum));
+	struct varatt_external ve;
+	uint32 i;
+
+	if (!VARATT_IS_EXTERNAL_ONDISK(attr))
+		return NULL;
+
+	VARATT_EXTERNAL_GET_POINTER(ve, attr);
+	for (i = 0; i < cache->nways; i++)
 	{
-		if (arg->geom)
-			shared_gserialized_unref(fcinfo, arg->geom);
-		arg->valueid = valueid;
-		arg->toastrelid = toastrelid;
-		arg->geom = shared_gserialized_new_cached(fcinfo, datum);
-		return arg->geom;
+		if (args[i].geom && args[i].valueid == ve.va_valueid && args[i].toastrelid == ve.va_toastrelid)
+			return shared_gserialized_get(args[i].geom);
 	}
+	return NULL;
 }
 
 /*
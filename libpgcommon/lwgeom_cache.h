@@ -37,6 +37,9 @@ MemoryContext PostgisCacheContext(FunctionCallInfo fcinfo);
 typedef struct {
 	GSERIALIZED *geom;
 	uint32_t count;
+	/* TOAST pointer of the source datum, zero unless it was TOASTed to disk */
+	Oid toastrelid;
+	Oid valueid;
 } SHARED_GSERIALIZED;
 
 SHARED_GSERIALIZED *shared_gserialized_new_nocache(Datum d);
@@ -48,15 +51,16 @@ const GSERIALIZED *shared_gserialized_get(SHARED_GSERIALIZED *s);
 
 /*
 * A generic GeomCache just needs space for the cache type,
-* the cache keys (GSERIALIZED geometries), the key sizes,
-* and the argument number the cached index/tree is going
-* to refer to.
+* the cache key (GSERIALIZED geometry), and the argument
+* number the cached index/tree is going to refer to.
+* Every call site keeps postgis.geometry_cache_ways of them
+* per cache type, replaced in least recently used order.
 */
 typedef struct {
 	uint32_t type;
 	uint32 argnum;
-	SHARED_GSERIALIZED *geom1;
-	SHARED_GSERIALIZED *geom2;
+	SHARED_GSERIALIZED *geom;
+	uint64 last_used;
 } GeomCache;
 
 /*
@@ -85,6 +89,34 @@ GeomCache *GetGeomCache(FunctionCallInfo fcinfo,
 			SHARED_GSERIALIZED *g1,
 			SHARED_GSERIALIZED *g2);
 
+/*
+* Size in MB of the backend-lifetime cache of indexes built by
+* GetGeomCache on TOASTed geometries (postgis.backend_geometry_cache_size).
+* Zero disables it.
+*/
+extern int postgis_backend_geometry_cache_size;
+
+/*
+* Number of geometries each call site remembers per cache type
+* (postgis.geometry_cache_ways).
+*/
+#define GEOMETRY_CACHE_WAYS_DEFAULT 4
+#define GEOMETRY_CACHE_WAYS_MAX 64
+extern int postgis_geometry_cache_ways;
+
+/*
+* Backend-wide counters of the caches, indexed by cache entry type.
+* Builds counts the indexes/trees built, hits the calls served by one.
+*/
+typedef struct {
+	uint64 hits;
+	uint64 misses;
+	uint64 builds;
+} GeomCacheStats;
+
+void GetGeomCacheStats(uint32_t entry_number, GeomCacheStats *stats);
+void GetBackendGeomCacheStats(GeomCacheStats *stats, uint64 *entries, uint64 *bytes);
+
 /******************************************************************************/
 
 #define ToastCacheSize 2
@@ -94,15 +126,19 @@ typedef struct
 	Oid valueid;
 	Oid toastrelid;
 	SHARED_GSERIALIZED *geom;
+	uint64 last_used;
 } ToastCacheArgument;
 
 typedef struct
 {
 	int type;
-	ToastCacheArgument arg[ToastCacheSize];
+	uint32 nways;
+	uint64 clock;
+	ToastCacheArgument *arg[ToastCacheSize]; /* nways entries per argument */
 } ToastCache;
 
 SHARED_GSERIALIZED *ToastCacheGetGeometry(FunctionCallInfo fcinfo, uint32_t argnum);
+const GSERIALIZED *ToastCacheFindGeometry(FunctionCallInfo fcinfo, uint32_t argnum);
 
 /******************************************************************************/
 
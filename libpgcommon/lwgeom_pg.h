@@ -92,6 +92,7 @@ void pg_install_lwgeom_handlers(void);
 #define PG_GETARG_GSERIALIZED_P_COPY(varno) ((GSERIALIZED *)PG_DETOAST_DATUM_COPY(PG_GETARG_DATUM(varno)))
 #define PG_GSERIALIZED_DATUM_NEEDS_DETOAST(datum) \
 	(VARATT_IS_EXTENDED((datum)) || VARATT_IS_EXTERNAL((datum)) || VARATT_IS_COMPRESSED((datum)))
+#define PG_GSERIALIZED_DATUM_IS_TOASTED(datum) (VARATT_IS_EXTERNAL((datum)) || VARATT_IS_COMPRESSED((datum)))
 #define PG_GETARG_GSERIALIZED_HEADER(varno) \
 	PG_GSERIALIZED_DATUM_NEEDS_DETOAST(PG_GETARG_DATUM(varno)) \
 	? ((GSERIALIZED *)PG_DETOAST_DATUM_SLICE(PG_GETARG_DATUM(varno), 0, gserialized_max_header_size())) \
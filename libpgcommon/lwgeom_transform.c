@@ -18,7 +18,13 @@
 #include "utils/memutils.h"
 #include "executor/spi.h"
 #include "access/hash.h"
+#include "access/xact.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
 #include "utils/hsearch.h"
+#include "utils/snapmgr.h"
 
 /* PostGIS headers */
 #include "../postgis_config.h"
@@ -47,6 +53,13 @@
 /* Global to hold the Proj object cache */
 PROJSRSCache *PROJ_CACHE = NULL;
 
+/* Shared cache generation the PROJ_CACHE entries were made in */
+static uint64 PROJ_CACHE_GENERATION = 0;
+
+/* This backend changed spatial_ref_sys in the current transaction */
+static bool srs_changed_in_xact = false;
+static bool srs_xact_callback_registered = false;
+
 
 /**
  * Utility structure to get many potential string representations
@@ -91,6 +104,353 @@ PROJSRSDestroyPortalCache(void *portalCache)
 	}
 }
 
+/*****************************************************************************
+ * Shared SRS cache
+ *
+ * When PostGIS is loaded with shared_preload_libraries, the spatial_ref_sys
+ * rows read by backends are kept in shared memory, so that new backends do
+ * not have to query the table again. The axis information of a coordinate
+ * system is kept next to its row once a backend has built it, which is all
+ * the geography checks need, without creating any PROJ object.
+ *
+ * Entries belong to a database. A statement trigger on spatial_ref_sys
+ * drops the entries of the database when the changing transaction commits
+ * and bumps the generation counter. Backends drop their own PROJ cache when
+ * they see a new generation, and rows read under an older generation are
+ * not added. Rows to be added are read with a snapshot taken after the
+ * generation, so they cannot predate it.
+ */
+
+/* Large enough for a spatial_ref_sys row, whose text columns are varchar(2048) */
+#define SRS_SHARED_TEXT_LEN 4400
+
+typedef struct
+{
+	Oid dbid; /* InvalidOid for a free slot */
+	int32_t srid;
+	pg_atomic_uint64 last_used; /* also written under the shared lock */
+	bool has_axis;
+	PROJSRSAxisCacheItem axis;
+	/* auth_name:auth_srid, srtext and proj4text, each null terminated */
+	char text[SRS_SHARED_TEXT_LEN];
+} SRSSharedEntry;
+
+typedef struct
+{
+	LWLock *lock;
+	pg_atomic_uint64 generation;
+	pg_atomic_uint64 clock;
+	int size;
+	SRSSharedEntry entries[FLEXIBLE_ARRAY_MEMBER];
+} SRSSharedCache;
+
+int postgis_srs_shared_cache_size = SRS_SHARED_CACHE_SIZE_DEFAULT;
+static SRSSharedCache *SRS_SHARED_CACHE = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+#if POSTGIS_PGSQL_VERSION >= 150
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+
+static Size
+SRSSharedCacheSize(void)
+{
+	return add_size(offsetof(SRSSharedCache, entries),
+			mul_size(postgis_srs_shared_cache_size, sizeof(SRSSharedEntry)));
+}
+
+static void
+SRSSharedCacheRequest(void)
+{
+#if POSTGIS_PGSQL_VERSION >= 150
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+	RequestAddinShmemSpace(SRSSharedCacheSize());
+	RequestNamedLWLockTranche("postgis_srs_cache", 1);
+}
+
+static void
+SRSSharedCacheStartup(void)
+{
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	SRS_SHARED_CACHE = ShmemInitStruct("postgis_srs_cache", SRSSharedCacheSize(), &found);
+	if (!found)
+	{
+		memset(SRS_SHARED_CACHE, 0, SRSSharedCacheSize());
+		SRS_SHARED_CACHE->lock = &(GetNamedLWLockTranche("postgis_srs_cache"))->lock;
+		pg_atomic_init_u64(&SRS_SHARED_CACHE->generation, 0);
+		pg_atomic_init_u64(&SRS_SHARED_CACHE->clock, 0);
+		SRS_SHARED_CACHE->size = postgis_srs_shared_cache_size;
+		for (int i = 0; i < SRS_SHARED_CACHE->size; i++)
+			pg_atomic_init_u64(&SRS_SHARED_CACHE->entries[i].last_used, 0);
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/**
+* Reserve the shared SRS cache, to be called from _PG_init
+* once the postgis.srs_shared_cache_size GUC is defined.
+*/
+void
+srs_shared_cache_init(void)
+{
+	if (!process_shared_preload_libraries_in_progress || postgis_srs_shared_cache_size <= 0)
+		return;
+
+#if POSTGIS_PGSQL_VERSION >= 150
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = SRSSharedCacheRequest;
+#else
+	SRSSharedCacheRequest();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = SRSSharedCacheStartup;
+}
+
+/* The shared cache is bypassed by a transaction that changed spatial_ref_sys */
+static bool
+SRSSharedCacheActive(void)
+{
+	return SRS_SHARED_CACHE && !srs_changed_in_xact;
+}
+
+/*
+* Rows are only added when they can be read with a fresh snapshot,
+* which a transaction snapshot does not allow.
+*/
+static bool
+SRSSharedCacheWritable(void)
+{
+	return SRSSharedCacheActive() && !IsolationUsesXactSnapshot();
+}
+
+static uint64
+SRSSharedCacheGeneration(void)
+{
+	return SRS_SHARED_CACHE ? pg_atomic_read_u64(&SRS_SHARED_CACHE->generation) : 0;
+}
+
+/* Caller holds the lock */
+static SRSSharedEntry *
+SRSSharedCacheFind(int32_t srid)
+{
+	for (int i = 0; i < SRS_SHARED_CACHE->size; i++)
+	{
+		SRSSharedEntry *entry = &SRS_SHARED_CACHE->entries[i];
+		if (entry->srid == srid && entry->dbid == MyDatabaseId)
+		{
+			/* Approximate LRU */
+			pg_atomic_write_u64(&entry->last_used,
+					    pg_atomic_fetch_add_u64(&SRS_SHARED_CACHE->clock, 1));
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static bool
+SRSSharedCacheGetStrings(int32_t srid, PjStrs *strs)
+{
+	SRSSharedEntry *entry;
+
+	if (!SRSSharedCacheActive())
+		return false;
+
+	LWLockAcquire(SRS_SHARED_CACHE->lock, LW_SHARED);
+	entry = SRSSharedCacheFind(srid);
+	if (entry)
+	{
+		char **fields[3] = {&strs->authtext, &strs->srtext, &strs->proj4text};
+		const char *str = entry->text;
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			size_t len = strlen(str);
+			*fields[i] = len ? pstrdup(str) : NULL;
+			str += len + 1;
+		}
+	}
+	LWLockRelease(SRS_SHARED_CACHE->lock);
+
+	return entry != NULL;
+}
+
+/**
+* Store the strings of a spatial_ref_sys row read while the
+* shared cache was at the given generation.
+*/
+static void
+SRSSharedCachePutStrings(int32_t srid, const PjStrs *strs, uint64 generation)
+{
+	const char *fields[3] = {strs->authtext, strs->srtext, strs->proj4text};
+	size_t lens[3];
+	size_t total = 0;
+	SRSSharedEntry *entry;
+
+	if (!SRSSharedCacheWritable())
+		return;
+
+	for (uint32_t i = 0; i < 3; i++)
+	{
+		lens[i] = fields[i] ? strlen(fields[i]) : 0;
+		total += lens[i] + 1;
+	}
+	if (total > SRS_SHARED_TEXT_LEN)
+		return;
+
+	LWLockAcquire(SRS_SHARED_CACHE->lock, LW_EXCLUSIVE);
+	if (pg_atomic_read_u64(&SRS_SHARED_CACHE->generation) == generation &&
+	    !SRSSharedCacheFind(srid))
+	{
+		char *str;
+
+		/* Take a free slot, or the least recently used one */
+		entry = &SRS_SHARED_CACHE->entries[0];
+		for (int i = 0; i < SRS_SHARED_CACHE->size && entry->dbid != InvalidOid; i++)
+		{
+			SRSSharedEntry *e = &SRS_SHARED_CACHE->entries[i];
+			if (e->dbid == InvalidOid ||
+			    pg_atomic_read_u64(&e->last_used) < pg_atomic_read_u64(&entry->last_used))
+				entry = e;
+		}
+
+		entry->dbid = MyDatabaseId;
+		entry->srid = srid;
+		pg_atomic_write_u64(&entry->last_used, pg_atomic_fetch_add_u64(&SRS_SHARED_CACHE->clock, 1));
+		entry->has_axis = false;
+		str = entry->text;
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			if (lens[i])
+				memcpy(str, fields[i], lens[i]);
+			str[lens[i]] = '\0';
+			str += lens[i] + 1;
+		}
+	}
+	LWLockRelease(SRS_SHARED_CACHE->lock);
+}
+
+static bool
+SRSSharedCacheGetAxis(int32_t srid, PROJSRSAxisCacheItem *axis)
+{
+	SRSSharedEntry *entry;
+	bool found = false;
+
+	if (!SRSSharedCacheActive())
+		return false;
+
+	LWLockAcquire(SRS_SHARED_CACHE->lock, LW_SHARED);
+	entry = SRSSharedCacheFind(srid);
+	if (entry && entry->has_axis)
+	{
+		*axis = entry->axis;
+		found = true;
+	}
+	LWLockRelease(SRS_SHARED_CACHE->lock);
+
+	return found;
+}
+
+/* Only SRIDs whose row is in the cache get their axis stored */
+static void
+SRSSharedCachePutAxis(const PROJSRSAxisCacheItem *axis, uint64 generation)
+{
+	SRSSharedEntry *entry;
+
+	if (!SRSSharedCacheActive())
+		return;
+
+	LWLockAcquire(SRS_SHARED_CACHE->lock, LW_EXCLUSIVE);
+	entry = SRSSharedCacheFind(axis->srid);
+	if (entry && pg_atomic_read_u64(&SRS_SHARED_CACHE->generation) == generation)
+	{
+		entry->axis = *axis;
+		entry->has_axis = true;
+	}
+	LWLockRelease(SRS_SHARED_CACHE->lock);
+}
+
+/* Drop the entries of the current database */
+static void
+SRSSharedCacheInvalidate(void)
+{
+	if (!SRS_SHARED_CACHE)
+		return;
+
+	LWLockAcquire(SRS_SHARED_CACHE->lock, LW_EXCLUSIVE);
+	for (int i = 0; i < SRS_SHARED_CACHE->size; i++)
+	{
+		SRSSharedEntry *entry = &SRS_SHARED_CACHE->entries[i];
+		if (entry->dbid == MyDatabaseId)
+		{
+			entry->dbid = InvalidOid;
+			entry->srid = SRID_UNKNOWN;
+		}
+	}
+	pg_atomic_fetch_add_u64(&SRS_SHARED_CACHE->generation, 1);
+	LWLockRelease(SRS_SHARED_CACHE->lock);
+}
+
+/**
+* Drop the whole PROJ cache of this backend. The reset
+* callback of its context destroys the PROJ objects.
+*/
+static void
+DropPROJSRSCache(void)
+{
+	if (PROJ_CACHE)
+	{
+		MemoryContextDelete(PROJ_CACHE->PROJSRSCacheContext);
+		PROJ_CACHE = NULL;
+	}
+}
+
+static void
+SRSCacheXactCallback(XactEvent event, void *arg)
+{
+	if (!srs_changed_in_xact)
+		return;
+
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+			/* The new rows are visible now, drop the old ones */
+			SRSSharedCacheInvalidate();
+			/* Fall through */
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			/* Built from rows that are gone, or never were */
+			DropPROJSRSCache();
+			srs_changed_in_xact = false;
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+* Called by the statement trigger on spatial_ref_sys. The current
+* transaction sees its own changes, the other backends see them
+* once it commits.
+*/
+void
+srs_cache_changed(void)
+{
+	if (!srs_xact_callback_registered)
+	{
+		RegisterXactCallback(SRSCacheXactCallback, NULL);
+		srs_xact_callback_registered = true;
+	}
+	srs_changed_in_xact = true;
+	DropPROJSRSCache();
+}
+
 /**
 * Get the Proj cache entry from the global variable if one exists.
 * If it doesn't exist, make a new blank one and return it.
@@ -98,7 +458,17 @@ PROJSRSDestroyPortalCache(void *portalCache)
 PROJSRSCache *
 GetPROJSRSCache()
 {
-	PROJSRSCache* cache = PROJ_CACHE;
+	PROJSRSCache* cache;
+	uint64 generation = SRSSharedCacheGeneration();
+
+	/* A committed change to spatial_ref_sys, start again */
+	if (generation != PROJ_CACHE_GENERATION)
+	{
+		DropPROJSRSCache();
+		PROJ_CACHE_GENERATION = generation;
+	}
+
+	cache = PROJ_CACHE;
 	if (!cache)
 	{
 		/* Put proj cache in a child of the CacheContext */
@@ -114,6 +484,7 @@ GetPROJSRSCache()
 			elog(ERROR, "Unable to allocate space for PROJSRSCache in context %p", context);
 
 		cache->PROJSRSCacheCount = 0;
+		cache->PROJSRSAxisCacheCount = 0;
 		cache->PROJSRSCacheContext = context;
 
 		/* Use this to clean up PROJSRSCache in event of MemoryContext reset */
@@ -248,7 +619,21 @@ GetProjStrings(int32_t srid)
 	/* SRIDs in SPATIAL_REF_SYS */
 	if ( srid < SRID_RESERVE_OFFSET )
 	{
-		return GetProjStringsSPI(srid);
+		uint64 generation = SRSSharedCacheGeneration();
+		if (SRSSharedCacheGetStrings(srid, &strs))
+			return strs;
+		if (!SRSSharedCacheWritable())
+			return GetProjStringsSPI(srid);
+
+		/*
+		 * The statement snapshot can predate a change committed before
+		 * the generation was read, so look at the latest rows instead.
+		 */
+		PushActiveSnapshot(GetLatestSnapshot());
+		strs = GetProjStringsSPI(srid);
+		PopActiveSnapshot();
+		SRSSharedCachePutStrings(srid, &strs, generation);
+		return strs;
 	}
 	/* Automagic SRIDs */
 	else
@@ -507,13 +892,59 @@ lwproj_is_latlong(const LWPROJ *pj)
 	return pj->source_is_latlong;
 }
 
+/**
+ * Axis information of an SRID. It is looked up in the local and then
+ * the shared caches before building a PROJ object, as the geography
+ * functions check the SRID of every value they read.
+ */
+static int
+srid_axis_lookup(int32_t srid, PROJSRSAxisCacheItem *axis)
+{
+	PROJSRSCache *proj_cache = GetPROJSRSCache();
+	uint64 generation = SRSSharedCacheGeneration();
+	uint32_t i;
+	LWPROJ *pj;
+
+	for (i = 0; i < proj_cache->PROJSRSAxisCacheCount; i++)
+	{
+		if (proj_cache->PROJSRSAxisCache[i].srid == srid)
+		{
+			*axis = proj_cache->PROJSRSAxisCache[i];
+			return LW_SUCCESS;
+		}
+	}
+
+	if (!SRSSharedCacheGetAxis(srid, axis))
+	{
+		if (lwproj_lookup(srid, srid, &pj) == LW_FAILURE)
+			return LW_FAILURE;
+
+		axis->srid = srid;
+		axis->is_latlong = pj->source_is_latlong;
+		axis->semi_major_metre = pj->source_semi_major_metre;
+		axis->semi_minor_metre = pj->source_semi_minor_metre;
+		SRSSharedCachePutAxis(axis, generation);
+
+		/* The lookup may have started a new cache */
+		proj_cache = GetPROJSRSCache();
+	}
+
+	/* When full, replace an entry picked by SRID, they are cheap to find again */
+	if (proj_cache->PROJSRSAxisCacheCount < PROJ_CACHE_ITEMS)
+		i = proj_cache->PROJSRSAxisCacheCount++;
+	else
+		i = (uint32_t)srid % PROJ_CACHE_ITEMS;
+	proj_cache->PROJSRSAxisCache[i] = *axis;
+	return LW_SUCCESS;
+}
+
 static int
 srid_is_latlong(int32_t srid)
 {
-	LWPROJ *pj;
-	if ( lwproj_lookup(srid, srid, &pj) == LW_FAILURE)
+	PROJSRSAxisCacheItem axis;
+	if (srid_axis_lookup(srid, &axis) == LW_FAILURE)
 		return LW_FALSE;
-	return lwproj_is_latlong(pj);
+	return axis.is_latlong;
 }
 
 void
@@ -553,14 +984,14 @@ srid_axis_precision(int32_t srid, int precision)
 int
 spheroid_init_from_srid(int32_t srid, SPHEROID *s)
 {
-	LWPROJ *pj;
+	PROJSRSAxisCacheItem axis;
 
-	if ( lwproj_lookup(srid, srid, &pj) == LW_FAILURE)
+	if (srid_axis_lookup(srid, &axis) == LW_FAILURE)
 		return LW_FAILURE;
 
-	if (!pj->source_is_latlong)
+	if (!axis.is_latlong)
 		return LW_FAILURE;
-	spheroid_init(s, pj->source_semi_major_metre, pj->source_semi_minor_metre);
+	spheroid_init(s, axis.semi_major_metre, axis.semi_minor_metre);
 
 	return LW_SUCCESS;
 }
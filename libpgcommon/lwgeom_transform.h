@@ -32,6 +32,16 @@ typedef struct struct_PROJSRSCacheItem
 }
 PROJSRSCacheItem;
 
+/* Axis information of an SRID, enough for the geography checks */
+typedef struct struct_PROJSRSAxisCacheItem
+{
+	int32_t srid;
+	bool is_latlong;
+	double semi_major_metre;
+	double semi_minor_metre;
+}
+PROJSRSAxisCacheItem;
+
 /* PROJ 4 lookup transaction cache methods */
 #define PROJ_CACHE_ITEMS 128
 
@@ -44,10 +54,19 @@ typedef struct struct_PROJSRSCache
 {
 	PROJSRSCacheItem PROJSRSCache[PROJ_CACHE_ITEMS];
 	uint32_t PROJSRSCacheCount;
+	PROJSRSAxisCacheItem PROJSRSAxisCache[PROJ_CACHE_ITEMS];
+	uint32_t PROJSRSAxisCacheCount;
 	MemoryContext PROJSRSCacheContext;
 }
 PROJSRSCache;
 
+/*
+* Number of spatial_ref_sys rows kept in shared memory,
+* when PostGIS is in shared_preload_libraries.
+*/
+extern int postgis_srs_shared_cache_size;
+#define SRS_SHARED_CACHE_SIZE_DEFAULT 512
+
 
 typedef struct srs_precision
 {
@@ -69,6 +88,8 @@ int lwproj_is_latlong(const LWPROJ *pj);
 int spheroid_init_from_srid(int32_t srid, SPHEROID *s);
 void srid_check_latlong(int32_t srid);
 srs_precision srid_axis_precision(int32_t srid, int precision);
+void srs_shared_cache_init(void);
+void srs_cache_changed(void);
 
 /**
  * Builtin SRID values
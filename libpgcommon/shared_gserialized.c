@@ -29,6 +29,8 @@ shared_gserialized_new_nocache(Datum d)
 {
 	SHARED_GSERIALIZED *s = palloc(sizeof(SHARED_GSERIALIZED));
 	s->count = 0;
+	s->toastrelid = InvalidOid;
+	s->valueid = InvalidOid;
 	s->geom = (GSERIALIZED *)PG_DETOAST_DATUM(d);
 	return s;
 }
@@ -41,6 +43,8 @@ shared_gserialized_new_cached(FunctionCallInfo fcinfo, Datum d)
 	s->geom = (GSERIALIZED *)PG_DETOAST_DATUM_COPY(d);
 	MemoryContextSwitchTo(old_context);
 	s->count = 1;
+	s->toastrelid = InvalidOid;
+	s->valueid = InvalidOid;
 	return s;
 }
 
@@ -61,6 +65,8 @@ shared_gserialized_ref(FunctionCallInfo fcinfo, SHARED_GSERIALIZED *ref)
 	{
 		SHARED_GSERIALIZED *sg = MemoryContextAlloc(PostgisCacheContext(fcinfo), sizeof(SHARED_GSERIALIZED));
 		sg->count = 1;
+		sg->toastrelid = ref->toastrelid;
+		sg->valueid = ref->valueid;
 		sg->geom = MemoryContextAlloc(PostgisCacheContext(fcinfo), VARSIZE(ref->geom));
 		memcpy(sg->geom, ref->geom, VARSIZE(ref->geom));
 		return sg;
@@ -1,5 +1,10 @@
 #include "postgis_brin.h"
 
+#include "access/skey.h"
+#include "access/stratnum.h"
+#include "catalog/pg_type.h"
+#include "utils/typcache.h"
+
 /*
  * As we index geometries but store either a BOX2DF or GIDX according to the
  * operator class, we need to overload the original brin_inclusion_add_value()
@@ -89,3 +94,324 @@ geom2d_brin_inclusion_add_value(PG_FUNCTION_ARGS)
 
 	PG_RETURN_BOOL(true);
 }
+
+/*
+ * Multi-box summaries for the brin_geometry_inclusion_ops_2d_multi operator
+ * class. Instead of a single inclusion box, each block range keeps a small
+ * set of disjoint boxes, so that one outlier row does not stretch the
+ * summary of the whole range. When a new box overlaps stored ones they are
+ * merged together, and when there are more than BRIN_MULTI_MAX_BOXES boxes
+ * the pair whose union grows the covered area the least is merged.
+ */
+
+#define BRIN_MULTI_MAX_BOXES 8
+
+typedef struct
+{
+	int32	vl_len_;		/* varlena header (do not touch directly!) */
+	int32	nboxes;
+	BOX2DF	boxes[FLEXIBLE_ARRAY_MEMBER];
+} BRIN_MULTI_BOX2DF;
+
+#define BRIN_MULTI_SIZE(n) (offsetof(BRIN_MULTI_BOX2DF, boxes) + (n) * sizeof(BOX2DF))
+
+static inline double
+box2df_area(const BOX2DF *b)
+{
+	return ((double)b->xmax - (double)b->xmin) * ((double)b->ymax - (double)b->ymin);
+}
+
+static inline double
+box2df_margin(const BOX2DF *b)
+{
+	return ((double)b->xmax - (double)b->xmin) + ((double)b->ymax - (double)b->ymin);
+}
+
+/*
+ * Add a box to the array of disjoint boxes, absorbing all the boxes it
+ * overlaps. The array has room for one more box than n. Returns the new
+ * number of boxes.
+ */
+static int
+brin_multi_insert(BOX2DF *boxes, int n, const BOX2DF *box)
+{
+	BOX2DF merged = *box;
+	int i = 0;
+
+	while (i < n)
+	{
+		if (box2df_overlaps(&boxes[i], &merged))
+		{
+			box2df_merge(&merged, &boxes[i]);
+			boxes[i] = boxes[--n];
+			/* The merged box grew, look at all the boxes again */
+			i = 0;
+			continue;
+		}
+		i++;
+	}
+	boxes[n++] = merged;
+	return n;
+}
+
+/*
+ * Bring the array of boxes back to BRIN_MULTI_MAX_BOXES, merging the pair
+ * with the smallest area enlargement first, and the smallest perimeter
+ * enlargement among those (points and lines have no area).
+ */
+static int
+brin_multi_reduce(BOX2DF *boxes, int n)
+{
+	while (n > BRIN_MULTI_MAX_BOXES)
+	{
+		double best_area = DBL_MAX, best_margin = DBL_MAX;
+		int best_i = 0, best_j = 1;
+		BOX2DF merged;
+		int i, j;
+
+		for (i = 0; i < n; i++)
+		{
+			for (j = i + 1; j < n; j++)
+			{
+				double area, margin;
+				merged = boxes[i];
+				box2df_merge(&merged, &boxes[j]);
+				area = box2df_area(&merged) - box2df_area(&boxes[i]) - box2df_area(&boxes[j]);
+				margin = box2df_margin(&merged) - box2df_margin(&boxes[i]) - box2df_margin(&boxes[j]);
+				if (area < best_area || (area == best_area && margin < best_margin))
+				{
+					best_area = area;
+					best_margin = margin;
+					best_i = i;
+					best_j = j;
+				}
+			}
+		}
+
+		merged = boxes[best_i];
+		box2df_merge(&merged, &boxes[best_j]);
+		/* Remove the higher index first so the lower one stays valid */
+		boxes[best_j] = boxes[--n];
+		boxes[best_i] = boxes[--n];
+		n = brin_multi_insert(boxes, n, &merged);
+	}
+	return n;
+}
+
+/*
+ * Return a new summary holding the boxes of the old one (if any) and the
+ * new boxes.
+ */
+static BRIN_MULTI_BOX2DF *
+brin_multi_add(const BRIN_MULTI_BOX2DF *summary, const BOX2DF *boxes_new, int n_new)
+{
+	BOX2DF boxes[BRIN_MULTI_MAX_BOXES + 1];
+	BRIN_MULTI_BOX2DF *result;
+	int n = 0;
+	int i;
+
+	if (summary)
+	{
+		n = summary->nboxes;
+		memcpy(boxes, summary->boxes, n * sizeof(BOX2DF));
+	}
+
+	for (i = 0; i < n_new; i++)
+	{
+		n = brin_multi_insert(boxes, n, &boxes_new[i]);
+		n = brin_multi_reduce(boxes, n);
+	}
+
+	result = palloc(BRIN_MULTI_SIZE(n));
+	SET_VARSIZE(result, BRIN_MULTI_SIZE(n));
+	result->nboxes = n;
+	memcpy(result->boxes, boxes, n * sizeof(BOX2DF));
+	return result;
+}
+
+/*
+ * Free the copy of a stored summary made by detoasting it (the index holds
+ * short varlenas, which are always copied), and the stored value itself
+ * when it is being replaced, as brin_inclusion_add_value does. Otherwise
+ * index builds and summarizations hold one summary per row added.
+ */
+static void
+brin_multi_free(Datum stored, BRIN_MULTI_BOX2DF *summary, bool replaced)
+{
+	if ((Pointer) summary != DatumGetPointer(stored))
+		pfree(summary);
+	if (replaced)
+		pfree(DatumGetPointer(stored));
+}
+
+PG_FUNCTION_INFO_V1(geom2d_brin_multi_opcinfo);
+Datum
+geom2d_brin_multi_opcinfo(PG_FUNCTION_ARGS)
+{
+	BrinOpcInfo *result;
+
+	/*
+	 * The summary is a single varlena holding the boxes, stored in the index
+	 * as a bytea.
+	 */
+	result = palloc0(MAXALIGN(SizeofBrinOpcInfo(1)));
+	result->oi_nstored = 1;
+#if POSTGIS_PGSQL_VERSION >= 140
+	result->oi_regular_nulls = true;
+#endif
+	result->oi_opaque = NULL;
+	result->oi_typcache[0] = lookup_type_cache(BYTEAOID, 0);
+
+	PG_RETURN_POINTER(result);
+}
+
+PG_FUNCTION_INFO_V1(geom2d_brin_multi_add_value);
+Datum
+geom2d_brin_multi_add_value(PG_FUNCTION_ARGS)
+{
+	BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+	Datum      newval = PG_GETARG_DATUM(2);
+	bool	   isnull = PG_GETARG_BOOL(3);
+	BRIN_MULTI_BOX2DF *summary = NULL;
+	BRIN_MULTI_BOX2DF *result;
+	BOX2DF     box_geom;
+	int        i;
+
+	if (isnull)
+	{
+		if (column->bv_hasnulls)
+			PG_RETURN_BOOL(false);
+
+		column->bv_hasnulls = true;
+		PG_RETURN_BOOL(true);
+	}
+
+	if (gserialized_datum_get_box2df_p(newval, &box_geom) == LW_FAILURE)
+	{
+		/*
+		 * Empty geometries are not matched by any of the operators, they
+		 * only have to make the range non-null.
+		 */
+		if (!is_gserialized_from_datum_empty(newval))
+			elog(ERROR, "Error while extracting the box2df from the geom");
+
+		if (!column->bv_allnulls)
+			PG_RETURN_BOOL(false);
+
+		column->bv_values[0] = PointerGetDatum(brin_multi_add(NULL, NULL, 0));
+		column->bv_allnulls = false;
+		PG_RETURN_BOOL(true);
+	}
+
+	if (!column->bv_allnulls)
+	{
+		summary = (BRIN_MULTI_BOX2DF *) PG_DETOAST_DATUM(column->bv_values[0]);
+
+		/* Nothing to do if one of the stored boxes contains the new one */
+		for (i = 0; i < summary->nboxes; i++)
+		{
+			if (box2df_contains(&summary->boxes[i], &box_geom))
+			{
+				brin_multi_free(column->bv_values[0], summary, false);
+				PG_RETURN_BOOL(false);
+			}
+		}
+	}
+
+	result = brin_multi_add(summary, &box_geom, 1);
+	if (summary)
+		brin_multi_free(column->bv_values[0], summary, true);
+	column->bv_values[0] = PointerGetDatum(result);
+	column->bv_allnulls = false;
+	PG_RETURN_BOOL(true);
+}
+
+PG_FUNCTION_INFO_V1(geom2d_brin_multi_consistent);
+Datum
+geom2d_brin_multi_consistent(PG_FUNCTION_ARGS)
+{
+	BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+	ScanKey    key = (ScanKey) PG_GETARG_POINTER(2);
+	BRIN_MULTI_BOX2DF *summary;
+	BOX2DF     query_box;
+	int        i;
+
+	/* Handle IS NULL/IS NOT NULL tests */
+	if (key->sk_flags & SK_ISNULL)
+	{
+		if (key->sk_flags & SK_SEARCHNULL)
+			PG_RETURN_BOOL(column->bv_allnulls || column->bv_hasnulls);
+
+		/* IS NOT NULL, or any other operator with a null argument */
+		PG_RETURN_BOOL(!column->bv_allnulls && (key->sk_flags & SK_SEARCHNOTNULL));
+	}
+
+	/* If it is all nulls, it cannot possibly be consistent */
+	if (column->bv_allnulls)
+		PG_RETURN_BOOL(false);
+
+	/* No geometry matches an empty query */
+	if (gserialized_datum_get_box2df_p(key->sk_argument, &query_box) == LW_FAILURE)
+		PG_RETURN_BOOL(false);
+
+	summary = (BRIN_MULTI_BOX2DF *) PG_DETOAST_DATUM(column->bv_values[0]);
+
+	for (i = 0; i < summary->nboxes; i++)
+	{
+		switch (key->sk_strategy)
+		{
+			/* A geometry inside the query overlaps one of the boxes too */
+			case RTOverlapStrategyNumber:
+			case RTContainedByStrategyNumber:
+				if (box2df_overlaps(&summary->boxes[i], &query_box))
+					PG_RETURN_BOOL(true);
+				break;
+			/* Equal geometries have equal boxes */
+			case RTSameStrategyNumber:
+			case RTContainsStrategyNumber:
+				if (box2df_contains(&summary->boxes[i], &query_box))
+					PG_RETURN_BOOL(true);
+				break;
+			default:
+				elog(ERROR, "invalid strategy number %d", key->sk_strategy);
+		}
+	}
+
+	PG_RETURN_BOOL(false);
+}
+
+PG_FUNCTION_INFO_V1(geom2d_brin_multi_union);
+Datum
+geom2d_brin_multi_union(PG_FUNCTION_ARGS)
+{
+	BrinValues *col_a = (BrinValues *) PG_GETARG_POINTER(1);
+	BrinValues *col_b = (BrinValues *) PG_GETARG_POINTER(2);
+	BRIN_MULTI_BOX2DF *summary_a, *summary_b, *result;
+
+	/* Adjust "hasnulls" */
+	if (!col_a->bv_hasnulls && col_b->bv_hasnulls)
+		col_a->bv_hasnulls = true;
+
+	/* If there are no values in B, there's nothing left to do */
+	if (col_b->bv_allnulls)
+		PG_RETURN_VOID();
+
+	summary_b = (BRIN_MULTI_BOX2DF *) PG_DETOAST_DATUM(col_b->bv_values[0]);
+
+	/* If A has no values, just copy the values of B */
+	if (col_a->bv_allnulls)
+	{
+		col_a->bv_allnulls = false;
+		col_a->bv_values[0] = PointerGetDatum(brin_multi_add(summary_b, NULL, 0));
+		brin_multi_free(col_b->bv_values[0], summary_b, false);
+		PG_RETURN_VOID();
+	}
+
+	summary_a = (BRIN_MULTI_BOX2DF *) PG_DETOAST_DATUM(col_a->bv_values[0]);
+	result = brin_multi_add(summary_a, summary_b->boxes, summary_b->nboxes);
+	brin_multi_free(col_a->bv_values[0], summary_a, true);
+	brin_multi_free(col_b->bv_values[0], summary_b, false);
+	col_a->bv_values[0] = PointerGetDatum(result);
+
+	PG_RETURN_VOID();
+}
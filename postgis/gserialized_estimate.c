@@ -40,6 +40,12 @@ queries with relations on both sides call gserialized_gist_joinsel.
 gserialized_gist_sel sums up the values in the histogram that overlap
 the contant search box.
 
+The histograms are uniform grids, which spread dense clusters (cities
+in a world-wide table) over whole cells. So ANALYZE also gives the
+densest cells a sub-grid, stored after the cell values in the same
+statistics slot, and gserialized_gist_sel reads partly covered dense
+cells from their sub-cells.
+
 gserialized_gist_joinsel sums up the product of the overlapping
 cells in each relation's histogram.
 
@@ -284,6 +290,57 @@ typedef struct ND_STATS_T
 	float4 value[1];
 } ND_STATS;
 
+/**
+* Version tag of the #ND_REFINE section that may follow the
+* histogram values in the same statistics slot. Stats written
+* before refinement existed just end after the values.
+*/
+#define ND_REFINE_VERSION 1
+
+/**
+* Number of sub-cells we aim for in each refined cell, spread
+* over the histogram dimensions that have more than one cell.
+*/
+#define ND_REFINE_SUBCELLS 64
+
+/**
+* Cells holding less than this many sample features are never
+* refined, there is nothing to gain splitting them.
+*/
+#define ND_REFINE_MIN_FEATURES 16.0
+
+/**
+* Cells are refined when they hold this many times the average
+* number of features per cell.
+*/
+#define ND_REFINE_DENSITY 4.0
+
+/**
+* Refined histogram cells. Dense cells of the uniform
+* histogram get their own sub-grid, so that small search
+* boxes in dense areas do not spread the whole cell count
+* over the box. Only the selectivity of partly covered cells
+* changes: the cell values stay the totals of their sub-cells.
+*/
+typedef struct ND_REFINE_T
+{
+	/* ND_REFINE_VERSION, or 0 if the histogram is not refined */
+	float4 version;
+
+	/* How many histogram cells are refined? */
+	float4 num_cells;
+
+	/* Size of the sub-grid of a refined cell in each dimension */
+	float4 size[ND_DIMS];
+
+	/* For each refined cell, in increasing order of cell index: */
+	/* the cell index followed by its sub-cell values */
+	float4 value[1];
+} ND_REFINE;
+
+#define ND_STATS_HEADER_FLOATS (offsetof(ND_STATS, value) / sizeof(float4))
+#define ND_REFINE_HEADER_FLOATS (offsetof(ND_REFINE, value) / sizeof(float4))
+
 typedef struct {
 	/* Saved state from std_typanalyze() */
 	AnalyzeAttrComputeStatsFunc std_compute_stats;
@@ -455,6 +512,57 @@ nd_stats_value_index(const ND_STATS *stats, int *indexes)
 	return vdx;
 }
 
+/**
+* Return the #ND_REFINE section following the histogram
+* values, or NULL if the histogram has no refined cells.
+*/
+static const ND_REFINE *
+nd_stats_refinement(const ND_STATS *stats)
+{
+	const ND_REFINE *refine = (const ND_REFINE *)(stats->value + (int)roundf(stats->histogram_cells));
+	if ( (int)roundf(refine->version) != ND_REFINE_VERSION || refine->num_cells < 1 )
+		return NULL;
+	return refine;
+}
+
+/**
+* Number of sub-cells of each refined cell.
+*/
+static int
+nd_refine_subcells(const ND_REFINE *refine, int ndims)
+{
+	int d, n = 1;
+	for ( d = 0; d < ndims; d++ )
+		n *= (int)roundf(refine->size[d]);
+	return n;
+}
+
+/**
+* Find the sub-cell values of histogram cell vdx,
+* or NULL if that cell is not refined.
+*/
+static const float4 *
+nd_refine_values(const ND_REFINE *refine, int ndims, int vdx)
+{
+	int stride = 1 + nd_refine_subcells(refine, ndims);
+	int lo = 0, hi = (int)roundf(refine->num_cells) - 1;
+
+	/* Refined cells are stored by increasing cell index */
+	while ( lo <= hi )
+	{
+		int mid = (lo + hi) / 2;
+		const float4 *entry = refine->value + (size_t)mid * stride;
+		int cell = (int)roundf(entry[0]);
+		if ( cell == vdx )
+			return entry + 1;
+		if ( cell < vdx )
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return NULL;
+}
+
 /**
 * Convert an #ND_BOX to a JSON string for printing
 */
@@ -494,6 +602,7 @@ nd_stats_to_json(const ND_STATS *nd_stats)
 {
 	char *json_extent, *str;
 	int d;
+	const ND_REFINE *refine;
 	stringbuffer_t *sb = stringbuffer_create();
 	int ndims = (int)roundf(nd_stats->ndims);
 
@@ -520,6 +629,31 @@ nd_stats_to_json(const ND_STATS *nd_stats)
 	stringbuffer_aprintf(sb, "\"histogram_features\":%d,", (int)roundf(nd_stats->histogram_features));
 	stringbuffer_aprintf(sb, "\"histogram_cells\":%d,", (int)roundf(nd_stats->histogram_cells));
 	stringbuffer_aprintf(sb, "\"cells_covered\":%d", (int)roundf(nd_stats->cells_covered));
+
+	/* Refined cells */
+	refine = nd_stats_refinement(nd_stats);
+	if ( refine )
+	{
+		int i, num_cells = (int)roundf(refine->num_cells);
+		int stride = 1 + nd_refine_subcells(refine, ndims);
+		double refined_features = 0.0;
+
+		for ( i = 0; i < num_cells; i++ )
+		{
+			int vdx = (int)roundf(refine->value[(size_t)i * stride]);
+			refined_features += nd_stats->value[vdx];
+		}
+
+		stringbuffer_aprintf(sb, ",\"refined_cells\":%d,", num_cells);
+		stringbuffer_append(sb, "\"refined_size\":[");
+		for ( d = 0; d < ndims; d++ )
+		{
+			if ( d ) stringbuffer_append(sb, ",");
+			stringbuffer_aprintf(sb, "%d", (int)roundf(refine->size[d]));
+		}
+		stringbuffer_append(sb, "],");
+		stringbuffer_aprintf(sb, "\"refined_features\":%d", (int)round(refined_features));
+	}
 	stringbuffer_append(sb, "}");
 
 	str = stringbuffer_getstringcopy(sb);
@@ -920,7 +1054,9 @@ pg_nd_stats_from_tuple(HeapTuple stats_tuple, int mode)
 {
 	int stats_kind = STATISTIC_KIND_ND;
 	int rv;
+	size_t nfloats;
 	ND_STATS *nd_stats;
+	ND_REFINE *refine;
 
 	/* If we're in 2D mode, set the kind appropriately */
 	if ( mode == 2 ) stats_kind = STATISTIC_KIND_2D;
@@ -935,10 +1071,33 @@ pg_nd_stats_from_tuple(HeapTuple stats_tuple, int mode)
 			return NULL;
 		}
 
-		/* Clone the stats here so we can release the attstatsslot immediately */
-		nd_stats = palloc(sizeof(float4) * sslot.nnumbers);
+		if ( sslot.nnumbers < (int)ND_STATS_HEADER_FLOATS )
+		{
+			POSTGIS_DEBUGF(2, "stats slot of kind %d is too short", stats_kind);
+			free_attstatsslot(&sslot);
+			return NULL;
+		}
+
+		/*
+		 * Clone the stats here so we can release the attstatsslot immediately.
+		 * Histograms without refinement get a zeroed ND_REFINE header after
+		 * the values, so readers can always look for one.
+		 */
+		nfloats = ND_STATS_HEADER_FLOATS + (size_t)roundf(((float4*)sslot.numbers)[offsetof(ND_STATS, histogram_cells) / sizeof(float4)]);
+		nfloats = Max(nfloats + ND_REFINE_HEADER_FLOATS, (size_t)sslot.nnumbers);
+		nd_stats = palloc0(sizeof(float4) * nfloats);
 		memcpy(nd_stats, sslot.numbers, sizeof(float4) * sslot.nnumbers);
 
+		/* Ignore a refinement we cannot read whole */
+		refine = (ND_REFINE *)nd_stats_refinement(nd_stats);
+		if ( refine )
+		{
+			size_t refine_floats = ND_REFINE_HEADER_FLOATS + (size_t)roundf(refine->num_cells) *
+			    (1 + nd_refine_subcells(refine, (int)roundf(nd_stats->ndims)));
+			if ( (float4*)refine + refine_floats > (float4*)nd_stats + nfloats )
+				refine->version = 0;
+		}
+
 		free_attstatsslot(&sslot);
 	}
 	return nd_stats;
@@ -1349,6 +1508,214 @@ Datum gserialized_gist_joinsel(PG_FUNCTION_ARGS)
 	PG_RETURN_FLOAT8(gserialized_joinsel_internal(root, args, jointype, mode));
 }
 
+/**
+* A histogram cell we may refine.
+*/
+typedef struct
+{
+	int vdx;
+	float4 value;
+} ND_REFINE_CANDIDATE;
+
+/**
+* Sort refine candidates by decreasing value, then cell index.
+*/
+static int
+cmp_refine_value(const void *a, const void *b)
+{
+	const ND_REFINE_CANDIDATE *ca = (const ND_REFINE_CANDIDATE *)a;
+	const ND_REFINE_CANDIDATE *cb = (const ND_REFINE_CANDIDATE *)b;
+	if ( ca->value != cb->value )
+		return ca->value > cb->value ? -1 : 1;
+	return ca->vdx - cb->vdx;
+}
+
+/**
+* Sort refine candidates by cell index.
+*/
+static int
+cmp_refine_index(const void *a, const void *b)
+{
+	const ND_REFINE_CANDIDATE *ca = (const ND_REFINE_CANDIDATE *)a;
+	const ND_REFINE_CANDIDATE *cb = (const ND_REFINE_CANDIDATE *)b;
+	return ca->vdx - cb->vdx;
+}
+
+/**
+* Give the densest cells of a filled histogram a sub-grid,
+* filled from the sample boxes like the histogram itself,
+* and append it as an #ND_REFINE section. At most as many
+* sub-cells as histogram cells are added. Returns the
+* (reallocated) statistics and updates nd_stats_size.
+*/
+static ND_STATS *
+nd_stats_refine(ND_STATS *nd_stats, size_t *nd_stats_size, const ND_BOX **sample_boxes, int num_boxes)
+{
+	int d, i, j;
+	int ndims = (int)roundf(nd_stats->ndims);
+	int histo_cells = (int)roundf(nd_stats->histogram_cells);
+	int refine_ndims = 0;
+	int sub_size[ND_DIMS];
+	int subcells = 1;
+	int num_candidates = 0;
+	int num_cells;
+	int *slots;
+	double threshold;
+	double *values;
+	double min[ND_DIMS], cellsize[ND_DIMS];
+	ND_REFINE_CANDIDATE *candidates;
+	ND_REFINE *refine;
+	float4 *entry;
+	size_t refine_size;
+
+	/* Only split the dimensions the histogram splits itself */
+	for ( d = 0; d < ndims; d++ )
+	{
+		if ( nd_stats->size[d] > 1 )
+			refine_ndims++;
+	}
+	if ( ! refine_ndims )
+		return nd_stats;
+
+	for ( d = 0; d < ndims; d++ )
+	{
+		sub_size[d] = 1;
+		if ( nd_stats->size[d] > 1 )
+			sub_size[d] = Max(2, (int)floor(pow(ND_REFINE_SUBCELLS, 1.0/refine_ndims) + 0.001));
+		subcells *= sub_size[d];
+		min[d] = nd_stats->extent.min[d];
+		cellsize[d] = (nd_stats->extent.max[d] - min[d]) / nd_stats->size[d];
+	}
+
+	/* Dense cells hold several times the average number of features */
+	threshold = Max(ND_REFINE_MIN_FEATURES, ND_REFINE_DENSITY * nd_stats->histogram_features / histo_cells);
+	candidates = palloc(sizeof(ND_REFINE_CANDIDATE) * histo_cells);
+	for ( i = 0; i < histo_cells; i++ )
+	{
+		if ( nd_stats->value[i] < threshold )
+			continue;
+		candidates[num_candidates].vdx = i;
+		candidates[num_candidates].value = nd_stats->value[i];
+		num_candidates++;
+	}
+	POSTGIS_DEBUGF(3, " refine: %d cells above %g features", num_candidates, threshold);
+
+	if ( ! num_candidates )
+	{
+		pfree(candidates);
+		return nd_stats;
+	}
+
+	/* Keep the densest ones, in cell order for lookups */
+	num_cells = Min(num_candidates, Max(1, histo_cells / subcells));
+	if ( num_cells < num_candidates )
+		qsort(candidates, num_candidates, sizeof(ND_REFINE_CANDIDATE), cmp_refine_value);
+	qsort(candidates, num_cells, sizeof(ND_REFINE_CANDIDATE), cmp_refine_index);
+
+	slots = palloc(sizeof(int) * histo_cells);
+	for ( i = 0; i < histo_cells; i++ )
+		slots[i] = -1;
+	for ( i = 0; i < num_cells; i++ )
+		slots[candidates[i].vdx] = i;
+	values = palloc0(sizeof(double) * num_cells * subcells);
+
+	/* Add the box overlap proportions to the sub-cells, as for the histogram */
+	for ( i = 0; i < num_boxes; i++ )
+	{
+		const ND_BOX *nd_box = sample_boxes[i];
+		ND_IBOX nd_ibox;
+		int at[ND_DIMS];
+
+		if ( ! nd_box ) continue; /* Skip Null'ed out hard deviants */
+
+		/* Give backend a chance of interrupting us */
+		vacuum_delay_point();
+
+		nd_box_overlap(nd_stats, nd_box, &nd_ibox);
+		memset(at, 0, sizeof(int)*ND_DIMS);
+		for ( d = 0; d < ndims; d++ )
+			at[d] = nd_ibox.min[d];
+
+		do
+		{
+			ND_IBOX sub_ibox;
+			int sub_at[ND_DIMS];
+			double cell_min[ND_DIMS], sub_width[ND_DIMS];
+			int slot = slots[nd_stats_value_index(nd_stats, at)];
+
+			if ( slot < 0 ) continue;
+
+			/* Find the sub-cells that overlap with this box */
+			memset(&sub_ibox, 0, sizeof(ND_IBOX));
+			memset(sub_at, 0, sizeof(int)*ND_DIMS);
+			for ( d = 0; d < ndims; d++ )
+			{
+				double lo = 0, hi = 0;
+				cell_min[d] = min[d] + at[d] * cellsize[d];
+				sub_width[d] = cellsize[d] / sub_size[d];
+				if ( sub_width[d] > 0 )
+				{
+					lo = floor((nd_box->min[d] - cell_min[d]) / sub_width[d]);
+					hi = floor((nd_box->max[d] - cell_min[d]) / sub_width[d]);
+				}
+				sub_ibox.min[d] = sub_at[d] = (int)Min(Max(lo, 0), sub_size[d] - 1);
+				sub_ibox.max[d] = (int)Min(Max(hi, 0), sub_size[d] - 1);
+			}
+
+			do
+			{
+				ND_BOX sub_cell = { {0.0, 0.0, 0.0, 0.0}, {0.0, 0.0, 0.0, 0.0} };
+				int sdx = 0, accum = 1;
+				for ( d = 0; d < ndims; d++ )
+				{
+					sub_cell.min[d] = cell_min[d] + (sub_at[d]+0) * sub_width[d];
+					sub_cell.max[d] = cell_min[d] + (sub_at[d]+1) * sub_width[d];
+					sdx += sub_at[d] * accum;
+					accum *= sub_size[d];
+				}
+				values[(size_t)slot * subcells + sdx] += nd_box_ratio(&sub_cell, nd_box, ndims);
+			}
+			while ( nd_increment(&sub_ibox, ndims, sub_at) );
+		}
+		while ( nd_increment(&nd_ibox, ndims, at) );
+	}
+
+	/* Append the refinement, it lives in the same context as the histogram */
+	refine_size = sizeof(float4) * (ND_REFINE_HEADER_FLOATS + (size_t)num_cells * (1 + subcells));
+	nd_stats = repalloc(nd_stats, *nd_stats_size + refine_size);
+	*nd_stats_size += refine_size;
+
+	refine = (ND_REFINE *)(nd_stats->value + histo_cells);
+	refine->version = ND_REFINE_VERSION;
+	refine->num_cells = num_cells;
+	for ( d = 0; d < ND_DIMS; d++ )
+		refine->size[d] = d < ndims ? sub_size[d] : 1;
+
+	entry = refine->value;
+	for ( i = 0; i < num_cells; i++ )
+	{
+		const double *cell_values = values + (size_t)i * subcells;
+		double cell_total = nd_stats->value[candidates[i].vdx];
+		double sum = 0.0;
+
+		/*
+		 * Features right on sub-cell edges are not counted
+		 * anywhere, so scale the sub-cells to add up to the cell.
+		 */
+		for ( j = 0; j < subcells; j++ )
+			sum += cell_values[j];
+
+		*entry++ = candidates[i].vdx;
+		for ( j = 0; j < subcells; j++ )
+			*entry++ = sum > 0.0 ? cell_values[j] * cell_total / sum : cell_total / subcells;
+	}
+
+	pfree(values);
+	pfree(slots);
+	pfree(candidates);
+	return nd_stats;
+}
+
 /**
  * The gserialized_analyze_nd sets this function as a
  * callback on the stats object when called by the ANALYZE
@@ -1690,8 +2057,8 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 	 */
 	old_context = MemoryContextSwitchTo(stats->anl_context);
 	nd_stats_size = sizeof(ND_STATS) + ((histo_cells - 1) * sizeof(float4));
-	nd_stats = palloc(nd_stats_size);
-	memset(nd_stats, 0, nd_stats_size); /* Initialize all values to 0 */
+	/* Room for an empty ND_REFINE header, in case no cell is refined */
+	nd_stats = palloc0(nd_stats_size + ND_REFINE_HEADER_FLOATS * sizeof(float4));
 	MemoryContextSwitchTo(old_context);
 
 	/* Initialize the #ND_STATS objects */
@@ -1802,6 +2169,13 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 	nd_stats->histogram_cells = histo_cells;
 	nd_stats->cells_covered = total_cell_count;
 
+	/*
+	 * Fifth scan:
+	 *  o split the densest cells into sub-cells, so
+	 *    small boxes in dense areas get good estimates
+	 */
+	nd_stats = nd_stats_refine(nd_stats, &nd_stats_size, sample_boxes, notnull_cnt);
+
 	/* Put this histogram data into the right slot/kind */
 	if ( mode == 2 )
 	{
@@ -1925,6 +2299,41 @@ Datum gserialized_analyze_nd(PG_FUNCTION_ARGS)
 	PG_RETURN_BOOL(true);
 }
 
+/**
+* Sum up the sub-cell values of a refined histogram cell,
+* each times the proportion of the sub-cell within the
+* search box.
+*/
+static double
+nd_refine_count(const ND_REFINE *refine, int ndims, const float4 *values, const ND_BOX *nd_cell, const ND_BOX *nd_box)
+{
+	int d, i;
+	int subcells = nd_refine_subcells(refine, ndims);
+	double total = 0.0;
+
+	for ( i = 0; i < subcells; i++ )
+	{
+		ND_BOX sub_cell = { {0.0, 0.0, 0.0, 0.0}, {0.0, 0.0, 0.0, 0.0} };
+		int rest = i;
+
+		if ( values[i] == 0.0 )
+			continue;
+
+		/* Sub-cells are numbered like the histogram cells */
+		for ( d = 0; d < ndims; d++ )
+		{
+			int size = (int)roundf(refine->size[d]);
+			double width = (nd_cell->max[d] - nd_cell->min[d]) / size;
+			int at = rest % size;
+			rest /= size;
+			sub_cell.min[d] = nd_cell->min[d] + (at+0) * width;
+			sub_cell.max[d] = nd_cell->min[d] + (at+1) * width;
+		}
+		total += values[i] * nd_box_ratio(nd_box, &sub_cell, ndims);
+	}
+	return total;
+}
+
 /**
 * This function returns an estimate of the selectivity
 * of a search GBOX by looking at data in the ND_STATS
@@ -1936,6 +2345,8 @@ Datum gserialized_analyze_nd(PG_FUNCTION_ARGS)
 * we need "only" sum up the values * the proportion of each cell
 * in the histogram that falls within the search box, then
 * divide by the number of features that generated the histogram.
+* Refined cells that the box only partly covers are pro-rated
+* on their sub-cells instead.
 */
 static float8
 estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
@@ -1950,6 +2361,7 @@ estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
 	double max[ND_DIMS];
 	double total_count = 0.0;
 	int ndims_max;
+	const ND_REFINE *refine;
 
 	/* Calculate the overlap of the box on the histogram */
 	if ( ! nd_stats )
@@ -2020,10 +2432,14 @@ estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
 		at[d] = nd_ibox.min[d];
 	}
 
+	refine = nd_stats_refinement(nd_stats);
+
 	/* Move through all the overlap values and sum them */
 	do
 	{
 		float cell_count, ratio;
+		const float4 *sub_values;
+		int vdx;
 		ND_BOX nd_cell = { {0.0, 0.0, 0.0, 0.0}, {0.0, 0.0, 0.0, 0.0} };
 
 		/* We have to pro-rate partially overlapped cells. */
@@ -2034,10 +2450,19 @@ estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
 		}
 
 		ratio = nd_box_ratio(&nd_box, &nd_cell, nd_stats->ndims);
-		cell_count = nd_stats->value[nd_stats_value_index(nd_stats, at)];
+		vdx = nd_stats_value_index(nd_stats, at);
+		cell_count = nd_stats->value[vdx];
+
+		/* Partly covered dense cells are pro-rated on their sub-cells */
+		sub_values = NULL;
+		if ( refine && ratio > 0.0 && ratio < 1.0 )
+			sub_values = nd_refine_values(refine, nd_stats->ndims, vdx);
 
 		/* Add the pro-rated count for this cell to the overall total */
-		total_count += cell_count * ratio;
+		if ( sub_values )
+			total_count += nd_refine_count(refine, nd_stats->ndims, sub_values, &nd_cell, &nd_box);
+		else
+			total_count += cell_count * ratio;
 		POSTGIS_DEBUGF(4, " cell (%d,%d), cell value %.6f, ratio %.6f", at[0], at[1], cell_count, ratio);
 	}
 	while ( nd_increment(&nd_ibox, nd_stats->ndims, at) );
@@ -87,6 +87,17 @@ Datum gserialized_gist_same_2d(PG_FUNCTION_ARGS);
 Datum gserialized_gist_distance_2d(PG_FUNCTION_ARGS);
 Datum gserialized_gist_sortsupport_2d(PG_FUNCTION_ARGS);
 
+/*
+** GiST 2D quantized key prototypes
+*/
+Datum box2dfq_out(PG_FUNCTION_ARGS);
+Datum box2dfq_in(PG_FUNCTION_ARGS);
+Datum gserialized_gist_consistent_2d_quantized(PG_FUNCTION_ARGS);
+Datum gserialized_gist_compress_2d_quantized(PG_FUNCTION_ARGS);
+Datum gserialized_gist_decompress_2d_quantized(PG_FUNCTION_ARGS);
+Datum gserialized_gist_distance_2d_quantized(PG_FUNCTION_ARGS);
+Datum gserialized_gist_sortsupport_2d_quantized(PG_FUNCTION_ARGS);
+
 /*
 ** GiST 2D operator prototypes
 */
@@ -406,7 +417,7 @@ static inline double pt_distance(double ax, double ay, double bx, double by)
 /**
 * Calculate the box->box distance.
 */
-static double box2df_distance(const BOX2DF *a, const BOX2DF *b)
+double box2df_distance(const BOX2DF *a, const BOX2DF *b)
 {
 	/* Check for overlap */
 	if ( box2df_overlaps(a, b) )
@@ -455,44 +466,19 @@ static double box2df_distance(const BOX2DF *a, const BOX2DF *b)
 static inline uint64_t
 box2df_get_sortable_hash(const BOX2DF *b)
 {
-	union floatuint {
-		uint32_t u;
-		float f;
-	} x, y;
-
-	x.f = (b->xmax + b->xmin) / 2;
-	y.f = (b->ymax + b->ymin) / 2;
-
-	return uint32_hilbert(y.u, x.u);
+	return gserialized_gist_sort_key(b->xmin, b->xmax, b->ymin, b->ymax);
 }
 
 /**
  * Peak into a #GSERIALIZED datum to find its bounding box and some other metadata. If the box is there, copy it out and
  * return it. If not, calculate the box from the full object and return the box based on that. If no box is available,
- * return #LW_FAILURE, otherwise #LW_SUCCESS.
+ * return #LW_FAILURE, otherwise #LW_SUCCESS. See gserialized_datum_get_box_part.
  */
 int
 gserialized_datum_get_internals_p(Datum gsdatum, GBOX *gbox, lwflags_t *flags, uint8_t *type, int32_t *srid)
 {
 	int result = LW_SUCCESS;
-	GSERIALIZED *gpart = NULL;
-	int need_detoast = PG_GSERIALIZED_DATUM_NEEDS_DETOAST((struct varlena *)gsdatum);
-	if (need_detoast)
-	{
-		gpart = (GSERIALIZED *)PG_DETOAST_DATUM_SLICE(gsdatum, 0, gserialized_max_header_size());
-	}
-	else
-	{
-		gpart = (GSERIALIZED *)gsdatum;
-	}
-
-	if (!gserialized_has_bbox(gpart) && need_detoast && LWSIZE_GET(gpart->size) >= gserialized_max_header_size())
-	{
-		/* The headers don't contain a bbox and the object is larger than what we retrieved, so
-		 * we now detoast it completely */
-		POSTGIS_FREE_IF_COPY_P(gpart, gsdatum);
-		gpart = (GSERIALIZED *)PG_DETOAST_DATUM(gsdatum);
-	}
+	GSERIALIZED *gpart = gserialized_datum_get_box_part(gsdatum, true);
 
 	result = gserialized_get_gbox_p(gpart, gbox);
 	*flags = gserialized_get_lwflags(gpart);
@@ -527,16 +513,7 @@ int
 gserialized_datum_get_box2df_p(Datum gsdatum, BOX2DF *box2df)
 {
 	int result = LW_SUCCESS;
-	GSERIALIZED *gpart = NULL;
-	int need_detoast = PG_GSERIALIZED_DATUM_NEEDS_DETOAST((struct varlena *)gsdatum);
-	if (need_detoast)
-	{
-		gpart = (GSERIALIZED *)PG_DETOAST_DATUM_SLICE(gsdatum, 0, gserialized_max_header_size());
-	}
-	else
-	{
-		gpart = (GSERIALIZED *)gsdatum;
-	}
+	GSERIALIZED *gpart = gserialized_datum_get_box_part(gsdatum, true);
 
 	if (gserialized_has_bbox(gpart))
 	{
@@ -548,13 +525,6 @@ gserialized_datum_get_box2df_p(Datum gsdatum, BOX2DF *box2df)
 	else
 	{
 		GBOX gbox = {0};
-		if (need_detoast && LWSIZE_GET(gpart->size) >= gserialized_max_header_size())
-		{
-			/* The headers don't contain a bbox and the object is larger than what we retrieved, so
-			 * we now detoast it completely and recheck */
-			POSTGIS_FREE_IF_COPY_P(gpart, gsdatum);
-			gpart = (GSERIALIZED *)PG_DETOAST_DATUM(gsdatum);
-		}
 		result = gserialized_get_gbox_p(gpart, &gbox);
 		if (result == LW_SUCCESS)
 		{
@@ -2131,3 +2101,342 @@ Datum box2df_out(PG_FUNCTION_ARGS)
   char *result = box2df_to_string(box);
   PG_RETURN_CSTRING(result);
 }
+
+
+/***********************************************************************
+** Quantized 2D keys, used by the gist_geometry_ops_2d_quantized opclass.
+**
+** A BOX2DF key makes for 24 byte index tuples once the tuple header and
+** the double alignment are added. The quantized keys are short varlenas
+** with no alignment, holding the ordinates as order preserving integers
+** with the low bits dropped, rounded outwards:
+**
+**   no payload  empty box
+**   7 bytes     point (no larger than one float step on each axis),
+**               28 bits per ordinate, in a 16 byte tuple
+**   15 bytes    any other box, 30 bits per ordinate, in a 24 byte tuple
+**
+** The decompressed key always contains the original box, so scans are
+** exact once the leaf matches are rechecked against the heap. Union,
+** penalty, picksplit and same work on the decompressed BOX2DF, and are
+** shared with the default opclass.
+*/
+
+#define BOX2DFQ_POINT_SIZE 7
+#define BOX2DFQ_POINT_SHIFT 4
+#define BOX2DFQ_BOX_SIZE 15
+#define BOX2DFQ_BOX_SHIFT 2
+
+/* Order preserving integer of FLT_MAX, the largest finite key */
+#define BOX2DFQ_KEY_MAX 0xFF7FFFFFu
+
+/* Map a float onto an unsigned integer that sorts the same way */
+static inline uint32_t
+box2dfq_float_to_key(float f)
+{
+	union { float f; uint32_t u; } v;
+	v.f = f;
+	return (v.u & 0x80000000u) ? ~v.u : (v.u | 0x80000000u);
+}
+
+static inline float
+box2dfq_key_to_float(uint64_t k)
+{
+	union { float f; uint32_t u; } v;
+	if (k > BOX2DFQ_KEY_MAX)
+		k = BOX2DFQ_KEY_MAX;
+	v.u = (k & 0x80000000u) ? (uint32_t)(k & 0x7FFFFFFFu) : ~(uint32_t)k;
+	return v.f;
+}
+
+/* Pack n values of the given bit width, most significant first */
+static void
+box2dfq_put(uint8_t *buf, const uint32_t *q, int n, int bits)
+{
+	uint64_t acc = 0;
+	int nacc = 0, i;
+	for (i = 0; i < n; i++)
+	{
+		acc = (acc << bits) | q[i];
+		nacc += bits;
+		while (nacc >= 8)
+		{
+			nacc -= 8;
+			*buf++ = (uint8_t)(acc >> nacc);
+		}
+	}
+}
+
+static void
+box2dfq_get(const uint8_t *buf, uint32_t *q, int n, int bits)
+{
+	uint64_t acc = 0;
+	int nacc = 0, i;
+	for (i = 0; i < n; i++)
+	{
+		while (nacc < bits)
+		{
+			acc = (acc << 8) | *buf++;
+			nacc += 8;
+		}
+		nacc -= bits;
+		q[i] = (uint32_t)(acc >> nacc) & ((1u << bits) - 1);
+	}
+}
+
+/*
+** Quantize a box that is either empty or finite with
+** minimums below maximums, into a new varlena key.
+*/
+static bytea *
+box2df_quantize(const BOX2DF *b)
+{
+	uint32_t xmin, xmax, ymin, ymax;
+	uint32_t q[4];
+	bytea *key;
+
+	if (box2df_is_empty(b))
+	{
+		key = palloc(VARHDRSZ);
+		SET_VARSIZE(key, VARHDRSZ);
+		return key;
+	}
+
+	xmin = box2dfq_float_to_key(b->xmin);
+	xmax = box2dfq_float_to_key(b->xmax);
+	ymin = box2dfq_float_to_key(b->ymin);
+	ymax = box2dfq_float_to_key(b->ymax);
+
+	/* Points only keep their lower corner, decoding covers the next step too */
+	if (xmax - xmin <= 1 && ymax - ymin <= 1)
+	{
+		q[0] = xmin >> BOX2DFQ_POINT_SHIFT;
+		q[1] = ymin >> BOX2DFQ_POINT_SHIFT;
+		key = palloc(VARHDRSZ + BOX2DFQ_POINT_SIZE);
+		SET_VARSIZE(key, VARHDRSZ + BOX2DFQ_POINT_SIZE);
+		box2dfq_put((uint8_t *)VARDATA(key), q, 2, 32 - BOX2DFQ_POINT_SHIFT);
+		return key;
+	}
+
+	/* Round minimums down and maximums up, finite keys can't overflow */
+	q[0] = xmin >> BOX2DFQ_BOX_SHIFT;
+	q[1] = ymin >> BOX2DFQ_BOX_SHIFT;
+	q[2] = (xmax + ((1u << BOX2DFQ_BOX_SHIFT) - 1)) >> BOX2DFQ_BOX_SHIFT;
+	q[3] = (ymax + ((1u << BOX2DFQ_BOX_SHIFT) - 1)) >> BOX2DFQ_BOX_SHIFT;
+	key = palloc(VARHDRSZ + BOX2DFQ_BOX_SIZE);
+	SET_VARSIZE(key, VARHDRSZ + BOX2DFQ_BOX_SIZE);
+	box2dfq_put((uint8_t *)VARDATA(key), q, 4, 32 - BOX2DFQ_BOX_SHIFT);
+	return key;
+}
+
+/*
+** Expand a quantized key, read straight off an index page
+** so possibly with a short header, into a covering box.
+*/
+static void
+box2dfq_decode(const bytea *key, BOX2DF *b)
+{
+	uint32_t q[4];
+	const uint8_t *data = (const uint8_t *)VARDATA_ANY(key);
+
+	switch (VARSIZE_ANY_EXHDR(key))
+	{
+	case 0:
+		box2df_set_empty(b);
+		break;
+	case BOX2DFQ_POINT_SIZE:
+		box2dfq_get(data, q, 2, 32 - BOX2DFQ_POINT_SHIFT);
+		b->xmin = box2dfq_key_to_float((uint64_t)q[0] << BOX2DFQ_POINT_SHIFT);
+		b->ymin = box2dfq_key_to_float((uint64_t)q[1] << BOX2DFQ_POINT_SHIFT);
+		b->xmax = box2dfq_key_to_float(((uint64_t)q[0] + 1) << BOX2DFQ_POINT_SHIFT);
+		b->ymax = box2dfq_key_to_float(((uint64_t)q[1] + 1) << BOX2DFQ_POINT_SHIFT);
+		break;
+	case BOX2DFQ_BOX_SIZE:
+		box2dfq_get(data, q, 4, 32 - BOX2DFQ_BOX_SHIFT);
+		b->xmin = box2dfq_key_to_float((uint64_t)q[0] << BOX2DFQ_BOX_SHIFT);
+		b->ymin = box2dfq_key_to_float((uint64_t)q[1] << BOX2DFQ_BOX_SHIFT);
+		b->xmax = box2dfq_key_to_float((uint64_t)q[2] << BOX2DFQ_BOX_SHIFT);
+		b->ymax = box2dfq_key_to_float((uint64_t)q[3] << BOX2DFQ_BOX_SHIFT);
+		break;
+	default:
+		elog(ERROR, "%s: invalid quantized key size %d", __func__, (int)VARSIZE_ANY_EXHDR(key));
+	}
+}
+
+/*
+** GiST support function. Quantize the box of a geometry, or the
+** union of an internal page, which comes in as a plain BOX2DF.
+*/
+PG_FUNCTION_INFO_V1(gserialized_gist_compress_2d_quantized);
+Datum gserialized_gist_compress_2d_quantized(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry_in = (GISTENTRY*)PG_GETARG_POINTER(0);
+	GISTENTRY *entry_out = palloc(sizeof(GISTENTRY));
+	BOX2DF bbox;
+
+	if (!entry_in->leafkey)
+	{
+		bbox = *(BOX2DF*)DatumGetPointer(entry_in->key);
+	}
+	else if (DatumGetPointer(entry_in->key) == NULL)
+	{
+		gistentryinit(*entry_out, (Datum) 0, entry_in->rel,
+		              entry_in->page, entry_in->offset, false);
+		PG_RETURN_POINTER(entry_out);
+	}
+	else if (gserialized_datum_get_box2df_p(entry_in->key, &bbox) == LW_FAILURE)
+	{
+		box2df_set_empty(&bbox);
+	}
+	else
+	{
+		box2df_set_finite(&bbox);
+		box2df_validate(&bbox);
+	}
+
+	gistentryinit(*entry_out, PointerGetDatum(box2df_quantize(&bbox)),
+	              entry_in->rel, entry_in->page, entry_in->offset, false);
+	PG_RETURN_POINTER(entry_out);
+}
+
+/*
+** GiST support function. Expand a quantized key into a BOX2DF
+** for the other support functions.
+*/
+PG_FUNCTION_INFO_V1(gserialized_gist_decompress_2d_quantized);
+Datum gserialized_gist_decompress_2d_quantized(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry_in = (GISTENTRY*)PG_GETARG_POINTER(0);
+	GISTENTRY *entry_out = palloc(sizeof(GISTENTRY));
+	BOX2DF *bbox = palloc(sizeof(BOX2DF));
+
+	box2dfq_decode((bytea *)DatumGetPointer(entry_in->key), bbox);
+	gistentryinit(*entry_out, PointerGetDatum(bbox), entry_in->rel,
+	              entry_in->page, entry_in->offset, entry_in->leafkey);
+	PG_RETURN_POINTER(entry_out);
+}
+
+/*
+** GiST support function. Leaf keys may be larger than the boxes they
+** stand for, like internal keys are, so both get the internal tests and
+** the leaf matches are rechecked.
+*/
+PG_FUNCTION_INFO_V1(gserialized_gist_consistent_2d_quantized);
+Datum gserialized_gist_consistent_2d_quantized(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY*) PG_GETARG_POINTER(0);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	bool *recheck = (bool *) PG_GETARG_POINTER(4);
+	BOX2DF query_gbox_index;
+
+	*recheck = true;
+
+	if (DatumGetPointer(PG_GETARG_DATUM(1)) == NULL || DatumGetPointer(entry->key) == NULL)
+		PG_RETURN_BOOL(false);
+
+	if (gserialized_datum_get_box2df_p(PG_GETARG_DATUM(1), &query_gbox_index) == LW_FAILURE)
+		PG_RETURN_BOOL(false);
+
+	PG_RETURN_BOOL(gserialized_gist_consistent_internal_2d(
+	                   (BOX2DF*)DatumGetPointer(entry->key),
+	                   &query_gbox_index, strategy));
+}
+
+/*
+** GiST support function. The box distance to a leaf key is only
+** a lower bound for both <-> and <#>, so leaves are rechecked.
+*/
+PG_FUNCTION_INFO_V1(gserialized_gist_distance_2d_quantized);
+Datum gserialized_gist_distance_2d_quantized(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY*) PG_GETARG_POINTER(0);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	bool *recheck = (bool *) PG_GETARG_POINTER(4);
+	BOX2DF query_box;
+
+	if ( strategy != 13 && strategy != 14 ) {
+		elog(ERROR, "unrecognized strategy number: %d", strategy);
+		PG_RETURN_FLOAT8(FLT_MAX);
+	}
+
+	if ( gserialized_datum_get_box2df_p(PG_GETARG_DATUM(1), &query_box) == LW_FAILURE )
+		PG_RETURN_FLOAT8(FLT_MAX);
+
+	if (GIST_LEAF(entry))
+		*recheck = true;
+
+	PG_RETURN_FLOAT8(box2df_distance((BOX2DF*)DatumGetPointer(entry->key), &query_box));
+}
+
+/*
+** Sort support works on the compressed keys, so they are
+** expanded before hashing.
+*/
+static uint64_t
+box2dfq_get_sortable_hash(Datum d, BOX2DF *b)
+{
+	box2dfq_decode((bytea *)DatumGetPointer(d), b);
+	return box2df_get_sortable_hash(b);
+}
+
+static Datum
+gserialized_gist_abbrev_convert_2d_quantized(Datum original, SortSupport ssup)
+{
+	BOX2DF b;
+	return box2dfq_get_sortable_hash(original, &b);
+}
+
+static int
+gserialized_gist_cmp_full_2d_quantized(Datum a, Datum b, SortSupport ssup)
+{
+	BOX2DF b1, b2;
+	uint64_t hash1 = box2dfq_get_sortable_hash(a, &b1);
+	uint64_t hash2 = box2dfq_get_sortable_hash(b, &b2);
+	int cmp;
+
+	if (hash1 > hash2)
+		return 1;
+	else if (hash1 < hash2)
+		return -1;
+
+	cmp = memcmp(&b1, &b2, sizeof(BOX2DF));
+	return cmp > 0 ? 1 : (cmp < 0 ? -1 : 0);
+}
+
+PG_FUNCTION_INFO_V1(gserialized_gist_sortsupport_2d_quantized);
+Datum gserialized_gist_sortsupport_2d_quantized(PG_FUNCTION_ARGS)
+{
+	SortSupport ssup = (SortSupport)PG_GETARG_POINTER(0);
+
+	ssup->comparator = gserialized_gist_cmp_full_2d_quantized;
+	ssup->ssup_extra = NULL;
+	/* Enable sortsupport only on 64 bit Datum */
+	if (ssup->abbreviate && sizeof(Datum) == 8)
+	{
+		ssup->comparator = gserialized_gist_cmp_abbrev_2d;
+		ssup->abbrev_converter = gserialized_gist_abbrev_convert_2d_quantized;
+		ssup->abbrev_abort = gserialized_gist_abbrev_abort_2d;
+		ssup->abbrev_full_comparator = gserialized_gist_cmp_full_2d_quantized;
+	}
+
+	PG_RETURN_VOID();
+}
+
+/*
+** Stubs binding the quantized key type, like the BOX2DF ones.
+*/
+PG_FUNCTION_INFO_V1(box2dfq_in);
+Datum box2dfq_in(PG_FUNCTION_ARGS)
+{
+	ereport(ERROR,(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+	               errmsg("function box2dfq_in not implemented")));
+	PG_RETURN_POINTER(NULL);
+}
+
+PG_FUNCTION_INFO_V1(box2dfq_out);
+Datum box2dfq_out(PG_FUNCTION_ARGS)
+{
+	BOX2DF box;
+	box2dfq_decode((bytea *)PG_DETOAST_DATUM_PACKED(PG_GETARG_DATUM(0)), &box);
+	PG_RETURN_CSTRING(box2df_to_string(&box));
+}
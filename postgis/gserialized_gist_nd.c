@@ -40,6 +40,7 @@
 #include "access/gist.h" /* For GiST */
 #include "access/itup.h"
 #include "access/skey.h"
+#include "utils/sortsupport.h" /* For index building sort support */
 
 #include "../postgis_config.h"
 
@@ -81,6 +82,7 @@ Datum gserialized_gist_penalty(PG_FUNCTION_ARGS);
 Datum gserialized_gist_picksplit(PG_FUNCTION_ARGS);
 Datum gserialized_gist_union(PG_FUNCTION_ARGS);
 Datum gserialized_gist_same(PG_FUNCTION_ARGS);
+Datum gserialized_gist_sortsupport(PG_FUNCTION_ARGS);
 Datum gserialized_gist_distance(PG_FUNCTION_ARGS);
 Datum gserialized_gist_geog_distance(PG_FUNCTION_ARGS);
 
@@ -1264,6 +1266,90 @@ Datum gserialized_gist_same(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(result);
 }
 
+/*
+** Sort key of the first two dimensions, the others are left to picksplit.
+*/
+static inline uint64_t
+gidx_get_sortable_hash(GIDX *b)
+{
+	if (gidx_is_unknown(b) || GIDX_NDIMS(b) < 2)
+		return 0;
+
+	return gserialized_gist_sort_key(GIDX_GET_MIN(b, 0), GIDX_GET_MAX(b, 0), GIDX_GET_MIN(b, 1), GIDX_GET_MAX(b, 1));
+}
+
+static int
+gserialized_gist_cmp_abbrev(Datum x, Datum y, SortSupport ssup)
+{
+	/* Empty is a special case */
+	if (x == 0 || y == 0 || x == y)
+		return 0; /* 0 means "ask bigger comparator" and not equality*/
+	else if (x > y)
+		return 1;
+	else
+		return -1;
+}
+
+static bool
+gserialized_gist_abbrev_abort(int memtupcount, SortSupport ssup)
+{
+	return LW_FALSE;
+}
+
+static Datum
+gserialized_gist_abbrev_convert(Datum original, SortSupport ssup)
+{
+	return gidx_get_sortable_hash((GIDX *)DatumGetPointer(original));
+}
+
+static int
+gserialized_gist_cmp_full(Datum a, Datum b, SortSupport ssup)
+{
+	GIDX *b1 = (GIDX *)DatumGetPointer(a);
+	GIDX *b2 = (GIDX *)DatumGetPointer(b);
+	uint64_t hash1, hash2;
+	int cmp;
+
+	cmp = memcmp(b1, b2, Min(VARSIZE(b1), VARSIZE(b2)));
+	if (cmp == 0)
+	{
+		if (VARSIZE(b1) == VARSIZE(b2))
+			return 0;
+		cmp = VARSIZE(b1) > VARSIZE(b2) ? 1 : -1;
+	}
+
+	hash1 = gidx_get_sortable_hash(b1);
+	hash2 = gidx_get_sortable_hash(b2);
+	if (hash1 > hash2)
+		return 1;
+	else if (hash1 < hash2)
+		return -1;
+
+	return cmp > 0 ? 1 : -1;
+}
+
+/*
+** GiST support function. Sorted index build, see gserialized_gist_sort_key.
+*/
+PG_FUNCTION_INFO_V1(gserialized_gist_sortsupport);
+Datum gserialized_gist_sortsupport(PG_FUNCTION_ARGS)
+{
+	SortSupport ssup = (SortSupport)PG_GETARG_POINTER(0);
+
+	ssup->comparator = gserialized_gist_cmp_full;
+	ssup->ssup_extra = NULL;
+	/* Enable sortsupport only on 64 bit Datum */
+	if (ssup->abbreviate && sizeof(Datum) == 8)
+	{
+		ssup->comparator = gserialized_gist_cmp_abbrev;
+		ssup->abbrev_converter = gserialized_gist_abbrev_convert;
+		ssup->abbrev_abort = gserialized_gist_abbrev_abort;
+		ssup->abbrev_full_comparator = gserialized_gist_cmp_full;
+	}
+
+	PG_RETURN_VOID();
+}
+
 PG_FUNCTION_INFO_V1(gserialized_gist_geog_distance);
 Datum gserialized_gist_geog_distance(PG_FUNCTION_ARGS)
 {
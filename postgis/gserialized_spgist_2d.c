@@ -281,6 +281,44 @@ overAbove4D(RectBox *rect_box, BOX2DF *query)
 	return rect_box->left.ymin >= query->ymin;
 }
 
+/*
+ * Distances of a box to the ORDER BY arguments. As in the GiST opclass,
+ * <-> (13) and <#> (14) both use the distance between the boxes, which
+ * is the lower bound of the <-> distance between the geometries.
+ */
+static double *
+orderbyDistances2D(ScanKey orderbys, int norderbys, const BOX2DF *box)
+{
+	double *distances = (double *)palloc(sizeof(double) * norderbys);
+	int i;
+
+	for (i = 0; i < norderbys; i++)
+	{
+		BOX2DF query_gbox_index;
+
+		if (gserialized_datum_get_box2df_p(orderbys[i].sk_argument, &query_gbox_index) == LW_FAILURE)
+			distances[i] = FLT_MAX;
+		else
+			distances[i] = box2df_distance(box, &query_gbox_index);
+	}
+	return distances;
+}
+
+/* Distances of the boxes of rect_box to the ORDER BY arguments */
+static double *
+orderbyDistances4D(ScanKey orderbys, int norderbys, RectBox *rect_box)
+{
+	BOX2DF bounds;
+
+	/* Every box of rect_box is inside these bounds */
+	bounds.xmin = rect_box->left.xmin;
+	bounds.xmax = rect_box->right.xmax;
+	bounds.ymin = rect_box->left.ymin;
+	bounds.ymax = rect_box->right.ymax;
+
+	return orderbyDistances2D(orderbys, norderbys, &bounds);
+}
+
 /*
  * SP-GiST config function
  */
@@ -415,6 +453,15 @@ PGDLLEXPORT Datum gserialized_spgist_inner_consistent_2d(PG_FUNCTION_ARGS)
 	uint8 quadrant;
 	BOX2DF *centroid;
 
+	/*
+	 * We are saving the traversal value or initialize it an unbounded one, if
+	 * we have just begun to walk the tree.
+	 */
+	if (in->traversalValue)
+		rect_box = in->traversalValue;
+	else
+		rect_box = initRectBox();
+
 	if (in->allTheSame)
 	{
 		/* Report that all nodes should be visited */
@@ -423,24 +470,25 @@ PGDLLEXPORT Datum gserialized_spgist_inner_consistent_2d(PG_FUNCTION_ARGS)
 		for (i = 0; i < in->nNodes; i++)
 			out->nodeNumbers[i] = i;
 
+		/* All the nodes are as far as the whole rect_box */
+		if (in->norderbys > 0)
+		{
+			out->distances = (double **)palloc(sizeof(double *) * in->nNodes);
+			for (i = 0; i < in->nNodes; i++)
+				out->distances[i] = orderbyDistances4D(in->orderbys, in->norderbys, rect_box);
+		}
+
 		PG_RETURN_VOID();
 	}
 
-	/*
-	 * We are saving the traversal value or initialize it an unbounded one, if
-	 * we have just begun to walk the tree.
-	 */
-	if (in->traversalValue)
-		rect_box = in->traversalValue;
-	else
-		rect_box = initRectBox();
-
 	centroid = (BOX2DF *)DatumGetPointer(in->prefixDatum);
 
 	/* Allocate enough memory for nodes */
 	out->nNodes = 0;
 	out->nodeNumbers = (int *)palloc(sizeof(int) * in->nNodes);
 	out->traversalValues = (void **)palloc(sizeof(void *) * in->nNodes);
+	if (in->norderbys > 0)
+		out->distances = (double **)palloc(sizeof(double *) * in->nNodes);
 
 	/*
 	 * We switch memory context, because we want to allocate memory for new
@@ -532,6 +580,8 @@ PGDLLEXPORT Datum gserialized_spgist_inner_consistent_2d(PG_FUNCTION_ARGS)
 		{
 			out->traversalValues[out->nNodes] = next_rect_box;
 			out->nodeNumbers[out->nNodes] = quadrant;
+			if (in->norderbys > 0)
+				out->distances[out->nNodes] = orderbyDistances4D(in->orderbys, in->norderbys, next_rect_box);
 			out->nNodes++;
 		}
 		else
@@ -657,6 +707,18 @@ PGDLLEXPORT Datum gserialized_spgist_leaf_consistent_2d(PG_FUNCTION_ARGS)
 			break;
 	}
 
+	/* Box distances are exact for <#>, and a lower bound for <-> */
+	if (flag && in->norderbys > 0)
+	{
+		out->distances = orderbyDistances2D(in->orderbys, in->norderbys, key);
+		out->recheckDistances = false;
+		for (i = 0; i < in->norderbys; i++)
+		{
+			if (in->orderbys[i].sk_strategy == 13)
+				out->recheckDistances = true;
+		}
+	}
+
 	PG_RETURN_BOOL(flag);
 }
 
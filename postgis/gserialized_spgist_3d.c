@@ -363,6 +363,46 @@ overBack6D(CubeBox3D *cube_box, BOX3D *query)
 	return (cube_box->left.zmin >= query->zmin);
 }
 
+/*
+ * Distances of the boxes within the bounds to the ORDER BY arguments, for
+ * <<->> (13) as in the GiST ND opclass. The keys of geometries without Z
+ * have a zero Z range, and <<->> measures those in 2D, so Z is left out
+ * of this lower bound and to the recheck. The serialized boxes of the
+ * arguments are a little larger than the geometries, which keeps it one.
+ */
+static double *
+orderbyDistances6D(ScanKey orderbys, int norderbys, double xmin, double xmax, double ymin, double ymax)
+{
+	double *distances = (double *)palloc(sizeof(double) * norderbys);
+	int i;
+
+	for (i = 0; i < norderbys; i++)
+	{
+		GBOX box;
+		double dx = 0.0, dy = 0.0;
+
+		/* Empty arguments are farthest from everything */
+		if (gserialized_datum_get_gbox_p(orderbys[i].sk_argument, &box) == LW_FAILURE)
+		{
+			distances[i] = DBL_MAX;
+			continue;
+		}
+
+		if (box.xmax < xmin)
+			dx = xmin - box.xmax;
+		else if (box.xmin > xmax)
+			dx = box.xmin - xmax;
+
+		if (box.ymax < ymin)
+			dy = ymin - box.ymax;
+		else if (box.ymin > ymax)
+			dy = box.ymin - ymax;
+
+		distances[i] = sqrt(dx * dx + dy * dy);
+	}
+	return distances;
+}
+
 /*
  * SP-GiST config function
  */
@@ -514,6 +554,16 @@ PGDLLEXPORT Datum gserialized_spgist_inner_consistent_3d(PG_FUNCTION_ARGS)
 	BOX3D *centroid;
 	int *nodeNumbers;
 	void **traversalValues;
+	double **distances = NULL;
+
+	/*
+	 * We are saving the traversal value or initialize it an unbounded one, if
+	 * we have just begun to walk the tree.
+	 */
+	if (in->traversalValue)
+		cube_box = in->traversalValue;
+	else
+		cube_box = initCubeBox();
 
 	if (in->allTheSame)
 	{
@@ -523,24 +573,30 @@ PGDLLEXPORT Datum gserialized_spgist_inner_consistent_3d(PG_FUNCTION_ARGS)
 		for (i = 0; i < in->nNodes; i++)
 			out->nodeNumbers[i] = i;
 
+		/* All the nodes are as far as the whole cube_box */
+		if (in->norderbys > 0)
+		{
+			out->distances = (double **)palloc(sizeof(double *) * in->nNodes);
+			for (i = 0; i < in->nNodes; i++)
+				out->distances[i] = orderbyDistances6D(in->orderbys,
+								       in->norderbys,
+								       cube_box->left.xmin,
+								       cube_box->right.xmax,
+								       cube_box->left.ymin,
+								       cube_box->right.ymax);
+		}
+
 		PG_RETURN_VOID();
 	}
 
-	/*
-	 * We are saving the traversal value or initialize it an unbounded one, if
-	 * we have just begun to walk the tree.
-	 */
-	if (in->traversalValue)
-		cube_box = in->traversalValue;
-	else
-		cube_box = initCubeBox();
-
 	centroid = DatumGetBox3DP(in->prefixDatum);
 
 	/* Allocate enough memory for nodes */
 	out->nNodes = 0;
 	nodeNumbers = (int *)palloc(sizeof(int) * in->nNodes);
 	traversalValues = (void **)palloc(sizeof(void *) * in->nNodes);
+	if (in->norderbys > 0)
+		distances = (double **)palloc(sizeof(double *) * in->nNodes);
 
 	/*
 	 * We switch memory context, because we want to allocate memory for new
@@ -633,6 +689,13 @@ PGDLLEXPORT Datum gserialized_spgist_inner_consistent_3d(PG_FUNCTION_ARGS)
 		{
 			traversalValues[out->nNodes] = next_cube_box;
 			nodeNumbers[out->nNodes] = octant;
+			if (distances)
+				distances[out->nNodes] = orderbyDistances6D(in->orderbys,
+									    in->norderbys,
+									    next_cube_box->left.xmin,
+									    next_cube_box->right.xmax,
+									    next_cube_box->left.ymin,
+									    next_cube_box->right.ymax);
 			out->nNodes++;
 		}
 		else
@@ -655,6 +718,7 @@ PGDLLEXPORT Datum gserialized_spgist_inner_consistent_3d(PG_FUNCTION_ARGS)
 	}
 	pfree(nodeNumbers);
 	pfree(traversalValues);
+	out->distances = distances;
 
 	/* Switch after */
 	MemoryContextSwitchTo(old_ctx);
@@ -763,6 +827,12 @@ PGDLLEXPORT Datum gserialized_spgist_leaf_consistent_3d(PG_FUNCTION_ARGS)
 			break;
 	}
 
+	if (flag && in->norderbys > 0)
+	{
+		out->distances = orderbyDistances6D(in->orderbys, in->norderbys, leaf->xmin, leaf->xmax, leaf->ymin, leaf->ymax);
+		out->recheckDistances = true;
+	}
+
 	PG_RETURN_BOOL(flag);
 }
 
@@ -188,8 +188,10 @@ typedef struct
 
 static const OpFamilyDim OpFamilyDims[] = {
 	{"gist_geometry_ops_2d", 2},
+	{"gist_geometry_ops_2d_quantized", 2},
 	{"gist_geometry_ops_nd", 3},
 	{"brin_geometry_inclusion_ops_2d", 2},
+	{"brin_geometry_inclusion_ops_2d_multi", 2},
 	{"brin_geometry_inclusion_ops_3d", 3},
 	{"brin_geometry_inclusion_ops_4d", 3},
 	{"spgist_geometry_ops_2d", 2},
@@ -928,15 +928,13 @@ int point_in_polygon_rtree(RTREE_NODE **root, int ringCount, LWPOINT *point)
  *
  * Expected **root order is each exterior ring followed by its holes, eg. EIIEIIEI
  */
-int point_in_multipolygon_rtree(RTREE_NODE **root, int polyCount, int *ringCounts, LWPOINT *point)
+static int point2d_in_multipolygon_rtree(RTREE_NODE **root, int polyCount, int *ringCounts, const POINT2D *pt)
 {
 	int i, p, r, in_ring;
-	POINT2D pt;
 	int result = -1;
 
-	POSTGIS_DEBUGF(2, "point_in_multipolygon_rtree called for %p %d %p.", root, polyCount, point);
+	POSTGIS_DEBUGF(2, "point_in_multipolygon_rtree called for %p %d (%g %g).", root, polyCount, pt->x, pt->y);
 
-	getPoint2d_p(point->point, 0, &pt);
 	/* assume bbox short-circuit has already been attempted */
 
         i = 0; /* the current index into the root array */
@@ -944,7 +942,7 @@ int point_in_multipolygon_rtree(RTREE_NODE **root, int polyCount, int *ringCount
 	/* is the point inside any of the sub-polygons? */
 	for ( p = 0; p < polyCount; p++ )
 	{
-		in_ring = point_in_ring_rtree(root[i], &pt);
+		in_ring = point_in_ring_rtree(root[i], pt);
 		POSTGIS_DEBUGF(4, "point_in_multipolygon_rtree: exterior ring (%d), point_in_ring returned %d", p, in_ring);
 		if ( in_ring == -1 ) /* outside the exterior ring */
 		{
@@ -959,7 +957,7 @@ int point_in_multipolygon_rtree(RTREE_NODE **root, int polyCount, int *ringCount
 
 	                for(r=1; r<ringCounts[p]; r++)
      	                {
-                        	in_ring = point_in_ring_rtree(root[i+r], &pt);
+                        	in_ring = point_in_ring_rtree(root[i+r], pt);
 		        	POSTGIS_DEBUGF(4, "point_in_multipolygon_rtree: interior ring (%d), point_in_ring returned %d", r, in_ring);
                         	if (in_ring == 1) /* inside a hole => outside the polygon */
                         	{
@@ -988,6 +986,36 @@ int point_in_multipolygon_rtree(RTREE_NODE **root, int polyCount, int *ringCount
 
 }
 
+int point_in_multipolygon_rtree(RTREE_NODE **root, int polyCount, int *ringCounts, LWPOINT *point)
+{
+	POINT2D pt;
+
+	getPoint2d_p(point->point, 0, &pt);
+	return point2d_in_multipolygon_rtree(root, polyCount, ringCounts, &pt);
+}
+
+/*
+ * Point in polygon test of a flat array of points against one index, writing
+ * the result of point_in_multipolygon_rtree for each point into results.
+ * Points outside the bounding box of the polygons are rejected without
+ * walking the rings.
+ */
+void point_in_multipolygon_rtree_batch(const RTREE_POLY_CACHE *index, const GBOX *box,
+				       const POINT2D *pts, uint32_t npoints, int8_t *results)
+{
+	uint32_t i;
+
+	for (i = 0; i < npoints; i++)
+	{
+		const POINT2D *pt = &pts[i];
+
+		if (pt->x < box->xmin || pt->x > box->xmax || pt->y < box->ymin || pt->y > box->ymax)
+			results[i] = -1;
+		else
+			results[i] = point2d_in_multipolygon_rtree(index->ringIndices, index->polyCount, index->ringCounts, pt);
+	}
+}
+
 /*
  * return -1 iff point outside polygon
  * return 0 iff point on boundary
@@ -31,6 +31,8 @@
 
 int point_in_polygon_rtree(RTREE_NODE **root, int ringCount, LWPOINT *point);
 int point_in_multipolygon_rtree(RTREE_NODE **root, int polyCount, int *ringCounts, LWPOINT *point);
+void point_in_multipolygon_rtree_batch(const RTREE_POLY_CACHE *index, const GBOX *box,
+				       const POINT2D *pts, uint32_t npoints, int8_t *results);
 int point_in_polygon(LWPOLY *polygon, LWPOINT *point);
 int point_in_multipolygon(LWMPOLY *mpolygon, LWPOINT *pont);
 
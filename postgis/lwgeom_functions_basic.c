@@ -25,6 +25,7 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "lib/stringinfo.h"
 #include "utils/array.h"
 #include "utils/builtins.h"
 #include "utils/elog.h"
@@ -34,6 +35,8 @@
 #include "liblwgeom.h"
 #include "liblwgeom_internal.h"
 #include "lwgeom_pg.h"
+#include "lwgeom_cache.h"
+#include "gserialized_gist.h"
 
 #include <math.h>
 #include <float.h>
@@ -56,6 +59,7 @@ Datum postgis_svn_version(PG_FUNCTION_ARGS);
 Datum postgis_lib_revision(PG_FUNCTION_ARGS);
 Datum postgis_libxml_version(PG_FUNCTION_ARGS);
 Datum postgis_lib_build_date(PG_FUNCTION_ARGS);
+Datum _postgis_cache_stats(PG_FUNCTION_ARGS);
 Datum LWGEOM_length2d_linestring(PG_FUNCTION_ARGS);
 Datum LWGEOM_length_linestring(PG_FUNCTION_ARGS);
 Datum LWGEOM_perimeter2d_poly(PG_FUNCTION_ARGS);
@@ -214,6 +218,59 @@ Datum postgis_lib_build_date(PG_FUNCTION_ARGS)
 	PG_RETURN_TEXT_P(result);
 }
 
+/**
+* Counters of the geometry caches of this backend, and of the boxes
+* read from toasted geometries, as JSON text.
+*/
+PG_FUNCTION_INFO_V1(_postgis_cache_stats);
+Datum _postgis_cache_stats(PG_FUNCTION_ARGS)
+{
+	static const struct {
+		uint32_t entry_number;
+		const char *name;
+	} caches[] = {
+		{TOAST_CACHE_ENTRY, "toast"},
+		{PREP_CACHE_ENTRY, "prepared"},
+		{RTREE_CACHE_ENTRY, "rtree"},
+		{CIRC_CACHE_ENTRY, "circtree"},
+		{RECT_CACHE_ENTRY, "recttree"}
+	};
+	GeomCacheStats stats;
+	uint64 entries, bytes;
+	StringInfoData str;
+	size_t i;
+
+	initStringInfo(&str);
+	appendStringInfo(&str, "{\"ways\":%d,", postgis_geometry_cache_ways);
+	for (i = 0; i < sizeof(caches) / sizeof(caches[0]); i++)
+	{
+		GetGeomCacheStats(caches[i].entry_number, &stats);
+		appendStringInfo(&str,
+				 "\"%s\":{\"hits\":" UINT64_FORMAT ",\"misses\":" UINT64_FORMAT ",\"builds\":" UINT64_FORMAT "},",
+				 caches[i].name,
+				 stats.hits,
+				 stats.misses,
+				 stats.builds);
+	}
+	GetBackendGeomCacheStats(&stats, &entries, &bytes);
+	appendStringInfo(&str,
+			 "\"backend\":{\"hits\":" UINT64_FORMAT ",\"misses\":" UINT64_FORMAT ",\"builds\":" UINT64_FORMAT
+			 ",\"entries\":" UINT64_FORMAT ",\"bytes\":" UINT64_FORMAT "},",
+			 stats.hits,
+			 stats.misses,
+			 stats.builds,
+			 entries,
+			 bytes);
+	appendStringInfo(&str,
+			 "\"detoast\":{\"box_sliced\":" UINT64_FORMAT ",\"box_detoasted\":" UINT64_FORMAT
+			 ",\"predicates_skipped\":" UINT64_FORMAT "}}",
+			 gserialized_detoast_stats.box_sliced,
+			 gserialized_detoast_stats.box_detoasted,
+			 gserialized_detoast_stats.predicates_skipped);
+
+	PG_RETURN_TEXT_P(cstring_to_text(str.data));
+}
+
 PG_FUNCTION_INFO_V1(postgis_scripts_released);
 Datum postgis_scripts_released(PG_FUNCTION_ARGS)
 {
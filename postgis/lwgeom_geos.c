@@ -35,6 +35,11 @@
 #include "utils/lsyscache.h"
 #include "utils/numeric.h"
 #include "access/htup_details.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_inherits.h"
+#include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "lib/stringinfo.h"
 
 /* PostGIS */
 #include "lwgeom_functions_analytic.h" /* for point_in_polygon */
@@ -44,6 +49,8 @@
 #include "lwgeom_rtree.h"
 #include "lwgeom_geos_prepared.h"
 #include "lwgeom_accum.h"
+#include "gserialized_gist.h"
+#include "lwunionfind.h"
 
 
 /* Return NULL on GEOS error
@@ -72,6 +79,7 @@ Datum ST_Intersects(PG_FUNCTION_ARGS);
 Datum crosses(PG_FUNCTION_ARGS);
 Datum contains(PG_FUNCTION_ARGS);
 Datum within(PG_FUNCTION_ARGS);
+Datum ST_ContainsPoints(PG_FUNCTION_ARGS);
 Datum containsproperly(PG_FUNCTION_ARGS);
 Datum covers(PG_FUNCTION_ARGS);
 Datum overlaps(PG_FUNCTION_ARGS);
@@ -96,6 +104,8 @@ Datum centroid(PG_FUNCTION_ARGS);
 Datum polygonize_garray(PG_FUNCTION_ARGS);
 Datum clusterintersecting_garray(PG_FUNCTION_ARGS);
 Datum cluster_within_distance_garray(PG_FUNCTION_ARGS);
+Datum clusterintersecting_index(PG_FUNCTION_ARGS);
+Datum cluster_within_distance_index(PG_FUNCTION_ARGS);
 Datum linemerge(PG_FUNCTION_ARGS);
 Datum coveredby(PG_FUNCTION_ARGS);
 Datum hausdorffdistance(PG_FUNCTION_ARGS);
@@ -146,6 +156,58 @@ is_point(const GSERIALIZED* g)
 	return type == POINTTYPE || type == MULTIPOINTTYPE;
 }
 
+static int
+gbox_contained_2d(const GBOX *g1, const GBOX *g2)
+{
+	return gbox_contains_2d(g2, g1);
+}
+
+/*
+ * Box test of the two arguments of a predicate, when either is toasted.
+ * Reads only the part of the datums holding the boxes, or the copies in the
+ * toast cache. True when the test fails, so that the predicate can return
+ * without detoasting the geometries. Mismatched SRIDs and empty geometries
+ * are left to the predicate.
+ *
+ * Only for the predicates using the toast cache: the others detoast their
+ * arguments anyway, and would read the start of them twice.
+ */
+static bool
+toasted_box_test_fails(FunctionCallInfo fcinfo, int (*box_test)(const GBOX *, const GBOX *))
+{
+	const GSERIALIZED *g[2];
+	GSERIALIZED *part[2] = {NULL, NULL};
+	GBOX box[2];
+	bool fails = false;
+	uint32_t i;
+
+	if (!PG_GSERIALIZED_DATUM_IS_TOASTED(PG_GETARG_RAW_VARLENA_P(0)) &&
+	    !PG_GSERIALIZED_DATUM_IS_TOASTED(PG_GETARG_RAW_VARLENA_P(1)))
+		return false;
+
+	for (i = 0; i < 2; i++)
+	{
+		g[i] = ToastCacheFindGeometry(fcinfo, i);
+		if (!g[i])
+			g[i] = part[i] = gserialized_datum_get_box_part(PG_GETARG_DATUM(i), false);
+		if (!g[i] || gserialized_get_gbox_p(g[i], &box[i]) == LW_FAILURE)
+			break;
+	}
+
+	if (i == 2 && gserialized_get_srid(g[0]) == gserialized_get_srid(g[1]) && !box_test(&box[0], &box[1]))
+	{
+		gserialized_detoast_stats.predicates_skipped++;
+		fails = true;
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		if (part[i])
+			POSTGIS_FREE_IF_COPY_P(part[i], PG_GETARG_POINTER(i));
+	}
+	return fails;
+}
+
 /* Utility function that checks a LWPOINT and a GSERIALIZED poly against a cache.
  * Serialized poly may be a multipart.
  */
@@ -1733,14 +1795,20 @@ Datum overlaps(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(contains);
 Datum contains(PG_FUNCTION_ARGS)
 {
-	SHARED_GSERIALIZED *shared_geom1 = ToastCacheGetGeometry(fcinfo, 0);
-	SHARED_GSERIALIZED *shared_geom2 = ToastCacheGetGeometry(fcinfo, 1);
-	const GSERIALIZED *geom1 = shared_gserialized_get(shared_geom1);
-	const GSERIALIZED *geom2 = shared_gserialized_get(shared_geom2);
+	SHARED_GSERIALIZED *shared_geom1, *shared_geom2;
+	const GSERIALIZED *geom1, *geom2;
 	int result;
 	GEOSGeometry *g1, *g2;
 	GBOX box1, box2;
 	PrepGeomCache *prep_cache;
+
+	if (toasted_box_test_fails(fcinfo, gbox_contains_2d))
+		PG_RETURN_BOOL(false);
+
+	shared_geom1 = ToastCacheGetGeometry(fcinfo, 0);
+	shared_geom2 = ToastCacheGetGeometry(fcinfo, 1);
+	geom1 = shared_gserialized_get(shared_geom1);
+	geom2 = shared_gserialized_get(shared_geom2);
 	gserialized_error_if_srid_mismatch(geom1, geom2, __func__);
 
 	/* A.Contains(Empty) == FALSE */
@@ -1860,6 +1928,112 @@ Datum contains(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * Tests many points against one polygon in a single call, for the joins of
+ * large point sets against polygons where the per row call, detoast and
+ * dispatch costs of contains() outweigh the point in polygon test itself.
+ * The points are read into a flat array and tested against one ring index.
+ * Returns an array with the result of ST_Contains(polygon, point) for each
+ * element, NULL for the NULL elements.
+ */
+PG_FUNCTION_INFO_V1(ST_ContainsPoints);
+Datum ST_ContainsPoints(PG_FUNCTION_ARGS)
+{
+	SHARED_GSERIALIZED *shared_gpoly = ToastCacheGetGeometry(fcinfo, 0);
+	const GSERIALIZED *gpoly = shared_gserialized_get(shared_gpoly);
+	ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+	int nelems = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+	int32_t srid = gserialized_get_srid(gpoly);
+	RTREE_POLY_CACHE *index = NULL, *local_index = NULL;
+	ArrayIterator iterator;
+	Datum value, *result_data;
+	bool isnull, *result_nulls;
+	POINT2D *pts;
+	int8_t *pip;
+	int *pts_elem;
+	uint32_t npts = 0;
+	int i = 0;
+	GBOX box;
+	ArrayType *result;
+	int dims[1], lbs[1] = {1};
+
+	if (!is_poly(gpoly))
+		elog(ERROR, "%s: first argument must be a polygon or multipolygon", __func__);
+
+	result_data = palloc(sizeof(Datum) * Max(nelems, 1));
+	result_nulls = palloc(sizeof(bool) * Max(nelems, 1));
+	pts = palloc(sizeof(POINT2D) * Max(nelems, 1));
+	pts_elem = palloc(sizeof(int) * Max(nelems, 1));
+
+	/* Gather the coordinates of the non-empty points */
+	iterator = array_create_iterator(array, 0, NULL);
+	while (array_iterate(iterator, &value, &isnull))
+	{
+		GSERIALIZED *gpoint;
+		POINT4D pt;
+
+		result_nulls[i] = isnull;
+		result_data[i] = BoolGetDatum(false);
+		if (!isnull)
+		{
+			gpoint = (GSERIALIZED *)DatumGetPointer(value);
+			if (gserialized_get_type(gpoint) != POINTTYPE)
+				elog(ERROR, "%s: element %d is not a point", __func__, i + 1);
+			gserialized_error_if_srid_mismatch_reference(gpoint, srid, __func__);
+
+			if (!gserialized_is_empty(gpoint) && gserialized_peek_first_point(gpoint, &pt) == LW_SUCCESS)
+			{
+				pts[npts].x = pt.x;
+				pts[npts].y = pt.y;
+				pts_elem[npts] = i;
+				npts++;
+			}
+		}
+		i++;
+	}
+	array_free_iterator(iterator);
+
+	/* A.Contains(Empty) == FALSE, Empty.Contains(B) == FALSE */
+	if (npts > 0 && !gserialized_is_empty(gpoly) && gserialized_get_gbox_p(gpoly, &box) == LW_SUCCESS)
+	{
+		uint32_t j;
+
+		/*
+		 * Use the cached index when the polygon has been seen before,
+		 * build one for this call otherwise, as all the points are tested
+		 * against it anyway.
+		 */
+		index = GetRtreeCache(fcinfo, shared_gpoly);
+		if (!index || !index->ringIndices)
+		{
+			LWGEOM *lwpoly = lwgeom_from_gserialized(gpoly);
+			index = local_index = RTreePolyCacheBuild(lwpoly);
+			lwgeom_free(lwpoly);
+		}
+
+		pip = palloc(npts);
+		point_in_multipolygon_rtree_batch(index, &box, pts, npts, pip);
+
+		for (j = 0; j < npts; j++)
+			result_data[pts_elem[j]] = BoolGetDatum(pip[j] == 1);
+
+		pfree(pip);
+		if (local_index)
+			RTreePolyCacheFree(local_index);
+	}
+
+	dims[0] = nelems;
+	result = construct_md_array(result_data, result_nulls, nelems > 0 ? 1 : 0, dims, lbs, BOOLOID, 1, true, 'c');
+
+	pfree(pts);
+	pfree(pts_elem);
+	pfree(result_data);
+	pfree(result_nulls);
+	PG_FREE_IF_COPY(array, 1);
+
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
 PG_FUNCTION_INFO_V1(within);
 Datum within(PG_FUNCTION_ARGS)
 {
@@ -1872,14 +2046,19 @@ Datum within(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(containsproperly);
 Datum containsproperly(PG_FUNCTION_ARGS)
 {
-	SHARED_GSERIALIZED *shared_geom1 = ToastCacheGetGeometry(fcinfo, 0);
-	SHARED_GSERIALIZED *shared_geom2 = ToastCacheGetGeometry(fcinfo, 1);
-	const GSERIALIZED *geom1 = shared_gserialized_get(shared_geom1);
-	const GSERIALIZED *geom2 = shared_gserialized_get(shared_geom2);
+	SHARED_GSERIALIZED *shared_geom1, *shared_geom2;
+	const GSERIALIZED *geom1, *geom2;
 	char 					result;
 	GBOX 			box1, box2;
 	PrepGeomCache *	prep_cache;
 
+	if (toasted_box_test_fails(fcinfo, gbox_contains_2d))
+		PG_RETURN_BOOL(false);
+
+	shared_geom1 = ToastCacheGetGeometry(fcinfo, 0);
+	shared_geom2 = ToastCacheGetGeometry(fcinfo, 1);
+	geom1 = shared_gserialized_get(shared_geom1);
+	geom2 = shared_gserialized_get(shared_geom2);
 	gserialized_error_if_srid_mismatch(geom1, geom2, __func__);
 
 	/* A.ContainsProperly(Empty) == FALSE */
@@ -1938,14 +2117,19 @@ Datum containsproperly(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(covers);
 Datum covers(PG_FUNCTION_ARGS)
 {
-	SHARED_GSERIALIZED *shared_geom1 = ToastCacheGetGeometry(fcinfo, 0);
-	SHARED_GSERIALIZED *shared_geom2 = ToastCacheGetGeometry(fcinfo, 1);
-	const GSERIALIZED *geom1 = shared_gserialized_get(shared_geom1);
-	const GSERIALIZED *geom2 = shared_gserialized_get(shared_geom2);
+	SHARED_GSERIALIZED *shared_geom1, *shared_geom2;
+	const GSERIALIZED *geom1, *geom2;
 	int result;
 	GBOX box1, box2;
 	PrepGeomCache *prep_cache;
 
+	if (toasted_box_test_fails(fcinfo, gbox_contains_2d))
+		PG_RETURN_BOOL(false);
+
+	shared_geom1 = ToastCacheGetGeometry(fcinfo, 0);
+	shared_geom2 = ToastCacheGetGeometry(fcinfo, 1);
+	geom1 = shared_gserialized_get(shared_geom1);
+	geom2 = shared_gserialized_get(shared_geom2);
 
 	/* A.Covers(Empty) == FALSE */
 	if ( gserialized_is_empty(geom1) || gserialized_is_empty(geom2) )
@@ -2068,15 +2252,20 @@ Datum within(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(coveredby);
 Datum coveredby(PG_FUNCTION_ARGS)
 {
-	SHARED_GSERIALIZED *shared_geom1 = ToastCacheGetGeometry(fcinfo, 0);
-	SHARED_GSERIALIZED *shared_geom2 = ToastCacheGetGeometry(fcinfo, 1);
-	const GSERIALIZED *geom1 = shared_gserialized_get(shared_geom1);
-	const GSERIALIZED *geom2 = shared_gserialized_get(shared_geom2);
+	SHARED_GSERIALIZED *shared_geom1, *shared_geom2;
+	const GSERIALIZED *geom1, *geom2;
 	GEOSGeometry *g1, *g2;
 	int result;
 	GBOX box1, box2;
 	char *patt = "**F**F***";
 
+	if (toasted_box_test_fails(fcinfo, gbox_contained_2d))
+		PG_RETURN_BOOL(false);
+
+	shared_geom1 = ToastCacheGetGeometry(fcinfo, 0);
+	shared_geom2 = ToastCacheGetGeometry(fcinfo, 1);
+	geom1 = shared_gserialized_get(shared_geom1);
+	geom2 = shared_gserialized_get(shared_geom2);
 	gserialized_error_if_srid_mismatch(geom1, geom2, __func__);
 
 	/* A.CoveredBy(Empty) == FALSE */
@@ -2235,14 +2424,19 @@ Datum crosses(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(ST_Intersects);
 Datum ST_Intersects(PG_FUNCTION_ARGS)
 {
-	SHARED_GSERIALIZED *shared_geom1 = ToastCacheGetGeometry(fcinfo, 0);
-	SHARED_GSERIALIZED *shared_geom2 = ToastCacheGetGeometry(fcinfo, 1);
-	const GSERIALIZED *geom1 = shared_gserialized_get(shared_geom1);
-	const GSERIALIZED *geom2 = shared_gserialized_get(shared_geom2);
+	SHARED_GSERIALIZED *shared_geom1, *shared_geom2;
+	const GSERIALIZED *geom1, *geom2;
 	int result;
 	GBOX box1, box2;
 	PrepGeomCache *prep_cache;
 
+	if (toasted_box_test_fails(fcinfo, gbox_overlaps_2d))
+		PG_RETURN_BOOL(false);
+
+	shared_geom1 = ToastCacheGetGeometry(fcinfo, 0);
+	shared_geom2 = ToastCacheGetGeometry(fcinfo, 1);
+	geom1 = shared_gserialized_get(shared_geom1);
+	geom2 = shared_gserialized_get(shared_geom2);
 	gserialized_error_if_srid_mismatch(geom1, geom2, __func__);
 
 	/* A.Intersects(Empty) == FALSE */
@@ -3075,6 +3269,239 @@ Datum cluster_within_distance_garray(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(result);
 }
 
+/*
+ * Clustering of a whole table that does not read all the geometries at once.
+ * The rows are read one at a time, and the rows they are connected to are
+ * found by an index assisted query on the same table, merging the clusters
+ * in a union-find. Only the sorted ctids of the rows and the union-find are
+ * kept in memory, 14 bytes per row. Rows of child tables can share ctids, so
+ * partitioned tables and tables with children are not supported.
+ */
+
+#define CLUSTER_INDEX_FETCH 10000
+
+typedef struct
+{
+	ItemPointerData *ctids;
+	uint32_t *cluster_ids;
+	uint32_t nrows;
+	uint32_t next;
+} ClusterIndexState;
+
+static int
+cluster_index_ctid_cmp(const void *a, const void *b)
+{
+	return ItemPointerCompare((ItemPointer) a, (ItemPointer) b);
+}
+
+static ClusterIndexState *
+cluster_index(Oid relid, Name colname, bool within, double tolerance)
+{
+	MemoryContext mcxt = CurrentMemoryContext, oldcontext;
+	ClusterIndexState *state;
+	StringInfoData sql;
+	const char *relname, *tbl, *col, *nsp;
+	Oid argtypes[2];
+	Datum args[2];
+	SPIPlanPtr plan_neighbors;
+	Portal portal;
+	UNIONFIND *uf;
+	size_t capacity = 1024;
+	uint64 i;
+
+	postgis_initialize_cache();
+
+	relname = get_rel_name(relid);
+	if (!relname)
+		elog(ERROR, "%s: relation %u does not exist", __func__, relid);
+	/* relhassubclass stays set once the children are dropped, look them up */
+	if (get_rel_relkind(relid) == RELKIND_PARTITIONED_TABLE ||
+	    (has_subclass(relid) && list_length(find_all_inheritors(relid, NoLock, NULL)) > 1))
+		lwpgerror("Table %s has partitions or child tables, cluster them one at a time", relname);
+	tbl = quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)), relname);
+	col = quote_identifier(NameStr(*colname));
+	nsp = quote_identifier(POSTGIS_CONSTANTS->install_nsp);
+
+	state = palloc0(sizeof(ClusterIndexState));
+	state->ctids = MemoryContextAllocHuge(mcxt, capacity * sizeof(ItemPointerData));
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "%s: could not connect to SPI manager", __func__);
+
+	/* Number the rows by their sorted ctids */
+	initStringInfo(&sql);
+	appendStringInfo(&sql, "SELECT ctid FROM ONLY %s WHERE %s IS NOT NULL", tbl, col);
+	portal = SPI_cursor_open_with_args(NULL, sql.data, 0, NULL, NULL, NULL, true, 0);
+	for (;;)
+	{
+		SPI_cursor_fetch(portal, true, CLUSTER_INDEX_FETCH);
+		if (SPI_processed == 0)
+			break;
+
+		if (state->nrows + SPI_processed > MaxAllocSize / sizeof(uint32_t))
+			elog(ERROR, "%s: too many rows in %s", __func__, tbl);
+
+		if (state->nrows + SPI_processed > capacity)
+		{
+			while (state->nrows + SPI_processed > capacity)
+				capacity *= 2;
+			state->ctids = repalloc_huge(state->ctids, capacity * sizeof(ItemPointerData));
+		}
+
+		for (i = 0; i < SPI_processed; i++)
+		{
+			bool isnull;
+			Datum d = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &isnull);
+			state->ctids[state->nrows++] = *(ItemPointer) DatumGetPointer(d);
+		}
+		SPI_freetuptable(SPI_tuptable);
+	}
+	SPI_cursor_close(portal);
+
+	if (state->nrows == 0)
+	{
+		SPI_finish();
+		return state;
+	}
+
+	qsort(state->ctids, state->nrows, sizeof(ItemPointerData), cluster_index_ctid_cmp);
+
+	oldcontext = MemoryContextSwitchTo(mcxt);
+	uf = UF_create(state->nrows);
+	MemoryContextSwitchTo(oldcontext);
+
+	/* ST_DWithin and ST_Intersects add the index condition themselves */
+	resetStringInfo(&sql);
+	argtypes[0] = postgis_oid(GEOMETRYOID);
+	argtypes[1] = FLOAT8OID;
+	if (within)
+		appendStringInfo(&sql, "SELECT ctid FROM ONLY %s WHERE %s.ST_DWithin(%s, $1, $2)", tbl, nsp, col);
+	else
+		appendStringInfo(&sql, "SELECT ctid FROM ONLY %s WHERE %s.ST_Intersects(%s, $1)", tbl, nsp, col);
+	plan_neighbors = SPI_prepare(sql.data, within ? 2 : 1, argtypes);
+	if (!plan_neighbors)
+		elog(ERROR, "%s: could not prepare query: %s", __func__, sql.data);
+	args[1] = Float8GetDatum(tolerance);
+
+	/* Merge every row with the rows it touches */
+	resetStringInfo(&sql);
+	appendStringInfo(&sql, "SELECT ctid, %s FROM ONLY %s WHERE %s IS NOT NULL", col, tbl, col);
+	portal = SPI_cursor_open_with_args(NULL, sql.data, 0, NULL, NULL, NULL, true, 0);
+	for (;;)
+	{
+		SPITupleTable *rows;
+		uint64 nrows;
+
+		SPI_cursor_fetch(portal, true, CLUSTER_INDEX_FETCH);
+		if (SPI_processed == 0)
+			break;
+
+		/* The neighbour queries overwrite the SPI globals */
+		rows = SPI_tuptable;
+		nrows = SPI_processed;
+		for (i = 0; i < nrows; i++)
+		{
+			ItemPointerData *found;
+			uint32_t row;
+			uint64 j;
+			bool isnull;
+
+			found = bsearch(DatumGetPointer(SPI_getbinval(rows->vals[i], rows->tupdesc, 1, &isnull)),
+					state->ctids, state->nrows, sizeof(ItemPointerData), cluster_index_ctid_cmp);
+			if (!found)
+				continue;
+			row = found - state->ctids;
+
+			args[0] = SPI_getbinval(rows->vals[i], rows->tupdesc, 2, &isnull);
+			if (SPI_execute_plan(plan_neighbors, args, NULL, true, 0) != SPI_OK_SELECT)
+				elog(ERROR, "%s: could not find the neighbours of a row", __func__);
+
+			for (j = 0; j < SPI_processed; j++)
+			{
+				found = bsearch(DatumGetPointer(SPI_getbinval(SPI_tuptable->vals[j], SPI_tuptable->tupdesc, 1, &isnull)),
+						state->ctids, state->nrows, sizeof(ItemPointerData), cluster_index_ctid_cmp);
+				if (found && (uint32_t)(found - state->ctids) != row)
+					UF_union(uf, row, found - state->ctids);
+			}
+			SPI_freetuptable(SPI_tuptable);
+		}
+		SPI_freetuptable(rows);
+	}
+	SPI_cursor_close(portal);
+	SPI_freeplan(plan_neighbors);
+	SPI_finish();
+
+	oldcontext = MemoryContextSwitchTo(mcxt);
+	state->cluster_ids = UF_get_collapsed_cluster_ids(uf, NULL);
+	UF_destroy(uf);
+	MemoryContextSwitchTo(oldcontext);
+
+	return state;
+}
+
+static Datum
+cluster_index_srf(FunctionCallInfo fcinfo, bool within)
+{
+	FuncCallContext *funcctx;
+	ClusterIndexState *state;
+	Datum values[2];
+	bool nulls[2] = {false, false};
+	HeapTuple tuple;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc tupdesc;
+		double tolerance = 0.0;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (within)
+		{
+			tolerance = PG_GETARG_FLOAT8(2);
+			if (tolerance < 0)
+				lwpgerror("Tolerance must be a positive number.");
+		}
+
+		funcctx->user_fctx = cluster_index(PG_GETARG_OID(0), PG_GETARG_NAME(1), within, tolerance);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+					"that cannot accept type record")));
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	state = funcctx->user_fctx;
+
+	if (state->next >= state->nrows)
+		SRF_RETURN_DONE(funcctx);
+
+	values[0] = PointerGetDatum(&state->ctids[state->next]);
+	values[1] = Int32GetDatum(state->cluster_ids[state->next]);
+	state->next++;
+
+	tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+}
+
+PG_FUNCTION_INFO_V1(clusterintersecting_index);
+Datum clusterintersecting_index(PG_FUNCTION_ARGS)
+{
+	return cluster_index_srf(fcinfo, false);
+}
+
+PG_FUNCTION_INFO_V1(cluster_within_distance_index);
+Datum cluster_within_distance_index(PG_FUNCTION_ARGS)
+{
+	return cluster_index_srf(fcinfo, true);
+}
+
 PG_FUNCTION_INFO_V1(linemerge);
 Datum linemerge(PG_FUNCTION_ARGS)
 {
@@ -441,6 +441,24 @@ GetRtreeCache(FunctionCallInfo fcinfo, SHARED_GSERIALIZED *g1)
 }
 
 
+RTREE_POLY_CACHE *
+RTreePolyCacheBuild(const LWGEOM *lwgeom)
+{
+	RTreeGeomCache cache;
+
+	memset(&cache, 0, sizeof(RTreeGeomCache));
+	if (RTreeBuilder(lwgeom, (GeomCache *)&cache) == LW_FAILURE)
+		return NULL;
+	return cache.index;
+}
+
+void
+RTreePolyCacheFree(RTREE_POLY_CACHE *index)
+{
+	RTreeCacheClear(index);
+	lwfree(index);
+}
+
 /**
 * Retrieves a collection of line segments given the root and crossing value.
 * The collection is a multilinestring consisting of two point lines
@@ -82,4 +82,12 @@ LWMLINE *RTreeFindLineSegments(RTREE_NODE *root, double value);
 */
 RTREE_POLY_CACHE *GetRtreeCache(FunctionCallInfo fcinfo, SHARED_GSERIALIZED *g1);
 
+/**
+* Builds an RTREE_POLY_CACHE for a polygon or multipolygon outside of the
+* function call cache, for callers testing many points against it at once.
+* The geometry must be a polygon or multipolygon.
+*/
+RTREE_POLY_CACHE *RTreePolyCacheBuild(const LWGEOM *lwgeom);
+void RTreePolyCacheFree(RTREE_POLY_CACHE *index);
+
 #endif /* !defined _LWGEOM_RTREE_H */
@@ -25,6 +25,7 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "commands/trigger.h"
 #include "utils/builtins.h"
 
 #include "../postgis_config.h"
@@ -37,6 +38,7 @@ Datum transform_geom(PG_FUNCTION_ARGS);
 Datum transform_pipeline_geom(PG_FUNCTION_ARGS);
 Datum postgis_proj_version(PG_FUNCTION_ARGS);
 Datum LWGEOM_asKML(PG_FUNCTION_ARGS);
+Datum postgis_srs_cache_invalidate(PG_FUNCTION_ARGS);
 
 /**
  * transform( GEOMETRY, INT (output srid) )
@@ -267,3 +269,17 @@ Datum LWGEOM_asKML(PG_FUNCTION_ARGS)
 		PG_RETURN_TEXT_P(kml);
 	PG_RETURN_NULL();
 }
+
+/**
+ * Statement trigger on spatial_ref_sys, so that the
+ * PROJ caches do not keep definitions that changed.
+ */
+PG_FUNCTION_INFO_V1(postgis_srs_cache_invalidate);
+Datum postgis_srs_cache_invalidate(PG_FUNCTION_ARGS)
+{
+	if ( ! CALLED_AS_TRIGGER(fcinfo) )
+		elog(ERROR, "postgis_srs_cache_invalidate: not fired by trigger manager");
+
+	srs_cache_changed();
+	PG_RETURN_POINTER(NULL);
+}
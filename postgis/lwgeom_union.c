@@ -4,11 +4,14 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "miscadmin.h"
+#include "utils/memutils.h"
 #include "utils/varlena.h"
 
 #include "../postgis_config.h"
 
 #include "liblwgeom.h"
+#include "lwunionfind.h"
 #include "lwgeom_log.h"
 #include "lwgeom_pg.h"
 #include "lwgeom_union.h"
@@ -28,9 +31,14 @@ Datum pgis_geometry_union_parallel_finalfn(PG_FUNCTION_ARGS);
 
 static UnionState* state_create(void);
 static void state_append(UnionState *state, const GSERIALIZED *gser);
+static void state_append_part(UnionState *state, GSERIALIZED *gser);
 static bytea* state_serialize(const UnionState *state);
 static UnionState* state_deserialize(const bytea* serialized);
-static void state_combine(UnionState *state1, UnionState *state2);
+static void state_combine(UnionState *state1, UnionState *state2, MemoryContext aggcontext);
+static bool state_needs_compact(const UnionState *state);
+static void state_compact(UnionState *state, MemoryContext aggcontext);
+static void state_merge_parts(UnionState *state, const LWGEOM *geom, List *parts, MemoryContext aggcontext);
+static LWGEOM* state_parts_collect(const UnionState *state);
 
 static LWGEOM* gserialized_list_union(List* list, float8 gridSize);
 
@@ -83,6 +91,10 @@ Datum pgis_geometry_union_parallel_transfn(PG_FUNCTION_ARGS)
 		MemoryContextSwitchTo(old);
 	}
 
+	/* Union the buffered values once they outgrow work_mem */
+	if (state_needs_compact(state))
+		state_compact(state, aggcontext);
+
 	PG_RETURN_POINTER(state);
 }
 
@@ -103,10 +115,13 @@ Datum pgis_geometry_union_parallel_combinefn(PG_FUNCTION_ARGS)
 
 	if (state1 && state2)
 	{
+		state_combine(state1, state2, aggcontext);
 		old = MemoryContextSwitchTo(aggcontext);
-		state_combine(state1, state2);
 		lwfree(state2);
 		MemoryContextSwitchTo(old);
+
+		if (state_needs_compact(state1))
+			state_compact(state1, aggcontext);
 	}
 	else if (state2)
 	{
@@ -122,11 +137,19 @@ Datum pgis_geometry_union_parallel_combinefn(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_serialfn);
 Datum pgis_geometry_union_parallel_serialfn(PG_FUNCTION_ARGS)
 {
+	MemoryContext aggcontext;
 	UnionState *state;
 
-	CheckAggContext();
+	GetAggContext(&aggcontext);
 
 	state = (UnionState*) PG_GETARG_POINTER(0);
+
+	/*
+	 * Serialization only happens in parallel workers, so do the union
+	 * work here rather than shipping raw inputs to the leader
+	 */
+	state_compact(state, aggcontext);
+
 	PG_RETURN_BYTEA_P(state_serialize(state));
 }
 
@@ -153,13 +176,30 @@ Datum pgis_geometry_union_parallel_deserialfn(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_finalfn);
 Datum pgis_geometry_union_parallel_finalfn(PG_FUNCTION_ARGS)
 {
+	MemoryContext aggcontext;
 	UnionState *state;
 	LWGEOM *geom = NULL;
 
-	CheckAggContext();
+	GetAggContext(&aggcontext);
 
 	state = (UnionState*)PG_GETARG_POINTER(0);
-	geom = gserialized_list_union(state->list, state->gridSize);
+
+	/* Small inputs never got partially unioned, do it in one go */
+	if (state->parts == NIL)
+	{
+		geom = gserialized_list_union(state->list, state->gridSize);
+		if (!geom)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(geometry_serialize(geom));
+	}
+
+	/*
+	 * Union what is left in the buffer into the parts. The parts have
+	 * disjoint boxes, so there is no overlay left to do between them.
+	 */
+	state_compact(state, aggcontext);
+
+	geom = state_parts_collect(state);
 	if (!geom)
 		PG_RETURN_NULL();
 	PG_RETURN_POINTER(geometry_serialize(geom));
@@ -172,6 +212,8 @@ UnionState* state_create(void)
 	state->gridSize = -1.0;
 	state->list = NIL;
 	state->size = 0;
+	state->parts = NIL;
+	state->partsSize = 0;
 	return state;
 }
 
@@ -189,9 +231,33 @@ void state_append(UnionState *state, const GSERIALIZED *gser)
 }
 
 
+/*
+ * Add an already unioned geometry to the parts, the caller is
+ * responsible for keeping the part boxes disjoint. The part takes
+ * ownership of gser.
+ */
+void state_append_part(UnionState *state, GSERIALIZED *gser)
+{
+	UnionPart *part = lwalloc(sizeof(UnionPart));
+
+	assert(gser);
+	part->gser = gser;
+	if (gserialized_is_empty(gser) || gserialized_get_gbox_p(gser, &part->box) == LW_FAILURE)
+		gbox_init(&part->box);
+
+	state->parts = lappend(state->parts, part);
+	state->partsSize += VARSIZE(gser);
+}
+
+
+/*
+ * The serialized state is the grid size, the number of parts, then
+ * the parts and the buffered values as consecutive GSERIALIZED.
+ */
 bytea* state_serialize(const UnionState *state)
 {
-	int32 size = VARHDRSZ + sizeof(state->gridSize) + state->size;
+	int32 nparts = list_length(state->parts);
+	int32 size = VARHDRSZ + sizeof(state->gridSize) + sizeof(nparts) + state->partsSize + state->size;
 	bytea *serialized = lwalloc(size);
 	uint8 *data;
 	ListCell *cell;
@@ -203,6 +269,17 @@ bytea* state_serialize(const UnionState *state)
 	memcpy(data, &state->gridSize, sizeof(state->gridSize));
 	data += sizeof(state->gridSize);
 
+	/* parts */
+	memcpy(data, &nparts, sizeof(nparts));
+	data += sizeof(nparts);
+	foreach (cell, state->parts)
+	{
+		const GSERIALIZED *gser = ((const UnionPart*)lfirst(cell))->gser;
+		assert(gser);
+		memcpy(data, gser, VARSIZE(gser));
+		data += VARSIZE(gser);
+	}
+
 	/* items */
 	foreach (cell, state->list)
 	{
@@ -221,11 +298,24 @@ UnionState* state_deserialize(const bytea* serialized)
 	UnionState *state = state_create();
 	const uint8 *data = (const uint8*)VARDATA(serialized);
 	const uint8 *data_end = (const uint8*)serialized + VARSIZE(serialized);
+	int32 nparts;
 
 	/* grid size */
 	memcpy(&state->gridSize, data, sizeof(state->gridSize));
 	data += sizeof(state->gridSize);
 
+	/* parts */
+	memcpy(&nparts, data, sizeof(nparts));
+	data += sizeof(nparts);
+	while (nparts-- > 0)
+	{
+		const GSERIALIZED* gser = (const GSERIALIZED*)data;
+		GSERIALIZED *gser_copy = lwalloc(VARSIZE(gser));
+		memcpy(gser_copy, gser, VARSIZE(gser));
+		state_append_part(state, gser_copy);
+		data += VARSIZE(gser);
+	}
+
 	/* items */
 	while (data < data_end)
 	{
@@ -238,16 +328,21 @@ UnionState* state_deserialize(const bytea* serialized)
 }
 
 
-void state_combine(UnionState *state1, UnionState *state2)
+void state_combine(UnionState *state1, UnionState *state2, MemoryContext aggcontext)
 {
 	List *list1;
 	List *list2;
+	MemoryContext old;
 
 	assert(state1 && state2);
 
 	list1 = state1->list;
 	list2 = state2->list;
 
+	if (list1 == NIL && state1->parts == NIL)
+		state1->gridSize = state2->gridSize;
+
+	old = MemoryContextSwitchTo(aggcontext);
 	if (list1 != NIL && list2 != NIL)
 	{
 		state1->list = list_concat(list1, list2);
@@ -256,11 +351,402 @@ void state_combine(UnionState *state1, UnionState *state2)
 	}
 	else if (list2 != NIL)
 	{
-		state1->gridSize = state2->gridSize;
 		state1->list = list2;
 		state1->size = state2->size;
 	}
 	state2->list = NIL;
+	MemoryContextSwitchTo(old);
+
+	/*
+	 * Worker results only need an overlay where their
+	 * part boxes meet, everything else is moved over as is
+	 */
+	if (state1->parts == NIL)
+	{
+		state1->parts = state2->parts;
+		state1->partsSize = state2->partsSize;
+	}
+	else if (state2->parts != NIL)
+	{
+		state_merge_parts(state1, NULL, state2->parts, aggcontext);
+	}
+	state2->parts = NIL;
+}
+
+
+/*
+ * Buffered values are unioned once their size exceeds work_mem, or the
+ * size of the unioned parts if that is larger, so that the parts are
+ * revisited a logarithmic number of times.
+ */
+bool state_needs_compact(const UnionState *state)
+{
+	int64 limit = Max((int64) work_mem * 1024L, (int64) state->partsSize);
+	return state->size > limit;
+}
+
+
+/*
+ * Union the buffered values and merge the result into the parts. All
+ * the intermediate GEOS and LWGEOM work happens in a scratch context,
+ * so only the unioned parts are kept in the aggregate context.
+ */
+void state_compact(UnionState *state, MemoryContext aggcontext)
+{
+	MemoryContext tmpcontext, old;
+	LWGEOM *geom;
+	ListCell *cell;
+
+	if (state->list == NIL)
+		return;
+
+	tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+		"ST_Union partial union", ALLOCSET_DEFAULT_SIZES);
+	old = MemoryContextSwitchTo(tmpcontext);
+
+	geom = gserialized_list_union(state->list, state->gridSize);
+
+	MemoryContextSwitchTo(aggcontext);
+	foreach (cell, state->list)
+		lwfree(lfirst(cell));
+	list_free(state->list);
+	state->list = NIL;
+	state->size = 0;
+	MemoryContextSwitchTo(old);
+
+	if (geom)
+		state_merge_parts(state, geom, NIL, aggcontext);
+
+	MemoryContextDelete(tmpcontext);
+}
+
+
+/*
+ * Something to be merged into the state parts: either a component of
+ * a freshly unioned geometry or an existing part.
+ */
+typedef struct
+{
+	GBOX box;
+	const LWGEOM *geom; /* component of a fresh union, or NULL */
+	UnionPart *part; /* existing part, or NULL */
+	uint32_t source; /* items from the same source are already unioned */
+} UnionItem;
+
+typedef struct
+{
+	GBOX box;
+	uint32_t id;
+} UnionGroup;
+
+static int
+union_group_cmp(const void *a, const void *b)
+{
+	const UnionGroup *ga = (const UnionGroup*)a;
+	const UnionGroup *gb = (const UnionGroup*)b;
+	if (ga->box.xmin < gb->box.xmin) return -1;
+	if (ga->box.xmin > gb->box.xmin) return 1;
+	return 0;
+}
+
+static inline void
+union_box_merge(const GBOX *box, GBOX *merged)
+{
+	merged->xmin = Min(merged->xmin, box->xmin);
+	merged->ymin = Min(merged->ymin, box->ymin);
+	merged->xmax = Max(merged->xmax, box->xmax);
+	merged->ymax = Max(merged->ymax, box->ymax);
+}
+
+/*
+ * Find the groups of items whose boxes transitively interact, repeating
+ * a sort-and-sweep over the group boxes until the group boxes are
+ * pairwise disjoint. Only boxes are looked at, no geometry is touched.
+ */
+static UNIONFIND*
+union_items_group(const UnionItem *items, uint32_t nitems, double gridSize)
+{
+	UNIONFIND *uf = UF_create(nitems);
+	GBOX *boxes = lwalloc(nitems * sizeof(GBOX));
+	UnionGroup *groups = lwalloc(nitems * sizeof(UnionGroup));
+	bool changed;
+	uint32_t i, j;
+
+	for (i = 0; i < nitems; i++)
+	{
+		boxes[i] = items[i].box;
+		/* Snapping to the grid can move vertices by half a cell */
+		if (gridSize > 0)
+			gbox_expand(&boxes[i], gridSize);
+	}
+
+	do
+	{
+		uint32_t ngroups = 0;
+		changed = false;
+
+		for (i = 0; i < nitems; i++)
+		{
+			if (UF_find(uf, i) != i)
+				continue;
+			groups[ngroups].box = boxes[i];
+			groups[ngroups].id = i;
+			ngroups++;
+		}
+
+		qsort(groups, ngroups, sizeof(UnionGroup), union_group_cmp);
+
+		for (i = 0; i < ngroups; i++)
+		{
+			for (j = i + 1; j < ngroups && groups[j].box.xmin <= groups[i].box.xmax; j++)
+			{
+				if (groups[j].box.ymin > groups[i].box.ymax ||
+				    groups[i].box.ymin > groups[j].box.ymax)
+					continue;
+				if (UF_find(uf, groups[i].id) == UF_find(uf, groups[j].id))
+					continue;
+				UF_union(uf, groups[i].id, groups[j].id);
+				changed = true;
+			}
+		}
+
+		if (changed)
+		{
+			for (i = 0; i < nitems; i++)
+			{
+				uint32_t root = UF_find(uf, i);
+				if (root != i)
+					union_box_merge(&boxes[i], &boxes[root]);
+			}
+		}
+	}
+	while (changed);
+
+	lwfree(groups);
+	lwfree(boxes);
+	return uf;
+}
+
+/*
+ * Merge the components of a freshly unioned geometry and/or a list of
+ * parts coming from another state into the state parts. Items are
+ * grouped by interacting boxes, and an overlay is only run on groups
+ * mixing items of different sources. Parts that end up alone in their
+ * group are kept untouched.
+ */
+void state_merge_parts(UnionState *state, const LWGEOM *geom, List *parts, MemoryContext aggcontext)
+{
+	MemoryContext tmpcontext, old;
+	LWCOLLECTION *col = NULL;
+	UnionItem *items;
+	uint32_t nitems = 0, maxitems, source = 1;
+	uint32_t *order = NULL;
+	UNIONFIND *uf = NULL;
+	GSERIALIZED *empty = NULL;
+	List *oldparts = state->parts;
+	List *consumed = NIL;
+	ListCell *cell;
+	uint32_t i, j;
+
+	tmpcontext = AllocSetContextCreate(CurrentMemoryContext,
+		"ST_Union merge parts", ALLOCSET_DEFAULT_SIZES);
+	old = MemoryContextSwitchTo(tmpcontext);
+
+	if (geom && lwgeom_is_collection(geom))
+		col = lwgeom_as_lwcollection(geom);
+
+	maxitems = list_length(oldparts) + list_length(parts) + (col ? col->ngeoms : 1);
+	items = palloc(maxitems * sizeof(UnionItem));
+
+	/* Existing parts, each one its own source */
+	state->parts = list_concat(list_copy(oldparts), parts);
+	foreach (cell, state->parts)
+	{
+		UnionPart *part = (UnionPart*)lfirst(cell);
+		if (gserialized_is_empty(part->gser))
+		{
+			if (!empty || gserialized_get_type(empty) < gserialized_get_type(part->gser))
+				empty = part->gser;
+			continue;
+		}
+		items[nitems].box = part->box;
+		items[nitems].geom = NULL;
+		items[nitems].part = part;
+		items[nitems].source = source++;
+		nitems++;
+	}
+
+	/* Components of the new union, all from source 0 */
+	if (geom)
+	{
+		uint32_t ngeoms = col ? col->ngeoms : 1;
+		for (i = 0; i < ngeoms; i++)
+		{
+			const LWGEOM *sub = col ? col->geoms[i] : geom;
+			GBOX box;
+			if (lwgeom_is_empty(sub) || lwgeom_calculate_gbox(sub, &box) == LW_FAILURE)
+				continue;
+			items[nitems].box = box;
+			items[nitems].geom = sub;
+			items[nitems].part = NULL;
+			items[nitems].source = 0;
+			nitems++;
+		}
+	}
+
+	/* Only the empty of the largest type is worth keeping */
+	if (geom && lwgeom_is_empty(geom))
+	{
+		if (!empty || gserialized_get_type(empty) < lwgeom_get_type(geom))
+			empty = geometry_serialize((LWGEOM*)geom);
+	}
+
+	if (nitems > 0)
+	{
+		uf = union_items_group(items, nitems, state->gridSize);
+		order = UF_ordered_by_cluster(uf);
+	}
+
+	MemoryContextSwitchTo(aggcontext);
+	state->parts = NIL;
+	state->partsSize = 0;
+	MemoryContextSwitchTo(tmpcontext);
+
+	for (i = 0; i < nitems; i = j)
+	{
+		uint32_t root = UF_find(uf, order[i]);
+		bool overlay = false;
+		LWGEOM **geoms;
+		LWGEOM *result;
+		GSERIALIZED *gser;
+		uint32_t k, ngeoms = 0;
+
+		for (j = i; j < nitems && UF_find(uf, order[j]) == root; j++)
+		{
+			if (items[order[j]].source != items[order[i]].source)
+				overlay = true;
+		}
+
+		/* A lone part is kept as is */
+		if (j - i == 1 && items[order[i]].part)
+		{
+			MemoryContextSwitchTo(aggcontext);
+			state->parts = lappend(state->parts, items[order[i]].part);
+			state->partsSize += VARSIZE(items[order[i]].part->gser);
+			MemoryContextSwitchTo(tmpcontext);
+			continue;
+		}
+
+		geoms = palloc((j - i) * sizeof(LWGEOM*));
+		for (k = i; k < j; k++)
+		{
+			UnionItem *item = &items[order[k]];
+			if (item->part)
+			{
+				geoms[ngeoms++] = lwgeom_from_gserialized(item->part->gser);
+				consumed = lappend(consumed, item->part);
+			}
+			else
+			{
+				geoms[ngeoms++] = (LWGEOM*)item->geom;
+			}
+		}
+
+		if (ngeoms == 1)
+		{
+			result = geoms[0];
+		}
+		else
+		{
+			LWCOLLECTION *group = lwcollection_construct(COLLECTIONTYPE,
+				lwgeom_get_srid(geoms[0]), NULL, ngeoms, geoms);
+			/* Components of one union do not need another overlay */
+			result = overlay
+				? lwgeom_unaryunion_prec(lwcollection_as_lwgeom(group), state->gridSize)
+				: lwgeom_homogenize(lwcollection_as_lwgeom(group));
+		}
+		gser = geometry_serialize(result);
+
+		MemoryContextSwitchTo(aggcontext);
+		{
+			GSERIALIZED *gser_copy = lwalloc(VARSIZE(gser));
+			memcpy(gser_copy, gser, VARSIZE(gser));
+			state_append_part(state, gser_copy);
+		}
+		MemoryContextSwitchTo(tmpcontext);
+	}
+
+	if (uf)
+		UF_destroy(uf);
+
+	/* Keep an empty only while there is nothing else */
+	MemoryContextSwitchTo(aggcontext);
+	if (state->parts == NIL && empty)
+	{
+		GSERIALIZED *gser_copy = lwalloc(VARSIZE(empty));
+		memcpy(gser_copy, empty, VARSIZE(empty));
+		state_append_part(state, gser_copy);
+	}
+
+	/* Release the parts that got merged into new ones, and the empties */
+	foreach (cell, consumed)
+	{
+		UnionPart *part = (UnionPart*)lfirst(cell);
+		lwfree(part->gser);
+		lwfree(part);
+	}
+	foreach (cell, oldparts)
+	{
+		UnionPart *part = (UnionPart*)lfirst(cell);
+		if (gserialized_is_empty(part->gser))
+		{
+			lwfree(part->gser);
+			lwfree(part);
+		}
+	}
+	foreach (cell, parts)
+	{
+		UnionPart *part = (UnionPart*)lfirst(cell);
+		if (gserialized_is_empty(part->gser))
+		{
+			lwfree(part->gser);
+			lwfree(part);
+		}
+	}
+	list_free(oldparts);
+	list_free(parts);
+	MemoryContextSwitchTo(old);
+
+	MemoryContextDelete(tmpcontext);
+}
+
+
+/*
+ * Collect the parts into a single geometry. The part boxes are
+ * disjoint, so their union is just their collection.
+ */
+LWGEOM* state_parts_collect(const UnionState *state)
+{
+	LWGEOM **geoms;
+	LWCOLLECTION *col;
+	uint32_t ngeoms = 0;
+	ListCell *cell;
+
+	if (state->parts == NIL)
+		return NULL;
+
+	if (list_length(state->parts) == 1)
+		return lwgeom_from_gserialized(((const UnionPart*)linitial(state->parts))->gser);
+
+	geoms = lwalloc(list_length(state->parts) * sizeof(LWGEOM*));
+	foreach (cell, state->parts)
+	{
+		const UnionPart *part = (const UnionPart*)lfirst(cell);
+		geoms[ngeoms++] = lwgeom_from_gserialized(part->gser);
+	}
+
+	col = lwcollection_construct(COLLECTIONTYPE, lwgeom_get_srid(geoms[0]), NULL, ngeoms, geoms);
+	return lwgeom_homogenize(lwcollection_as_lwgeom(col));
 }
 
 
@@ -4,11 +4,19 @@
 #include "postgres.h"
 #include "liblwgeom.h"
 
+typedef struct UnionPart
+{
+	GBOX box; /* 2D extent of gser, unset if gser is empty */
+	GSERIALIZED *gser; /* already unioned geometry */
+} UnionPart;
+
 typedef struct UnionState
 {
 	float8 gridSize; /* gridSize argument */
-	List *list; /* list of GSERIALIZED* */
+	List *list; /* list of GSERIALIZED* not unioned yet */
 	int32 size; /* total size of GSERIAZLIZED values in list in bytes */
+	List *parts; /* list of UnionPart* with pairwise disjoint boxes */
+	int32 partsSize; /* total size of GSERIALIZED values in parts in bytes */
 } UnionState;
 
 #endif /* _LWGEOM_UNION_H */
@@ -40,6 +40,12 @@
 extern Datum ST_ClusterDBSCAN(PG_FUNCTION_ARGS);
 extern Datum ST_ClusterKMeans(PG_FUNCTION_ARGS);
 
+/* Threads used by ST_ClusterDBSCAN (postgis.cluster_threads) */
+int postgis_cluster_threads = 1;
+
+/* Mini-batch size of ST_ClusterKMeans, 0 for exact (postgis.kmeans_batch_size) */
+int postgis_kmeans_batch_size = 0;
+
 typedef struct {
 	bool	isdone;
 	bool	isnull;
@@ -128,7 +134,13 @@ Datum ST_ClusterDBSCAN(PG_FUNCTION_ARGS)
 			}
 		}
 
-		if (union_dbscan(geoms, ngeoms, uf, tolerance, minpoints, minpoints > 1 ? &is_in_cluster : NULL) == LW_SUCCESS)
+		if (postgis_cluster_threads > 1)
+		{
+			if (union_dbscan_parallel(geoms, ngeoms, uf, tolerance, minpoints,
+						  minpoints > 1 ? &is_in_cluster : NULL, postgis_cluster_threads) == LW_SUCCESS)
+				context->is_error = LW_FALSE;
+		}
+		else if (union_dbscan(geoms, ngeoms, uf, tolerance, minpoints, minpoints > 1 ? &is_in_cluster : NULL) == LW_SUCCESS)
 			context->is_error = LW_FALSE;
 
 		for (i = 0; i < ngeoms; i++)
@@ -242,7 +254,7 @@ Datum ST_ClusterKMeans(PG_FUNCTION_ARGS)
 		}
 
 		/* Calculate k-means on the list! */
-		r = lwgeom_cluster_kmeans((const LWGEOM **)geoms, N, k, max_radius);
+		r = lwgeom_cluster_kmeans_batch((const LWGEOM **)geoms, N, k, max_radius, postgis_kmeans_batch_size);
 
 		/* Clean up */
 		for (i = 0; i < N; i++)
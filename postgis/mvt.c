@@ -31,6 +31,8 @@
 #include "lwgeom_geos.h"
 #include "pgsql_compat.h"
 
+int mvt_clip_engine = MVT_CLIP_ENGINE_WAGYU;
+
 #ifdef HAVE_LIBPROTOBUF
 #include "utils/jsonb.h"
 
@@ -44,7 +46,24 @@
 
 #include "vector_tile.pb-c.h"
 
-#define FEATURES_CAPACITY_INITIAL 50
+#define GEOMETRY_INITIAL_CAPACITY 64
+
+/* Protobuf wire types and field numbers used when streaming the encoding */
+#define PB_WIRETYPE_VARINT 0
+#define PB_WIRETYPE_LENGTH 2
+#define PB_KEY(field, wiretype) (((field) << 3) | (wiretype))
+
+#define PB_TILE_LAYERS 3
+#define PB_LAYER_NAME 1
+#define PB_LAYER_FEATURES 2
+#define PB_LAYER_KEYS 3
+#define PB_LAYER_VALUES 4
+#define PB_LAYER_EXTENT 5
+#define PB_LAYER_VERSION 15
+#define PB_FEATURE_ID 1
+#define PB_FEATURE_TAGS 2
+#define PB_FEATURE_TYPE 3
+#define PB_FEATURE_GEOMETRY 4
 
 enum mvt_cmd_id
 {
@@ -78,7 +97,8 @@ struct mvt_kv_value {
 #define TAGS_INITIAL_CAPACITY 20
 
 /* This structure keeps track of the capacity of
- * the tags array while the feature is being built.
+ * the tags and geometry arrays while the feature is being built.
+ * A single builder is reused for all the features of a layer.
  */
 struct feature_builder {
 	bool has_id;
@@ -89,36 +109,105 @@ struct feature_builder {
 	size_t tags_capacity;
 	uint32_t *tags;
 
-	/* The geometry of the feature. */
+	/* The geometry of the feature, a growable array too */
 	VectorTile__Tile__GeomType type;
 	size_t n_geometry;
+	size_t geometry_capacity;
 	uint32_t *geometry;
 };
 
+static struct feature_builder *feature_create(void)
+{
+	struct feature_builder *builder = palloc(sizeof(*builder));
+	builder->tags_capacity = TAGS_INITIAL_CAPACITY;
+	builder->tags = palloc(TAGS_INITIAL_CAPACITY * sizeof(*builder->tags));
+	builder->geometry_capacity = GEOMETRY_INITIAL_CAPACITY;
+	builder->geometry = palloc(GEOMETRY_INITIAL_CAPACITY * sizeof(*builder->geometry));
+	return builder;
+}
+
 static void feature_init(struct feature_builder *builder)
 {
 	builder->has_id = false;
 	builder->n_tags = 0;
-	builder->tags_capacity = TAGS_INITIAL_CAPACITY;
-	builder->tags = palloc(TAGS_INITIAL_CAPACITY * sizeof(*builder->tags));
 	builder->type = VECTOR_TILE__TILE__GEOM_TYPE__UNKNOWN;
 	builder->n_geometry = 0;
-	builder->geometry = NULL;
 }
 
-static VectorTile__Tile__Feature *feature_build(struct feature_builder *builder)
+/* Makes sure the geometry array can hold at least size commands/parameters */
+static void feature_geometry_reserve(struct feature_builder *builder, size_t size)
+{
+	if (size > builder->geometry_capacity)
+	{
+		size_t new_capacity = builder->geometry_capacity * 2;
+		while (new_capacity < size)
+			new_capacity *= 2;
+		pfree(builder->geometry);
+		builder->geometry = palloc(new_capacity * sizeof(*builder->geometry));
+		builder->geometry_capacity = new_capacity;
+	}
+}
+
+static inline size_t pb_varint_size(uint64_t value)
 {
-	VectorTile__Tile__Feature *feature = palloc(sizeof(*feature));
-	vector_tile__tile__feature__init(feature);
-
-	feature->has_id = builder->has_id;
-	feature->id = builder->id;
-	feature->n_tags = builder->n_tags;
-	feature->tags = builder->tags;
-	feature->type = builder->type;
-	feature->n_geometry = builder->n_geometry;
-	feature->geometry = builder->geometry;
-	return feature;
+	size_t size = 1;
+	while (value >= 0x80)
+	{
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
+
+static size_t pb_packed_size(const uint32_t *values, size_t n_values)
+{
+	size_t i, size = 0;
+	for (i = 0; i < n_values; i++)
+		size += pb_varint_size(values[i]);
+	return size;
+}
+
+static void pb_append_packed(bytebuffer_t *buf, uint32_t field, const uint32_t *values, size_t n_values, size_t size)
+{
+	size_t i;
+	if (!n_values)
+		return;
+	bytebuffer_append_uvarint(buf, PB_KEY(field, PB_WIRETYPE_LENGTH));
+	bytebuffer_append_uvarint(buf, size);
+	for (i = 0; i < n_values; i++)
+		bytebuffer_append_uvarint(buf, values[i]);
+}
+
+/**
+ * Appends the feature to the buffer as a Layer.features field, using
+ * the same field order as protobuf-c so the output does not change.
+ */
+static void feature_write(struct feature_builder *builder, bytebuffer_t *buf)
+{
+	size_t tags_size = pb_packed_size(builder->tags, builder->n_tags);
+	size_t geometry_size = pb_packed_size(builder->geometry, builder->n_geometry);
+	size_t size = 0;
+
+	if (builder->has_id)
+		size += 1 + pb_varint_size(builder->id);
+	if (builder->n_tags)
+		size += 1 + pb_varint_size(tags_size) + tags_size;
+	size += 1 + pb_varint_size(builder->type);
+	if (builder->n_geometry)
+		size += 1 + pb_varint_size(geometry_size) + geometry_size;
+
+	bytebuffer_append_uvarint(buf, PB_KEY(PB_LAYER_FEATURES, PB_WIRETYPE_LENGTH));
+	bytebuffer_append_uvarint(buf, size);
+
+	if (builder->has_id)
+	{
+		bytebuffer_append_uvarint(buf, PB_KEY(PB_FEATURE_ID, PB_WIRETYPE_VARINT));
+		bytebuffer_append_uvarint(buf, builder->id);
+	}
+	pb_append_packed(buf, PB_FEATURE_TAGS, builder->tags, builder->n_tags, tags_size);
+	bytebuffer_append_uvarint(buf, PB_KEY(PB_FEATURE_TYPE, PB_WIRETYPE_VARINT));
+	bytebuffer_append_uvarint(buf, builder->type);
+	pb_append_packed(buf, PB_FEATURE_GEOMETRY, builder->geometry, builder->n_geometry, geometry_size);
 }
 
 static void feature_add_property(struct feature_builder *builder, uint32_t key_id, uint32_t value_id)
@@ -206,7 +295,7 @@ static void encode_point(struct feature_builder *feature, LWPOINT *point)
 {
 	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__POINT;
 	feature->n_geometry = 3;
-	feature->geometry = palloc(sizeof(*feature->geometry) * 3);
+	feature_geometry_reserve(feature, 3);
 	encode_ptarray_initial(MVT_POINT, point->point, feature->geometry);
 }
 
@@ -217,7 +306,7 @@ static void encode_mpoint(struct feature_builder *feature, LWMPOINT *mpoint)
 	LWLINE *lwline = lwline_from_lwmpoint(mpoint->srid, mpoint);
 	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__POINT;
 	c = 1 + lwline->points->npoints * 2;
-	feature->geometry = palloc(sizeof(*feature->geometry) * c);
+	feature_geometry_reserve(feature, c);
 	feature->n_geometry = encode_ptarray_initial(MVT_POINT,
 		lwline->points, feature->geometry);
 }
@@ -227,7 +316,7 @@ static void encode_line(struct feature_builder *feature, LWLINE *lwline)
 	size_t c;
 	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__LINESTRING;
 	c = 2 + lwline->points->npoints * 2;
-	feature->geometry = palloc(sizeof(*feature->geometry) * c);
+	feature_geometry_reserve(feature, c);
 	feature->n_geometry = encode_ptarray_initial(MVT_LINE,
 		lwline->points, feature->geometry);
 }
@@ -240,7 +329,7 @@ static void encode_mline(struct feature_builder *feature, LWMLINE *lwmline)
 	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__LINESTRING;
 	for (i = 0; i < lwmline->ngeoms; i++)
 		c += 2 + lwmline->geoms[i]->points->npoints * 2;
-	feature->geometry = palloc(sizeof(*feature->geometry) * c);
+	feature_geometry_reserve(feature, c);
 	for (i = 0; i < lwmline->ngeoms; i++)
 		offset += encode_ptarray(MVT_LINE,
 			lwmline->geoms[i]->points,
@@ -256,7 +345,7 @@ static void encode_poly(struct feature_builder *feature, LWPOLY *lwpoly)
 	feature->type = VECTOR_TILE__TILE__GEOM_TYPE__POLYGON;
 	for (i = 0; i < lwpoly->nrings; i++)
 		c += 3 + ((lwpoly->rings[i]->npoints - 1) * 2);
-	feature->geometry = palloc(sizeof(*feature->geometry) * c);
+	feature_geometry_reserve(feature, c);
 	for (i = 0; i < lwpoly->nrings; i++)
 		offset += encode_ptarray(MVT_RING,
 			lwpoly->rings[i],
@@ -274,7 +363,7 @@ static void encode_mpoly(struct feature_builder *feature, LWMPOLY *lwmpoly)
 	for (i = 0; i < lwmpoly->ngeoms; i++)
 		for (j = 0; poly = lwmpoly->geoms[i], j < poly->nrings; j++)
 			c += 3 + ((poly->rings[j]->npoints - 1) * 2);
-	feature->geometry = palloc(sizeof(*feature->geometry) * c);
+	feature_geometry_reserve(feature, c);
 	for (i = 0; i < lwmpoly->ngeoms; i++)
 		for (j = 0; poly = lwmpoly->geoms[i], j < poly->nrings; j++)
 			offset += encode_ptarray(MVT_RING,
@@ -892,13 +981,38 @@ mvt_clip_and_validate_geos(LWGEOM *lwgeom, uint8_t basic_type, uint32_t extent,
 	return ng;
 }
 
+/* Clips and validates a polygon for MVT using GEOS.
+ * Might return NULL
+ */
+static LWGEOM *
+mvt_clip_and_validate_polygon_geos(LWGEOM *lwgeom, GBOX *clip_box)
+{
+	gridspec grid = {0, 0, 0, 0, 1, 1, 0, 0};
+	LWGEOM *ng = mvt_unsafe_clip_by_box(lwgeom, clip_box);
+	if (!ng)
+		return NULL;
+
+	lwgeom_grid_in_place(ng, &grid);
+	ng = lwgeom_make_valid(ng);
+	if (!ng)
+		return NULL;
+
+	ng = lwgeom_to_basic_type(ng, POLYGONTYPE);
+	if (ng->type != POLYGONTYPE && ng->type != MULTIPOLYGONTYPE)
+		return NULL;
+
+	/* Shells must have positive area in tile coordinates, as wagyu outputs them */
+	lwgeom_force_clockwise(ng);
+	lwgeom_reverse_in_place(ng);
+	return ng;
+}
+
 static LWGEOM *
 mvt_clip_and_validate(LWGEOM *lwgeom, uint8_t basic_type, uint32_t extent, uint32_t buffer, bool clip_geom)
 {
 	GBOX clip_box = {0};
-	LWGEOM *clipped_lwgeom;
 
-	/* Wagyu only supports polygons. Default to geos for other types */
+	/* Polygon engines only support polygons. Default to geos for other types */
 	lwgeom = lwgeom_to_basic_type(lwgeom, POLYGONTYPE);
 	if (lwgeom->type != POLYGONTYPE && lwgeom->type != MULTIPOLYGONTYPE)
 	{
@@ -916,9 +1030,16 @@ mvt_clip_and_validate(LWGEOM *lwgeom, uint8_t basic_type, uint32_t extent, uint3
 		clip_box.xmin = clip_box.ymin = -(double)buffer;
 	}
 
-	clipped_lwgeom = lwgeom_wagyu_clip_by_box(lwgeom, &clip_box);
-
-	return clipped_lwgeom;
+	switch (mvt_clip_engine)
+	{
+	case MVT_CLIP_ENGINE_GEOS:
+		return mvt_clip_and_validate_polygon_geos(lwgeom, &clip_box);
+	case MVT_CLIP_ENGINE_NATIVE:
+		/* The input is already snapped to the grid (see mvt_geom) */
+		return lwgeom_clip_by_box_grid(lwgeom, &clip_box);
+	default:
+		return lwgeom_wagyu_clip_by_box(lwgeom, &clip_box);
+	}
 }
 
 /**
@@ -996,7 +1117,6 @@ void mvt_agg_init_context(mvt_agg_context *ctx)
 		elog(ERROR, "mvt_agg_init_context: extent cannot be 0");
 
 	ctx->tile = NULL;
-	ctx->features_capacity = FEATURES_CAPACITY_INITIAL;
 	ctx->keys_hash = NULL;
 	ctx->string_values_hash = NULL;
 	ctx->float_values_hash = NULL;
@@ -1016,25 +1136,26 @@ void mvt_agg_init_context(mvt_agg_context *ctx)
 	layer->version = 2;
 	layer->name = ctx->name;
 	layer->extent = ctx->extent;
-	layer->features = palloc(ctx->features_capacity * sizeof(*layer->features));
 
 	ctx->layer = layer;
+	ctx->feature = feature_create();
+	bytebuffer_init_with_size(&ctx->features_buffer, 0);
 }
 
 /**
  * Aggregation step. Parse a row, turn it into a feature, and add it to the layer.
  *
- * Expands features array if needed by a factor of 2.
- * Allocates a new feature, increment feature counter and
- * encode geometry and properties into it.
- */
+ * Encodes geometry and properties into the reusable feature builder, then
+ * appends the encoded feature to the features buffer and increments the
+ * feature counter. No per feature protobuf objects are kept.
+ */
 void mvt_agg_transfn(mvt_agg_context *ctx)
 {
 	bool isnull = false;
 	Datum datum;
 	GSERIALIZED *gs;
 	LWGEOM *lwgeom;
-	struct feature_builder feature_builder;
+	struct feature_builder *feature_builder = ctx->feature;
 	VectorTile__Tile__Layer *layer = ctx->layer;
 	POSTGIS_DEBUG(2, "mvt_agg_transfn called");
 
@@ -1047,71 +1168,129 @@ void mvt_agg_transfn(mvt_agg_context *ctx)
 	if (isnull) /* Skip rows that have null geometry */
 		return;
 
-	/* Allocate a new feature object */
-	feature_init(&feature_builder);
+	/* Reset the feature builder */
+	feature_init(feature_builder);
 
 	/* Deserialize the geometry */
 	gs = (GSERIALIZED *) PG_DETOAST_DATUM(datum);
 	lwgeom = lwgeom_from_gserialized(gs);
 
 	/* Set the geometry of the feature */
-	encode_feature_geometry(&feature_builder, lwgeom);
+	encode_feature_geometry(feature_builder, lwgeom);
 	lwgeom_free(lwgeom);
-	// TODO: free detoasted datum?
+	if ((Pointer) gs != DatumGetPointer(datum))
+		pfree(gs);
 
 	/* Parse properties */
-	parse_values(ctx, &feature_builder);
+	parse_values(ctx, feature_builder);
 
-	/* Grow the features array of the layer */
+	/* Encode the feature into the layer */
+	feature_write(feature_builder, &ctx->features_buffer);
+	layer->n_features++;
 	POSTGIS_DEBUGF(3, "mvt_agg_transfn encoded feature count: %zd", layer->n_features);
-	if (layer->n_features >= ctx->features_capacity)
-	{
-		size_t new_capacity = ctx->features_capacity * 2;
-		layer->features = repalloc(layer->features, new_capacity *
-			sizeof(*layer->features));
-		ctx->features_capacity = new_capacity;
-		POSTGIS_DEBUGF(3, "mvt_agg_transfn new_capacity: %zd", new_capacity);
-	}
-
-	/* Build and add the feature to the layer */
-	layer->features[layer->n_features++] = feature_build(&feature_builder);
 }
 
-static VectorTile__Tile * mvt_ctx_to_tile(mvt_agg_context *ctx)
+static void mvt_ctx_encode_dictionaries(mvt_agg_context *ctx)
 {
-	int n_layers = 1;
-	VectorTile__Tile *tile;
+	/* Keys and values can only be encoded once, the hashes are released */
+	if (ctx->layer->keys || ctx->layer->values)
+		return;
 	encode_keys(ctx);
 	encode_values(ctx);
+}
 
-	tile = palloc(sizeof(VectorTile__Tile));
-	vector_tile__tile__init(tile);
-	tile->layers = palloc(sizeof(VectorTile__Tile__Layer*) * n_layers);
-	tile->layers[0] = ctx->layer;
-	tile->n_layers = n_layers;
-	return tile;
+static inline uint8_t *pb_write_varint(uint8_t *buf, uint64_t value)
+{
+	return buf + varint_u64_encode_buf(value, buf);
+}
+
+static inline uint8_t *pb_write_bytes(uint8_t *buf, uint32_t field, const void *data, size_t size)
+{
+	buf = pb_write_varint(buf, PB_KEY(field, PB_WIRETYPE_LENGTH));
+	buf = pb_write_varint(buf, size);
+	memcpy(buf, data, size);
+	return buf + size;
+}
+
+/**
+ * Packs the single layer Tile straight from the encoded features buffer,
+ * writing the same bytes protobuf-c would write for the equivalent objects.
+ */
+static bytea *mvt_ctx_pack_streamed(mvt_agg_context *ctx)
+{
+	VectorTile__Tile__Layer *layer = ctx->layer;
+	size_t name_size = strlen(layer->name);
+	size_t features_size;
+	const uint8_t *features = bytebuffer_get_buffer(&ctx->features_buffer, &features_size);
+	size_t *values_size = palloc(sizeof(size_t) * (layer->n_values + 1));
+	size_t layer_size, len, i;
+	bytea *ba;
+	uint8_t *buf;
+
+	layer_size = 1 + pb_varint_size(name_size) + name_size;
+	layer_size += features_size;
+	for (i = 0; i < layer->n_keys; i++)
+	{
+		size_t key_size = strlen(layer->keys[i]);
+		layer_size += 1 + pb_varint_size(key_size) + key_size;
+	}
+	for (i = 0; i < layer->n_values; i++)
+	{
+		values_size[i] = vector_tile__tile__value__get_packed_size(layer->values[i]);
+		layer_size += 1 + pb_varint_size(values_size[i]) + values_size[i];
+	}
+	layer_size += 1 + pb_varint_size(layer->extent);
+	layer_size += 1 + pb_varint_size(layer->version);
+
+	len = VARHDRSZ + 1 + pb_varint_size(layer_size) + layer_size;
+	ba = palloc(len);
+	SET_VARSIZE(ba, len);
+	buf = (uint8_t *)VARDATA(ba);
+
+	buf = pb_write_varint(buf, PB_KEY(PB_TILE_LAYERS, PB_WIRETYPE_LENGTH));
+	buf = pb_write_varint(buf, layer_size);
+	buf = pb_write_bytes(buf, PB_LAYER_NAME, layer->name, name_size);
+	memcpy(buf, features, features_size);
+	buf += features_size;
+	for (i = 0; i < layer->n_keys; i++)
+		buf = pb_write_bytes(buf, PB_LAYER_KEYS, layer->keys[i], strlen(layer->keys[i]));
+	for (i = 0; i < layer->n_values; i++)
+	{
+		buf = pb_write_varint(buf, PB_KEY(PB_LAYER_VALUES, PB_WIRETYPE_LENGTH));
+		buf = pb_write_varint(buf, values_size[i]);
+		buf += vector_tile__tile__value__pack(layer->values[i], buf);
+	}
+	buf = pb_write_varint(buf, PB_KEY(PB_LAYER_EXTENT, PB_WIRETYPE_VARINT));
+	buf = pb_write_varint(buf, layer->extent);
+	buf = pb_write_varint(buf, PB_KEY(PB_LAYER_VERSION, PB_WIRETYPE_VARINT));
+	buf = pb_write_varint(buf, layer->version);
+
+	Assert(buf == (uint8_t *)ba + len);
+	pfree(values_size);
+	return ba;
 }
 
 static bytea *mvt_ctx_to_bytea(mvt_agg_context *ctx)
 {
-	/* Fill out the tile slot, if it's not already filled. */
-	/* We should only have a filled slot when all the work of building */
-	/* out the data is complete, so after a serialize/deserialize cycle */
-	/* or after a context combine */
+	/* We only have a filled tile slot after a serialize/deserialize */
+	/* cycle or after a context combine. Otherwise the features are */
+	/* already encoded and only need to be wrapped in a layer and tile */
 	size_t len;
 	bytea *ba;
 
 	if (!ctx->tile)
 	{
-		ctx->tile = mvt_ctx_to_tile(ctx);
-	}
+		mvt_ctx_encode_dictionaries(ctx);
 
-	/* Zero features => empty bytea output */
-	if (ctx && ctx->layer && ctx->layer->n_features == 0)
-	{
-		bytea *ba = palloc(VARHDRSZ);
-		SET_VARSIZE(ba, VARHDRSZ);
-		return ba;
+		/* Zero features => empty bytea output */
+		if (ctx->layer->n_features == 0)
+		{
+			ba = palloc(VARHDRSZ);
+			SET_VARSIZE(ba, VARHDRSZ);
+			return ba;
+		}
+
+		return mvt_ctx_pack_streamed(ctx);
 	}
 
 	/* Serialize the Tile */
@@ -40,6 +40,17 @@
 #include "liblwgeom.h"
 #include "lwgeom_pg.h"
 #include "lwgeom_log.h"
+#include "bytebuffer.h"
+
+/* Polygon clipping engine used by ST_AsMVTGeom, set by postgis.mvt_clip_engine */
+typedef enum
+{
+	MVT_CLIP_ENGINE_WAGYU = 0,
+	MVT_CLIP_ENGINE_GEOS,
+	MVT_CLIP_ENGINE_NATIVE
+} mvt_clip_engine_t;
+
+extern int mvt_clip_engine;
 
 #ifdef HAVE_LIBPROTOBUF
 
@@ -72,10 +83,13 @@ typedef struct mvt_agg_context
 	uint32_t geom_index;
 
 	HeapTupleHeader row;
-	/* The layer which stores all the aggregated features. Aggregation can only yield a single layer. */
+	/* The layer header: name, extent, and the keys and values once encoded. The features
+	 * are not kept as objects, n_features only counts the ones in features_buffer */
 	VectorTile__Tile__Layer *layer;
-	/* The size of the features array in the layer */
-	size_t features_capacity;
+	/* The aggregated features, already encoded as protobuf Layer.features fields */
+	bytebuffer_t features_buffer;
+	/* Scratch feature reused for every row */
+	struct feature_builder *feature;
 	/* The cached result of the aggregation. It can only be set once the operation is complete. */
 	VectorTile__Tile *tile;
 
@@ -30,11 +30,18 @@
 #include "utils/guc.h"
 #include "libpq/pqsignal.h"
 
+#include <float.h> /* for DBL_MAX */
+
 #include "../postgis_config.h"
 
 #include "lwgeom_log.h"
 #include "lwgeom_pg.h"
 #include "geos_c.h"
+#include "lwgeom_geos.h"
+#include "lwgeom_cache.h"
+#include "lwgeom_transform.h"
+#include "gserialized_gist.h"
+#include "mvt.h"
 
 #ifdef HAVE_LIBPROTOBUF
 #include "lwgeom_wagyu.h"
@@ -55,9 +62,26 @@ static void interruptCallback() {
 }
 #endif
 
+/* Defined in lwgeom_window.c */
+extern int postgis_cluster_threads;
+extern int postgis_kmeans_batch_size;
+
 static ExecutorStart_hook_type onExecutorStartPrev = NULL;
 static void onExecutorStart(QueryDesc *queryDesc, int eflags);
 
+static const struct config_enum_entry mvt_clip_engine_options[] = {
+  {"wagyu", MVT_CLIP_ENGINE_WAGYU, false},
+  {"geos", MVT_CLIP_ENGINE_GEOS, false},
+  {"native", MVT_CLIP_ENGINE_NATIVE, false},
+  {NULL, 0, false}
+};
+
+static const struct config_enum_entry gist_build_order_options[] = {
+  {"center", GIST_BUILD_ORDER_CENTER, false},
+  {"size", GIST_BUILD_ORDER_SIZE, false},
+  {NULL, 0, false}
+};
+
 /*
 * Pass proj error message out via the PostgreSQL logging
 * system instead of letting them default into the
@@ -95,6 +119,185 @@ _PG_init(void)
   proj_log_func(NULL, NULL, pjLogFunction);
 #endif
 
+  /* Define custom GUC variables. */
+  if ( postgis_guc_find_option("postgis.mvt_clip_engine") )
+  {
+    /* Probably an upgrade, the old library still owns the variable */
+    elog(WARNING, "'%s' is already set and cannot be changed until you reconnect", "postgis.mvt_clip_engine");
+  }
+  else
+  {
+    DefineCustomEnumVariable(
+      "postgis.mvt_clip_engine", /* name */
+      "Polygon clipping engine used by ST_AsMVTGeom.", /* short_desc */
+      "One of 'wagyu' (default), 'geos' or 'native'. 'native' clips on the integer tile grid without a general make valid step.", /* long_desc */
+      &mvt_clip_engine, /* valueAddr */
+      MVT_CLIP_ENGINE_WAGYU, /* bootValue */
+      mvt_clip_engine_options, /* options */
+      PGC_USERSET, /* GucContext context */
+      0, /* int flags */
+      NULL, /* GucEnumCheckHook check_hook */
+      NULL, /* GucEnumAssignHook assign_hook */
+      NULL  /* GucShowHook show_hook */
+    );
+  }
+
+  if ( postgis_guc_find_option("postgis.backend_geometry_cache_size") )
+  {
+    elog(WARNING, "'%s' is already set and cannot be changed until you reconnect", "postgis.backend_geometry_cache_size");
+  }
+  else
+  {
+    DefineCustomIntVariable(
+      "postgis.backend_geometry_cache_size", /* name */
+      "Memory used to keep prepared geometries and trees across queries.", /* short_desc */
+      "Indexes built on TOASTed geometries are kept for the life of the backend, up to this size. 0 disables the cache.", /* long_desc */
+      &postgis_backend_geometry_cache_size, /* valueAddr */
+      0, /* bootValue */
+      0, /* minValue */
+      MAX_KILOBYTES / 1024, /* maxValue */
+      PGC_USERSET, /* GucContext context */
+      GUC_UNIT_MB, /* int flags */
+      NULL, /* GucIntCheckHook check_hook */
+      NULL, /* GucIntAssignHook assign_hook */
+      NULL  /* GucShowHook show_hook */
+    );
+  }
+
+  if ( postgis_guc_find_option("postgis.geometry_cache_ways") )
+  {
+    elog(WARNING, "'%s' is already set and cannot be changed until you reconnect", "postgis.geometry_cache_ways");
+  }
+  else
+  {
+    DefineCustomIntVariable(
+      "postgis.geometry_cache_ways", /* name */
+      "Number of geometries each function call site keeps cached.", /* short_desc */
+      "Detoasted geometries and prepared geometries or trees are kept for this many distinct inputs per argument, replaced least recently used.", /* long_desc */
+      &postgis_geometry_cache_ways, /* valueAddr */
+      GEOMETRY_CACHE_WAYS_DEFAULT, /* bootValue */
+      2, /* minValue */
+      GEOMETRY_CACHE_WAYS_MAX, /* maxValue */
+      PGC_USERSET, /* GucContext context */
+      0, /* int flags */
+      NULL, /* GucIntCheckHook check_hook */
+      NULL, /* GucIntAssignHook assign_hook */
+      NULL  /* GucShowHook show_hook */
+    );
+  }
+
+  if ( postgis_guc_find_option("postgis.cluster_threads") )
+  {
+    elog(WARNING, "'%s' is already set and cannot be changed until you reconnect", "postgis.cluster_threads");
+  }
+  else
+  {
+    DefineCustomIntVariable(
+      "postgis.cluster_threads", /* name */
+      "Number of threads ST_ClusterDBSCAN uses for each partition.", /* short_desc */
+      "Values above 1 run the neighbour searches on that many threads, with cluster ids numbered by first row of each cluster.", /* long_desc */
+      &postgis_cluster_threads, /* valueAddr */
+      1, /* bootValue */
+      1, /* minValue */
+      LW_DBSCAN_MAX_THREADS, /* maxValue */
+      PGC_USERSET, /* GucContext context */
+      0, /* int flags */
+      NULL, /* GucIntCheckHook check_hook */
+      NULL, /* GucIntAssignHook assign_hook */
+      NULL  /* GucShowHook show_hook */
+    );
+  }
+
+  if ( postgis_guc_find_option("postgis.kmeans_batch_size") )
+  {
+    elog(WARNING, "'%s' is already set and cannot be changed until you reconnect", "postgis.kmeans_batch_size");
+  }
+  else
+  {
+    DefineCustomIntVariable(
+      "postgis.kmeans_batch_size", /* name */
+      "Number of rows in each mini-batch of ST_ClusterKMeans.", /* short_desc */
+      "Above 0, cluster centers are refined on random batches of this many rows, and every row is only assigned once at the end. 0 runs the exact algorithm.", /* long_desc */
+      &postgis_kmeans_batch_size, /* valueAddr */
+      0, /* bootValue */
+      0, /* minValue */
+      INT_MAX, /* maxValue */
+      PGC_USERSET, /* GucContext context */
+      0, /* int flags */
+      NULL, /* GucIntCheckHook check_hook */
+      NULL, /* GucIntAssignHook assign_hook */
+      NULL  /* GucShowHook show_hook */
+    );
+  }
+
+  if ( postgis_guc_find_option("postgis.gist_build_order") )
+  {
+    elog(WARNING, "'%s' is already set and cannot be changed until you reconnect", "postgis.gist_build_order");
+  }
+  else
+  {
+    DefineCustomEnumVariable(
+      "postgis.gist_build_order", /* name */
+      "Order of the boxes in sorted GiST index builds.", /* short_desc */
+      "'center' sorts boxes on the Hilbert curve of their centers, 'size' (default) does the same but puts large boxes after the others.", /* long_desc */
+      &postgis_gist_build_order, /* valueAddr */
+      GIST_BUILD_ORDER_SIZE, /* bootValue */
+      gist_build_order_options, /* options */
+      PGC_USERSET, /* GucContext context */
+      0, /* int flags */
+      NULL, /* GucEnumCheckHook check_hook */
+      NULL, /* GucEnumAssignHook assign_hook */
+      NULL  /* GucShowHook show_hook */
+    );
+  }
+
+  if ( postgis_guc_find_option("postgis.gist_build_large_size") )
+  {
+    elog(WARNING, "'%s' is already set and cannot be changed until you reconnect", "postgis.gist_build_large_size");
+  }
+  else
+  {
+    DefineCustomRealVariable(
+      "postgis.gist_build_large_size", /* name */
+      "Size above which boxes are sorted apart in sorted GiST index builds.", /* short_desc */
+      "Boxes wider or taller than this, in the units of the data, go after the others when postgis.gist_build_order is 'size'.", /* long_desc */
+      &postgis_gist_build_large_size, /* valueAddr */
+      GIST_BUILD_LARGE_SIZE_DEFAULT, /* bootValue */
+      0.0, /* minValue */
+      DBL_MAX, /* maxValue */
+      PGC_USERSET, /* GucContext context */
+      0, /* int flags */
+      NULL, /* GucRealCheckHook check_hook */
+      NULL, /* GucRealAssignHook assign_hook */
+      NULL  /* GucShowHook show_hook */
+    );
+  }
+
+  if ( postgis_guc_find_option("postgis.srs_shared_cache_size") )
+  {
+    elog(WARNING, "'%s' is already set and cannot be changed until you reconnect", "postgis.srs_shared_cache_size");
+  }
+  else
+  {
+    DefineCustomIntVariable(
+      "postgis.srs_shared_cache_size", /* name */
+      "Number of spatial_ref_sys rows kept in shared memory.", /* short_desc */
+      "Only used when PostGIS is in shared_preload_libraries. Backends read coordinate system definitions from there before querying spatial_ref_sys. 0 disables the cache.", /* long_desc */
+      &postgis_srs_shared_cache_size, /* valueAddr */
+      SRS_SHARED_CACHE_SIZE_DEFAULT, /* bootValue */
+      0, /* minValue */
+      INT_MAX / 8192, /* maxValue */
+      PGC_POSTMASTER, /* GucContext context */
+      0, /* int flags */
+      NULL, /* GucIntCheckHook check_hook */
+      NULL, /* GucIntAssignHook assign_hook */
+      NULL  /* GucShowHook show_hook */
+    );
+  }
+
+  /* reserve shared memory, when preloaded */
+  srs_shared_cache_init();
+
   /* setup hooks */
   onExecutorStartPrev = ExecutorStart_hook;
   ExecutorStart_hook = onExecutorStart;
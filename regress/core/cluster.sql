@@ -15,6 +15,15 @@ SELECT 't2', ST_AsText(unnest(ST_ClusterIntersecting(array_agg(geom ORDER BY id)
 SELECT 't3', ST_AsText(unnest(ST_ClusterWithin(geom, 1.4 ORDER BY id))) FROM cluster_inputs;
 SELECT 't4', ST_AsText(unnest(ST_ClusterWithin(array_agg(geom ORDER BY id), 1.5))) FROM cluster_inputs;
 
+-- tests for ST_ClusterIntersectingIndex and ST_ClusterWithinIndex
+CREATE INDEX ON cluster_inputs USING GIST (geom);
+SELECT 't5', array_agg(i.id ORDER BY i.id) FROM cluster_inputs i JOIN ST_ClusterIntersectingIndex('cluster_inputs', 'geom') c ON i.ctid = c.id GROUP BY c.cluster_id ORDER BY 2;
+SELECT 't6', array_agg(i.id ORDER BY i.id) FROM cluster_inputs i JOIN ST_ClusterWithinIndex('cluster_inputs', 'geom', 1.4) c ON i.ctid = c.id GROUP BY c.cluster_id ORDER BY 2;
+SELECT 't7', array_agg(i.id ORDER BY i.id) FROM cluster_inputs i JOIN ST_ClusterWithinIndex('cluster_inputs', 'geom', 1.5) c ON i.ctid = c.id GROUP BY c.cluster_id ORDER BY 2;
+CREATE TEMPORARY TABLE cluster_inputs_child () INHERITS (cluster_inputs);
+SELECT 't7b', count(*) FROM ST_ClusterIntersectingIndex('cluster_inputs', 'geom');
+DROP TABLE cluster_inputs_child;
+
 -- tests for ST_DBSCAN
 
 CREATE TEMPORARY TABLE dbscan_inputs (id int, geom geometry);
@@ -42,6 +51,25 @@ SELECT '#3612a', ST_ClusterDBSCAN(foo1.the_geom, 20.1, 5)OVER()  As result
 											( ST_GeomFromEWKT('SRID=4326;POLYGONM((-71.1319 42.2512 0,-71.1318 42.2511 20,-71.1317 42.2511 -20,-71.1317 42.251 5,-71.1317 42.2509 4,-71.132 42.2511 6,-71.1319 42.2512 30))') ) ) As g(geom))) As foo1 LIMIT 3;
 SELECT '#3612b', ST_ClusterDBSCAN(ST_Point(1,1), 20.1, 5) OVER();
 
+-- multi-threaded DBSCAN
+SET postgis.cluster_threads = 4;
+SELECT 't104', id, ST_ClusterDBSCAN(geom, eps := 0.8, minpoints := 1) OVER () from dbscan_inputs;
+SELECT 't105', id, ST_ClusterDBSCAN(geom, eps := 0.6, minpoints := 3) OVER () from dbscan_inputs;
+CREATE TEMPORARY TABLE dbscan_threads AS
+SELECT i, ST_MakePoint(abs(hashint4(i)) % 40000 / 1000.0, abs(hashint4(-i)) % 30000 / 1000.0) AS geom
+FROM generate_series(1, 3000) i;
+CREATE TEMPORARY TABLE dbscan_threads_result AS
+SELECT i, ST_ClusterDBSCAN(geom, 0.5, 4) OVER (ORDER BY i) AS cid FROM dbscan_threads;
+RESET postgis.cluster_threads;
+SELECT 't106', count(DISTINCT (s.cid, p.cid)) FILTER (WHERE s.cid IS NOT NULL) = count(DISTINCT s.cid), count(DISTINCT s.cid) = count(DISTINCT p.cid),
+	bool_and((s.cid IS NULL) = (p.cid IS NULL))
+FROM (SELECT i, ST_ClusterDBSCAN(geom, 0.5, 4) OVER (ORDER BY i) AS cid FROM dbscan_threads) s
+JOIN dbscan_threads_result p USING (i);
+CREATE INDEX ON dbscan_threads USING GIST (geom);
+SELECT 't107', count(DISTINCT (s.cid, c.cluster_id)) = count(DISTINCT s.cid), count(DISTINCT s.cid) = count(DISTINCT c.cluster_id), count(*)
+FROM (SELECT ctid AS tid, ST_ClusterDBSCAN(geom, 0.5, 1) OVER () AS cid FROM dbscan_threads) s
+JOIN ST_ClusterWithinIndex('dbscan_threads', 'geom', 0.5) c ON s.tid = c.id;
+
 
 -- ST_ClusterKMeans
 select '#4100a', count(distinct result) from (SELECT ST_ClusterKMeans(foo1.the_geom, 3) OVER()  As result
@@ -76,3 +104,12 @@ from (values (null::geometry), ('POINT(1 1)'), ('POINT EMPTY'), ('POINT(0 0)'),
 
 select 'weight-and-limit-support-1', count(distinct cid) from (select ST_ClusterKMeans(ST_Force2D(geom), 1, 1) over () as cid from (values ('POINT(0 0 0 1)'::geometry), ('POINT(1 0 0 1)'), ('POINT(2 0 0 10000)')) g(geom)) kmeans;
 select 'weight-and-limit-support-2', count(distinct cid) from (select ST_ClusterKMeans(geom, 1, 1) over () as cid from (values ('POINT(0 0 0 1)'::geometry), ('POINT(1 0 0 1)'), ('POINT(2 0 0 10000)')) g(geom)) kmeans;
+
+-- large k, exact and mini-batch
+select 'kmeans-large-k', count(distinct cid), min(cnt) >= 4 and max(cnt) <= 36 from (
+	select cid, count(*) over (partition by cid) cnt from (
+		select ST_ClusterKMeans(ST_MakePoint(x, y), 400) over (order by x, y) as cid
+		from generate_series(1, 80) x, generate_series(1, 80) y) a) b;
+SET postgis.kmeans_batch_size = 200;
+select 'kmeans-batch', count(distinct cid), count(cid) from (select ST_ClusterKMeans(ST_MakePoint(x, y), 81) over (order by x, y) as cid from generate_series(1, 45) x, generate_series(1, 45) y) kmeans;
+RESET postgis.kmeans_batch_size;
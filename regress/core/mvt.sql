@@ -734,3 +734,33 @@ WITH geom AS (
 	SELECT 3 as id, 'TRIANGLE EMPTY'::geometry geom
 )
 select '#4399', id, 'ST_AsMVTGeom', ST_AsText(ST_AsMVTGeom(geom, ST_MakeBox2D(ST_Point(0, 0), ST_Point(32, 32))))::text from geom order by id asc;
+
+-- Native integer grid clipping engine
+SET postgis.mvt_clip_engine = 'native';
+SELECT 'PG65', ST_AsText(ST_AsMVTGeom(
+	ST_GeomFromText('POLYGON((10 10, 10 0, 0 0, 0 10, 10 10), (9 9, 9 1, 1 1, 1 9, 9 9))'),
+	ST_MakeBox2D(ST_Point(0, 0), ST_Point(10, 10)),
+	10, 0, false));
+SELECT 'PG66', ST_AsText(ST_AsMVTGeom(
+	ST_GeomFromText('POLYGON((0 0, 10 0, 10 10, 0 10, 0 0), (9 9, 9 1, 1 1, 1 9, 9 9))'),
+	ST_MakeBox2D(ST_Point(0, 0), ST_Point(10, 10)),
+	10, 0, false));
+SELECT 'PG67', ST_AsText(ST_AsMVTGeom(
+	ST_GeomFromText('POLYGON((-5 -5, 15 -5, 15 15, -5 15, -5 -5), (2 2, 8 2, 8 8, 2 8, 2 2))'),
+	ST_MakeBox2D(ST_Point(0, 0), ST_Point(10, 10)),
+	10, 0, true));
+-- Adjacent polygons are merged
+SELECT 'PG68', ST_AsText(ST_AsMVTGeom(
+	ST_GeomFromText('MULTIPOLYGON(((0 0, 5 0, 5 5, 0 5, 0 0)), ((5 0, 10 0, 10 5, 5 5, 5 0)))'),
+	ST_MakeBox2D(ST_Point(0, 0), ST_Point(10, 10)),
+	10, 0, true));
+-- Concave polygon split in two by the tile border
+SELECT 'PG69', ST_AsText(ST_AsMVTGeom(
+	ST_GeomFromText('POLYGON((-5 0, 5 0, 5 2, -3 2, -3 8, 5 8, 5 10, -5 10, -5 0))'),
+	ST_MakeBox2D(ST_Point(0, 0), ST_Point(10, 10)),
+	10, 0, true));
+SELECT 'PG70', ST_AsMVTGeom(
+	ST_GeomFromText('POLYGON((20 20, 30 20, 30 30, 20 20))'),
+	ST_MakeBox2D(ST_Point(0, 0), ST_Point(10, 10)),
+	10, 0, true) IS NULL;
+RESET postgis.mvt_clip_engine;
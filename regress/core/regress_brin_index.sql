@@ -171,6 +171,56 @@ SELECT 'scan_idx', qnodes('select count(*) from test where the_geom &&& ''BOX3D(
 
 DROP INDEX brin_4d;
 
+-- 2D multi-box summaries, time ordered points with outliers in every range
+CREATE TABLE test_brin_multi AS
+SELECT i, CASE WHEN i % 50 = 0 THEN ST_MakePoint(-500 - i % 7, 500)
+  ELSE ST_MakePoint(i / 100.0, i % 10) END AS geom
+FROM generate_series(1, 20000) i;
+INSERT INTO test_brin_multi VALUES (0, NULL), (0, 'POINT EMPTY');
+
+CREATE OR REPLACE FUNCTION lossy_blocks(q text) RETURNS bigint
+LANGUAGE 'plpgsql' AS
+$$
+DECLARE
+  plan json;
+BEGIN
+  EXECUTE 'EXPLAIN (ANALYZE, FORMAT JSON) ' || q INTO plan;
+  RETURN (SELECT sum((n->>'Lossy Heap Blocks')::bigint)
+    FROM json_path_query(plan::jsonb, 'strict $.**') n
+    WHERE n->>'Node Type' = 'Bitmap Heap Scan');
+END;
+$$;
+
+set enable_indexscan = off;
+set enable_bitmapscan = on;
+set enable_seqscan = off;
+
+CREATE INDEX brin_2d on test_brin_multi using brin (geom) WITH (pages_per_range = 1);
+CREATE TEMP TABLE test_brin_multi_blocks AS
+SELECT lossy_blocks('select * from test_brin_multi where geom && ''BOX(49.1 4.1, 50.9 5.9)''::box2d') AS single;
+DROP INDEX brin_2d;
+
+CREATE INDEX brin_2d_multi on test_brin_multi using brin (geom brin_geometry_inclusion_ops_2d_multi) WITH (pages_per_range = 1);
+
+SELECT 'scan_idx', qnodes('select * from test_brin_multi where geom && ST_MakePoint(0,0)');
+ select '2d multi &&', count(*) from test_brin_multi where geom && 'BOX(49.1 4.1, 50.9 5.9)'::box2d;
+ select '2d multi @', count(*) from test_brin_multi where geom @ 'BOX(49.1 4.1, 50.9 5.9)'::box2d;
+ select '2d multi ~', count(*) from test_brin_multi where geom ~ 'POINT(50.05 5)'::geometry;
+ select '2d multi ~=', count(*) from test_brin_multi where geom ~= 'POINT(50.05 5)'::geometry;
+ select '2d multi ST_Intersects', count(*) from test_brin_multi where ST_Intersects(geom, ST_MakeEnvelope(49.1, 4.1, 50.9, 5.9));
+ select '2d multi pruning', lossy_blocks('select * from test_brin_multi where geom && ''BOX(49.1 4.1, 50.9 5.9)''::box2d') * 10 < single from test_brin_multi_blocks;
+
+INSERT INTO test_brin_multi
+SELECT i, CASE WHEN i % 50 = 0 THEN ST_MakePoint(-500 - i % 7, 500)
+  ELSE ST_MakePoint(i / 100.0, i % 10) END AS geom
+FROM generate_series(20001, 30000) i;
+SELECT 'summarize 2d multi', brin_summarize_new_values('brin_2d_multi') > 0;
+ select '2d multi &&', count(*) from test_brin_multi where geom && 'BOX(201.1 4.1, 202.9 5.9)'::box2d;
+
+DROP INDEX brin_2d_multi;
+DROP TABLE test_brin_multi;
+DROP FUNCTION lossy_blocks(text);
+
 -- cleanup
 DROP TABLE test;
 DROP FUNCTION qnodes(text);
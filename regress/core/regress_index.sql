@@ -103,6 +103,53 @@ SELECT 'expr &&', id, estimate_error(
   'select num from test where st_centroid(the_geom) && ' || box, tol )
   FROM sample_queries ORDER BY id;
 
+-- Sorted GiST builds of mixed size boxes, in both orders
+
+CREATE TABLE test_mixed AS
+SELECT num, CASE WHEN num % 100 = 0
+  THEN ST_Expand(the_geom, 50 + num % 300)
+  ELSE ST_Expand(the_geom, 0.5) END AS the_geom
+FROM test;
+
+set enable_indexscan = off;
+set enable_bitmapscan = off;
+set enable_seqscan = on;
+
+SELECT 'mixed_seq', count(*) FROM test_mixed WHERE the_geom && ST_MakeEnvelope(400.25,400.25,420.25,420.25);
+
+set enable_indexscan = on;
+set enable_bitmapscan = off;
+set enable_seqscan = off;
+
+SET postgis.gist_build_order = 'center';
+CREATE INDEX test_mixed_gist ON test_mixed USING gist (the_geom);
+SELECT 'mixed_center', count(*) FROM test_mixed WHERE the_geom && ST_MakeEnvelope(400.25,400.25,420.25,420.25);
+DROP INDEX test_mixed_gist;
+
+SET postgis.gist_build_order = 'size';
+SET postgis.gist_build_large_size = 10;
+CREATE INDEX test_mixed_gist ON test_mixed USING gist (the_geom);
+SELECT 'mixed_size', count(*) FROM test_mixed WHERE the_geom && ST_MakeEnvelope(400.25,400.25,420.25,420.25);
+CREATE INDEX test_mixed_gist_nd ON test_mixed USING gist (the_geom gist_geometry_ops_nd);
+SELECT 'mixed_size_nd', count(*) FROM test_mixed WHERE the_geom &&& ST_MakeEnvelope(400.25,400.25,420.25,420.25);
+
+RESET postgis.gist_build_order;
+RESET postgis.gist_build_large_size;
+
+-- Quantized keys, by insertion and by sorting
+
+DROP INDEX test_mixed_gist;
+CREATE INDEX test_mixed_gist_quantized ON test_mixed USING gist (the_geom gist_geometry_ops_2d_quantized) WITH (buffering = on);
+SELECT 'mixed_quantized', count(*) FROM test_mixed WHERE the_geom && ST_MakeEnvelope(400.25,400.25,420.25,420.25);
+DROP TABLE test_mixed;
+
+DROP INDEX quick_gist;
+CREATE INDEX quick_gist_quantized ON test USING gist (the_geom gist_geometry_ops_2d_quantized);
+SELECT 'quantized &&', count(*) FROM test WHERE the_geom && ST_MakeEnvelope(400.25,400.25,420.25,420.25);
+SELECT 'quantized <->', array_agg(num) FROM (
+  SELECT num FROM test ORDER BY the_geom <-> ST_MakePoint(500,500) LIMIT 5
+) f;
+
 DROP TABLE test;
 DROP TABLE sample_queries;
 
@@ -292,3 +292,65 @@ SELECT 'covers311', ST_Covers('POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))', p) FROM
 ('LINESTRING(1 10, 10 10, 10 8)'),('LINESTRING(1 10, 10 10, 10 8)'),('LINESTRING(1 10, 10 10, 10 8)')
 ) AS v(p);
 
+
+-- Backend cache of prepared geometries (postgis.backend_geometry_cache_size)
+CREATE TABLE prep_toasted (id int, g geometry);
+ALTER TABLE prep_toasted ALTER COLUMN g SET STORAGE EXTERNAL;
+INSERT INTO prep_toasted VALUES (1, ST_Buffer('POINT(0 0)'::geometry, 10, 1000));
+CREATE TABLE prep_points AS SELECT i, ST_MakePoint(i - 14.5, 0) AS p FROM generate_series(0, 30) i;
+SET postgis.backend_geometry_cache_size = '1MB';
+SELECT 'backendcache1', count(*) FROM prep_toasted, prep_points WHERE ST_Contains(g, p);
+SELECT 'backendcache2', count(*) FROM prep_toasted, prep_points WHERE ST_Contains(g, p);
+SELECT 'backendcache3', count(*) FROM prep_toasted, prep_points WHERE ST_Intersects(p, g);
+UPDATE prep_toasted SET g = ST_Buffer('POINT(0 0)'::geometry, 5, 1000);
+SELECT 'backendcache4', count(*) FROM prep_toasted, prep_points WHERE ST_Contains(g, p);
+SET postgis.backend_geometry_cache_size = 0;
+SELECT 'backendcache5', count(*) FROM prep_toasted, prep_points WHERE ST_Contains(g, p);
+RESET postgis.backend_geometry_cache_size;
+DROP TABLE prep_toasted;
+DROP TABLE prep_points;
+
+-- Call sites cycling over a few geometries (postgis.geometry_cache_ways)
+CREATE TEMP TABLE prep_stats AS SELECT _postgis_cache_stats()::json AS s;
+SELECT 'cacheways1', count(*) FROM generate_series(0, 299) i, LATERAL (SELECT i % 3 AS k) AS c
+WHERE ST_Contains(ST_MakeEnvelope(k * 10, 0, k * 10 + 10, 10), ST_MakeLine(ST_MakePoint(k * 10 + 1, 1), ST_MakePoint(k * 10 + 9, i % 9 + 1)));
+SELECT 'cacheways2', (_postgis_cache_stats()::json->'prepared'->>'hits')::bigint - (s->'prepared'->>'hits')::bigint > 250 FROM prep_stats;
+DROP TABLE prep_stats;
+
+-- Boxes of toasted geometries read from slices of the datums
+CREATE TEMP TABLE prep_toasted (id integer, geom geometry);
+ALTER TABLE prep_toasted ALTER COLUMN geom SET STORAGE EXTERNAL;
+INSERT INTO prep_toasted SELECT i, ST_Segmentize(ST_MakeEnvelope(i, 0, i + 0.5, 1), 0.001) FROM generate_series(0, 3) i;
+CREATE TEMP TABLE prep_stats AS SELECT _postgis_cache_stats()::json->'detoast' AS s;
+SELECT 'toastbox1', count(*) FROM prep_toasted WHERE geom && ST_MakeEnvelope(0.9, 0.5, 2.1, 0.6);
+SELECT 'toastbox2', count(*) FROM prep_toasted WHERE ST_Intersects(geom, 'POINT(3.25 0.5)'::geometry);
+SELECT 'toastbox3', d->>'box_sliced', d->>'box_detoasted', d->>'predicates_skipped'
+FROM (SELECT json_object_agg(k, (_postgis_cache_stats()::json->'detoast'->>k)::bigint - (s->>k)::bigint) AS d
+      FROM prep_stats, json_object_keys(s) k) f;
+DROP TABLE prep_stats;
+UPDATE prep_toasted SET geom = postgis_dropbbox(geom) WHERE id < 2;
+CREATE TEMP TABLE prep_stats AS SELECT _postgis_cache_stats()::json->'detoast' AS s;
+SELECT 'toastbox4', count(*) FROM prep_toasted WHERE geom && ST_MakeEnvelope(0.9, 0.5, 2.1, 0.6);
+SELECT 'toastbox5', d->>'box_sliced', d->>'box_detoasted', d->>'predicates_skipped'
+FROM (SELECT json_object_agg(k, (_postgis_cache_stats()::json->'detoast'->>k)::bigint - (s->>k)::bigint) AS d
+      FROM prep_stats, json_object_keys(s) k) f;
+SELECT 'toastbox6', postgis_addbbox('prep_toasted', 'geom');
+SELECT 'toastbox7', count(*) FROM prep_toasted WHERE postgis_hasbbox(geom);
+DROP TABLE prep_stats;
+DROP TABLE prep_toasted;
+
+-- Batch point in polygon
+SELECT 'containspoints1', ST_ContainsPoints('POLYGON((0 0, 10 0, 10 10, 0 10, 0 0), (2 2, 4 2, 4 4, 2 4, 2 2))',
+	ARRAY['POINT(5 5)', 'POINT(10 5)', NULL, 'POINT(20 5)', 'POINT(3 3)', 'POINT EMPTY', 'POINT(2 3)']::geometry[]);
+SELECT 'containspoints2', ST_ContainsPoints('MULTIPOLYGON(((0 0, 1 0, 1 1, 0 1, 0 0)), ((5 5, 6 5, 6 6, 5 6, 5 5)))',
+	ARRAY['POINT(0.5 0.5)', 'POINT(5.5 5.5)', 'POINT(3 3)']::geometry[]);
+SELECT 'containspoints3', ST_ContainsPoints('POLYGON EMPTY', ARRAY['POINT(0 0)']::geometry[]);
+SELECT 'containspoints4', ST_ContainsPoints('POLYGON((0 0, 1 0, 1 1, 0 1, 0 0))', '{}'::geometry[]);
+WITH pts AS (SELECT i, ST_MakePoint(i % 31 - 15, i / 31 - 15) AS g FROM generate_series(0, 960) i),
+     poly AS (SELECT ST_Buffer('POINT(0 0)'::geometry, 10) AS p),
+     arr AS (SELECT array_agg(g ORDER BY i) AS a FROM pts)
+SELECT 'containspoints5', bool_and(c.inside = ST_Contains(p, pts.g)), count(*)
+FROM poly, arr, unnest(ST_ContainsPoints(p, a)) WITH ORDINALITY AS c(inside, n), pts
+WHERE pts.i = c.n - 1;
+SELECT 'containspoints6', ST_ContainsPoints('LINESTRING(0 0, 1 1)', ARRAY['POINT(0 0)']::geometry[]);
+SELECT 'containspoints7', ST_ContainsPoints('POLYGON((0 0, 1 0, 1 1, 0 1, 0 0))', ARRAY['LINESTRING(0 0, 1 1)']::geometry[]);
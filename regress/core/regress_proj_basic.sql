@@ -21,6 +21,12 @@ SELECT 4,ST_AsEWKT(ST_SnapToGrid(ST_transform(ST_GeomFromEWKT('SRID=100002;LINES
 --- test #5: LINESTRING projection, 2 points, 4D
 SELECT 5,ST_AsEWKT(ST_SnapToGrid(ST_transform(ST_GeomFromEWKT('SRID=100002;LINESTRING(16 48 0 0, 16 49 0 0)'),100001),10));
 
+--- test #6: changed definitions are not kept in the cache
+UPDATE spatial_ref_sys SET auth_name = NULL, auth_srid = NULL, srtext = NULL,
+	proj4text = '+proj=utm +zone=34 +ellps=WGS84 +datum=WGS84 +units=m +no_defs '
+	WHERE srid = 100001;
+SELECT 6,ST_AsEWKT(ST_SnapToGrid(ST_transform(ST_GeomFromEWKT('SRID=100002;POINT(16 48)'),100001),10));
+
 DELETE FROM spatial_ref_sys WHERE srid in (100001, 100002);
 
 SELECT 'M1', ST_AsText(ST_SnapToGrid(st_transform('SRID=4326;POINT(-20 -20)'::geometry, 3857),1));
@@ -2199,7 +2199,20 @@ select 'selectivity_09', 'estimated', _postgis_selectivity('regular_overdots','g
 select 'selectivity_10', 'actual', 1;
 select 'selectivity_09', 'estimated', _postgis_selectivity('regular_overdots','g','LINESTRING(0 0, 12 12)');
 
+-- Dense cluster in a sparse table, dense cells get refined
+create table skewed_points as
+  select st_makepoint(a * 100, b * 100) as g
+    from generate_series(0, 9) a, generate_series(0, 9) b
+  union all
+  select st_makepoint(500.001 + a * 0.02, 500.001 + b * 0.02)
+    from generate_series(0, 49) a, generate_series(0, 49) b;
+analyze skewed_points;
+select 'selectivity_11', (_postgis_stats('skewed_points','g')::json->>'refined_cells')::integer > 0;
+select 'selectivity_12', count(*) from skewed_points where g && 'LINESTRING(500 500, 500.49 500.49)';
+select 'selectivity_13', _postgis_selectivity('skewed_points','g','LINESTRING(500 500, 500.49 500.49)') between 0.15 and 0.35;
+
 -- Clean
+drop table if exists skewed_points;
 drop table if exists regular_overdots;
 drop table if exists regular_overdots_ab;
 
@@ -129,6 +129,31 @@ select * from test_spgist_idx_2d;
 
 -------------------------------------------------------------------------------
 
+-- k-NN ordering
+
+create table test_spgist_knn_2d(op text, spgistidx int[], spgidxscan varchar(32), noidx int[]);
+insert into test_spgist_knn_2d(op, spgistidx, spgidxscan)
+select '<->', array(select k from tbl_geomcollection order by g <-> 'POINT(-10 -10)'::geometry limit 10),
+qnodes('select k from tbl_geomcollection order by g <-> ''POINT(-10 -10)''::geometry limit 10');
+insert into test_spgist_knn_2d(op, spgistidx, spgidxscan)
+select '<#>', array(select k from tbl_geomcollection order by g <#> 'POINT(-10 -10)'::geometry limit 10),
+qnodes('select k from tbl_geomcollection order by g <#> ''POINT(-10 -10)''::geometry limit 10');
+
+set enable_indexscan = off;
+set enable_seqscan = on;
+
+update test_spgist_knn_2d
+set noidx = array(select k from tbl_geomcollection order by g <-> 'POINT(-10 -10)'::geometry limit 10)
+where op = '<->';
+update test_spgist_knn_2d
+set noidx = array(select k from tbl_geomcollection order by g <#> 'POINT(-10 -10)'::geometry limit 10)
+where op = '<#>';
+
+select op, spgistidx = noidx, spgidxscan from test_spgist_knn_2d;
+
+-------------------------------------------------------------------------------
+
 DROP TABLE tbl_geomcollection CASCADE;
 DROP TABLE test_spgist_idx_2d CASCADE;
+DROP TABLE test_spgist_knn_2d CASCADE;
 DROP FUNCTION qnodes;
@@ -66,4 +66,25 @@ INSERT INTO geoms SELECT ST_GeomFromText('POLYGON EMPTY') AS geom;
 SELECT ST_AsText(ST_Union(geom)) FROM geoms;
 
 
+-- Test partial unions of the buffered values
+
+TRUNCATE TABLE geoms;
+
+WITH coords AS (SELECT * FROM generate_series(0, 99) AS x, generate_series(0, 99) AS y)
+INSERT INTO geoms
+SELECT ST_Square(1.0, x, y, ST_MakePoint(0, 0))
+FROM coords;
+
+SET work_mem = '64kB';
+
+WITH u AS (SELECT ST_Union(geom) AS g FROM geoms)
+SELECT ST_Area(g), ST_XMin((g)), ST_YMin(g), ST_XMax(g), ST_YMax(g) from u;
+
+-- Disjoint squares end up in separate parts
+WITH u AS (SELECT ST_Union(geom) AS g FROM geoms WHERE ST_XMin(geom)::integer % 2 = 0 AND ST_YMin(geom)::integer % 2 = 0)
+SELECT ST_GeometryType(g), ST_NumGeometries(g), ST_Area(g), ST_XMin((g)), ST_YMin(g), ST_XMax(g), ST_YMax(g) from u;
+
+RESET work_mem;
+
+
 DROP TABLE geoms;
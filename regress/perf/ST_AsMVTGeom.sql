@@ -0,0 +1,45 @@
+-- Compares the polygon clipping engines of ST_AsMVTGeom
+-- (postgis.mvt_clip_engine) on a zoom 2 tile grid.
+--
+--   psql -f regress/perf/ST_AsMVTGeom.sql
+--
+BEGIN;
+
+CREATE TEMP TABLE mvtperf_polygons AS
+SELECT i, ST_Buffer(
+	ST_MakePoint(random() * 40000000 - 20000000, random() * 40000000 - 20000000),
+	200000 + random() * 4000000, 64) AS geom
+FROM generate_series(1, 2000) i;
+
+-- Polygons with holes and concave outlines
+INSERT INTO mvtperf_polygons
+SELECT i, ST_Difference(ST_Buffer(geom, 500000, 32), ST_Buffer(ST_Centroid(geom), 300000, 32))
+FROM mvtperf_polygons WHERE i <= 500;
+
+CREATE TEMP TABLE mvtperf_tiles AS
+SELECT ST_TileEnvelope(2, x, y) AS bounds
+FROM generate_series(0, 3) x, generate_series(0, 3) y;
+
+ANALYZE mvtperf_polygons;
+ANALYZE mvtperf_tiles;
+
+\timing on
+
+SET postgis.mvt_clip_engine = 'wagyu';
+SELECT 'wagyu', count(g), sum(ST_NPoints(g)), sum(ST_Area(g))::bigint, count(*) FILTER (WHERE NOT ST_IsValid(g))
+FROM (SELECT ST_AsMVTGeom(p.geom, t.bounds::box2d, 4096, 256, true) g
+	FROM mvtperf_polygons p, mvtperf_tiles t WHERE p.geom && t.bounds) foo;
+
+SET postgis.mvt_clip_engine = 'geos';
+SELECT 'geos', count(g), sum(ST_NPoints(g)), sum(ST_Area(g))::bigint, count(*) FILTER (WHERE NOT ST_IsValid(g))
+FROM (SELECT ST_AsMVTGeom(p.geom, t.bounds::box2d, 4096, 256, true) g
+	FROM mvtperf_polygons p, mvtperf_tiles t WHERE p.geom && t.bounds) foo;
+
+SET postgis.mvt_clip_engine = 'native';
+SELECT 'native', count(g), sum(ST_NPoints(g)), sum(ST_Area(g))::bigint, count(*) FILTER (WHERE NOT ST_IsValid(g))
+FROM (SELECT ST_AsMVTGeom(p.geom, t.bounds::box2d, 4096, 256, true) g
+	FROM mvtperf_polygons p, mvtperf_tiles t WHERE p.geom && t.bounds) foo;
+
+\timing off
+
+ROLLBACK;
@@ -0,0 +1,41 @@
+-- Compares ST_ClusterDBSCAN on point partitions, which are clustered on a
+-- grid, with the same points as single point multipoints, which go through
+-- the spatial index, on one thread and on several (postgis.cluster_threads).
+--
+--   psql -v npoints=1000000 -f regress/perf/ST_ClusterDBSCAN.sql
+--
+-- Throughput is npoints divided by the reported time. The whole partition
+-- is held in memory, so runs of 10 to 100 million points need several
+-- gigabytes.
+--
+\if :{?npoints}
+\else
+\set npoints 1000000
+\endif
+
+BEGIN;
+
+-- About 10 points per eps sized cell, whatever the number of points
+CREATE TEMP TABLE dbscanperf_points AS
+SELECT i, ST_MakePoint(random() * sqrt(:npoints / 10.0), random() * sqrt(:npoints / 10.0)) AS geom
+FROM generate_series(1, :npoints) i;
+
+\timing on
+
+SET postgis.cluster_threads = 1;
+SELECT 'points, 1 thread', count(DISTINCT cid), count(cid)
+FROM (SELECT ST_ClusterDBSCAN(geom, 1.0, 5) OVER () cid FROM dbscanperf_points) foo;
+
+SELECT 'multipoints, 1 thread', count(DISTINCT cid), count(cid)
+FROM (SELECT ST_ClusterDBSCAN(ST_Multi(geom), 1.0, 5) OVER () cid FROM dbscanperf_points) foo;
+
+SET postgis.cluster_threads = 8;
+SELECT 'points, 8 threads', count(DISTINCT cid), count(cid)
+FROM (SELECT ST_ClusterDBSCAN(geom, 1.0, 5) OVER () cid FROM dbscanperf_points) foo;
+
+SELECT 'multipoints, 8 threads', count(DISTINCT cid), count(cid)
+FROM (SELECT ST_ClusterDBSCAN(ST_Multi(geom), 1.0, 5) OVER () cid FROM dbscanperf_points) foo;
+
+\timing off
+
+ROLLBACK;
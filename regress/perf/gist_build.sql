@@ -0,0 +1,143 @@
+-- Compares GiST indexes on the same boxes built by insertion (buffering),
+-- and by sorting in both postgis.gist_build_order orders: index size, build
+-- time and the index pages read by window queries, for the 2D, quantized 2D
+-- and ND opclasses. Sorted builds need PostgreSQL 15.
+--
+--   psql -v tbl=buildings -v col=geom -f regress/perf/gist_build.sql
+--
+-- Without tbl, a synthetic set of clustered buildings, roads of all
+-- lengths and a few large areas is used (nrows rows, 1M by default).
+-- The query windows are random boxes of 1/1000 and 1/100 of the width of
+-- the data, nqueries of each (1000 by default).
+--
+\if :{?nrows}
+\else
+\set nrows 1000000
+\endif
+\if :{?nqueries}
+\else
+\set nqueries 1000
+\endif
+
+BEGIN;
+
+\if :{?tbl}
+CREATE TEMP TABLE gistperf AS SELECT :col::geometry AS geom FROM :tbl;
+\else
+\set tbl synthetic
+CREATE TEMP TABLE gistperf AS
+SELECT CASE
+  -- Buildings, half of them in 500 dense clusters
+  WHEN i % 100 < 90 THEN
+    ST_MakeEnvelope(x, y, x + 8 + random() * 25, y + 8 + random() * 25)
+  -- Roads, 50m to 5km long
+  WHEN i % 1000 != 999 THEN
+    ST_MakeLine(ST_MakePoint(x, y), ST_MakePoint(x + l * cos(a), y + l * sin(a)))
+  -- Large areas
+  ELSE
+    ST_MakeEnvelope(x, y, x + 2000 + random() * 20000, y + 2000 + random() * 20000)
+  END AS geom
+FROM (
+  SELECT i,
+    CASE WHEN i % 2 = 0 THEN 500000 + random() * 100000
+      ELSE 500000 + (hashint4(i % 500) & 65535) * 1.5 + random() * 3000 END AS x,
+    CASE WHEN i % 2 = 0 THEN 5000000 + random() * 100000
+      ELSE 5000000 + (hashint4(i % 500 + 1000) & 65535) * 1.5 + random() * 3000 END AS y,
+    50 * power(100, random()) AS l,
+    random() * pi() AS a
+  FROM generate_series(1, :nrows) i
+) f;
+\endif
+
+CREATE TEMP TABLE gistperf_windows AS
+WITH e AS (SELECT ST_Extent(geom) AS e FROM gistperf)
+SELECT ST_MakeEnvelope(x, y, x + w, y + w) AS geom, w
+FROM e, LATERAL (
+  SELECT ST_XMin(e) + random() * (ST_XMax(e) - ST_XMin(e)) AS x,
+         ST_YMin(e) + random() * (ST_YMax(e) - ST_YMin(e)) AS y,
+         (ST_XMax(e) - ST_XMin(e)) * s AS w
+  FROM generate_series(1, :nqueries), unnest(ARRAY[0.001, 0.01]) s
+) f;
+
+ANALYZE gistperf;
+ANALYZE gistperf_windows;
+
+-- Index pages read by the window queries of each size
+CREATE FUNCTION pg_temp.gistperf_pages(op text)
+RETURNS TABLE (window_size float8, pages_per_query numeric)
+LANGUAGE 'plpgsql' AS $$
+DECLARE
+  win RECORD;
+  plan json;
+BEGIN
+  CREATE TEMP TABLE IF NOT EXISTS gistperf_reads (w float8, pages bigint);
+  TRUNCATE gistperf_reads;
+  FOR win IN SELECT * FROM gistperf_windows LOOP
+    EXECUTE format('EXPLAIN (ANALYZE, BUFFERS, FORMAT JSON) SELECT count(*) FROM gistperf WHERE geom %s %L::geometry', op, win.geom) INTO plan;
+    INSERT INTO gistperf_reads
+    SELECT win.w, (n->>'Shared Hit Blocks')::bigint + (n->>'Shared Read Blocks')::bigint
+    FROM json_path_query(plan::jsonb, 'strict $.**') n
+    WHERE n->>'Node Type' = 'Bitmap Index Scan';
+  END LOOP;
+  RETURN QUERY SELECT w, round(avg(pages), 1) FROM gistperf_reads GROUP BY w ORDER BY w;
+END;
+$$;
+
+SET enable_seqscan = off;
+SET enable_indexscan = off;
+SET max_parallel_maintenance_workers = 0;
+\timing on
+
+SELECT 'insert 2d', :'tbl';
+CREATE INDEX gistperf_idx ON gistperf USING gist (geom) WITH (buffering = on);
+\timing off
+SELECT pg_size_pretty(pg_relation_size('gistperf_idx')), * FROM pg_temp.gistperf_pages('&&');
+DROP INDEX gistperf_idx;
+\timing on
+
+SET postgis.gist_build_order = 'center';
+SELECT 'sorted 2d, center order', :'tbl';
+CREATE INDEX gistperf_idx ON gistperf USING gist (geom);
+\timing off
+SELECT pg_size_pretty(pg_relation_size('gistperf_idx')), * FROM pg_temp.gistperf_pages('&&');
+DROP INDEX gistperf_idx;
+\timing on
+
+SET postgis.gist_build_order = 'size';
+SELECT 'sorted 2d, size order', :'tbl';
+CREATE INDEX gistperf_idx ON gistperf USING gist (geom);
+\timing off
+SELECT pg_size_pretty(pg_relation_size('gistperf_idx')), * FROM pg_temp.gistperf_pages('&&');
+DROP INDEX gistperf_idx;
+\timing on
+
+SELECT 'sorted 2d quantized, size order', :'tbl';
+CREATE INDEX gistperf_idx ON gistperf USING gist (geom gist_geometry_ops_2d_quantized);
+\timing off
+SELECT pg_size_pretty(pg_relation_size('gistperf_idx')), * FROM pg_temp.gistperf_pages('&&');
+DROP INDEX gistperf_idx;
+\timing on
+
+SELECT 'insert nd', :'tbl';
+CREATE INDEX gistperf_idx ON gistperf USING gist (geom gist_geometry_ops_nd) WITH (buffering = on);
+\timing off
+SELECT pg_size_pretty(pg_relation_size('gistperf_idx')), * FROM pg_temp.gistperf_pages('&&&');
+DROP INDEX gistperf_idx;
+\timing on
+
+SET postgis.gist_build_order = 'center';
+SELECT 'sorted nd, center order', :'tbl';
+CREATE INDEX gistperf_idx ON gistperf USING gist (geom gist_geometry_ops_nd);
+\timing off
+SELECT pg_size_pretty(pg_relation_size('gistperf_idx')), * FROM pg_temp.gistperf_pages('&&&');
+DROP INDEX gistperf_idx;
+\timing on
+
+SET postgis.gist_build_order = 'size';
+SELECT 'sorted nd, size order', :'tbl';
+CREATE INDEX gistperf_idx ON gistperf USING gist (geom gist_geometry_ops_nd);
+\timing off
+SELECT pg_size_pretty(pg_relation_size('gistperf_idx')), * FROM pg_temp.gistperf_pages('&&&');
+DROP INDEX gistperf_idx;
+
+ROLLBACK;
@@ -16,6 +16,8 @@
 #include "utils/builtins.h" /* for cstring_to_text */
 #include "utils/elog.h"
 #include "utils/memutils.h" /* for TopMemoryContext */
+#include "utils/guc.h" /* for DefineCustomIntVariable */
+#include "utils/hsearch.h" /* for the primitives cache */
 #include "utils/array.h" /* for ArrayType */
 #include "catalog/pg_type.h" /* for INT4OID, TEXTOID */
 #include "lib/stringinfo.h"
@@ -28,6 +30,7 @@
 
 #include "liblwgeom_internal.h" /* for gbox_clone */
 #include "liblwgeom_topo.h"
+#include "stringbuffer.h"
 
 /*#define POSTGIS_DEBUG_LEVEL 1*/
 #include "lwgeom_log.h"
@@ -78,6 +81,34 @@ struct LWT_BE_DATA_T
 
 LWT_BE_DATA be_data;
 
+/*
+ * Snapshot of the edge linking, used by the ring walks of the plain
+ * backend. It is filled one ring at a time and patched by the edge
+ * writes of the same call, see cb_getRingEdges.
+ */
+typedef struct RingAdjEntry
+{
+  LWT_ELEMID edge_id;
+  LWT_ELEMID start_node;
+  LWT_ELEMID end_node;
+  LWT_ELEMID next_left; /* 0 if NULL */
+  LWT_ELEMID next_right; /* 0 if NULL */
+  uint32 walk[2]; /* last walk along the left and right side */
+  char status;
+} RingAdjEntry;
+
+#define SH_PREFIX ringadj
+#define SH_ELEMENT_TYPE RingAdjEntry
+#define SH_KEY_TYPE LWT_ELEMID
+#define SH_KEY edge_id
+#define SH_HASH_KEY(tb, key) \
+  ((uint32) (((uint64) (key) * UINT64CONST(0x9E3779B97F4A7C15)) >> 32))
+#define SH_EQUAL(tb, a, b) ((a) == (b))
+#define SH_SCOPE static inline
+#define SH_DECLARE
+#define SH_DEFINE
+#include "lib/simplehash.h"
+
 struct LWT_BE_TOPOLOGY_T
 {
   LWT_BE_DATA* be_data;
@@ -87,6 +118,9 @@ struct LWT_BE_TOPOLOGY_T
   double precision;
   int hasZ;
   Oid geometryOID;
+  struct TopoCache *cache; /* primitives kept for the transaction, or NULL */
+  ringadj_hash *adj; /* edge linking snapshot, or NULL */
+  uint32 adjwalk; /* serial of the last ring walk */
 };
 
 /* utility funx */
@@ -220,6 +254,9 @@ cb_loadTopologyByName(const LWT_BE_DATA* be, const char *name)
   topo->be_data = (LWT_BE_DATA *)be; /* const cast.. */
   topo->name = pstrdup(name);
   topo->hasZ = 0;
+  topo->cache = NULL;
+  topo->adj = NULL;
+  topo->adjwalk = 0;
 
   dat = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
   if ( isnull )
@@ -289,6 +326,7 @@ cb_topoGetPrecision(const LWT_BE_TOPOLOGY* topo)
 static int
 cb_freeTopology(LWT_BE_TOPOLOGY* topo)
 {
+  if ( topo->adj ) ringadj_destroy(topo->adj);
   pfree(topo->name);
   pfree(topo);
   return 1;
@@ -1163,8 +1201,9 @@ cb_getFacesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *nu
   return faces;
 }
 
+/* Walk the ring with a recursive query */
 static LWT_ELEMID *
-cb_getRingEdges(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID edge, uint64_t *numelems, int limit)
+cb_queryRingEdges(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID edge, uint64_t *numelems, int limit)
 {
   LWT_ELEMID *edges;
   int spi_result;
@@ -1193,7 +1232,7 @@ cb_getRingEdges(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID edge, uint64_t *numelems
     appendStringInfo(sql, " LIMIT %d", limit);
   }
 
-  POSTGIS_DEBUGF(1, "cb_getRingEdges query (limit %d): %s", limit, sql->data);
+  POSTGIS_DEBUGF(1, "cb_queryRingEdges query (limit %d): %s", limit, sql->data);
   spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, limit);
   MemoryContextSwitchTo( oldcontext ); /* switch back */
   if ( spi_result != SPI_OK_SELECT )
@@ -1205,7 +1244,7 @@ cb_getRingEdges(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID edge, uint64_t *numelems
   }
   pfree(sqldata.data);
 
-  POSTGIS_DEBUGF(1, "cb_getRingEdges: edge query returned " UINT64_FORMAT " rows", SPI_processed);
+  POSTGIS_DEBUGF(1, "cb_queryRingEdges: edge query returned " UINT64_FORMAT " rows", SPI_processed);
   *numelems = SPI_processed;
   if ( ! SPI_processed )
   {
@@ -1284,6 +1323,266 @@ cb_getRingEdges(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID edge, uint64_t *numelems
   return edges;
 }
 
+/* Max number of edges kept in the linking snapshot */
+#define RINGADJ_MAXSIZE 65536
+
+/* Edge fields kept in the linking snapshot */
+#define RINGADJ_FIELDS ( LWT_COL_EDGE_EDGE_ID | LWT_COL_EDGE_START_NODE | \
+                         LWT_COL_EDGE_END_NODE | LWT_COL_EDGE_NEXT_LEFT | \
+                         LWT_COL_EDGE_NEXT_RIGHT )
+
+static void
+_ringadj_drop(const LWT_BE_TOPOLOGY *topo)
+{
+  LWT_BE_TOPOLOGY *t = (LWT_BE_TOPOLOGY *)topo; /* const cast */
+  if ( ! t->adj ) return;
+  ringadj_destroy(t->adj);
+  t->adj = NULL;
+}
+
+static void
+_ringadj_set(RingAdjEntry *e, const LWT_ISO_EDGE *edge, int fields)
+{
+  if ( fields & LWT_COL_EDGE_START_NODE ) e->start_node = edge->start_node;
+  if ( fields & LWT_COL_EDGE_END_NODE ) e->end_node = edge->end_node;
+  if ( fields & LWT_COL_EDGE_NEXT_LEFT ) e->next_left = edge->next_left;
+  if ( fields & LWT_COL_EDGE_NEXT_RIGHT ) e->next_right = edge->next_right;
+}
+
+static void
+_ringadj_put(ringadj_hash *adj, const LWT_ISO_EDGE *edge)
+{
+  bool found;
+  RingAdjEntry *e = ringadj_insert(adj, edge->edge_id, &found);
+  if ( ! found ) e->walk[0] = e->walk[1] = 0;
+  _ringadj_set(e, edge, RINGADJ_FIELDS);
+}
+
+/*
+ * Tell if an entry passes the tests of an update selection, all
+ * equalities or all inequalities. A NULL next edge never passes,
+ * like in SQL.
+ */
+static bool
+_ringadj_match(const RingAdjEntry *e, const LWT_ISO_EDGE *edge, int fields, bool equal)
+{
+  if ( (fields & LWT_COL_EDGE_EDGE_ID) &&
+       (e->edge_id == edge->edge_id) != equal ) return false;
+  if ( (fields & LWT_COL_EDGE_START_NODE) &&
+       (e->start_node == edge->start_node) != equal ) return false;
+  if ( (fields & LWT_COL_EDGE_END_NODE) &&
+       (e->end_node == edge->end_node) != equal ) return false;
+  if ( (fields & LWT_COL_EDGE_NEXT_LEFT) &&
+       ( ! e->next_left || (e->next_left == edge->next_left) != equal ) ) return false;
+  if ( (fields & LWT_COL_EDGE_NEXT_RIGHT) &&
+       ( ! e->next_right || (e->next_right == edge->next_right) != equal ) ) return false;
+  return true;
+}
+
+/* Apply to the snapshot an update of the edge_data table */
+static void
+_ringadj_update(const LWT_BE_TOPOLOGY *topo,
+                const LWT_ISO_EDGE *sel_edge, int sel_fields,
+                const LWT_ISO_EDGE *upd_edge, int upd_fields,
+                const LWT_ISO_EDGE *exc_edge, int exc_fields)
+{
+  ringadj_iterator it;
+  RingAdjEntry *e;
+
+  if ( ! topo->adj || ! (upd_fields & RINGADJ_FIELDS) ) return;
+
+  /* Rows selected by fields we do not keep could be any of them */
+  if ( ( sel_edge && (sel_fields & ~RINGADJ_FIELDS) ) ||
+       ( exc_edge && (exc_fields & ~RINGADJ_FIELDS) ) )
+  {
+    _ringadj_drop(topo);
+    return;
+  }
+
+  if ( sel_edge && sel_fields == LWT_COL_EDGE_EDGE_ID )
+  {
+    e = ringadj_lookup(topo->adj, sel_edge->edge_id);
+    if ( e && ( ! exc_edge || _ringadj_match(e, exc_edge, exc_fields, false) ) )
+      _ringadj_set(e, upd_edge, upd_fields);
+    return;
+  }
+
+  ringadj_start_iterate(topo->adj, &it);
+  while ( (e = ringadj_iterate(topo->adj, &it)) )
+  {
+    if ( sel_edge && ! _ringadj_match(e, sel_edge, sel_fields, true) ) continue;
+    if ( exc_edge && ! _ringadj_match(e, exc_edge, exc_fields, false) ) continue;
+    _ringadj_set(e, upd_edge, upd_fields);
+  }
+}
+
+/*
+ * Copy the linking of the ring of the given signed edge into the
+ * snapshot. Returns 0 on error, 1 otherwise, even if the edge
+ * does not exist.
+ */
+static int
+_ringadj_loadRing(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID edge)
+{
+  int spi_result;
+  TupleDesc rowdesc;
+  StringInfoData sqldata;
+  StringInfo sql = &sqldata;
+  uint64_t i;
+  MemoryContext oldcontext = CurrentMemoryContext;
+
+  initStringInfo(sql);
+  appendStringInfo(sql, "WITH RECURSIVE edgering AS ( "
+                   "SELECT %" LWTFMT_ELEMID " as signed_edge_id, edge_id, "
+                   "start_node, end_node, next_left_edge, next_right_edge "
+                   "FROM \"%s\".edge_data WHERE edge_id = %" LWTFMT_ELEMID " UNION "
+                   "SELECT CASE WHEN "
+                   "p.signed_edge_id < 0 THEN p.next_right_edge ELSE p.next_left_edge END, "
+                   "e.edge_id, e.start_node, e.end_node, "
+                   "e.next_left_edge, e.next_right_edge "
+                   "FROM \"%s\".edge_data e, edgering p WHERE "
+                   "e.edge_id = CASE WHEN p.signed_edge_id < 0 THEN "
+                   "abs(p.next_right_edge) ELSE abs(p.next_left_edge) END ) "
+                   "SELECT edge_id, start_node, end_node, "
+                   "next_left_edge, next_right_edge FROM edgering",
+                   edge, topo->name, ABS(edge), topo->name);
+
+  POSTGIS_DEBUGF(1, "_ringadj_loadRing query: %s", sql->data);
+  spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, 0);
+  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  if ( spi_result != SPI_OK_SELECT )
+  {
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
+    pfree(sqldata.data);
+    return 0;
+  }
+  pfree(sqldata.data);
+
+  POSTGIS_DEBUGF(1, "_ringadj_loadRing: edge query returned " UINT64_FORMAT " rows", SPI_processed);
+  rowdesc = SPI_tuptable->tupdesc;
+  for ( i=0; i<SPI_processed; ++i )
+  {
+    HeapTuple row = SPI_tuptable->vals[i];
+    LWT_ISO_EDGE e;
+    LWT_ELEMID *cols[] = {
+      &e.edge_id, &e.start_node, &e.end_node, &e.next_left, &e.next_right
+    };
+    bool isnull;
+    Datum dat;
+    int col;
+
+    for ( col = 0; col < 5; ++col )
+    {
+      dat = SPI_getbinval(row, rowdesc, col + 1, &isnull);
+      *cols[col] = isnull ? 0 : DatumGetInt32(dat);
+    }
+    _ringadj_put(topo->adj, &e);
+  }
+
+  SPI_freetuptable(SPI_tuptable);
+
+  return 1;
+}
+
+/*
+ * Walk the ring in the linking snapshot, loading the missing
+ * edges from the database.
+ *
+ * Splitting faces walks the same rings over and over while their
+ * edges are being linked, so only the first walk of a ring in the
+ * same call runs a query. The transaction cache has its own walk,
+ * see ccb_getRingEdges.
+ */
+static LWT_ELEMID *
+cb_getRingEdges(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID edge, uint64_t *numelems, int limit)
+{
+  LWT_BE_TOPOLOGY *t = (LWT_BE_TOPOLOGY *)topo; /* const cast */
+  LWT_ELEMID *edges;
+  LWT_ELEMID cur = edge;
+  uint64_t n = 0, size = 16;
+  uint32 walk;
+
+  if ( t->adj && t->adj->members > RINGADJ_MAXSIZE ) _ringadj_drop(topo);
+  if ( ! t->adj )
+    t->adj = ringadj_create(GetMemoryChunkContext(t), 256, NULL);
+  walk = ++t->adjwalk;
+
+  edges = palloc(sizeof(LWT_ELEMID) * size);
+  for (;;)
+  {
+    RingAdjEntry *e = ringadj_lookup(t->adj, ABS(cur));
+    int side = cur > 0 ? 0 : 1;
+    LWT_ELEMID next;
+
+    if ( ! e )
+    {
+      if ( ! _ringadj_loadRing(topo, cur) )
+      {
+        pfree(edges);
+        *numelems = UINT64_MAX;
+        return NULL;
+      }
+      e = ringadj_lookup(t->adj, ABS(cur));
+    }
+
+    if ( ! e )
+    {
+      pfree(edges);
+      if ( cur == edge )
+        cberror(topo->be_data,
+                "No edge with id %" LWTFMT_ELEMID " in Topology \"%s\"",
+                ABS(edge), topo->name);
+      else
+        cberror(topo->be_data, "Corrupted topology: ring of edge %"
+                               LWTFMT_ELEMID " is topologically non-closed",
+                               edge);
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+
+    if ( e->walk[side] == walk )
+    {
+      pfree(edges);
+      cberror(topo->be_data, "Corrupted topology: ring of edge %"
+                             LWTFMT_ELEMID " is topologically non-closed",
+                             edge);
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+    e->walk[side] = walk;
+
+    if ( limit && n == (uint64_t)limit )
+    {
+      pfree(edges);
+      cberror(topo->be_data, "Max traversing limit hit: %d", limit);
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+    if ( n == size )
+    {
+      size *= 2;
+      edges = repalloc(edges, sizeof(LWT_ELEMID) * size);
+    }
+    edges[n++] = cur;
+
+    next = side ? e->next_right : e->next_left;
+    if ( ! next )
+    {
+      pfree(edges);
+      cberror(topo->be_data, "Edge %" LWTFMT_ELEMID
+                             " has NULL next_%s_edge",
+                             ABS(cur), side ? "right" : "left");
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+    if ( next == edge ) break;
+    cur = next;
+  }
+
+  *numelems = n;
+  return edges;
+}
+
 static LWT_ISO_NODE *
 cb_getNodeById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields)
 {
@@ -1723,6 +2022,11 @@ cb_insertEdges(const LWT_BE_TOPOLOGY *topo, LWT_ISO_EDGE *edges, uint64_t numele
 
   SPI_freetuptable(SPI_tuptable);
 
+  if ( topo->adj )
+  {
+    for ( i=0; i<numelems; ++i ) _ringadj_put(topo->adj, &edges[i]);
+  }
+
   return SPI_processed;
 }
 
@@ -1829,6 +2133,9 @@ cb_updateEdges( const LWT_BE_TOPOLOGY* topo,
 
   POSTGIS_DEBUGF(1, "cb_updateEdges: update query processed " UINT64_FORMAT " rows", SPI_processed);
 
+  _ringadj_update(topo, sel_edge, sel_fields, upd_edge, upd_fields,
+                  exc_edge, exc_fields);
+
   return SPI_processed;
 }
 
@@ -2089,6 +2396,15 @@ cb_updateEdgesById(const LWT_BE_TOPOLOGY *topo, const LWT_ISO_EDGE *edges, uint6
 
   POSTGIS_DEBUGF(1, "cb_updateEdgesById: update query processed " UINT64_FORMAT " rows", SPI_processed);
 
+  if ( topo->adj && (fields & RINGADJ_FIELDS) )
+  {
+    for ( i=0; i<numedges; ++i )
+    {
+      RingAdjEntry *e = ringadj_lookup(topo->adj, edges[i].edge_id);
+      if ( e ) _ringadj_set(e, &edges[i], fields);
+    }
+  }
+
   return SPI_processed;
 }
 
@@ -2122,6 +2438,14 @@ cb_deleteEdges( const LWT_BE_TOPOLOGY* topo,
 
   POSTGIS_DEBUGF(1, "cb_deleteEdges: delete query processed " UINT64_FORMAT " rows", SPI_processed);
 
+  if ( topo->adj )
+  {
+    if ( sel_fields == LWT_COL_EDGE_EDGE_ID )
+      ringadj_delete(topo->adj, sel_edge->edge_id);
+    else
+      _ringadj_drop(topo);
+  }
+
   return SPI_processed;
 }
 
@@ -2172,6 +2496,60 @@ cb_getNextEdgeId( const LWT_BE_TOPOLOGY* topo )
   return edge_id;
 }
 
+static int
+cb_getNextEdgeIds(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID *ids, uint64_t numelems)
+{
+  MemoryContext oldcontext = CurrentMemoryContext;
+  int spi_result;
+  StringInfoData sqldata;
+  StringInfo sql = &sqldata;
+  bool isnull;
+  Datum dat;
+  uint64_t i;
+
+  initStringInfo(sql);
+  appendStringInfo(sql, "SELECT nextval('\"%s\".edge_data_edge_id_seq') "
+                   "FROM generate_series(1," UINT64_FORMAT ")",
+                   topo->name, numelems);
+  spi_result = SPI_execute(sql->data, false, numelems);
+  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  if ( spi_result != SPI_OK_SELECT )
+  {
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s",
+            spi_result, sql->data);
+    pfree(sqldata.data);
+    return -1;
+  }
+  pfree(sqldata.data);
+
+  if ( SPI_processed ) topo->be_data->data_changed = true;
+
+  if ( SPI_processed != numelems )
+  {
+	  cberror(topo->be_data,
+		  "processed " UINT64_FORMAT " rows, expected " UINT64_FORMAT,
+		  (uint64_t)SPI_processed,
+		  numelems);
+	  return -1;
+  }
+
+  for ( i=0; i<numelems; ++i )
+  {
+    dat = SPI_getbinval( SPI_tuptable->vals[i],
+                         SPI_tuptable->tupdesc, 1, &isnull );
+    if ( isnull )
+    {
+      cberror(topo->be_data, "nextval for edge_id returned null");
+      return -1;
+    }
+    ids[i] = DatumGetInt64(dat); /* sequences return 64bit integers */
+  }
+
+  SPI_freetuptable(SPI_tuptable);
+
+  return 0;
+}
+
 static int
 cb_updateTopoGeomEdgeSplit ( const LWT_BE_TOPOLOGY* topo,
                              LWT_ELEMID split_edge, LWT_ELEMID new_edge1, LWT_ELEMID new_edge2 )
@@ -3539,1253 +3917,2181 @@ static LWT_BE_CALLBACKS be_callbacks =
   cb_checkTopoGeomRemIsoNode,
   cb_checkTopoGeomRemIsoEdge,
   cb_getClosestEdge,
-  cb_computeFaceMBR
+  cb_computeFaceMBR,
+  cb_getNextEdgeIds
 };
 
-static void
-xact_callback(XactEvent event, void *arg)
-{
-  LWT_BE_DATA* data = (LWT_BE_DATA *)arg;
-  POSTGIS_DEBUGF(1, "xact_callback called with event %d", event);
-  data->data_changed = false;
-}
-
+/* ---------- Cache of primitives for snapshot isolation ---------- */
 
 /*
- * Module load callback
+ * When postgis.topology_cache_size is above 0 the ccb_* callbacks below
+ * are registered in place of the ones above. In REPEATABLE READ and
+ * SERIALIZABLE transactions they keep the nodes, edges and faces read or
+ * written by topology functions in memory for the rest of the
+ * transaction, so that the next calls find them without querying the
+ * database again, and they keep the changes in memory until the end of
+ * each call, where they are written back with a few multi-row
+ * statements.
+ *
+ * Changes are not kept until commit: the deferred constraints on the
+ * edge links are checked before the pre-commit callbacks run, and SQL
+ * run later in the same transaction needs to see the primitives.
+ * Instead, the transaction statistics of the primitive tables are read
+ * when a topology is loaded, and its cached primitives are dropped if
+ * anything else wrote to those tables. The statistics only count the
+ * writes of this backend, which is enough when the transaction uses a
+ * single snapshot. Under READ COMMITTED the commits of concurrent
+ * sessions show up between statements, so the plain callbacks are put
+ * back for the rest of the transaction instead.
+ *
+ * A spatial lookup is answered from memory when its box is within the
+ * box of a previous lookup that loaded every primitive overlapping it.
+ * Each of those regions lists its primitives, and gets the primitives
+ * later added or moved within it.
  */
-void _PG_init(void);
-void
-_PG_init(void)
-{
-  MemoryContext old_context;
 
-  /*
-   * install PostgreSQL handlers for liblwgeom
-   * NOTE: they may be already in place!
-   */
-  pg_install_lwgeom_handlers();
+#define TC_NODE 0
+#define TC_EDGE 1
+#define TC_FACE 2
+#define TC_KINDS 3
 
-  /* Switch to the top memory context so that the backend interface
-   * is valid for the whole backend lifetime */
-  old_context = MemoryContextSwitchTo( TopMemoryContext );
+/* Identifiers reserved at once from the sequences */
+#define TC_ID_CHUNK 64
 
-  /* initialize backend data */
-  be_data.data_changed = false;
-  be_data.topoLoadFailMessageFlavor = 0;
+/* Rows per statement when writing back */
+#define TC_FLUSH_BATCH 1000
 
-  /* hook on transaction end to reset data_changed */
-  RegisterXactCallback(xact_callback, &be_data);
+static const char *tc_tables[TC_KINDS] = { "node", "edge_data", "face" };
+static const char *tc_sequences[TC_KINDS] = {
+  "node_node_id_seq", "edge_data_edge_id_seq", "face_face_id_seq"
+};
+static const int tc_allfields[TC_KINDS] = {
+  LWT_COL_NODE_ALL, LWT_COL_EDGE_ALL, LWT_COL_FACE_ALL
+};
+static const size_t tc_rowsize[TC_KINDS] = {
+  sizeof(LWT_ISO_NODE), sizeof(LWT_ISO_EDGE), sizeof(LWT_ISO_FACE)
+};
 
-  /* register callbacks against liblwgeom-topo */
-  be_iface = lwt_CreateBackendIface(&be_data);
-  lwt_BackendIfaceRegisterCallbacks(be_iface, &be_callbacks);
+typedef enum
+{
+  TC_CLEAN,   /* same as in the database */
+  TC_NEW,     /* to be inserted */
+  TC_DIRTY,   /* to be updated, see the dirty fields */
+  TC_DELETED, /* to be deleted */
+  TC_GONE     /* neither in the database nor in the topology */
+} TopoCacheState;
 
-  /* Switch back to whatever memory context was in place
-   * at time of _PG_init enter.
-   * See http://www.postgresql.org/message-id/20150623114125.GD5835@localhost
-   */
-  MemoryContextSwitchTo(old_context);
-}
+#define TC_LIVE(e) ( (e)->state == TC_CLEAN || (e)->state == TC_NEW || \
+                     (e)->state == TC_DIRTY )
 
-/*
- * Module unload callback
- */
-void _PG_fini(void);
-void
-_PG_fini(void)
+typedef struct TopoCacheEntry
 {
-  elog(NOTICE, "Goodbye from PostGIS Topology %s", POSTGIS_VERSION);
+  LWT_ELEMID id; /* hash key, must be first */
+  TopoCacheState state;
+  int dirty; /* fields to update, for TC_DIRTY */
+  bool pending; /* in the pending list of its table */
+  bool hasbox;
+  uint32 stamp; /* last lookup visiting the entry */
+  uint32 ringstamp[2]; /* last ring walk visiting each side */
+  GBOX box; /* 2D box, rounded to floats as the && operator does */
+  union
+  {
+    LWT_ISO_NODE node;
+    LWT_ISO_EDGE edge;
+    LWT_ISO_FACE face;
+  } row;
+} TopoCacheEntry;
+
+typedef struct TopoCacheRegion
+{
+  GBOX box; /* rounded to floats */
+  List *entries; /* every entry overlapping the box, and maybe more */
+} TopoCacheRegion;
 
-  UnregisterXactCallback(xact_callback, &be_data);
-  lwt_FreeBackendIface(be_iface);
+typedef struct TopoCacheTable
+{
+  HTAB *hash;
+  List *regions;
+  bool complete; /* every row of the table was loaded */
+  List *pending; /* entries to write back */
+  LWT_ELEMID *ids; /* identifiers reserved from the sequence */
+  int nids;
+  int nextid;
+} TopoCacheTable;
+
+typedef struct TopoCache
+{
+  struct TopoCache *next;
+  MemoryContext mcxt;
+  char *name;
+  int id;
+  TopoCacheTable tab[TC_KINDS];
+  Oid relids[TC_KINDS];
+  int64 modcount[TC_KINDS]; /* rows written in the transaction */
+  bool tracked; /* our writes show in the statistics */
+  uint64 written; /* rows written since modcount was read */
+  uint32 stamp;
+  Size size; /* rough memory use */
+} TopoCache;
+
+static int topology_cache_size = 0; /* MB */
+static bool topology_cache_skipped = false; /* plain callbacks put back */
+static MemoryContext topo_cache_context = NULL;
+static TopoCache *topo_caches = NULL;
+
+/* Criteria of the entries collected by a lookup */
+typedef struct TopoCacheFilter
+{
+  bool (*match)(int kind, const TopoCacheEntry *e,
+                const struct TopoCacheFilter *f);
+  const GBOX *box; /* entries must overlap it, if not NULL */
+  const LWGEOM *pt;
+  double dist;
+  const LWT_ELEMID *ids;
+  uint64_t nids;
+  uint64_t limit; /* stop after that many hits, 0 for no limit */
+  List *hits;
+  uint64_t nhits;
+} TopoCacheFilter;
+
+static void
+_tc_dropAll(void)
+{
+  if ( topo_cache_context ) MemoryContextDelete(topo_cache_context);
+  topo_cache_context = NULL;
+  topo_caches = NULL;
 }
 
-/*  ST_ModEdgeSplit(atopology, anedge, apoint) */
-Datum ST_ModEdgeSplit(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_ModEdgeSplit);
-Datum ST_ModEdgeSplit(PG_FUNCTION_ARGS)
+static void
+_tc_drop(TopoCache *cache)
 {
-  text* toponame_text;
-  char* toponame;
-  LWT_ELEMID edge_id;
-  LWT_ELEMID node_id;
-  GSERIALIZED *geom;
-  LWGEOM *lwgeom;
-  LWPOINT *pt;
-  LWT_TOPOLOGY *topo;
+  TopoCache **prev = &topo_caches;
+  while ( *prev && *prev != cache ) prev = &(*prev)->next;
+  if ( *prev ) *prev = cache->next;
+  MemoryContextDelete(cache->mcxt);
+}
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+static TopoCache *
+_tc_create(const LWT_BE_TOPOLOGY *topo)
+{
+  MemoryContext mcxt;
+  TopoCache *cache;
+  HASHCTL ctl;
+  int k;
+
+  if ( ! topo_cache_context )
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    topo_cache_context = AllocSetContextCreate(TopTransactionContext,
+                                               "topology caches",
+                                               ALLOCSET_DEFAULT_SIZES);
   }
+  mcxt = AllocSetContextCreate(topo_cache_context, "topology cache",
+                               ALLOCSET_DEFAULT_SIZES);
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
-
-  edge_id = PG_GETARG_INT32(1) ;
+  cache = MemoryContextAllocZero(mcxt, sizeof(TopoCache));
+  cache->mcxt = mcxt;
+  cache->name = MemoryContextStrdup(mcxt, topo->name);
+  cache->id = topo->id;
+  cache->tracked = true;
 
-  geom = PG_GETARG_GSERIALIZED_P(2);
-  lwgeom = lwgeom_from_gserialized(geom);
-  pt = lwgeom_as_lwpoint(lwgeom);
-  if ( ! pt )
+  memset(&ctl, 0, sizeof(ctl));
+  ctl.keysize = sizeof(LWT_ELEMID);
+  ctl.entrysize = sizeof(TopoCacheEntry);
+  ctl.hcxt = mcxt;
+  for ( k=0; k<TC_KINDS; ++k )
   {
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 2);
-    lwpgerror("ST_ModEdgeSplit third argument must be a point geometry");
-    PG_RETURN_NULL();
+    cache->tab[k].hash = hash_create(tc_tables[k], 1024, &ctl,
+                                     HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
   }
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
+  cache->next = topo_caches;
+  topo_caches = cache;
+  return cache;
+}
+
+/* Read the identifiers and transaction write counts of the primitive tables */
+static bool
+_tc_modcount(const LWT_BE_TOPOLOGY *topo, Oid *relids, int64 *counts)
+{
+  MemoryContext oldcontext = CurrentMemoryContext;
+  int spi_result;
+  StringInfoData sqldata;
+  StringInfo sql = &sqldata;
+  uint64_t i;
+
+  initStringInfo(sql);
+  appendStringInfo(sql, "SELECT r::oid, pg_stat_get_xact_tuples_inserted(r)"
+                   " + pg_stat_get_xact_tuples_updated(r)"
+                   " + pg_stat_get_xact_tuples_deleted(r)"
+                   " FROM unnest(ARRAY['\"%s\".node', '\"%s\".edge_data',"
+                   " '\"%s\".face']::regclass[]) r",
+                   topo->name, topo->name, topo->name);
+
+  spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, 0);
+  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  if ( spi_result != SPI_OK_SELECT )
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
+    pfree(sqldata.data);
+    return false;
   }
+  pfree(sqldata.data);
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
+  if ( SPI_processed != TC_KINDS )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    cberror(topo->be_data, "processed " UINT64_FORMAT " rows, expected %d",
+            (uint64_t)SPI_processed, TC_KINDS);
+    return false;
   }
 
-  POSTGIS_DEBUG(1, "Calling lwt_ModEdgeSplit");
-  node_id = lwt_ModEdgeSplit(topo, edge_id, pt, 0);
-  POSTGIS_DEBUG(1, "lwt_ModEdgeSplit returned");
-  lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 3);
-  lwt_FreeTopology(topo);
-
-  if ( node_id == -1 )
+  for ( i=0; i<TC_KINDS; ++i )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    bool isnull;
+    Datum dat;
+    dat = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &isnull);
+    relids[i] = isnull ? InvalidOid : DatumGetObjectId(dat);
+    dat = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 2, &isnull);
+    counts[i] = isnull ? 0 : DatumGetInt64(dat);
   }
 
-  SPI_finish();
-  PG_RETURN_INT32(node_id);
+  SPI_freetuptable(SPI_tuptable);
+
+  return true;
 }
 
-/*  ST_NewEdgesSplit(atopology, anedge, apoint) */
-Datum ST_NewEdgesSplit(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_NewEdgesSplit);
-Datum ST_NewEdgesSplit(PG_FUNCTION_ARGS)
+/* Find the cache of a topology, dropping it if something else wrote to it */
+static bool
+_tc_attach(LWT_BE_TOPOLOGY *topo)
 {
-  text* toponame_text;
-  char* toponame;
-  LWT_ELEMID edge_id;
-  LWT_ELEMID node_id;
-  GSERIALIZED *geom;
-  LWGEOM *lwgeom;
-  LWPOINT *pt;
-  LWT_TOPOLOGY *topo;
+  TopoCache *cache;
+  Oid relids[TC_KINDS];
+  int64 counts[TC_KINDS];
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  for ( cache = topo_caches; cache; cache = cache->next )
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    if ( ! strcmp(cache->name, topo->name) ) break;
   }
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
-
-  edge_id = PG_GETARG_INT32(1) ;
+  if ( ! _tc_modcount(topo, relids, counts) ) return false;
 
-  geom = PG_GETARG_GSERIALIZED_P(2);
-  lwgeom = lwgeom_from_gserialized(geom);
-  pt = lwgeom_as_lwpoint(lwgeom);
-  if ( ! pt )
+  if ( cache &&
+       ( cache->id != topo->id || ! cache->tracked ||
+         memcmp(relids, cache->relids, sizeof(relids)) ||
+         memcmp(counts, cache->modcount, sizeof(counts)) ) )
   {
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 2);
-    lwpgerror("ST_NewEdgesSplit third argument must be a point geometry");
-    PG_RETURN_NULL();
+    POSTGIS_DEBUGF(1, "dropping stale cache of topology \"%s\"", topo->name);
+    _tc_drop(cache);
+    cache = NULL;
   }
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
+  if ( ! cache )
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+    cache = _tc_create(topo);
+    memcpy(cache->relids, relids, sizeof(relids));
+    memcpy(cache->modcount, counts, sizeof(counts));
   }
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
+  topo->cache = cache;
+  return true;
+}
+
+static LWT_ELEMID
+_tc_rowId(int kind, const void *row)
+{
+  switch ( kind )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+  case TC_NODE:
+    return ((const LWT_ISO_NODE *)row)->node_id;
+  case TC_EDGE:
+    return ((const LWT_ISO_EDGE *)row)->edge_id;
+  default:
+    return ((const LWT_ISO_FACE *)row)->face_id;
   }
+}
 
-  POSTGIS_DEBUG(1, "Calling lwt_NewEdgesSplit");
-  node_id = lwt_NewEdgesSplit(topo, edge_id, pt, 0);
-  POSTGIS_DEBUG(1, "lwt_NewEdgesSplit returned");
-  lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 3);
-  lwt_FreeTopology(topo);
+static void *
+_tc_row(int kind, void *rows, uint64_t i)
+{
+  return (char *)rows + i * tc_rowsize[kind];
+}
 
-  if ( node_id == -1 )
+static void
+_tc_freeRows(int kind, void *rows, uint64_t n)
+{
+  uint64_t i;
+
+  if ( ! rows ) return;
+  for ( i=0; i<n; ++i )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    void *row = _tc_row(kind, rows, i);
+    switch ( kind )
+    {
+    case TC_NODE:
+      if ( ((LWT_ISO_NODE *)row)->geom ) lwpoint_free(((LWT_ISO_NODE *)row)->geom);
+      break;
+    case TC_EDGE:
+      if ( ((LWT_ISO_EDGE *)row)->geom ) lwline_free(((LWT_ISO_EDGE *)row)->geom);
+      break;
+    default:
+      if ( ((LWT_ISO_FACE *)row)->mbr ) lwfree(((LWT_ISO_FACE *)row)->mbr);
+      break;
+    }
   }
+  pfree(rows);
+}
 
-  SPI_finish();
-  PG_RETURN_INT32(node_id);
+static void
+_tc_roundBox(const GBOX *in, GBOX *out)
+{
+  *out = *in;
+  out->flags = 0;
+  gbox_float_round(out);
 }
 
-/*  ST_AddIsoNode(atopology, aface, apoint) */
-Datum ST_AddIsoNode(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_AddIsoNode);
-Datum ST_AddIsoNode(PG_FUNCTION_ARGS)
+static TopoCacheEntry *
+_tc_lookup(TopoCacheTable *tab, LWT_ELEMID id)
 {
-  text* toponame_text;
-  char* toponame;
-  LWT_ELEMID containing_face;
-  LWT_ELEMID node_id;
-  GSERIALIZED *geom;
-  LWGEOM *lwgeom;
-  LWPOINT *pt;
-  LWT_TOPOLOGY *topo;
+  return (TopoCacheEntry *)hash_search(tab->hash, &id, HASH_FIND, NULL);
+}
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(2) )
+/* Add an entry to the regions it overlaps, in the cache memory context */
+static void
+_tc_index(TopoCache *cache, TopoCacheTable *tab, TopoCacheEntry *e)
+{
+  ListCell *lc;
+
+  if ( ! e->hasbox ) return;
+  foreach(lc, tab->regions)
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    TopoCacheRegion *r = lfirst(lc);
+    if ( gbox_overlaps_2d(&r->box, &e->box) )
+    {
+      r->entries = lappend(r->entries, e);
+      cache->size += sizeof(ListCell);
+    }
   }
+}
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
+static void
+_tc_setBox(int kind, TopoCacheEntry *e)
+{
+  LWGEOM *g = NULL;
 
-  if ( PG_ARGISNULL(1) ) containing_face = -1;
-  else
+  e->hasbox = false;
+  switch ( kind )
   {
-    containing_face = PG_GETARG_INT32(1);
-    if ( containing_face < 0 )
+  case TC_NODE:
+    if ( e->row.node.geom ) g = lwpoint_as_lwgeom(e->row.node.geom);
+    break;
+  case TC_EDGE:
+    if ( e->row.edge.geom ) g = lwline_as_lwgeom(e->row.edge.geom);
+    break;
+  default:
+    if ( e->row.face.mbr )
     {
-      lwpgerror("SQL/MM Spatial exception - not within face");
-      PG_RETURN_NULL();
+      e->box = *e->row.face.mbr;
+      e->hasbox = true;
     }
+    break;
   }
-
-  geom = PG_GETARG_GSERIALIZED_P(2);
-  lwgeom = lwgeom_from_gserialized(geom);
-  pt = lwgeom_as_lwpoint(lwgeom);
-  if ( ! pt )
+  if ( g && ! lwgeom_is_empty(g) &&
+       lwgeom_calculate_gbox(g, &e->box) == LW_SUCCESS )
   {
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 2);
-    lwpgerror("SQL/MM Spatial exception - invalid point");
-    PG_RETURN_NULL();
+    e->hasbox = true;
   }
-  if ( lwpoint_is_empty(pt) )
+  if ( e->hasbox ) _tc_roundBox(&e->box, &e->box);
+}
+
+static Size
+_tc_geomSize(const LWGEOM *g)
+{
+  return 64 + lwgeom_count_vertices(g) * FLAGS_NDIMS(g->flags) * sizeof(double);
+}
+
+/* Copy fields of a row into an entry, taking copies of the geometries */
+static void
+_tc_copyIn(TopoCache *cache, int kind, TopoCacheEntry *e, const void *row, int fields)
+{
+  MemoryContext oldcontext = MemoryContextSwitchTo(cache->mcxt);
+  bool moved = false;
+
+  switch ( kind )
   {
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 2);
-    lwpgerror("SQL/MM Spatial exception - empty point");
-    PG_RETURN_NULL();
+  case TC_NODE:
+    {
+      const LWT_ISO_NODE *src = row;
+      LWT_ISO_NODE *dst = &e->row.node;
+      if ( fields & LWT_COL_NODE_CONTAINING_FACE )
+        dst->containing_face = src->containing_face;
+      if ( fields & LWT_COL_NODE_GEOM )
+      {
+        if ( dst->geom ) lwpoint_free(dst->geom);
+        dst->geom = NULL;
+        if ( src->geom )
+        {
+          dst->geom = lwgeom_as_lwpoint(lwgeom_clone_deep(lwpoint_as_lwgeom(src->geom)));
+          cache->size += _tc_geomSize(lwpoint_as_lwgeom(dst->geom));
+        }
+        moved = true;
+      }
+    }
+    break;
+  case TC_EDGE:
+    {
+      const LWT_ISO_EDGE *src = row;
+      LWT_ISO_EDGE *dst = &e->row.edge;
+      if ( fields & LWT_COL_EDGE_START_NODE ) dst->start_node = src->start_node;
+      if ( fields & LWT_COL_EDGE_END_NODE ) dst->end_node = src->end_node;
+      if ( fields & LWT_COL_EDGE_FACE_LEFT ) dst->face_left = src->face_left;
+      if ( fields & LWT_COL_EDGE_FACE_RIGHT ) dst->face_right = src->face_right;
+      if ( fields & LWT_COL_EDGE_NEXT_LEFT ) dst->next_left = src->next_left;
+      if ( fields & LWT_COL_EDGE_NEXT_RIGHT ) dst->next_right = src->next_right;
+      if ( fields & LWT_COL_EDGE_GEOM )
+      {
+        if ( dst->geom ) lwline_free(dst->geom);
+        dst->geom = NULL;
+        if ( src->geom )
+        {
+          dst->geom = lwgeom_as_lwline(lwgeom_clone_deep(lwline_as_lwgeom(src->geom)));
+          cache->size += _tc_geomSize(lwline_as_lwgeom(dst->geom));
+        }
+        moved = true;
+      }
+    }
+    break;
+  default:
+    {
+      const LWT_ISO_FACE *src = row;
+      LWT_ISO_FACE *dst = &e->row.face;
+      if ( fields & LWT_COL_FACE_MBR )
+      {
+        if ( dst->mbr ) lwfree(dst->mbr);
+        dst->mbr = src->mbr ? gbox_clone(src->mbr) : NULL;
+        moved = true;
+      }
+    }
+    break;
   }
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
+  if ( moved )
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+    _tc_setBox(kind, e);
+    _tc_index(cache, &cache->tab[kind], e);
   }
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
+  MemoryContextSwitchTo(oldcontext);
+}
+
+/* Copy an entry out to a row allocated by the caller */
+static void
+_tc_copyOut(int kind, const TopoCacheEntry *e, void *row, int fields)
+{
+  switch ( kind )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+  case TC_NODE:
+    {
+      LWT_ISO_NODE *dst = row;
+      *dst = e->row.node;
+      dst->geom = NULL;
+      if ( ( fields & LWT_COL_NODE_GEOM ) && e->row.node.geom )
+        dst->geom = lwgeom_as_lwpoint(lwgeom_clone_deep(lwpoint_as_lwgeom(e->row.node.geom)));
+    }
+    break;
+  case TC_EDGE:
+    {
+      LWT_ISO_EDGE *dst = row;
+      *dst = e->row.edge;
+      dst->geom = NULL;
+      if ( ( fields & LWT_COL_EDGE_GEOM ) && e->row.edge.geom )
+        dst->geom = lwgeom_as_lwline(lwgeom_clone_deep(lwline_as_lwgeom(e->row.edge.geom)));
+    }
+    break;
+  default:
+    {
+      LWT_ISO_FACE *dst = row;
+      *dst = e->row.face;
+      dst->mbr = NULL;
+      if ( ( fields & LWT_COL_FACE_MBR ) && e->row.face.mbr )
+        dst->mbr = gbox_clone(e->row.face.mbr);
+    }
+    break;
   }
+}
 
-  POSTGIS_DEBUG(1, "Calling lwt_AddIsoNode");
-  node_id = lwt_AddIsoNode(topo, containing_face, pt, 0);
-  POSTGIS_DEBUG(1, "lwt_AddIsoNode returned");
-  lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 2);
-  lwt_FreeTopology(topo);
+/* Create the entry of a row, which must not be in the cache yet */
+static TopoCacheEntry *
+_tc_enter(TopoCache *cache, int kind, const void *row, TopoCacheState state)
+{
+  LWT_ELEMID id = _tc_rowId(kind, row);
+  TopoCacheEntry *e;
 
-  if ( node_id == -1 )
+  e = (TopoCacheEntry *)hash_search(cache->tab[kind].hash, &id, HASH_ENTER, NULL);
+  memset((char *)e + sizeof(LWT_ELEMID), 0, sizeof(TopoCacheEntry) - sizeof(LWT_ELEMID));
+  e->state = state;
+  switch ( kind )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+  case TC_NODE:
+    e->row.node.node_id = id;
+    break;
+  case TC_EDGE:
+    e->row.edge.edge_id = id;
+    break;
+  default:
+    e->row.face.face_id = id;
+    break;
   }
-
-  SPI_finish();
-  PG_RETURN_INT32(node_id);
+  cache->size += sizeof(TopoCacheEntry);
+  _tc_copyIn(cache, kind, e, row, tc_allfields[kind]);
+  return e;
 }
 
-/*  ST_AddIsoEdge(atopology, anode, anothernode, acurve) */
-Datum ST_AddIsoEdge(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_AddIsoEdge);
-Datum ST_AddIsoEdge(PG_FUNCTION_ARGS)
+/* Get the entry of a row read from the database, which loses to the cache */
+static TopoCacheEntry *
+_tc_absorb(TopoCache *cache, int kind, const void *row)
 {
-  text* toponame_text;
-  char* toponame;
-  LWT_ELEMID edge_id;
-  LWT_ELEMID start_node, end_node;
-  GSERIALIZED *geom;
-  LWGEOM *lwgeom;
-  LWLINE *curve;
-  LWT_TOPOLOGY *topo;
+  TopoCacheEntry *e = _tc_lookup(&cache->tab[kind], _tc_rowId(kind, row));
+  if ( e ) return e;
+  return _tc_enter(cache, kind, row, TC_CLEAN);
+}
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) ||
-       PG_ARGISNULL(2) || PG_ARGISNULL(3) )
+static void
+_tc_pend(TopoCache *cache, TopoCacheTable *tab, TopoCacheEntry *e)
+{
+  MemoryContext oldcontext;
+
+  if ( e->pending ) return;
+  oldcontext = MemoryContextSwitchTo(cache->mcxt);
+  tab->pending = lappend(tab->pending, e);
+  MemoryContextSwitchTo(oldcontext);
+  e->pending = true;
+}
+
+static void
+_tc_touch(TopoCache *cache, TopoCacheTable *tab, TopoCacheEntry *e, int fields)
+{
+  if ( ! fields ) return;
+  if ( e->state == TC_CLEAN )
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    e->state = TC_DIRTY;
+    e->dirty = 0;
   }
+  if ( e->state == TC_DIRTY ) e->dirty |= fields;
+  _tc_pend(cache, tab, e);
+}
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
+static void
+_tc_remove(TopoCache *cache, TopoCacheTable *tab, TopoCacheEntry *e)
+{
+  if ( e->state == TC_NEW )
+  {
+    e->state = TC_GONE;
+    return;
+  }
+  e->state = TC_DELETED;
+  _tc_pend(cache, tab, e);
+}
 
-  start_node = PG_GETARG_INT32(1);
-  end_node = PG_GETARG_INT32(2);
+/* Add a row created by liblwgeom, which already has its identifier */
+static bool
+_tc_insert(const LWT_BE_TOPOLOGY *topo, int kind, const void *row)
+{
+  TopoCache *cache = topo->cache;
+  TopoCacheTable *tab = &cache->tab[kind];
+  LWT_ELEMID id = _tc_rowId(kind, row);
+  TopoCacheEntry *e = _tc_lookup(tab, id);
 
-  if ( start_node == end_node )
+  if ( ! e )
   {
-    lwpgerror("Closed edges would not be isolated, try ST_AddEdgeNewFaces");
-    PG_RETURN_NULL();
+    e = _tc_enter(cache, kind, row, TC_NEW);
+    _tc_pend(cache, tab, e);
+    return true;
   }
 
-  geom = PG_GETARG_GSERIALIZED_P(3);
-  lwgeom = lwgeom_from_gserialized(geom);
-  curve = lwgeom_as_lwline(lwgeom);
-  if ( ! curve )
+  if ( TC_LIVE(e) )
   {
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 3);
-    lwpgerror("SQL/MM Spatial exception - invalid curve");
-    PG_RETURN_NULL();
+    cberror(topo->be_data, "duplicate %s identifier %" LWTFMT_ELEMID,
+            tc_tables[kind], id);
+    return false;
   }
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
+  _tc_copyIn(cache, kind, e, row, tc_allfields[kind]);
+  if ( e->state == TC_GONE )
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+    e->state = TC_NEW;
+    _tc_pend(cache, tab, e);
   }
-
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
+  else
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    /* deleted, but still in the database */
+    e->state = TC_CLEAN;
+    _tc_touch(cache, tab, e, tc_allfields[kind] & ~1);
   }
+  return true;
+}
 
-  POSTGIS_DEBUG(1, "Calling lwt_AddIsoEdge");
-  edge_id = lwt_AddIsoEdge(topo, start_node, end_node, curve);
-  POSTGIS_DEBUG(1, "lwt_AddIsoNode returned");
-  lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 3);
-  lwt_FreeTopology(topo);
+/* Hand out identifiers, reserving them from the sequence in chunks */
+static bool
+_tc_nextIds(const LWT_BE_TOPOLOGY *topo, int kind, LWT_ELEMID *ids, uint64_t numelems)
+{
+  TopoCache *cache = topo->cache;
+  TopoCacheTable *tab = &cache->tab[kind];
+  uint64_t i;
 
-  if ( edge_id == -1 )
+  for ( i=0; i<numelems; ++i )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    if ( tab->nextid == tab->nids )
+    {
+      MemoryContext oldcontext = CurrentMemoryContext;
+      int spi_result;
+      StringInfoData sqldata;
+      StringInfo sql = &sqldata;
+      uint64_t j, nids = Max(TC_ID_CHUNK, numelems - i);
+
+      initStringInfo(sql);
+      appendStringInfo(sql, "SELECT nextval('\"%s\".%s') "
+                       "FROM generate_series(1," UINT64_FORMAT ")",
+                       topo->name, tc_sequences[kind], nids);
+      spi_result = SPI_execute(sql->data, false, nids);
+      MemoryContextSwitchTo( oldcontext ); /* switch back */
+      if ( spi_result != SPI_OK_SELECT )
+      {
+        cberror(topo->be_data, "unexpected return (%d) from query execution: %s",
+                spi_result, sql->data);
+        pfree(sqldata.data);
+        return false;
+      }
+      pfree(sqldata.data);
+
+      if ( SPI_processed ) topo->be_data->data_changed = true;
+
+      if ( SPI_processed != nids )
+      {
+        cberror(topo->be_data,
+                "processed " UINT64_FORMAT " rows, expected " UINT64_FORMAT,
+                (uint64_t)SPI_processed, nids);
+        return false;
+      }
+
+      if ( tab->ids ) pfree(tab->ids);
+      tab->ids = MemoryContextAlloc(cache->mcxt, sizeof(LWT_ELEMID) * nids);
+      for ( j=0; j<nids; ++j )
+      {
+        bool isnull;
+        Datum dat = SPI_getbinval(SPI_tuptable->vals[j],
+                                  SPI_tuptable->tupdesc, 1, &isnull);
+        if ( isnull )
+        {
+          cberror(topo->be_data, "nextval for %s returned null", tc_sequences[kind]);
+          tab->nids = tab->nextid = 0;
+          return false;
+        }
+        tab->ids[j] = DatumGetInt64(dat); /* sequences return 64bit integers */
+      }
+      tab->nids = nids;
+      tab->nextid = 0;
+
+      SPI_freetuptable(SPI_tuptable);
+    }
+    ids[i] = tab->ids[tab->nextid++];
   }
 
-  SPI_finish();
-  PG_RETURN_INT32(edge_id);
+  return true;
 }
 
-/*  ST_AddEdgeModFace(atopology, snode, enode, line) */
-Datum ST_AddEdgeModFace(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_AddEdgeModFace);
-Datum ST_AddEdgeModFace(PG_FUNCTION_ARGS)
+/* Read every field of the rows of a primitive table matching a condition */
+static void *
+_tc_fetchWhere(const LWT_BE_TOPOLOGY *topo, int kind, const char *where, uint64_t *numelems)
 {
-  text* toponame_text;
-  char* toponame;
-  LWT_ELEMID startnode_id, endnode_id;
-  int edge_id;
-  GSERIALIZED *geom;
-  LWGEOM *lwgeom;
-  LWLINE *line;
-  LWT_TOPOLOGY *topo;
+  MemoryContext oldcontext = CurrentMemoryContext;
+  int spi_result;
+  StringInfoData sqldata;
+  StringInfo sql = &sqldata;
+  void *rows;
+  uint64_t i;
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(3) )
+  initStringInfo(sql);
+  appendStringInfoString(sql, "SELECT ");
+  switch ( kind )
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+  case TC_NODE:
+    addNodeFields(sql, LWT_COL_NODE_ALL);
+    break;
+  case TC_EDGE:
+    addEdgeFields(sql, LWT_COL_EDGE_ALL, 0);
+    break;
+  default:
+    addFaceFields(sql, LWT_COL_FACE_ALL);
+    break;
   }
+  appendStringInfo(sql, " FROM \"%s\".%s", topo->name, tc_tables[kind]);
+  if ( where ) appendStringInfo(sql, " WHERE %s", where);
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
-
-  startnode_id = PG_GETARG_INT32(1) ;
-  endnode_id = PG_GETARG_INT32(2) ;
+  POSTGIS_DEBUGF(1, "_tc_fetchWhere query: %s", sql->data);
 
-  geom = PG_GETARG_GSERIALIZED_P(3);
-  lwgeom = lwgeom_from_gserialized(geom);
-  line = lwgeom_as_lwline(lwgeom);
-  if ( ! line )
+  spi_result = SPI_execute(sql->data, !topo->be_data->data_changed, 0);
+  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  if ( spi_result != SPI_OK_SELECT )
   {
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 3);
-    lwpgerror("ST_AddEdgeModFace fourth argument must be a line geometry");
-    PG_RETURN_NULL();
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s", spi_result, sql->data);
+    pfree(sqldata.data);
+    *numelems = UINT64_MAX;
+    return NULL;
   }
+  pfree(sqldata.data);
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
+  *numelems = SPI_processed;
+  if ( ! SPI_processed ) return NULL;
+
+  rows = palloc(tc_rowsize[kind] * *numelems);
+  for ( i=0; i<*numelems; ++i )
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+    HeapTuple row = SPI_tuptable->vals[i];
+    switch ( kind )
+    {
+    case TC_NODE:
+      fillNodeFields(_tc_row(kind, rows, i), row, SPI_tuptable->tupdesc, LWT_COL_NODE_ALL);
+      break;
+    case TC_EDGE:
+      fillEdgeFields(_tc_row(kind, rows, i), row, SPI_tuptable->tupdesc, LWT_COL_EDGE_ALL);
+      break;
+    default:
+      fillFaceFields(_tc_row(kind, rows, i), row, SPI_tuptable->tupdesc, LWT_COL_FACE_ALL);
+      break;
+    }
   }
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
+  SPI_freetuptable(SPI_tuptable);
+
+  return rows;
+}
+
+/* Add an entry to the hits of a lookup, once, if it passes the filter */
+static bool
+_tc_accept(int kind, TopoCacheEntry *e, uint32 stamp, TopoCacheFilter *f)
+{
+  if ( e->stamp == stamp ) return false;
+  e->stamp = stamp;
+  if ( ! TC_LIVE(e) ) return false;
+  if ( f->box && ( ! e->hasbox || ! gbox_overlaps_2d(f->box, &e->box) ) )
+    return false;
+  if ( f->match && ! f->match(kind, e, f) ) return false;
+  f->hits = lappend(f->hits, e);
+  f->nhits++;
+  return true;
+}
+
+#define TC_FULL(f) ( (f)->limit && (f)->nhits >= (f)->limit )
+
+/* Accept the entries to write back, which the database does not know about */
+static void
+_tc_acceptPending(TopoCache *cache, int kind, uint32 stamp, TopoCacheFilter *f)
+{
+  ListCell *lc;
+  foreach(lc, cache->tab[kind].pending)
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    if ( TC_FULL(f) ) break;
+    _tc_accept(kind, lfirst(lc), stamp, f);
   }
+}
 
-  POSTGIS_DEBUG(1, "Calling lwt_AddEdgeModFace");
-  edge_id = lwt_AddEdgeModFace(topo, startnode_id, endnode_id, line, 0);
-  POSTGIS_DEBUG(1, "lwt_AddEdgeModFace returned");
-  lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 3);
-  lwt_FreeTopology(topo);
-
-  if ( edge_id == -1 )
+/* Accept the entries of database rows, then free the rows */
+static void
+_tc_acceptRows(TopoCache *cache, int kind, void *rows, uint64_t n, uint32 stamp, TopoCacheFilter *f)
+{
+  uint64_t i;
+  for ( i=0; i<n; ++i )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    TopoCacheEntry *e = _tc_absorb(cache, kind, _tc_row(kind, rows, i));
+    if ( ! TC_FULL(f) ) _tc_accept(kind, e, stamp, f);
   }
+  _tc_freeRows(kind, rows, n);
+}
 
-  SPI_finish();
-  PG_RETURN_INT32(edge_id);
+static TopoCacheRegion *
+_tc_region(TopoCacheTable *tab, const GBOX *box)
+{
+  ListCell *lc;
+  foreach(lc, tab->regions)
+  {
+    TopoCacheRegion *r = lfirst(lc);
+    if ( gbox_contains_2d(&r->box, box) ) return r;
+  }
+  return NULL;
 }
 
-/*  ST_AddEdgeNewFaces(atopology, snode, enode, line) */
-Datum ST_AddEdgeNewFaces(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_AddEdgeNewFaces);
-Datum ST_AddEdgeNewFaces(PG_FUNCTION_ARGS)
+/*
+ * Run a lookup on the entries of a loaded region containing the given
+ * (rounded) box, or on all entries if the table is complete.
+ * Returns false if neither is available.
+ */
+static bool
+_tc_scan(TopoCache *cache, int kind, const GBOX *box, uint32 stamp, TopoCacheFilter *f)
 {
-  text* toponame_text;
-  char* toponame;
-  LWT_ELEMID startnode_id, endnode_id;
-  int edge_id;
-  GSERIALIZED *geom;
-  LWGEOM *lwgeom;
-  LWLINE *line;
-  LWT_TOPOLOGY *topo;
+  TopoCacheTable *tab = &cache->tab[kind];
+  TopoCacheRegion *r = box ? _tc_region(tab, box) : NULL;
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(3) )
+  if ( r )
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    ListCell *lc;
+    foreach(lc, r->entries)
+    {
+      if ( TC_FULL(f) ) break;
+      _tc_accept(kind, lfirst(lc), stamp, f);
+    }
+    return true;
   }
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
+  if ( tab->complete )
+  {
+    HASH_SEQ_STATUS status;
+    TopoCacheEntry *e;
+    hash_seq_init(&status, tab->hash);
+    while ( (e = hash_seq_search(&status)) )
+    {
+      if ( TC_FULL(f) )
+      {
+        hash_seq_term(&status);
+        break;
+      }
+      _tc_accept(kind, e, stamp, f);
+    }
+    return true;
+  }
 
-  startnode_id = PG_GETARG_INT32(1) ;
-  endnode_id = PG_GETARG_INT32(2) ;
+  return false;
+}
 
-  geom = PG_GETARG_GSERIALIZED_P(3);
-  lwgeom = lwgeom_from_gserialized(geom);
-  line = lwgeom_as_lwline(lwgeom);
-  if ( ! line )
+/* Load all rows overlapping a box, or the whole table if box is NULL */
+static bool
+_tc_loadRegion(const LWT_BE_TOPOLOGY *topo, int kind, const GBOX *box)
+{
+  TopoCache *cache = topo->cache;
+  TopoCacheTable *tab = &cache->tab[kind];
+  MemoryContext oldcontext;
+  TopoCacheRegion *r;
+  ListCell *lc;
+  uint64_t n = 0, i;
+  uint32 stamp;
+  void *rows;
+
+  if ( ! box )
+    rows = _tc_fetchWhere(topo, kind, NULL, &n);
+  else if ( kind == TC_NODE )
+    rows = cb_getNodeWithinBox2D(topo, box, &n, LWT_COL_NODE_ALL, 0);
+  else if ( kind == TC_EDGE )
+    rows = cb_getEdgeWithinBox2D(topo, box, &n, LWT_COL_EDGE_ALL, 0);
+  else
+    rows = cb_getFaceWithinBox2D(topo, box, &n, LWT_COL_FACE_ALL, 0);
+  if ( n == UINT64_MAX ) return false;
+
+  POSTGIS_DEBUGF(1, "_tc_loadRegion: loaded " UINT64_FORMAT " %s rows", n, tc_tables[kind]);
+
+  oldcontext = MemoryContextSwitchTo(cache->mcxt);
+  r = palloc0(sizeof(TopoCacheRegion));
+  if ( box ) _tc_roundBox(box, &r->box);
+  stamp = ++cache->stamp;
+  for ( i=0; i<n; ++i )
   {
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 3);
-    lwpgerror("ST_AddEdgeModFace fourth argument must be a line geometry");
-    PG_RETURN_NULL();
+    TopoCacheEntry *e = _tc_absorb(cache, kind, _tc_row(kind, rows, i));
+    if ( e->stamp == stamp ) continue;
+    e->stamp = stamp;
+    r->entries = lappend(r->entries, e);
   }
-
-  if ( SPI_OK_CONNECT != SPI_connect() )
+  foreach(lc, tab->pending)
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+    TopoCacheEntry *e = lfirst(lc);
+    if ( e->stamp == stamp || ! e->hasbox ) continue;
+    if ( box && ! gbox_overlaps_2d(&r->box, &e->box) ) continue;
+    e->stamp = stamp;
+    r->entries = lappend(r->entries, e);
   }
+  cache->size += sizeof(TopoCacheRegion) + list_length(r->entries) * sizeof(ListCell);
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
+  if ( box )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    tab->regions = lappend(tab->regions, r);
+  }
+  else
+  {
+    list_free(r->entries);
+    pfree(r);
+    tab->complete = true;
   }
+  MemoryContextSwitchTo(oldcontext);
 
-  POSTGIS_DEBUG(1, "Calling lwt_AddEdgeNewFaces");
-  edge_id = lwt_AddEdgeNewFaces(topo, startnode_id, endnode_id, line, 0);
-  POSTGIS_DEBUG(1, "lwt_AddEdgeNewFaces returned");
-  lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 3);
-  lwt_FreeTopology(topo);
+  _tc_freeRows(kind, rows, n);
+  return true;
+}
 
-  if ( edge_id == -1 )
+/* Run a lookup on the entries overlapping a box, loading them if needed */
+static bool
+_tc_lookupBox(const LWT_BE_TOPOLOGY *topo, int kind, const GBOX *box, TopoCacheFilter *f)
+{
+  TopoCache *cache = topo->cache;
+  GBOX rbox;
+
+  if ( box ) _tc_roundBox(box, &rbox);
+  f->box = box ? &rbox : NULL;
+  if ( ! _tc_scan(cache, kind, f->box, ++cache->stamp, f) )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    if ( ! _tc_loadRegion(topo, kind, box) ) return false;
+    _tc_scan(cache, kind, f->box, ++cache->stamp, f);
   }
-
-  SPI_finish();
-  PG_RETURN_INT32(edge_id);
+  f->box = NULL;
+  return true;
 }
 
-/* ST_GetFaceGeometry(atopology, aface) */
-Datum ST_GetFaceGeometry(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_GetFaceGeometry);
-Datum ST_GetFaceGeometry(PG_FUNCTION_ARGS)
+/* Run a lookup on the entries with the given identifiers */
+static bool
+_tc_lookupIds(const LWT_BE_TOPOLOGY *topo, int kind, const LWT_ELEMID *ids, uint64_t numelems, TopoCacheFilter *f)
 {
-  text* toponame_text;
-  char* toponame;
-  LWT_ELEMID face_id;
-  LWGEOM *lwgeom;
-  LWT_TOPOLOGY *topo;
-  GSERIALIZED *geom;
-  MemoryContext old_context;
+  TopoCache *cache = topo->cache;
+  TopoCacheTable *tab = &cache->tab[kind];
+  LWT_ELEMID *missing = NULL;
+  uint64_t i, nmissing = 0;
+  uint32 stamp;
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
+  for ( i=0; i<numelems; ++i )
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    if ( _tc_lookup(tab, ids[i]) ) continue;
+    if ( ! missing ) missing = palloc(sizeof(LWT_ELEMID) * numelems);
+    missing[nmissing++] = ids[i];
   }
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
-
-  face_id = PG_GETARG_INT32(1) ;
-
-  if ( SPI_OK_CONNECT != SPI_connect() )
+  if ( nmissing )
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+    void *rows;
+    uint64_t n = nmissing;
+    if ( kind == TC_NODE )
+      rows = cb_getNodeById(topo, missing, &n, LWT_COL_NODE_ALL);
+    else if ( kind == TC_EDGE )
+      rows = cb_getEdgeById(topo, missing, &n, LWT_COL_EDGE_ALL);
+    else
+      rows = cb_getFacesById(topo, missing, &n, LWT_COL_FACE_ALL);
+    pfree(missing);
+    if ( n == UINT64_MAX ) return false;
+    for ( i=0; i<n; ++i ) _tc_absorb(cache, kind, _tc_row(kind, rows, i));
+    _tc_freeRows(kind, rows, n);
   }
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
+  stamp = ++cache->stamp;
+  for ( i=0; i<numelems; ++i )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    TopoCacheEntry *e = _tc_lookup(tab, ids[i]);
+    if ( e ) _tc_accept(kind, e, stamp, f);
   }
+  return true;
+}
 
-  POSTGIS_DEBUG(1, "Calling lwt_GetFaceGeometry");
-  lwgeom = lwt_GetFaceGeometry(topo, face_id);
-  POSTGIS_DEBUG(1, "lwt_GetFaceGeometry returned");
-  lwt_FreeTopology(topo);
-
-  if ( lwgeom == NULL )
+static bool
+_tc_matchIds(LWT_ELEMID id, const TopoCacheFilter *f)
+{
+  uint64_t i;
+  for ( i=0; i<f->nids; ++i )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    if ( f->ids[i] == id ) return true;
   }
-
-  /* Serialize in upper memory context (outside of SPI) */
-  /* TODO: use a narrower context to switch to */
-  old_context = MemoryContextSwitchTo( TopMemoryContext );
-  geom = geometry_serialize(lwgeom);
-  MemoryContextSwitchTo(old_context);
-
-  SPI_finish();
-
-  PG_RETURN_POINTER(geom);
+  return false;
 }
 
-typedef struct FACEEDGESSTATE
+static bool
+_tc_matchEdgeNodes(int kind, const TopoCacheEntry *e, const TopoCacheFilter *f)
 {
-  LWT_ELEMID *elems;
-  int nelems;
-  int curr;
+  return _tc_matchIds(e->row.edge.start_node, f) ||
+         _tc_matchIds(e->row.edge.end_node, f);
 }
-FACEEDGESSTATE;
 
-/* ST_GetFaceEdges(atopology, aface) */
-Datum ST_GetFaceEdges(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_GetFaceEdges);
-Datum ST_GetFaceEdges(PG_FUNCTION_ARGS)
+static bool
+_tc_matchFaces(int kind, const TopoCacheEntry *e, const TopoCacheFilter *f)
 {
-  text* toponame_text;
-  char* toponame;
-  LWT_ELEMID face_id;
-  int nelems;
-  LWT_ELEMID *elems;
-  LWT_TOPOLOGY *topo;
-  FuncCallContext *funcctx;
-  MemoryContext oldcontext, newcontext;
-  TupleDesc tupdesc;
-  HeapTuple tuple;
-  AttInMetadata *attinmeta;
-  FACEEDGESSTATE *state;
-  char buf[64];
-  char *values[2];
-  Datum result;
-
-  values[0] = buf;
-  values[1] = &(buf[32]);
-
-  if (SRF_IS_FIRSTCALL())
+  if ( kind == TC_NODE )
   {
+    return e->row.node.containing_face != -1 &&
+           _tc_matchIds(e->row.node.containing_face, f);
+  }
+  return _tc_matchIds(e->row.edge.face_left, f) ||
+         _tc_matchIds(e->row.edge.face_right, f);
+}
 
-    POSTGIS_DEBUG(1, "ST_GetFaceEdges first call");
-    funcctx = SRF_FIRSTCALL_INIT();
-    newcontext = funcctx->multi_call_memory_ctx;
+/* Same as ST_DWithin, or as ST_Equals for nodes at distance 0 */
+static bool
+_tc_matchDistance(int kind, const TopoCacheEntry *e, const TopoCacheFilter *f)
+{
+  const LWGEOM *g;
+  POINT2D p1, p2;
 
-    if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
-    {
-      lwpgerror("SQL/MM Spatial exception - null argument");
-      PG_RETURN_NULL();
-    }
+  if ( kind == TC_NODE )
+  {
+    if ( ! e->row.node.geom ) return false;
+    g = lwpoint_as_lwgeom(e->row.node.geom);
+  }
+  else
+  {
+    if ( ! e->row.edge.geom ) return false;
+    g = lwline_as_lwgeom(e->row.edge.geom);
+  }
 
-    toponame_text = PG_GETARG_TEXT_P(0);
-    toponame = text_to_cstring(toponame_text);
-    PG_FREE_IF_COPY(toponame_text, 0);
+  if ( f->dist )
+    return lwgeom_mindistance2d_tolerance(f->pt, g, f->dist) <= f->dist;
 
-    face_id = PG_GETARG_INT32(1) ;
+  if ( ! lwpoint_getPoint2d_p(lwgeom_as_lwpoint(f->pt), &p1) ||
+       ! lwpoint_getPoint2d_p(e->row.node.geom, &p2) )
+    return false;
+  return p1.x == p2.x && p1.y == p2.y;
+}
 
-    if ( SPI_OK_CONNECT != SPI_connect() )
-    {
-      lwpgerror("Could not connect to SPI");
-      PG_RETURN_NULL();
-    }
+/* Run a lookup on the edges incident to the given nodes */
+static bool
+_tc_lookupEdgesByNodes(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t numelems, TopoCacheFilter *f)
+{
+  TopoCache *cache = topo->cache;
+  TopoCacheFilter nf;
+  LWT_ELEMID *uncovered = NULL;
+  uint64_t i, nuncovered = 0;
+  uint32 stamp;
+
+  /* The node boxes tell which regions hold their edges */
+  memset(&nf, 0, sizeof(nf));
+  if ( ! _tc_lookupIds(topo, TC_NODE, ids, numelems, &nf) ) return false;
+  list_free(nf.hits);
+
+  f->match = _tc_matchEdgeNodes;
+  f->ids = ids;
+  f->nids = numelems;
+
+  stamp = ++cache->stamp;
+  for ( i=0; i<numelems; ++i )
+  {
+    TopoCacheEntry *ne = _tc_lookup(&cache->tab[TC_NODE], ids[i]);
+    if ( ne && TC_LIVE(ne) && ne->hasbox &&
+         _tc_scan(cache, TC_EDGE, &ne->box, stamp, f) ) continue;
+    if ( ! uncovered ) uncovered = palloc(sizeof(LWT_ELEMID) * numelems);
+    uncovered[nuncovered++] = ids[i];
+  }
 
-    topo = lwt_LoadTopology(be_iface, toponame);
-    oldcontext = MemoryContextSwitchTo( newcontext );
-    pfree(toponame);
-    if ( ! topo )
-    {
-      /* should never reach this point, as lwerror would raise an exception */
-      SPI_finish();
-      PG_RETURN_NULL();
-    }
+  if ( nuncovered )
+  {
+    uint64_t n = nuncovered;
+    void *rows = cb_getEdgeByNode(topo, uncovered, &n, LWT_COL_EDGE_ALL);
+    pfree(uncovered);
+    if ( n == UINT64_MAX ) return false;
+    _tc_acceptRows(cache, TC_EDGE, rows, n, stamp, f);
+    _tc_acceptPending(cache, TC_EDGE, stamp, f);
+  }
 
-    POSTGIS_DEBUG(1, "Calling lwt_GetFaceEdges");
-    nelems = lwt_GetFaceEdges(topo, face_id, &elems);
-    POSTGIS_DEBUGF(1, "lwt_GetFaceEdges returned %d", nelems);
-    lwt_FreeTopology(topo);
+  return true;
+}
 
-    if ( nelems < 0 )
-    {
-      /* should never reach this point, as lwerror would raise an exception */
-      SPI_finish();
-      PG_RETURN_NULL();
-    }
+/*
+ * Run a lookup on the edges or nodes possibly matching a selection,
+ * which the caller checks against the cached fields.
+ */
+static bool
+_tc_lookupSelection(const LWT_BE_TOPOLOGY *topo, int kind, const void *sel, int sel_fields, TopoCacheFilter *f)
+{
+  TopoCache *cache = topo->cache;
+  StringInfoData sqldata;
+  uint64_t n;
+  uint32 stamp;
+  void *rows;
 
-    state = lwalloc(sizeof(FACEEDGESSTATE));
-    state->elems = elems;
-    state->nelems = nelems;
-    state->curr = 0;
-    funcctx->user_fctx = state;
+  if ( ! sel || ! sel_fields )
+  {
+    return _tc_lookupBox(topo, kind, NULL, f);
+  }
 
-    /*
-     * Build a tuple description for a
-     * getfaceedges_returntype tuple
-     */
-    tupdesc = RelationNameGetTupleDesc("topology.getfaceedges_returntype");
+  if ( kind == TC_NODE && ( sel_fields & LWT_COL_NODE_NODE_ID ) )
+  {
+    return _tc_lookupIds(topo, kind, &((const LWT_ISO_NODE *)sel)->node_id, 1, f);
+  }
 
-    /*
-     * generate attribute metadata needed later to produce
-     * tuples from raw C strings
-     */
-    attinmeta = TupleDescGetAttInMetadata(tupdesc);
-    funcctx->attinmeta = attinmeta;
+  if ( kind == TC_EDGE )
+  {
+    const LWT_ISO_EDGE *edge = sel;
+    if ( sel_fields & LWT_COL_EDGE_EDGE_ID )
+      return _tc_lookupIds(topo, kind, &edge->edge_id, 1, f);
+    if ( sel_fields & LWT_COL_EDGE_START_NODE )
+      return _tc_lookupEdgesByNodes(topo, &edge->start_node, 1, f);
+    if ( sel_fields & LWT_COL_EDGE_END_NODE )
+      return _tc_lookupEdgesByNodes(topo, &edge->end_node, 1, f);
+  }
 
-    POSTGIS_DEBUG(1, "lwt_GetFaceEdges calling SPI_finish");
+  stamp = ++cache->stamp;
+  if ( cache->tab[kind].complete )
+  {
+    _tc_scan(cache, kind, NULL, stamp, f);
+    return true;
+  }
 
-    MemoryContextSwitchTo(oldcontext);
+  /* The database rows matching, plus those changed in memory */
+  initStringInfo(&sqldata);
+  if ( kind == TC_NODE )
+    addNodeUpdate(&sqldata, sel, sel_fields, 0, updSel);
+  else
+    addEdgeUpdate(&sqldata, sel, sel_fields, 0, updSel);
+  rows = _tc_fetchWhere(topo, kind, sqldata.data, &n);
+  pfree(sqldata.data);
+  if ( n == UINT64_MAX ) return false;
+  _tc_acceptRows(cache, kind, rows, n, stamp, f);
+  _tc_acceptPending(cache, kind, stamp, f);
+  return true;
+}
 
-    SPI_finish();
+/* SQL comparison of the selected fields, false if any operand is null */
+static bool
+_tc_edgeMatches(const LWT_ISO_EDGE *e, const LWT_ISO_EDGE *sel, int fields, bool negate)
+{
+  if ( ( fields & LWT_COL_EDGE_EDGE_ID ) && ( e->edge_id == sel->edge_id ) == negate )
+    return false;
+  if ( ( fields & LWT_COL_EDGE_START_NODE ) && ( e->start_node == sel->start_node ) == negate )
+    return false;
+  if ( ( fields & LWT_COL_EDGE_END_NODE ) && ( e->end_node == sel->end_node ) == negate )
+    return false;
+  if ( ( fields & LWT_COL_EDGE_FACE_LEFT ) && ( e->face_left == sel->face_left ) == negate )
+    return false;
+  if ( ( fields & LWT_COL_EDGE_FACE_RIGHT ) && ( e->face_right == sel->face_right ) == negate )
+    return false;
+  if ( ( fields & LWT_COL_EDGE_NEXT_LEFT ) && ( e->next_left == sel->next_left ) == negate )
+    return false;
+  if ( ( fields & LWT_COL_EDGE_NEXT_RIGHT ) && ( e->next_right == sel->next_right ) == negate )
+    return false;
+  if ( fields & LWT_COL_EDGE_GEOM )
+  {
+    if ( ! e->geom || ! sel->geom ) return false;
+    if ( ( lwgeom_same(lwline_as_lwgeom(e->geom), lwline_as_lwgeom(sel->geom)) != 0 ) == negate )
+      return false;
   }
+  return true;
+}
 
-  /* stuff done on every call of the function */
-  funcctx = SRF_PERCALL_SETUP();
+static bool
+_tc_nodeMatches(const LWT_ISO_NODE *n, const LWT_ISO_NODE *sel, int fields, bool negate)
+{
+  if ( ( fields & LWT_COL_NODE_NODE_ID ) && ( n->node_id == sel->node_id ) == negate )
+    return false;
+  if ( fields & LWT_COL_NODE_CONTAINING_FACE )
+  {
+    if ( n->containing_face == -1 || sel->containing_face == -1 ) return false;
+    if ( ( n->containing_face == sel->containing_face ) == negate ) return false;
+  }
+  if ( fields & LWT_COL_NODE_GEOM )
+  {
+    if ( ! n->geom || ! sel->geom ) return false;
+    if ( ( lwgeom_same(lwpoint_as_lwgeom(n->geom), lwpoint_as_lwgeom(sel->geom)) != 0 ) == negate )
+      return false;
+  }
+  return true;
+}
 
-  /* get state */
-  state = funcctx->user_fctx;
+/* Return the hits of a lookup as an array of rows with the given fields */
+static void *
+_tc_result(int kind, TopoCacheFilter *f, int fields, uint64_t *numelems)
+{
+  void *rows = NULL;
+  ListCell *lc;
+  uint64_t i = 0;
 
-  if ( state->curr == state->nelems )
+  *numelems = f->nhits;
+  if ( f->nhits )
   {
-    SRF_RETURN_DONE(funcctx);
+    rows = palloc(tc_rowsize[kind] * f->nhits);
+    foreach(lc, f->hits)
+    {
+      _tc_copyOut(kind, lfirst(lc), _tc_row(kind, rows, i++), fields);
+    }
   }
+  list_free(f->hits);
+  return rows;
+}
 
-  if ( snprintf(values[0], 32, "%d", state->curr+1) >= 32 )
+static bool
+_tc_deleteEdgesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t numelems)
+{
+  MemoryContext oldcontext = CurrentMemoryContext;
+  int spi_result;
+  StringInfoData sqldata;
+  StringInfo sql = &sqldata;
+  uint64_t i;
+
+  initStringInfo(sql);
+  appendStringInfo(sql, "DELETE FROM \"%s\".edge_data WHERE edge_id IN (",
+                   topo->name);
+  for ( i=0; i<numelems; ++i )
   {
-    lwerror("Face edge sequence number does not fit 32 chars ?!: %d",
-            state->curr+1);
+    appendStringInfo(sql, "%s%" LWTFMT_ELEMID, (i?",":""), ids[i]);
   }
-  if ( snprintf(values[1], 32, "%" LWTFMT_ELEMID,
-                state->elems[state->curr]) >= 32 )
+  appendStringInfoString(sql, ")");
+
+  spi_result = SPI_execute( sql->data, false, 0 );
+  MemoryContextSwitchTo( oldcontext ); /* switch back */
+  if ( spi_result != SPI_OK_DELETE )
   {
-    lwerror("Signed edge identifier does not fit 32 chars ?!: %"
-            LWTFMT_ELEMID, state->elems[state->curr]);
+    cberror(topo->be_data, "unexpected return (%d) from query execution: %s",
+            spi_result, sql->data);
+    pfree(sqldata.data);
+    return false;
   }
+  pfree(sqldata.data);
 
-  POSTGIS_DEBUGF(1, "ST_GetFaceEdges: cur:%d, val0:%s, val1:%s",
-                 state->curr, values[0], values[1]);
+  if ( SPI_processed ) topo->be_data->data_changed = true;
 
-  tuple = BuildTupleFromCStrings(funcctx->attinmeta, values);
-  result = HeapTupleGetDatum(tuple);
-  state->curr++;
+  return true;
+}
 
-  SRF_RETURN_NEXT(funcctx, result);
+static int
+_tc_compareDirty(const void *a, const void *b)
+{
+  const TopoCacheEntry *ea = *(const TopoCacheEntry * const *)a;
+  const TopoCacheEntry *eb = *(const TopoCacheEntry * const *)b;
+  return ea->dirty - eb->dirty;
 }
 
-/*  ST_ChangeEdgeGeom(atopology, anedge, acurve) */
-Datum ST_ChangeEdgeGeom(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_ChangeEdgeGeom);
-Datum ST_ChangeEdgeGeom(PG_FUNCTION_ARGS)
+/* Write back the entries of a table in the given state */
+static bool
+_tc_flushTable(const LWT_BE_TOPOLOGY *topo, int kind, TopoCacheState state)
 {
-  text* toponame_text;
-  char buf[64];
-  char* toponame;
-  int ret;
-  LWT_ELEMID edge_id;
-  GSERIALIZED *geom;
-  LWGEOM *lwgeom;
-  LWLINE *line;
-  LWT_TOPOLOGY *topo;
+  TopoCache *cache = topo->cache;
+  TopoCacheEntry **entries;
+  ListCell *lc;
+  uint64_t n = 0, i, j;
+  void *rows;
+  LWT_ELEMID *ids;
+  bool ok = true;
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  entries = palloc(sizeof(TopoCacheEntry *) * list_length(cache->tab[kind].pending));
+  foreach(lc, cache->tab[kind].pending)
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    TopoCacheEntry *e = lfirst(lc);
+    if ( e->state == state ) entries[n++] = e;
+  }
+  if ( ! n )
+  {
+    pfree(entries);
+    return true;
   }
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
-
-  edge_id = PG_GETARG_INT32(1) ;
+  POSTGIS_DEBUGF(1, "_tc_flushTable: writing " UINT64_FORMAT " %s rows (state %d)",
+                 n, tc_tables[kind], state);
 
-  geom = PG_GETARG_GSERIALIZED_P(2);
-  lwgeom = lwgeom_from_gserialized(geom);
-  line = lwgeom_as_lwline(lwgeom);
-  if ( ! line )
+  rows = palloc(tc_rowsize[kind] * n);
+  ids = palloc(sizeof(LWT_ELEMID) * n);
+  if ( state == TC_DIRTY )
+    qsort(entries, n, sizeof(TopoCacheEntry *), _tc_compareDirty);
+  for ( i=0; i<n; ++i )
   {
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 2);
-    lwpgerror("ST_ChangeEdgeGeom third argument must be a line geometry");
-    PG_RETURN_NULL();
+    memcpy(_tc_row(kind, rows, i), &entries[i]->row, tc_rowsize[kind]);
+    ids[i] = entries[i]->id;
   }
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
+  for ( i=0; ok && i<n; i=j )
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
-  }
-
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
-  {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
-  }
+    uint64_t count;
 
-  POSTGIS_DEBUG(1, "Calling lwt_ChangeEdgeGeom");
-  ret = lwt_ChangeEdgeGeom(topo, edge_id, line);
-  POSTGIS_DEBUG(1, "lwt_ChangeEdgeGeom returned");
-  lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 2);
-  lwt_FreeTopology(topo);
+    /* Updates of a batch share the same fields */
+    for ( j=i+1; j<n && j-i<TC_FLUSH_BATCH; ++j )
+    {
+      if ( state == TC_DIRTY && entries[j]->dirty != entries[i]->dirty ) break;
+    }
+    count = j - i;
 
-  if ( ret == -1 )
-  {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    if ( state == TC_NEW )
+    {
+      if ( kind == TC_NODE )
+        ok = cb_insertNodes(topo, _tc_row(kind, rows, i), count) != 0;
+      else if ( kind == TC_EDGE )
+        ok = cb_insertEdges(topo, _tc_row(kind, rows, i), count) != -1;
+      else
+        ok = cb_insertFaces(topo, _tc_row(kind, rows, i), count) != -1;
+    }
+    else if ( state == TC_DIRTY )
+    {
+      int fields = entries[i]->dirty;
+      if ( kind == TC_NODE )
+        ok = cb_updateNodesById(topo, _tc_row(kind, rows, i), count, fields) != -1;
+      else if ( kind == TC_EDGE )
+        ok = cb_updateEdgesById(topo, _tc_row(kind, rows, i), count, fields) != -1;
+      else
+        ok = cb_updateFacesById(topo, _tc_row(kind, rows, i), count) != UINT64_MAX;
+    }
+    else
+    {
+      if ( kind == TC_NODE )
+        ok = cb_deleteNodesById(topo, &ids[i], count) != -1;
+      else if ( kind == TC_EDGE )
+        ok = _tc_deleteEdgesById(topo, &ids[i], count);
+      else
+        ok = cb_deleteFacesById(topo, &ids[i], count) != -1;
+    }
+    cache->written += count;
   }
 
-  SPI_finish();
-
-  if ( snprintf(buf, 64, "Edge %" LWTFMT_ELEMID " changed", edge_id) >= 64 )
-  {
-    buf[63] = '\0';
-  }
-  PG_RETURN_TEXT_P(cstring_to_text(buf));
+  pfree(ids);
+  pfree(rows);
+  pfree(entries);
+  return ok;
 }
 
-/*  ST_RemoveIsoNode(atopology, anode) */
-Datum ST_RemoveIsoNode(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_RemoveIsoNode);
-Datum ST_RemoveIsoNode(PG_FUNCTION_ARGS)
+/*
+ * Write back the changes kept in memory. Faces go first and edges last
+ * on insert and update, the other way around on delete, as required by
+ * the immediate foreign keys.
+ */
+static bool
+_tc_flush(const LWT_BE_TOPOLOGY *topo)
 {
-  text* toponame_text;
-  char buf[64];
-  char* toponame;
-  int ret;
-  LWT_ELEMID node_id;
-  LWT_TOPOLOGY *topo;
+  static const int order[TC_KINDS] = { TC_FACE, TC_NODE, TC_EDGE };
+  TopoCache *cache = topo->cache;
+  ListCell *lc;
+  int k;
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
+  for ( k=0; k<TC_KINDS; ++k )
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    if ( ! _tc_flushTable(topo, order[k], TC_NEW) ) return false;
   }
-
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
-
-  node_id = PG_GETARG_INT32(1) ;
-
-  if ( SPI_OK_CONNECT != SPI_connect() )
+  for ( k=0; k<TC_KINDS; ++k )
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+    if ( ! _tc_flushTable(topo, order[k], TC_DIRTY) ) return false;
+  }
+  for ( k=TC_KINDS-1; k>=0; --k )
+  {
+    if ( ! _tc_flushTable(topo, order[k], TC_DELETED) ) return false;
   }
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
+  for ( k=0; k<TC_KINDS; ++k )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    TopoCacheTable *tab = &cache->tab[k];
+    foreach(lc, tab->pending)
+    {
+      TopoCacheEntry *e = lfirst(lc);
+      if ( e->state == TC_NEW || e->state == TC_DIRTY ) e->state = TC_CLEAN;
+      else if ( e->state == TC_DELETED ) e->state = TC_GONE;
+      e->dirty = 0;
+      e->pending = false;
+    }
+    list_free(tab->pending);
+    tab->pending = NIL;
   }
 
-  POSTGIS_DEBUG(1, "Calling lwt_RemoveIsoNode");
-  ret = lwt_RemoveIsoNode(topo, node_id);
-  POSTGIS_DEBUG(1, "lwt_RemoveIsoNode returned");
-  lwt_FreeTopology(topo);
+  return true;
+}
 
-  if ( ret == -1 )
+/* Callbacks */
+
+static LWT_BE_TOPOLOGY *
+ccb_loadTopologyByName(const LWT_BE_DATA *be, const char *name)
+{
+  LWT_BE_TOPOLOGY *topo;
+
+  if ( ! IsolationUsesXactSnapshot() )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    if ( ! topology_cache_skipped )
+      lwpgwarning("postgis.topology_cache_size is ignored outside of "
+                  "REPEATABLE READ or SERIALIZABLE transactions");
+    topology_cache_skipped = true;
+    lwt_BackendIfaceRegisterCallbacks(be_iface, &be_callbacks);
+    return cb_loadTopologyByName(be, name);
   }
 
-  SPI_finish();
-
-  if ( snprintf(buf, 64, "Isolated node %" LWTFMT_ELEMID
-                " removed", node_id) >= 64 )
+  topo = cb_loadTopologyByName(be, name);
+  if ( ! topo ) return NULL;
+  if ( ! _tc_attach(topo) )
   {
-    buf[63] = '\0';
+    cb_freeTopology(topo);
+    return NULL;
   }
-  PG_RETURN_TEXT_P(cstring_to_text(buf));
+  return topo;
 }
 
-/*  ST_RemIsoEdge(atopology, anedge) */
-Datum ST_RemIsoEdge(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_RemIsoEdge);
-Datum ST_RemIsoEdge(PG_FUNCTION_ARGS)
+static int
+ccb_freeTopology(LWT_BE_TOPOLOGY *topo)
 {
-  text* toponame_text;
-  char buf[64];
-  char* toponame;
-  int ret;
-  LWT_ELEMID node_id;
-  LWT_TOPOLOGY *topo;
+  TopoCache *cache = topo->cache;
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
+  if ( ! _tc_flush(topo) )
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    /* the changes are lost, the transaction cannot go on */
+    _tc_drop(cache);
+    lwpgerror("Could not write back topology \"%s\": %s",
+              topo->name, topo->be_data->lastErrorMsg);
+    return 0;
   }
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
-
-  node_id = PG_GETARG_INT32(1) ;
-
-  if ( SPI_OK_CONNECT != SPI_connect() )
+  if ( cache->written )
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+    int64 counts[TC_KINDS];
+    if ( ! _tc_modcount(topo, cache->relids, counts) )
+    {
+      _tc_drop(cache);
+      cache = NULL;
+    }
+    else
+    {
+      /* without statistics we cannot tell others' writes from ours */
+      if ( ! memcmp(counts, cache->modcount, sizeof(counts)) )
+        cache->tracked = false;
+      memcpy(cache->modcount, counts, sizeof(counts));
+      cache->written = 0;
+    }
   }
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
+  if ( cache && cache->size > (Size)topology_cache_size * 1024 * 1024 )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    POSTGIS_DEBUGF(1, "dropping cache of topology \"%s\" using %zu bytes",
+                   topo->name, cache->size);
+    _tc_drop(cache);
   }
 
-  POSTGIS_DEBUG(1, "Calling lwt_RemIsoEdge");
-  ret = lwt_RemIsoEdge(topo, node_id);
-  POSTGIS_DEBUG(1, "lwt_RemIsoEdge returned");
-  lwt_FreeTopology(topo);
+  return cb_freeTopology(topo);
+}
 
-  if ( ret == -1 )
+static LWT_ISO_NODE *
+ccb_getNodeById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields)
+{
+  TopoCacheFilter f;
+  memset(&f, 0, sizeof(f));
+  if ( ! _tc_lookupIds(topo, TC_NODE, ids, *numelems, &f) )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    *numelems = UINT64_MAX;
+    return NULL;
   }
+  return _tc_result(TC_NODE, &f, fields, numelems);
+}
 
-  SPI_finish();
+static LWT_ISO_EDGE *
+ccb_getEdgeById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields)
+{
+  TopoCacheFilter f;
+  memset(&f, 0, sizeof(f));
+  if ( ! _tc_lookupIds(topo, TC_EDGE, ids, *numelems, &f) )
+  {
+    *numelems = UINT64_MAX;
+    return NULL;
+  }
+  return _tc_result(TC_EDGE, &f, fields, numelems);
+}
 
-  if ( snprintf(buf, 64, "Isolated edge %" LWTFMT_ELEMID
-                " removed", node_id) >= 64 )
+static LWT_ISO_FACE *
+ccb_getFacesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields)
+{
+  TopoCacheFilter f;
+  memset(&f, 0, sizeof(f));
+  if ( ! _tc_lookupIds(topo, TC_FACE, ids, *numelems, &f) )
   {
-    buf[63] = '\0';
+    *numelems = UINT64_MAX;
+    return NULL;
   }
-  PG_RETURN_TEXT_P(cstring_to_text(buf));
+  return _tc_result(TC_FACE, &f, fields, numelems);
 }
 
-/*  ST_MoveIsoNode(atopology, anode, apoint) */
-Datum ST_MoveIsoNode(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_MoveIsoNode);
-Datum ST_MoveIsoNode(PG_FUNCTION_ARGS)
+static void *
+_tc_withinDistance2D(const LWT_BE_TOPOLOGY *topo, int kind, const LWPOINT *pt, double dist,
+                     uint64_t *numelems, int fields, int64_t limit)
 {
-  text* toponame_text;
-  char buf[64];
-  char* toponame;
-  int ret;
-  LWT_ELEMID node_id;
-  GSERIALIZED *geom;
-  LWGEOM *lwgeom;
-  LWPOINT *pt;
-  LWT_TOPOLOGY *topo;
+  TopoCacheFilter f;
   POINT2D p;
+  GBOX box;
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  memset(&f, 0, sizeof(f));
+  memset(&box, 0, sizeof(box));
+  if ( ! lwpoint_getPoint2d_p(pt, &p) )
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    *numelems = 0;
+    return NULL;
   }
+  box.xmin = p.x - dist;
+  box.xmax = p.x + dist;
+  box.ymin = p.y - dist;
+  box.ymax = p.y + dist;
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
-
-  node_id = PG_GETARG_INT32(1) ;
-
-  geom = PG_GETARG_GSERIALIZED_P(2);
-  lwgeom = lwgeom_from_gserialized(geom);
-  pt = lwgeom_as_lwpoint(lwgeom);
-  if ( ! pt )
+  f.match = _tc_matchDistance;
+  f.pt = lwpoint_as_lwgeom(pt);
+  f.dist = dist;
+  f.limit = limit < 0 ? 1 : limit;
+  if ( ! _tc_lookupBox(topo, kind, &box, &f) )
   {
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 2);
-    lwpgerror("SQL/MM Spatial exception - invalid point");
-    PG_RETURN_NULL();
+    *numelems = UINT64_MAX;
+    return NULL;
   }
 
-  if ( ! getPoint2d_p(pt->point, 0, &p) )
+  if ( limit == -1 )
   {
-    /* Do not let empty points in, see
-     * https://trac.osgeo.org/postgis/ticket/3234
-     */
-    lwpgerror("SQL/MM Spatial exception - empty point");
-    PG_RETURN_NULL();
+    *numelems = f.nhits ? 1 : 0;
+    list_free(f.hits);
+    return NULL;
   }
+  return _tc_result(kind, &f, fields, numelems);
+}
 
-  /* TODO: check point for NaN values ? */
+static LWT_ISO_NODE *
+ccb_getNodeWithinDistance2D(const LWT_BE_TOPOLOGY *topo, const LWPOINT *pt, double dist,
+                            uint64_t *numelems, int fields, int64_t limit)
+{
+  return _tc_withinDistance2D(topo, TC_NODE, pt, dist, numelems, fields, limit);
+}
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
+static LWT_ISO_EDGE *
+ccb_getEdgeWithinDistance2D(const LWT_BE_TOPOLOGY *topo, const LWPOINT *pt, double dist,
+                            uint64_t *numelems, int fields, int64_t limit)
+{
+  if ( ! dist )
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+    /* ST_Within semantic, leave it to the database */
+    if ( ! _tc_flush(topo) )
+    {
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+    return cb_getEdgeWithinDistance2D(topo, pt, dist, numelems, fields, limit);
   }
+  return _tc_withinDistance2D(topo, TC_EDGE, pt, dist, numelems, fields, limit);
+}
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
-  {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
-  }
+static void *
+_tc_withinBox2D(const LWT_BE_TOPOLOGY *topo, int kind, const GBOX *box,
+                uint64_t *numelems, int fields, int limit)
+{
+  TopoCache *cache = topo->cache;
+  TopoCacheFilter f;
+  GBOX rbox;
 
-  POSTGIS_DEBUG(1, "Calling lwt_MoveIsoNode");
-  ret = lwt_MoveIsoNode(topo, node_id, pt);
-  POSTGIS_DEBUG(1, "lwt_MoveIsoNode returned");
-  lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 2);
-  lwt_FreeTopology(topo);
+  memset(&f, 0, sizeof(f));
+  f.limit = limit < 0 ? 1 : limit;
+  if ( box ) _tc_roundBox(box, &rbox);
+  f.box = box ? &rbox : NULL;
 
-  if ( ret == -1 )
+  if ( ! _tc_scan(cache, kind, f.box, ++cache->stamp, &f) )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    if ( limit )
+    {
+      /* Not worth loading the whole box for a few rows */
+      list_free(f.hits);
+      if ( ! _tc_flush(topo) )
+      {
+        *numelems = UINT64_MAX;
+        return NULL;
+      }
+      if ( kind == TC_NODE )
+        return cb_getNodeWithinBox2D(topo, box, numelems, fields, limit);
+      else if ( kind == TC_EDGE )
+        return cb_getEdgeWithinBox2D(topo, box, numelems, fields, limit);
+      return cb_getFaceWithinBox2D(topo, box, numelems, fields, limit);
+    }
+    if ( ! _tc_loadRegion(topo, kind, box) )
+    {
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+    _tc_scan(cache, kind, f.box, ++cache->stamp, &f);
   }
 
-  SPI_finish();
-
-  if ( snprintf(buf, 64, "Isolated Node %" LWTFMT_ELEMID
-                " moved to location %g,%g",
-                node_id, p.x, p.y) >= 64 )
+  if ( limit == -1 )
   {
-    buf[63] = '\0';
+    *numelems = f.nhits ? 1 : 0;
+    list_free(f.hits);
+    return NULL;
   }
-  PG_RETURN_TEXT_P(cstring_to_text(buf));
+  return _tc_result(kind, &f, fields, numelems);
 }
 
-/*  ST_RemEdgeModFace(atopology, anedge) */
-Datum ST_RemEdgeModFace(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_RemEdgeModFace);
-Datum ST_RemEdgeModFace(PG_FUNCTION_ARGS)
+static LWT_ISO_NODE *
+ccb_getNodeWithinBox2D(const LWT_BE_TOPOLOGY *topo, const GBOX *box, uint64_t *numelems, int fields, int limit)
 {
-  text* toponame_text;
-  char* toponame;
-  int ret;
-  LWT_ELEMID node_id;
-  LWT_TOPOLOGY *topo;
-
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
-  {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
-  }
+  return _tc_withinBox2D(topo, TC_NODE, box, numelems, fields, limit);
+}
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
+static LWT_ISO_EDGE *
+ccb_getEdgeWithinBox2D(const LWT_BE_TOPOLOGY *topo, const GBOX *box, uint64_t *numelems, int fields, int limit)
+{
+  return _tc_withinBox2D(topo, TC_EDGE, box, numelems, fields, limit);
+}
 
-  node_id = PG_GETARG_INT32(1) ;
+static LWT_ISO_FACE *
+ccb_getFaceWithinBox2D(const LWT_BE_TOPOLOGY *topo, const GBOX *box, uint64_t *numelems, int fields, int limit)
+{
+  return _tc_withinBox2D(topo, TC_FACE, box, numelems, fields, limit);
+}
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
+static LWT_ISO_EDGE *
+ccb_getEdgeByNode(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields)
+{
+  TopoCacheFilter f;
+  memset(&f, 0, sizeof(f));
+  if ( ! _tc_lookupEdgesByNodes(topo, ids, *numelems, &f) )
   {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+    *numelems = UINT64_MAX;
+    return NULL;
   }
+  return _tc_result(TC_EDGE, &f, fields, numelems);
+}
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
-  {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+static void *
+_tc_getByFace(const LWT_BE_TOPOLOGY *topo, int kind, const LWT_ELEMID *ids,
+              uint64_t *numelems, int fields, const GBOX *box)
+{
+  TopoCache *cache = topo->cache;
+  TopoCacheFilter f;
+  GBOX rbox;
+  uint32 stamp = ++cache->stamp;
+
+  memset(&f, 0, sizeof(f));
+  f.match = _tc_matchFaces;
+  f.ids = ids;
+  f.nids = *numelems;
+  if ( box ) _tc_roundBox(box, &rbox);
+  f.box = box ? &rbox : NULL;
+
+  if ( ! _tc_scan(cache, kind, f.box, stamp, &f) )
+  {
+    uint64_t n = *numelems;
+    void *rows;
+    if ( kind == TC_NODE )
+      rows = cb_getNodeByFace(topo, ids, &n, LWT_COL_NODE_ALL, box);
+    else
+      rows = cb_getEdgeByFace(topo, ids, &n, LWT_COL_EDGE_ALL, box);
+    if ( n == UINT64_MAX )
+    {
+      list_free(f.hits);
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+    _tc_acceptRows(cache, kind, rows, n, stamp, &f);
+    _tc_acceptPending(cache, kind, stamp, &f);
   }
 
-  POSTGIS_DEBUG(1, "Calling lwt_RemEdgeModFace");
-  ret = lwt_RemEdgeModFace(topo, node_id);
-  POSTGIS_DEBUG(1, "lwt_RemEdgeModFace returned");
-  lwt_FreeTopology(topo);
-
-  if ( ret == -1 )
-  {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
-  }
+  return _tc_result(kind, &f, fields, numelems);
+}
 
-  SPI_finish();
+static LWT_ISO_EDGE *
+ccb_getEdgeByFace(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields, const GBOX *box)
+{
+  return _tc_getByFace(topo, TC_EDGE, ids, numelems, fields, box);
+}
 
-  PG_RETURN_INT32(ret);
+static LWT_ISO_NODE *
+ccb_getNodeByFace(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t *numelems, int fields, const GBOX *box)
+{
+  return _tc_getByFace(topo, TC_NODE, ids, numelems, fields, box);
 }
 
-/*  ST_RemEdgeNewFace(atopology, anedge) */
-Datum ST_RemEdgeNewFace(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_RemEdgeNewFace);
-Datum ST_RemEdgeNewFace(PG_FUNCTION_ARGS)
+/* Walk the ring in memory, or leave it to the database at the first miss */
+static LWT_ELEMID *
+ccb_getRingEdges(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID edge, uint64_t *numelems, int limit)
 {
-  text* toponame_text;
-  char* toponame;
-  int ret;
-  LWT_ELEMID node_id;
-  LWT_TOPOLOGY *topo;
+  TopoCache *cache = topo->cache;
+  TopoCacheTable *tab = &cache->tab[TC_EDGE];
+  uint32 walk = ++cache->stamp;
+  LWT_ELEMID *edges;
+  LWT_ELEMID cur = edge;
+  uint64_t n = 0, size = 16;
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
+  edges = palloc(sizeof(LWT_ELEMID) * size);
+  for (;;)
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
-  }
+    LWT_ELEMID id = ABS(cur);
+    TopoCacheEntry *e = _tc_lookup(tab, id);
+    int side = cur > 0 ? 0 : 1;
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
+    if ( ! e )
+    {
+      TopoCacheFilter f;
+      memset(&f, 0, sizeof(f));
+      if ( ! _tc_lookupIds(topo, TC_EDGE, &id, 1, &f) )
+      {
+        pfree(edges);
+        *numelems = UINT64_MAX;
+        return NULL;
+      }
+      list_free(f.hits);
+      e = _tc_lookup(tab, id);
+    }
 
-  node_id = PG_GETARG_INT32(1) ;
+    /* Let the database report missing edges */
+    if ( ! e || ! TC_LIVE(e) )
+    {
+      pfree(edges);
+      if ( ! _tc_flush(topo) )
+      {
+        *numelems = UINT64_MAX;
+        return NULL;
+      }
+      return cb_queryRingEdges(topo, edge, numelems, limit);
+    }
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
-  {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
-  }
+    if ( e->ringstamp[side] == walk )
+    {
+      pfree(edges);
+      cberror(topo->be_data, "Corrupted topology: ring of edge %"
+                             LWTFMT_ELEMID " is topologically non-closed",
+                             edge);
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+    e->ringstamp[side] = walk;
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
-  {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    if ( limit && n == (uint64_t)limit )
+    {
+      pfree(edges);
+      cberror(topo->be_data, "Max traversing limit hit: %d", limit);
+      *numelems = UINT64_MAX;
+      return NULL;
+    }
+    if ( n == size )
+    {
+      size *= 2;
+      edges = repalloc(edges, sizeof(LWT_ELEMID) * size);
+    }
+    edges[n++] = cur;
+
+    cur = cur > 0 ? e->row.edge.next_left : e->row.edge.next_right;
+    if ( cur == edge ) break;
   }
 
-  POSTGIS_DEBUG(1, "Calling lwt_RemEdgeNewFace");
-  ret = lwt_RemEdgeNewFace(topo, node_id);
-  POSTGIS_DEBUG(1, "lwt_RemEdgeNewFace returned");
-  lwt_FreeTopology(topo);
-  SPI_finish();
+  *numelems = n;
+  return edges;
+}
 
-  if ( ret <= 0 )
+static int
+ccb_insertNodes(const LWT_BE_TOPOLOGY *topo, LWT_ISO_NODE *nodes, uint64_t numelems)
+{
+  uint64_t i;
+  for ( i=0; i<numelems; ++i )
   {
-    /* error or no face created */
-    PG_RETURN_NULL();
+    if ( nodes[i].node_id == -1 &&
+         ! _tc_nextIds(topo, TC_NODE, &nodes[i].node_id, 1) ) return 0;
+    if ( ! _tc_insert(topo, TC_NODE, &nodes[i]) ) return 0;
   }
-
-  PG_RETURN_INT32(ret);
+  return 1;
 }
 
-/*  ST_ModEdgeHeal(atopology, anedge, anotheredge) */
-Datum ST_ModEdgeHeal(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_ModEdgeHeal);
-Datum ST_ModEdgeHeal(PG_FUNCTION_ARGS)
+static int
+ccb_insertEdges(const LWT_BE_TOPOLOGY *topo, LWT_ISO_EDGE *edges, uint64_t numelems)
 {
-  text* toponame_text;
-  char* toponame;
-  int ret;
-  LWT_ELEMID eid1, eid2;
-  LWT_TOPOLOGY *topo;
+  uint64_t i;
+  for ( i=0; i<numelems; ++i )
+  {
+    if ( edges[i].edge_id == -1 &&
+         ! _tc_nextIds(topo, TC_EDGE, &edges[i].edge_id, 1) ) return -1;
+    if ( ! _tc_insert(topo, TC_EDGE, &edges[i]) ) return -1;
+  }
+  return numelems;
+}
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+static int
+ccb_insertFaces(const LWT_BE_TOPOLOGY *topo, LWT_ISO_FACE *faces, uint64_t numelems)
+{
+  uint64_t i;
+  for ( i=0; i<numelems; ++i )
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    if ( faces[i].face_id == -1 &&
+         ! _tc_nextIds(topo, TC_FACE, &faces[i].face_id, 1) ) return -1;
+    if ( ! _tc_insert(topo, TC_FACE, &faces[i]) ) return -1;
   }
+  return numelems;
+}
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
+static LWT_ELEMID
+ccb_getNextEdgeId(const LWT_BE_TOPOLOGY *topo)
+{
+  LWT_ELEMID id;
+  if ( ! _tc_nextIds(topo, TC_EDGE, &id, 1) ) return -1;
+  return id;
+}
 
-  eid1 = PG_GETARG_INT32(1) ;
-  eid2 = PG_GETARG_INT32(2) ;
+static int
+ccb_getNextEdgeIds(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID *ids, uint64_t numelems)
+{
+  return _tc_nextIds(topo, TC_EDGE, ids, numelems) ? 0 : -1;
+}
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
-  {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
-  }
+static int
+ccb_updateEdges(const LWT_BE_TOPOLOGY *topo,
+                const LWT_ISO_EDGE *sel_edge, int sel_fields,
+                const LWT_ISO_EDGE *upd_edge, int upd_fields,
+                const LWT_ISO_EDGE *exc_edge, int exc_fields)
+{
+  TopoCache *cache = topo->cache;
+  TopoCacheFilter f;
+  ListCell *lc;
+  int n = 0;
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
+  memset(&f, 0, sizeof(f));
+  if ( ! _tc_lookupSelection(topo, TC_EDGE, sel_edge, sel_fields, &f) ) return -1;
+
+  upd_fields &= ~(LWT_COL_EDGE_EDGE_ID);
+  foreach(lc, f.hits)
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    TopoCacheEntry *e = lfirst(lc);
+    if ( sel_edge && ! _tc_edgeMatches(&e->row.edge, sel_edge, sel_fields, false) ) continue;
+    if ( exc_edge && ! _tc_edgeMatches(&e->row.edge, exc_edge, exc_fields, true) ) continue;
+    _tc_copyIn(cache, TC_EDGE, e, upd_edge, upd_fields);
+    _tc_touch(cache, &cache->tab[TC_EDGE], e, upd_fields);
+    ++n;
   }
+  list_free(f.hits);
 
-  POSTGIS_DEBUG(1, "Calling lwt_ModEdgeHeal");
-  ret = lwt_ModEdgeHeal(topo, eid1, eid2);
-  POSTGIS_DEBUG(1, "lwt_ModEdgeHeal returned");
-  lwt_FreeTopology(topo);
-  SPI_finish();
+  POSTGIS_DEBUGF(1, "ccb_updateEdges: updated %d edges", n);
+  return n;
+}
 
-  if ( ret <= 0 )
+static int
+ccb_updateNodes(const LWT_BE_TOPOLOGY *topo,
+                const LWT_ISO_NODE *sel_node, int sel_fields,
+                const LWT_ISO_NODE *upd_node, int upd_fields,
+                const LWT_ISO_NODE *exc_node, int exc_fields)
+{
+  TopoCache *cache = topo->cache;
+  TopoCacheFilter f;
+  ListCell *lc;
+  int n = 0;
+
+  memset(&f, 0, sizeof(f));
+  if ( ! _tc_lookupSelection(topo, TC_NODE, sel_node, sel_fields, &f) ) return -1;
+
+  upd_fields &= ~(LWT_COL_NODE_NODE_ID);
+  foreach(lc, f.hits)
   {
-    /* error, should have sent message already */
-    PG_RETURN_NULL();
+    TopoCacheEntry *e = lfirst(lc);
+    if ( sel_node && ! _tc_nodeMatches(&e->row.node, sel_node, sel_fields, false) ) continue;
+    if ( exc_node && ! _tc_nodeMatches(&e->row.node, exc_node, exc_fields, true) ) continue;
+    _tc_copyIn(cache, TC_NODE, e, upd_node, upd_fields);
+    _tc_touch(cache, &cache->tab[TC_NODE], e, upd_fields);
+    ++n;
   }
+  list_free(f.hits);
 
-  PG_RETURN_INT32(ret);
+  return n;
 }
 
-/*  ST_NewEdgeHeal(atopology, anedge, anotheredge) */
-Datum ST_NewEdgeHeal(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(ST_NewEdgeHeal);
-Datum ST_NewEdgeHeal(PG_FUNCTION_ARGS)
+static int
+ccb_deleteEdges(const LWT_BE_TOPOLOGY *topo, const LWT_ISO_EDGE *sel_edge, int sel_fields)
 {
-  text* toponame_text;
-  char* toponame;
-  int ret;
-  LWT_ELEMID eid1, eid2;
-  LWT_TOPOLOGY *topo;
+  TopoCache *cache = topo->cache;
+  TopoCacheFilter f;
+  ListCell *lc;
+  int n = 0;
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  memset(&f, 0, sizeof(f));
+  if ( ! _tc_lookupSelection(topo, TC_EDGE, sel_edge, sel_fields, &f) ) return -1;
+
+  foreach(lc, f.hits)
   {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
+    TopoCacheEntry *e = lfirst(lc);
+    if ( ! _tc_edgeMatches(&e->row.edge, sel_edge, sel_fields, false) ) continue;
+    _tc_remove(cache, &cache->tab[TC_EDGE], e);
+    ++n;
   }
+  list_free(f.hits);
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
-
-  eid1 = PG_GETARG_INT32(1) ;
-  eid2 = PG_GETARG_INT32(2) ;
+  return n;
+}
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
-  {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
+/* Update rows by identifier, returns the number of rows found */
+static uint64_t
+_tc_updateById(const LWT_BE_TOPOLOGY *topo, int kind, const void *rows, uint64_t numelems, int fields)
+{
+  TopoCache *cache = topo->cache;
+  TopoCacheTable *tab = &cache->tab[kind];
+  TopoCacheFilter f;
+  LWT_ELEMID *ids;
+  uint64_t i, n = 0;
+
+  ids = palloc(sizeof(LWT_ELEMID) * numelems);
+  for ( i=0; i<numelems; ++i ) ids[i] = _tc_rowId(kind, _tc_row(kind, (void *)rows, i));
+  memset(&f, 0, sizeof(f));
+  if ( ! _tc_lookupIds(topo, kind, ids, numelems, &f) )
+  {
+    pfree(ids);
+    return UINT64_MAX;
   }
+  list_free(f.hits);
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
+  fields &= ~1; /* identifiers don't change */
+  for ( i=0; i<numelems; ++i )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    TopoCacheEntry *e = _tc_lookup(tab, ids[i]);
+    if ( ! e || ! TC_LIVE(e) ) continue;
+    _tc_copyIn(cache, kind, e, _tc_row(kind, (void *)rows, i), fields);
+    _tc_touch(cache, tab, e, fields);
+    ++n;
   }
+  pfree(ids);
 
-  POSTGIS_DEBUG(1, "Calling lwt_NewEdgeHeal");
-  ret = lwt_NewEdgeHeal(topo, eid1, eid2);
-  POSTGIS_DEBUG(1, "lwt_NewEdgeHeal returned");
-  lwt_FreeTopology(topo);
-  SPI_finish();
+  return n;
+}
 
-  if ( ret <= 0 )
+static int
+ccb_updateNodesById(const LWT_BE_TOPOLOGY *topo, const LWT_ISO_NODE *nodes, uint64_t numnodes, int fields)
+{
+  uint64_t n;
+  if ( ! fields )
   {
-    /* error, should have sent message already */
-    PG_RETURN_NULL();
+    cberror(topo->be_data,
+            "updateNodesById callback called with no update fields!");
+    return -1;
   }
-
-  PG_RETURN_INT32(ret);
+  n = _tc_updateById(topo, TC_NODE, nodes, numnodes, fields);
+  return n == UINT64_MAX ? -1 : (int)n;
 }
 
-/*  GetNodeByPoint(atopology, point, tolerance) */
-Datum GetNodeByPoint(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(GetNodeByPoint);
-Datum GetNodeByPoint(PG_FUNCTION_ARGS)
+static int
+ccb_updateEdgesById(const LWT_BE_TOPOLOGY *topo, const LWT_ISO_EDGE *edges, uint64_t numedges, int fields)
+{
+  uint64_t n;
+  if ( ! fields )
+  {
+    cberror(topo->be_data,
+            "updateEdgesById callback called with no update fields!");
+    return -1;
+  }
+  n = _tc_updateById(topo, TC_EDGE, edges, numedges, fields);
+  return n == UINT64_MAX ? -1 : (int)n;
+}
+
+static uint64_t
+ccb_updateFacesById(const LWT_BE_TOPOLOGY *topo, const LWT_ISO_FACE *faces, uint64_t numfaces)
+{
+  return _tc_updateById(topo, TC_FACE, faces, numfaces, LWT_COL_FACE_MBR);
+}
+
+static int
+_tc_deleteById(const LWT_BE_TOPOLOGY *topo, int kind, const LWT_ELEMID *ids, uint64_t numelems)
+{
+  TopoCache *cache = topo->cache;
+  TopoCacheFilter f;
+  ListCell *lc;
+  int n = 0;
+
+  memset(&f, 0, sizeof(f));
+  if ( ! _tc_lookupIds(topo, kind, ids, numelems, &f) ) return -1;
+  foreach(lc, f.hits)
+  {
+    _tc_remove(cache, &cache->tab[kind], lfirst(lc));
+    ++n;
+  }
+  list_free(f.hits);
+
+  return n;
+}
+
+static int
+ccb_deleteFacesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t numelems)
+{
+  return _tc_deleteById(topo, TC_FACE, ids, numelems);
+}
+
+static int
+ccb_deleteNodesById(const LWT_BE_TOPOLOGY *topo, const LWT_ELEMID *ids, uint64_t numelems)
+{
+  return _tc_deleteById(topo, TC_NODE, ids, numelems);
+}
+
+static LWT_ISO_EDGE *
+ccb_getClosestEdge(const LWT_BE_TOPOLOGY *topo, const LWPOINT *pt, uint64_t *numelems, int fields)
+{
+  if ( ! _tc_flush(topo) )
+  {
+    *numelems = UINT64_MAX;
+    return NULL;
+  }
+  return cb_getClosestEdge(topo, pt, numelems, fields);
+}
+
+static GBOX *
+ccb_computeFaceMBR(const LWT_BE_TOPOLOGY *topo, LWT_ELEMID face)
+{
+  if ( ! _tc_flush(topo) ) return NULL;
+  return cb_computeFaceMBR(topo, face);
+}
+
+/* The TopoGeometry callbacks only deal with the relation table */
+static LWT_BE_CALLBACKS be_cache_callbacks =
+{
+  cb_lastErrorMessage,
+  NULL, /* createTopology */
+  ccb_loadTopologyByName,
+  ccb_freeTopology,
+  ccb_getNodeById,
+  ccb_getNodeWithinDistance2D,
+  ccb_insertNodes,
+  ccb_getEdgeById,
+  ccb_getEdgeWithinDistance2D,
+  ccb_getNextEdgeId,
+  ccb_insertEdges,
+  ccb_updateEdges,
+  ccb_getFacesById,
+  cb_updateTopoGeomEdgeSplit,
+  ccb_deleteEdges,
+  ccb_getNodeWithinBox2D,
+  ccb_getEdgeWithinBox2D,
+  ccb_getEdgeByNode,
+  ccb_updateNodes,
+  cb_updateTopoGeomFaceSplit,
+  ccb_insertFaces,
+  ccb_updateFacesById,
+  ccb_getRingEdges,
+  ccb_updateEdgesById,
+  ccb_getEdgeByFace,
+  ccb_getNodeByFace,
+  ccb_updateNodesById,
+  ccb_deleteFacesById,
+  cb_topoGetSRID,
+  cb_topoGetPrecision,
+  cb_topoHasZ,
+  ccb_deleteNodesById,
+  cb_checkTopoGeomRemEdge,
+  cb_updateTopoGeomFaceHeal,
+  cb_checkTopoGeomRemNode,
+  cb_updateTopoGeomEdgeHeal,
+  ccb_getFaceWithinBox2D,
+  cb_checkTopoGeomRemIsoNode,
+  cb_checkTopoGeomRemIsoEdge,
+  ccb_getClosestEdge,
+  ccb_computeFaceMBR,
+  ccb_getNextEdgeIds
+};
+
+static void
+topology_cache_size_assign(int newval, void *extra)
+{
+  if ( ! be_iface ) return;
+  lwt_BackendIfaceRegisterCallbacks(be_iface,
+                                    newval > 0 ? &be_cache_callbacks : &be_callbacks);
+}
+
+static void
+xact_callback(XactEvent event, void *arg)
+{
+  LWT_BE_DATA* data = (LWT_BE_DATA *)arg;
+  POSTGIS_DEBUGF(1, "xact_callback called with event %d", event);
+  data->data_changed = false;
+  /* the caches went away with the transaction memory */
+  topo_cache_context = NULL;
+  topo_caches = NULL;
+  if ( topology_cache_skipped )
+  {
+    topology_cache_skipped = false;
+    topology_cache_size_assign(topology_cache_size, NULL);
+  }
+}
+
+static void
+subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+                 SubTransactionId parentSubid, void *arg)
+{
+  /* the caches may hold changes rolled back in the database */
+  if ( event == SUBXACT_EVENT_ABORT_SUB ) _tc_dropAll();
+}
+
+
+/*
+ * Module load callback
+ */
+void _PG_init(void);
+void
+_PG_init(void)
+{
+  MemoryContext old_context;
+
+  /*
+   * install PostgreSQL handlers for liblwgeom
+   * NOTE: they may be already in place!
+   */
+  pg_install_lwgeom_handlers();
+
+  /* Switch to the top memory context so that the backend interface
+   * is valid for the whole backend lifetime */
+  old_context = MemoryContextSwitchTo( TopMemoryContext );
+
+  /* initialize backend data */
+  be_data.data_changed = false;
+  be_data.topoLoadFailMessageFlavor = 0;
+
+  /* hook on transaction end to reset data_changed */
+  RegisterXactCallback(xact_callback, &be_data);
+  RegisterSubXactCallback(subxact_callback, NULL);
+
+  /* register callbacks against liblwgeom-topo */
+  be_iface = lwt_CreateBackendIface(&be_data);
+  lwt_BackendIfaceRegisterCallbacks(be_iface, &be_callbacks);
+
+  if ( postgis_guc_find_option("postgis.topology_cache_size") )
+  {
+    /* Message about extension already loaded */
+    elog(WARNING, "'%s' is already set and cannot be changed until you reconnect", "postgis.topology_cache_size");
+  }
+  else
+  {
+    DefineCustomIntVariable(
+      "postgis.topology_cache_size", /* name */
+      "Memory for caching topology primitives in a transaction, 0 to disable.", /* short_desc */
+      "Keeps the nodes, edges and faces used by topology editing functions in memory until the end of REPEATABLE READ or SERIALIZABLE transactions.", /* long_desc */
+      &topology_cache_size, /* valueAddr */
+      0, /* bootValue */
+      0, /* minValue */
+      MAX_KILOBYTES / 1024, /* maxValue */
+      PGC_USERSET, /* GucContext context */
+      GUC_UNIT_MB, /* int flags */
+      NULL, /* GucIntCheckHook check_hook */
+      topology_cache_size_assign, /* GucIntAssignHook assign_hook */
+      NULL  /* GucShowHook show_hook */
+    );
+  }
+
+  /* Switch back to whatever memory context was in place
+   * at time of _PG_init enter.
+   * See http://www.postgresql.org/message-id/20150623114125.GD5835@localhost
+   */
+  MemoryContextSwitchTo(old_context);
+}
+
+/*
+ * Module unload callback
+ */
+void _PG_fini(void);
+void
+_PG_fini(void)
+{
+  elog(NOTICE, "Goodbye from PostGIS Topology %s", POSTGIS_VERSION);
+
+  UnregisterXactCallback(xact_callback, &be_data);
+  UnregisterSubXactCallback(subxact_callback, NULL);
+  lwt_FreeBackendIface(be_iface);
+}
+
+/*  ST_ModEdgeSplit(atopology, anedge, apoint) */
+Datum ST_ModEdgeSplit(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_ModEdgeSplit);
+Datum ST_ModEdgeSplit(PG_FUNCTION_ARGS)
 {
   text* toponame_text;
   char* toponame;
-  double tol;
+  LWT_ELEMID edge_id;
   LWT_ELEMID node_id;
   GSERIALIZED *geom;
   LWGEOM *lwgeom;
   LWPOINT *pt;
   LWT_TOPOLOGY *topo;
 
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
   toponame_text = PG_GETARG_TEXT_P(0);
   toponame = text_to_cstring(toponame_text);
   PG_FREE_IF_COPY(toponame_text, 0);
 
-  geom = PG_GETARG_GSERIALIZED_P(1);
+  edge_id = PG_GETARG_INT32(1) ;
+
+  geom = PG_GETARG_GSERIALIZED_P(2);
   lwgeom = lwgeom_from_gserialized(geom);
   pt = lwgeom_as_lwpoint(lwgeom);
   if ( ! pt )
   {
     lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 1);
-    lwpgerror("Node geometry must be a point");
-    PG_RETURN_NULL();
-  }
-
-  tol = PG_GETARG_FLOAT8(2);
-  if ( tol < 0 )
-  {
-    PG_FREE_IF_COPY(geom, 1);
-    lwpgerror("Tolerance must be >=0");
+    PG_FREE_IF_COPY(geom, 2);
+    lwpgerror("ST_ModEdgeSplit third argument must be a point geometry");
     PG_RETURN_NULL();
   }
 
@@ -4804,11 +6110,11 @@ Datum GetNodeByPoint(PG_FUNCTION_ARGS)
     PG_RETURN_NULL();
   }
 
-  POSTGIS_DEBUG(1, "Calling lwt_GetNodeByPoint");
-  node_id = lwt_GetNodeByPoint(topo, pt, tol);
-  POSTGIS_DEBUG(1, "lwt_GetNodeByPoint returned");
+  POSTGIS_DEBUG(1, "Calling lwt_ModEdgeSplit");
+  node_id = lwt_ModEdgeSplit(topo, edge_id, pt, 0);
+  POSTGIS_DEBUG(1, "lwt_ModEdgeSplit returned");
   lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 1);
+  PG_FREE_IF_COPY(geom, 3);
   lwt_FreeTopology(topo);
 
   if ( node_id == -1 )
@@ -4822,50 +6128,1707 @@ Datum GetNodeByPoint(PG_FUNCTION_ARGS)
   PG_RETURN_INT32(node_id);
 }
 
-/*  GetEdgeByPoint(atopology, point, tolerance) */
-Datum GetEdgeByPoint(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(GetEdgeByPoint);
-Datum GetEdgeByPoint(PG_FUNCTION_ARGS)
+/*  ST_NewEdgesSplit(atopology, anedge, apoint) */
+Datum ST_NewEdgesSplit(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_NewEdgesSplit);
+Datum ST_NewEdgesSplit(PG_FUNCTION_ARGS)
 {
   text* toponame_text;
   char* toponame;
-  double tol;
+  LWT_ELEMID edge_id;
   LWT_ELEMID node_id;
   GSERIALIZED *geom;
   LWGEOM *lwgeom;
   LWPOINT *pt;
   LWT_TOPOLOGY *topo;
 
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
   toponame_text = PG_GETARG_TEXT_P(0);
   toponame = text_to_cstring(toponame_text);
   PG_FREE_IF_COPY(toponame_text, 0);
 
-  geom = PG_GETARG_GSERIALIZED_P(1);
+  edge_id = PG_GETARG_INT32(1) ;
+
+  geom = PG_GETARG_GSERIALIZED_P(2);
   lwgeom = lwgeom_from_gserialized(geom);
   pt = lwgeom_as_lwpoint(lwgeom);
   if ( ! pt )
   {
     lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 1);
-    lwpgerror("Node geometry must be a point");
+    PG_FREE_IF_COPY(geom, 2);
+    lwpgerror("ST_NewEdgesSplit third argument must be a point geometry");
+    PG_RETURN_NULL();
+  }
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_NewEdgesSplit");
+  node_id = lwt_NewEdgesSplit(topo, edge_id, pt, 0);
+  POSTGIS_DEBUG(1, "lwt_NewEdgesSplit returned");
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 3);
+  lwt_FreeTopology(topo);
+
+  if ( node_id == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+  PG_RETURN_INT32(node_id);
+}
+
+/*  ST_AddIsoNode(atopology, aface, apoint) */
+Datum ST_AddIsoNode(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_AddIsoNode);
+Datum ST_AddIsoNode(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  LWT_ELEMID containing_face;
+  LWT_ELEMID node_id;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWPOINT *pt;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(2) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  if ( PG_ARGISNULL(1) ) containing_face = -1;
+  else
+  {
+    containing_face = PG_GETARG_INT32(1);
+    if ( containing_face < 0 )
+    {
+      lwpgerror("SQL/MM Spatial exception - not within face");
+      PG_RETURN_NULL();
+    }
+  }
+
+  geom = PG_GETARG_GSERIALIZED_P(2);
+  lwgeom = lwgeom_from_gserialized(geom);
+  pt = lwgeom_as_lwpoint(lwgeom);
+  if ( ! pt )
+  {
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 2);
+    lwpgerror("SQL/MM Spatial exception - invalid point");
+    PG_RETURN_NULL();
+  }
+  if ( lwpoint_is_empty(pt) )
+  {
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 2);
+    lwpgerror("SQL/MM Spatial exception - empty point");
+    PG_RETURN_NULL();
+  }
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_AddIsoNode");
+  node_id = lwt_AddIsoNode(topo, containing_face, pt, 0);
+  POSTGIS_DEBUG(1, "lwt_AddIsoNode returned");
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 2);
+  lwt_FreeTopology(topo);
+
+  if ( node_id == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+  PG_RETURN_INT32(node_id);
+}
+
+/*  ST_AddIsoEdge(atopology, anode, anothernode, acurve) */
+Datum ST_AddIsoEdge(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_AddIsoEdge);
+Datum ST_AddIsoEdge(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  LWT_ELEMID edge_id;
+  LWT_ELEMID start_node, end_node;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWLINE *curve;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) ||
+       PG_ARGISNULL(2) || PG_ARGISNULL(3) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  start_node = PG_GETARG_INT32(1);
+  end_node = PG_GETARG_INT32(2);
+
+  if ( start_node == end_node )
+  {
+    lwpgerror("Closed edges would not be isolated, try ST_AddEdgeNewFaces");
+    PG_RETURN_NULL();
+  }
+
+  geom = PG_GETARG_GSERIALIZED_P(3);
+  lwgeom = lwgeom_from_gserialized(geom);
+  curve = lwgeom_as_lwline(lwgeom);
+  if ( ! curve )
+  {
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 3);
+    lwpgerror("SQL/MM Spatial exception - invalid curve");
+    PG_RETURN_NULL();
+  }
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_AddIsoEdge");
+  edge_id = lwt_AddIsoEdge(topo, start_node, end_node, curve);
+  POSTGIS_DEBUG(1, "lwt_AddIsoNode returned");
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 3);
+  lwt_FreeTopology(topo);
+
+  if ( edge_id == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+  PG_RETURN_INT32(edge_id);
+}
+
+/*  ST_AddEdgeModFace(atopology, snode, enode, line) */
+Datum ST_AddEdgeModFace(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_AddEdgeModFace);
+Datum ST_AddEdgeModFace(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  LWT_ELEMID startnode_id, endnode_id;
+  int edge_id;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWLINE *line;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(3) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  startnode_id = PG_GETARG_INT32(1) ;
+  endnode_id = PG_GETARG_INT32(2) ;
+
+  geom = PG_GETARG_GSERIALIZED_P(3);
+  lwgeom = lwgeom_from_gserialized(geom);
+  line = lwgeom_as_lwline(lwgeom);
+  if ( ! line )
+  {
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 3);
+    lwpgerror("ST_AddEdgeModFace fourth argument must be a line geometry");
+    PG_RETURN_NULL();
+  }
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_AddEdgeModFace");
+  edge_id = lwt_AddEdgeModFace(topo, startnode_id, endnode_id, line, 0);
+  POSTGIS_DEBUG(1, "lwt_AddEdgeModFace returned");
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 3);
+  lwt_FreeTopology(topo);
+
+  if ( edge_id == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+  PG_RETURN_INT32(edge_id);
+}
+
+/*  ST_AddEdgeNewFaces(atopology, snode, enode, line) */
+Datum ST_AddEdgeNewFaces(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_AddEdgeNewFaces);
+Datum ST_AddEdgeNewFaces(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  LWT_ELEMID startnode_id, endnode_id;
+  int edge_id;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWLINE *line;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) || PG_ARGISNULL(3) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  startnode_id = PG_GETARG_INT32(1) ;
+  endnode_id = PG_GETARG_INT32(2) ;
+
+  geom = PG_GETARG_GSERIALIZED_P(3);
+  lwgeom = lwgeom_from_gserialized(geom);
+  line = lwgeom_as_lwline(lwgeom);
+  if ( ! line )
+  {
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 3);
+    lwpgerror("ST_AddEdgeModFace fourth argument must be a line geometry");
+    PG_RETURN_NULL();
+  }
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_AddEdgeNewFaces");
+  edge_id = lwt_AddEdgeNewFaces(topo, startnode_id, endnode_id, line, 0);
+  POSTGIS_DEBUG(1, "lwt_AddEdgeNewFaces returned");
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 3);
+  lwt_FreeTopology(topo);
+
+  if ( edge_id == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+  PG_RETURN_INT32(edge_id);
+}
+
+/* ST_GetFaceGeometry(atopology, aface) */
+Datum ST_GetFaceGeometry(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_GetFaceGeometry);
+Datum ST_GetFaceGeometry(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  LWT_ELEMID face_id;
+  LWGEOM *lwgeom;
+  LWT_TOPOLOGY *topo;
+  GSERIALIZED *geom;
+  MemoryContext old_context;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  face_id = PG_GETARG_INT32(1) ;
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_GetFaceGeometry");
+  lwgeom = lwt_GetFaceGeometry(topo, face_id);
+  POSTGIS_DEBUG(1, "lwt_GetFaceGeometry returned");
+  lwt_FreeTopology(topo);
+
+  if ( lwgeom == NULL )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  /* Serialize in upper memory context (outside of SPI) */
+  /* TODO: use a narrower context to switch to */
+  old_context = MemoryContextSwitchTo( TopMemoryContext );
+  geom = geometry_serialize(lwgeom);
+  MemoryContextSwitchTo(old_context);
+
+  SPI_finish();
+
+  PG_RETURN_POINTER(geom);
+}
+
+typedef struct FACEEDGESSTATE
+{
+  LWT_ELEMID *elems;
+  int nelems;
+  int curr;
+}
+FACEEDGESSTATE;
+
+/* ST_GetFaceEdges(atopology, aface) */
+Datum ST_GetFaceEdges(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_GetFaceEdges);
+Datum ST_GetFaceEdges(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  LWT_ELEMID face_id;
+  int nelems;
+  LWT_ELEMID *elems;
+  LWT_TOPOLOGY *topo;
+  FuncCallContext *funcctx;
+  MemoryContext oldcontext, newcontext;
+  TupleDesc tupdesc;
+  HeapTuple tuple;
+  AttInMetadata *attinmeta;
+  FACEEDGESSTATE *state;
+  char buf[64];
+  char *values[2];
+  Datum result;
+
+  values[0] = buf;
+  values[1] = &(buf[32]);
+
+  if (SRF_IS_FIRSTCALL())
+  {
+
+    POSTGIS_DEBUG(1, "ST_GetFaceEdges first call");
+    funcctx = SRF_FIRSTCALL_INIT();
+    newcontext = funcctx->multi_call_memory_ctx;
+
+    if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
+    {
+      lwpgerror("SQL/MM Spatial exception - null argument");
+      PG_RETURN_NULL();
+    }
+
+    toponame_text = PG_GETARG_TEXT_P(0);
+    toponame = text_to_cstring(toponame_text);
+    PG_FREE_IF_COPY(toponame_text, 0);
+
+    face_id = PG_GETARG_INT32(1) ;
+
+    if ( SPI_OK_CONNECT != SPI_connect() )
+    {
+      lwpgerror("Could not connect to SPI");
+      PG_RETURN_NULL();
+    }
+
+    topo = lwt_LoadTopology(be_iface, toponame);
+    oldcontext = MemoryContextSwitchTo( newcontext );
+    pfree(toponame);
+    if ( ! topo )
+    {
+      /* should never reach this point, as lwerror would raise an exception */
+      SPI_finish();
+      PG_RETURN_NULL();
+    }
+
+    POSTGIS_DEBUG(1, "Calling lwt_GetFaceEdges");
+    nelems = lwt_GetFaceEdges(topo, face_id, &elems);
+    POSTGIS_DEBUGF(1, "lwt_GetFaceEdges returned %d", nelems);
+    lwt_FreeTopology(topo);
+
+    if ( nelems < 0 )
+    {
+      /* should never reach this point, as lwerror would raise an exception */
+      SPI_finish();
+      PG_RETURN_NULL();
+    }
+
+    state = lwalloc(sizeof(FACEEDGESSTATE));
+    state->elems = elems;
+    state->nelems = nelems;
+    state->curr = 0;
+    funcctx->user_fctx = state;
+
+    /*
+     * Build a tuple description for a
+     * getfaceedges_returntype tuple
+     */
+    tupdesc = RelationNameGetTupleDesc("topology.getfaceedges_returntype");
+
+    /*
+     * generate attribute metadata needed later to produce
+     * tuples from raw C strings
+     */
+    attinmeta = TupleDescGetAttInMetadata(tupdesc);
+    funcctx->attinmeta = attinmeta;
+
+    POSTGIS_DEBUG(1, "lwt_GetFaceEdges calling SPI_finish");
+
+    MemoryContextSwitchTo(oldcontext);
+
+    SPI_finish();
+  }
+
+  /* stuff done on every call of the function */
+  funcctx = SRF_PERCALL_SETUP();
+
+  /* get state */
+  state = funcctx->user_fctx;
+
+  if ( state->curr == state->nelems )
+  {
+    SRF_RETURN_DONE(funcctx);
+  }
+
+  if ( snprintf(values[0], 32, "%d", state->curr+1) >= 32 )
+  {
+    lwerror("Face edge sequence number does not fit 32 chars ?!: %d",
+            state->curr+1);
+  }
+  if ( snprintf(values[1], 32, "%" LWTFMT_ELEMID,
+                state->elems[state->curr]) >= 32 )
+  {
+    lwerror("Signed edge identifier does not fit 32 chars ?!: %"
+            LWTFMT_ELEMID, state->elems[state->curr]);
+  }
+
+  POSTGIS_DEBUGF(1, "ST_GetFaceEdges: cur:%d, val0:%s, val1:%s",
+                 state->curr, values[0], values[1]);
+
+  tuple = BuildTupleFromCStrings(funcctx->attinmeta, values);
+  result = HeapTupleGetDatum(tuple);
+  state->curr++;
+
+  SRF_RETURN_NEXT(funcctx, result);
+}
+
+/*  ST_ChangeEdgeGeom(atopology, anedge, acurve) */
+Datum ST_ChangeEdgeGeom(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_ChangeEdgeGeom);
+Datum ST_ChangeEdgeGeom(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char buf[64];
+  char* toponame;
+  int ret;
+  LWT_ELEMID edge_id;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWLINE *line;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  edge_id = PG_GETARG_INT32(1) ;
+
+  geom = PG_GETARG_GSERIALIZED_P(2);
+  lwgeom = lwgeom_from_gserialized(geom);
+  line = lwgeom_as_lwline(lwgeom);
+  if ( ! line )
+  {
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 2);
+    lwpgerror("ST_ChangeEdgeGeom third argument must be a line geometry");
+    PG_RETURN_NULL();
+  }
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_ChangeEdgeGeom");
+  ret = lwt_ChangeEdgeGeom(topo, edge_id, line);
+  POSTGIS_DEBUG(1, "lwt_ChangeEdgeGeom returned");
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 2);
+  lwt_FreeTopology(topo);
+
+  if ( ret == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+
+  if ( snprintf(buf, 64, "Edge %" LWTFMT_ELEMID " changed", edge_id) >= 64 )
+  {
+    buf[63] = '\0';
+  }
+  PG_RETURN_TEXT_P(cstring_to_text(buf));
+}
+
+/*  ST_RemoveIsoNode(atopology, anode) */
+Datum ST_RemoveIsoNode(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_RemoveIsoNode);
+Datum ST_RemoveIsoNode(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char buf[64];
+  char* toponame;
+  int ret;
+  LWT_ELEMID node_id;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  node_id = PG_GETARG_INT32(1) ;
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_RemoveIsoNode");
+  ret = lwt_RemoveIsoNode(topo, node_id);
+  POSTGIS_DEBUG(1, "lwt_RemoveIsoNode returned");
+  lwt_FreeTopology(topo);
+
+  if ( ret == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+
+  if ( snprintf(buf, 64, "Isolated node %" LWTFMT_ELEMID
+                " removed", node_id) >= 64 )
+  {
+    buf[63] = '\0';
+  }
+  PG_RETURN_TEXT_P(cstring_to_text(buf));
+}
+
+/*  ST_RemIsoEdge(atopology, anedge) */
+Datum ST_RemIsoEdge(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_RemIsoEdge);
+Datum ST_RemIsoEdge(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char buf[64];
+  char* toponame;
+  int ret;
+  LWT_ELEMID node_id;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  node_id = PG_GETARG_INT32(1) ;
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_RemIsoEdge");
+  ret = lwt_RemIsoEdge(topo, node_id);
+  POSTGIS_DEBUG(1, "lwt_RemIsoEdge returned");
+  lwt_FreeTopology(topo);
+
+  if ( ret == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+
+  if ( snprintf(buf, 64, "Isolated edge %" LWTFMT_ELEMID
+                " removed", node_id) >= 64 )
+  {
+    buf[63] = '\0';
+  }
+  PG_RETURN_TEXT_P(cstring_to_text(buf));
+}
+
+/*  ST_MoveIsoNode(atopology, anode, apoint) */
+Datum ST_MoveIsoNode(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_MoveIsoNode);
+Datum ST_MoveIsoNode(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char buf[64];
+  char* toponame;
+  int ret;
+  LWT_ELEMID node_id;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWPOINT *pt;
+  LWT_TOPOLOGY *topo;
+  POINT2D p;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  node_id = PG_GETARG_INT32(1) ;
+
+  geom = PG_GETARG_GSERIALIZED_P(2);
+  lwgeom = lwgeom_from_gserialized(geom);
+  pt = lwgeom_as_lwpoint(lwgeom);
+  if ( ! pt )
+  {
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 2);
+    lwpgerror("SQL/MM Spatial exception - invalid point");
+    PG_RETURN_NULL();
+  }
+
+  if ( ! getPoint2d_p(pt->point, 0, &p) )
+  {
+    /* Do not let empty points in, see
+     * https://trac.osgeo.org/postgis/ticket/3234
+     */
+    lwpgerror("SQL/MM Spatial exception - empty point");
+    PG_RETURN_NULL();
+  }
+
+  /* TODO: check point for NaN values ? */
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_MoveIsoNode");
+  ret = lwt_MoveIsoNode(topo, node_id, pt);
+  POSTGIS_DEBUG(1, "lwt_MoveIsoNode returned");
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 2);
+  lwt_FreeTopology(topo);
+
+  if ( ret == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+
+  if ( snprintf(buf, 64, "Isolated Node %" LWTFMT_ELEMID
+                " moved to location %g,%g",
+                node_id, p.x, p.y) >= 64 )
+  {
+    buf[63] = '\0';
+  }
+  PG_RETURN_TEXT_P(cstring_to_text(buf));
+}
+
+/*  ST_RemEdgeModFace(atopology, anedge) */
+Datum ST_RemEdgeModFace(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_RemEdgeModFace);
+Datum ST_RemEdgeModFace(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  int ret;
+  LWT_ELEMID node_id;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  node_id = PG_GETARG_INT32(1) ;
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_RemEdgeModFace");
+  ret = lwt_RemEdgeModFace(topo, node_id);
+  POSTGIS_DEBUG(1, "lwt_RemEdgeModFace returned");
+  lwt_FreeTopology(topo);
+
+  if ( ret == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+
+  PG_RETURN_INT32(ret);
+}
+
+/*  ST_RemEdgeNewFace(atopology, anedge) */
+Datum ST_RemEdgeNewFace(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_RemEdgeNewFace);
+Datum ST_RemEdgeNewFace(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  int ret;
+  LWT_ELEMID node_id;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  node_id = PG_GETARG_INT32(1) ;
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_RemEdgeNewFace");
+  ret = lwt_RemEdgeNewFace(topo, node_id);
+  POSTGIS_DEBUG(1, "lwt_RemEdgeNewFace returned");
+  lwt_FreeTopology(topo);
+  SPI_finish();
+
+  if ( ret <= 0 )
+  {
+    /* error or no face created */
+    PG_RETURN_NULL();
+  }
+
+  PG_RETURN_INT32(ret);
+}
+
+/*  ST_ModEdgeHeal(atopology, anedge, anotheredge) */
+Datum ST_ModEdgeHeal(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_ModEdgeHeal);
+Datum ST_ModEdgeHeal(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  int ret;
+  LWT_ELEMID eid1, eid2;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  eid1 = PG_GETARG_INT32(1) ;
+  eid2 = PG_GETARG_INT32(2) ;
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_ModEdgeHeal");
+  ret = lwt_ModEdgeHeal(topo, eid1, eid2);
+  POSTGIS_DEBUG(1, "lwt_ModEdgeHeal returned");
+  lwt_FreeTopology(topo);
+  SPI_finish();
+
+  if ( ret <= 0 )
+  {
+    /* error, should have sent message already */
+    PG_RETURN_NULL();
+  }
+
+  PG_RETURN_INT32(ret);
+}
+
+/*  ST_NewEdgeHeal(atopology, anedge, anotheredge) */
+Datum ST_NewEdgeHeal(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ST_NewEdgeHeal);
+Datum ST_NewEdgeHeal(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  int ret;
+  LWT_ELEMID eid1, eid2;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  eid1 = PG_GETARG_INT32(1) ;
+  eid2 = PG_GETARG_INT32(2) ;
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_NewEdgeHeal");
+  ret = lwt_NewEdgeHeal(topo, eid1, eid2);
+  POSTGIS_DEBUG(1, "lwt_NewEdgeHeal returned");
+  lwt_FreeTopology(topo);
+  SPI_finish();
+
+  if ( ret <= 0 )
+  {
+    /* error, should have sent message already */
+    PG_RETURN_NULL();
+  }
+
+  PG_RETURN_INT32(ret);
+}
+
+/*  GetNodeByPoint(atopology, point, tolerance) */
+Datum GetNodeByPoint(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(GetNodeByPoint);
+Datum GetNodeByPoint(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  double tol;
+  LWT_ELEMID node_id;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWPOINT *pt;
+  LWT_TOPOLOGY *topo;
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  geom = PG_GETARG_GSERIALIZED_P(1);
+  lwgeom = lwgeom_from_gserialized(geom);
+  pt = lwgeom_as_lwpoint(lwgeom);
+  if ( ! pt )
+  {
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 1);
+    lwpgerror("Node geometry must be a point");
+    PG_RETURN_NULL();
+  }
+
+  tol = PG_GETARG_FLOAT8(2);
+  if ( tol < 0 )
+  {
+    PG_FREE_IF_COPY(geom, 1);
+    lwpgerror("Tolerance must be >=0");
+    PG_RETURN_NULL();
+  }
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_GetNodeByPoint");
+  node_id = lwt_GetNodeByPoint(topo, pt, tol);
+  POSTGIS_DEBUG(1, "lwt_GetNodeByPoint returned");
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 1);
+  lwt_FreeTopology(topo);
+
+  if ( node_id == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+  PG_RETURN_INT32(node_id);
+}
+
+/*  GetEdgeByPoint(atopology, point, tolerance) */
+Datum GetEdgeByPoint(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(GetEdgeByPoint);
+Datum GetEdgeByPoint(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  double tol;
+  LWT_ELEMID node_id;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWPOINT *pt;
+  LWT_TOPOLOGY *topo;
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  geom = PG_GETARG_GSERIALIZED_P(1);
+  lwgeom = lwgeom_from_gserialized(geom);
+  pt = lwgeom_as_lwpoint(lwgeom);
+  if ( ! pt )
+  {
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 1);
+    lwpgerror("Node geometry must be a point");
+    PG_RETURN_NULL();
+  }
+
+  tol = PG_GETARG_FLOAT8(2);
+  if ( tol < 0 )
+  {
+    PG_FREE_IF_COPY(geom, 1);
+    lwpgerror("Tolerance must be >=0");
+    PG_RETURN_NULL();
+  }
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_GetEdgeByPoint");
+  node_id = lwt_GetEdgeByPoint(topo, pt, tol);
+  POSTGIS_DEBUG(1, "lwt_GetEdgeByPoint returned");
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 1);
+  lwt_FreeTopology(topo);
+
+  if ( node_id == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+  PG_RETURN_INT32(node_id);
+}
+
+/*  GetFaceByPoint(atopology, point, tolerance) */
+Datum GetFaceByPoint(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(GetFaceByPoint);
+Datum GetFaceByPoint(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  double tol;
+  LWT_ELEMID node_id;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWPOINT *pt;
+  LWT_TOPOLOGY *topo;
+
+  lwpgwarning("This function should not be hit, please upgrade your PostGIS install");
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  geom = PG_GETARG_GSERIALIZED_P(1);
+  lwgeom = lwgeom_from_gserialized(geom);
+  pt = lwgeom_as_lwpoint(lwgeom);
+  if ( ! pt )
+  {
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 1);
+    lwpgerror("Node geometry must be a point");
+    PG_RETURN_NULL();
+  }
+
+  tol = PG_GETARG_FLOAT8(2);
+  if ( tol < 0 )
+  {
+    PG_FREE_IF_COPY(geom, 1);
+    lwpgerror("Tolerance must be >=0");
+    PG_RETURN_NULL();
+  }
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  topo = lwt_LoadTopology(be_iface, toponame);
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_GetFaceByPoint");
+  node_id = lwt_GetFaceByPoint(topo, pt, tol);
+  POSTGIS_DEBUG(1, "lwt_GetFaceByPoint returned");
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 1);
+  lwt_FreeTopology(topo);
+
+  if ( node_id == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+  PG_RETURN_INT32(node_id);
+}
+
+/*  TopoGeo_AddPoint(atopology, point, tolerance) */
+Datum TopoGeo_AddPoint(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(TopoGeo_AddPoint);
+Datum TopoGeo_AddPoint(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  double tol;
+  LWT_ELEMID node_id;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWPOINT *pt;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
+    PG_RETURN_NULL();
+  }
+
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  geom = PG_GETARG_GSERIALIZED_P(1);
+  lwgeom = lwgeom_from_gserialized(geom);
+  pt = lwgeom_as_lwpoint(lwgeom);
+  if ( ! pt )
+  {
+    {
+      char buf[32];
+      _lwtype_upper_name(lwgeom_get_type(lwgeom), buf, 32);
+      lwgeom_free(lwgeom);
+      PG_FREE_IF_COPY(geom, 1);
+      lwpgerror("Invalid geometry type (%s) passed to TopoGeo_AddPoint"
+                ", expected POINT", buf );
+      PG_RETURN_NULL();
+    }
+  }
+
+  tol = PG_GETARG_FLOAT8(2);
+  if ( tol < 0 )
+  {
+    PG_FREE_IF_COPY(geom, 1);
+    lwpgerror("Tolerance must be >=0");
+    PG_RETURN_NULL();
+  }
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
+
+  {
+    int pre = be_data.topoLoadFailMessageFlavor;
+    be_data.topoLoadFailMessageFlavor = 1;
+    topo = lwt_LoadTopology(be_iface, toponame);
+    be_data.topoLoadFailMessageFlavor = pre;
+  }
+  pfree(toponame);
+  if ( ! topo )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  POSTGIS_DEBUG(1, "Calling lwt_AddPoint");
+  node_id = lwt_AddPoint(topo, pt, tol);
+  POSTGIS_DEBUG(1, "lwt_AddPoint returned");
+  lwgeom_free(lwgeom);
+  PG_FREE_IF_COPY(geom, 1);
+  lwt_FreeTopology(topo);
+
+  if ( node_id == -1 )
+  {
+    /* should never reach this point, as lwerror would raise an exception */
+    SPI_finish();
+    PG_RETURN_NULL();
+  }
+
+  SPI_finish();
+  PG_RETURN_INT32(node_id);
+}
+
+/*  TopoGeo_AddLinestring(atopology, point, tolerance) */
+Datum TopoGeo_AddLinestring(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(TopoGeo_AddLinestring);
+Datum TopoGeo_AddLinestring(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  double tol;
+  LWT_ELEMID *elems;
+  int nelems;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWLINE *ln;
+  LWT_TOPOLOGY *topo;
+  FuncCallContext *funcctx;
+  MemoryContext oldcontext, newcontext;
+  FACEEDGESSTATE *state;
+  Datum result;
+  LWT_ELEMID id;
+
+  if (SRF_IS_FIRSTCALL())
+  {
+    POSTGIS_DEBUG(1, "TopoGeo_AddLinestring first call");
+    funcctx = SRF_FIRSTCALL_INIT();
+    newcontext = funcctx->multi_call_memory_ctx;
+
+    if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+    {
+      lwpgerror("SQL/MM Spatial exception - null argument");
+      PG_RETURN_NULL();
+    }
+
+    toponame_text = PG_GETARG_TEXT_P(0);
+    toponame = text_to_cstring(toponame_text);
+    PG_FREE_IF_COPY(toponame_text, 0);
+
+    geom = PG_GETARG_GSERIALIZED_P(1);
+    lwgeom = lwgeom_from_gserialized(geom);
+    ln = lwgeom_as_lwline(lwgeom);
+    if ( ! ln )
+    {
+      {
+        char buf[32];
+        _lwtype_upper_name(lwgeom_get_type(lwgeom), buf, 32);
+        lwgeom_free(lwgeom);
+        PG_FREE_IF_COPY(geom, 1);
+        lwpgerror("Invalid geometry type (%s) passed to "
+                  "TopoGeo_AddLinestring, expected LINESTRING", buf);
+        PG_RETURN_NULL();
+      }
+    }
+
+    tol = PG_GETARG_FLOAT8(2);
+    if ( tol < 0 )
+    {
+      PG_FREE_IF_COPY(geom, 1);
+      lwpgerror("Tolerance must be >=0");
+      PG_RETURN_NULL();
+    }
+
+    if ( SPI_OK_CONNECT != SPI_connect() )
+    {
+      lwpgerror("Could not connect to SPI");
+      PG_RETURN_NULL();
+    }
+
+    {
+      int pre = be_data.topoLoadFailMessageFlavor;
+      be_data.topoLoadFailMessageFlavor = 1;
+      topo = lwt_LoadTopology(be_iface, toponame);
+      be_data.topoLoadFailMessageFlavor = pre;
+    }
+    oldcontext = MemoryContextSwitchTo( newcontext );
+    pfree(toponame);
+    if ( ! topo )
+    {
+      /* should never reach this point, as lwerror would raise an exception */
+      SPI_finish();
+      PG_RETURN_NULL();
+    }
+
+    POSTGIS_DEBUG(1, "Calling lwt_AddLine");
+    elems = lwt_AddLine(topo, ln, tol, &nelems);
+    POSTGIS_DEBUG(1, "lwt_AddLine returned");
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 1);
+    lwt_FreeTopology(topo);
+
+    if ( nelems < 0 )
+    {
+      /* should never reach this point, as lwerror would raise an exception */
+      SPI_finish();
+      PG_RETURN_NULL();
+    }
+
+    state = lwalloc(sizeof(FACEEDGESSTATE));
+    state->elems = elems;
+    state->nelems = nelems;
+    state->curr = 0;
+    funcctx->user_fctx = state;
+
+    POSTGIS_DEBUG(1, "TopoGeo_AddLinestring calling SPI_finish");
+
+    MemoryContextSwitchTo(oldcontext);
+
+    SPI_finish();
+  }
+
+  POSTGIS_DEBUG(1, "Per-call invocation");
+
+  /* stuff done on every call of the function */
+  funcctx = SRF_PERCALL_SETUP();
+
+  /* get state */
+  state = funcctx->user_fctx;
+
+  if ( state->curr == state->nelems )
+  {
+    POSTGIS_DEBUG(1, "We're done, cleaning up all");
+    SRF_RETURN_DONE(funcctx);
+  }
+
+  id = state->elems[state->curr++];
+  POSTGIS_DEBUGF(1, "TopoGeo_AddLinestring: cur:%d, val:%" LWTFMT_ELEMID,
+                 state->curr-1, id);
+
+  result = Int32GetDatum((int32)id);
+
+  SRF_RETURN_NEXT(funcctx, result);
+}
+
+/*  TopoGeo_AddPolygon(atopology, poly, tolerance) */
+Datum TopoGeo_AddPolygon(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(TopoGeo_AddPolygon);
+Datum TopoGeo_AddPolygon(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  double tol;
+  LWT_ELEMID *elems;
+  int nelems;
+  GSERIALIZED *geom;
+  LWGEOM *lwgeom;
+  LWPOLY *pol;
+  LWT_TOPOLOGY *topo;
+  FuncCallContext *funcctx;
+  MemoryContext oldcontext, newcontext;
+  FACEEDGESSTATE *state;
+  Datum result;
+  LWT_ELEMID id;
+
+  if (SRF_IS_FIRSTCALL())
+  {
+    POSTGIS_DEBUG(1, "TopoGeo_AddPolygon first call");
+    funcctx = SRF_FIRSTCALL_INIT();
+    newcontext = funcctx->multi_call_memory_ctx;
+
+    if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+    {
+      lwpgerror("SQL/MM Spatial exception - null argument");
+      PG_RETURN_NULL();
+    }
+
+    toponame_text = PG_GETARG_TEXT_P(0);
+    toponame = text_to_cstring(toponame_text);
+    PG_FREE_IF_COPY(toponame_text, 0);
+
+    geom = PG_GETARG_GSERIALIZED_P(1);
+    lwgeom = lwgeom_from_gserialized(geom);
+    pol = lwgeom_as_lwpoly(lwgeom);
+    if ( ! pol )
+    {
+      {
+        char buf[32];
+        _lwtype_upper_name(lwgeom_get_type(lwgeom), buf, 32);
+        lwgeom_free(lwgeom);
+        PG_FREE_IF_COPY(geom, 1);
+        lwpgerror("Invalid geometry type (%s) passed to "
+                  "TopoGeo_AddPolygon, expected POLYGON", buf);
+        PG_RETURN_NULL();
+      }
+    }
+
+    tol = PG_GETARG_FLOAT8(2);
+    if ( tol < 0 )
+    {
+      PG_FREE_IF_COPY(geom, 1);
+      lwpgerror("Tolerance must be >=0");
+      PG_RETURN_NULL();
+    }
+
+    if ( SPI_OK_CONNECT != SPI_connect() )
+    {
+      lwpgerror("Could not connect to SPI");
+      PG_RETURN_NULL();
+    }
+
+    {
+      int pre = be_data.topoLoadFailMessageFlavor;
+      be_data.topoLoadFailMessageFlavor = 1;
+      topo = lwt_LoadTopology(be_iface, toponame);
+      be_data.topoLoadFailMessageFlavor = pre;
+    }
+    oldcontext = MemoryContextSwitchTo( newcontext );
+    pfree(toponame);
+    if ( ! topo )
+    {
+      /* should never reach this point, as lwerror would raise an exception */
+      SPI_finish();
+      PG_RETURN_NULL();
+    }
+
+    POSTGIS_DEBUG(1, "Calling lwt_AddPolygon");
+    elems = lwt_AddPolygon(topo, pol, tol, &nelems);
+    POSTGIS_DEBUG(1, "lwt_AddPolygon returned");
+    lwgeom_free(lwgeom);
+    PG_FREE_IF_COPY(geom, 1);
+    lwt_FreeTopology(topo);
+
+    if ( nelems < 0 )
+    {
+      /* should never reach this point, as lwerror would raise an exception */
+      SPI_finish();
+      PG_RETURN_NULL();
+    }
+
+    state = lwalloc(sizeof(FACEEDGESSTATE));
+    state->elems = elems;
+    state->nelems = nelems;
+    state->curr = 0;
+    funcctx->user_fctx = state;
+
+    POSTGIS_DEBUG(1, "TopoGeo_AddPolygon calling SPI_finish");
+
+    MemoryContextSwitchTo(oldcontext);
+
+    SPI_finish();
+  }
+
+  POSTGIS_DEBUG(1, "Per-call invocation");
+
+  /* stuff done on every call of the function */
+  funcctx = SRF_PERCALL_SETUP();
+
+  /* get state */
+  state = funcctx->user_fctx;
+
+  if ( state->curr == state->nelems )
+  {
+    POSTGIS_DEBUG(1, "We're done, cleaning up all");
+    SRF_RETURN_DONE(funcctx);
+  }
+
+  id = state->elems[state->curr++];
+  POSTGIS_DEBUGF(1, "TopoGeo_AddPolygon: cur:%d, val:%" LWTFMT_ELEMID,
+                 state->curr-1, id);
+
+  result = Int32GetDatum((int32)id);
+
+  SRF_RETURN_NEXT(funcctx, result);
+}
+
+/*  TopoGeo_LoadGeometries(atopology, geoms, tolerance) */
+Datum TopoGeo_LoadGeometries(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(TopoGeo_LoadGeometries);
+Datum TopoGeo_LoadGeometries(PG_FUNCTION_ARGS)
+{
+  text* toponame_text;
+  char* toponame;
+  double tol;
+  ArrayType *array;
+  ArrayIterator iterator;
+  Datum value;
+  bool isnull;
+  LWGEOM **geoms;
+  uint32_t ngeoms = 0;
+  uint32_t i;
+  int nelems;
+  int ret;
+  LWT_TOPOLOGY *topo;
+
+  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+  {
+    lwpgerror("SQL/MM Spatial exception - null argument");
     PG_RETURN_NULL();
   }
 
   tol = PG_GETARG_FLOAT8(2);
   if ( tol < 0 )
   {
-    PG_FREE_IF_COPY(geom, 1);
     lwpgerror("Tolerance must be >=0");
     PG_RETURN_NULL();
   }
 
+  toponame_text = PG_GETARG_TEXT_P(0);
+  toponame = text_to_cstring(toponame_text);
+  PG_FREE_IF_COPY(toponame_text, 0);
+
+  /* Null and empty elements are skipped */
+  array = PG_GETARG_ARRAYTYPE_P(1);
+  nelems = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+  geoms = palloc(sizeof(LWGEOM *) * Max(nelems, 1));
+  iterator = array_create_iterator(array, 0, NULL);
+  while (array_iterate(iterator, &value, &isnull))
+  {
+    if ( isnull ) continue;
+    geoms[ngeoms++] = lwgeom_from_gserialized((GSERIALIZED *)DatumGetPointer(value));
+  }
+  array_free_iterator(iterator);
+
   if ( SPI_OK_CONNECT != SPI_connect() )
   {
     lwpgerror("Could not connect to SPI");
     PG_RETURN_NULL();
   }
 
-  topo = lwt_LoadTopology(be_iface, toponame);
+  {
+    int pre = be_data.topoLoadFailMessageFlavor;
+    be_data.topoLoadFailMessageFlavor = 1;
+    topo = lwt_LoadTopology(be_iface, toponame);
+    be_data.topoLoadFailMessageFlavor = pre;
+  }
   pfree(toponame);
   if ( ! topo )
   {
@@ -4874,14 +7837,14 @@ Datum GetEdgeByPoint(PG_FUNCTION_ARGS)
     PG_RETURN_NULL();
   }
 
-  POSTGIS_DEBUG(1, "Calling lwt_GetEdgeByPoint");
-  node_id = lwt_GetEdgeByPoint(topo, pt, tol);
-  POSTGIS_DEBUG(1, "lwt_GetEdgeByPoint returned");
-  lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 1);
+  POSTGIS_DEBUGF(1, "Calling lwt_LoadGeometries with %u geometries", ngeoms);
+  ret = lwt_LoadGeometries(topo, geoms, ngeoms, tol);
+  POSTGIS_DEBUG(1, "lwt_LoadGeometries returned");
+  for ( i=0; i<ngeoms; ++i ) lwgeom_free(geoms[i]);
+  pfree(geoms);
   lwt_FreeTopology(topo);
 
-  if ( node_id == -1 )
+  if ( ret == -1 )
   {
     /* should never reach this point, as lwerror would raise an exception */
     SPI_finish();
@@ -4889,101 +7852,150 @@ Datum GetEdgeByPoint(PG_FUNCTION_ARGS)
   }
 
   SPI_finish();
-  PG_RETURN_INT32(node_id);
+
+  PG_RETURN_VOID();
 }
 
-/*  GetFaceByPoint(atopology, point, tolerance) */
-Datum GetFaceByPoint(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(GetFaceByPoint);
-Datum GetFaceByPoint(PG_FUNCTION_ARGS)
+/*  GetRingEdges(atopology, anedge, maxedges default null) */
+Datum GetRingEdges(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(GetRingEdges);
+Datum GetRingEdges(PG_FUNCTION_ARGS)
 {
   text* toponame_text;
   char* toponame;
-  double tol;
-  LWT_ELEMID node_id;
-  GSERIALIZED *geom;
-  LWGEOM *lwgeom;
-  LWPOINT *pt;
-  LWT_TOPOLOGY *topo;
+  LWT_ELEMID edge_id;
+  int maxedges = 0;
+  uint64_t nelems;
+  LWT_ELEMID *elems;
+  LWT_BE_TOPOLOGY *topo;
+  FuncCallContext *funcctx;
+  MemoryContext oldcontext, newcontext;
+  FACEEDGESSTATE *state;
+  Datum result;
+  HeapTuple tuple;
+  Datum ret[2];
+  bool isnull[2] = {0,0}; /* needed to say neither value is null */
 
-  lwpgwarning("This function should not be hit, please upgrade your PostGIS install");
+  if (SRF_IS_FIRSTCALL())
+  {
+    POSTGIS_DEBUG(1, "GetRingEdges first call");
+    funcctx = SRF_FIRSTCALL_INIT();
+    newcontext = funcctx->multi_call_memory_ctx;
 
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
 
-  geom = PG_GETARG_GSERIALIZED_P(1);
-  lwgeom = lwgeom_from_gserialized(geom);
-  pt = lwgeom_as_lwpoint(lwgeom);
-  if ( ! pt )
-  {
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 1);
-    lwpgerror("Node geometry must be a point");
-    PG_RETURN_NULL();
-  }
+    if ( PG_ARGISNULL(0) )
+    {
+      lwpgerror("GetRingEdges: topology name cannot be null");
+      PG_RETURN_NULL();
+    }
+    toponame_text = PG_GETARG_TEXT_P(0);
+    toponame = text_to_cstring(toponame_text);
+    PG_FREE_IF_COPY(toponame_text, 0);
 
-  tol = PG_GETARG_FLOAT8(2);
-  if ( tol < 0 )
-  {
-    PG_FREE_IF_COPY(geom, 1);
-    lwpgerror("Tolerance must be >=0");
-    PG_RETURN_NULL();
-  }
+    if ( PG_ARGISNULL(1) )
+    {
+      lwpgerror("GetRingEdges: edge id cannot be null");
+      PG_RETURN_NULL();
+    }
+    edge_id = PG_GETARG_INT32(1) ;
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
-  {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
-  }
+    if ( ! PG_ARGISNULL(2) )
+    {
+      maxedges = PG_GETARG_INT32(2) ;
+    }
+
+    if ( SPI_OK_CONNECT != SPI_connect() )
+    {
+      lwpgerror("Could not connect to SPI");
+      PG_RETURN_NULL();
+    }
+
+    {
+      int pre = be_data.topoLoadFailMessageFlavor;
+      be_data.topoLoadFailMessageFlavor = 1;
+      topo = cb_loadTopologyByName(&be_data, toponame);
+      be_data.topoLoadFailMessageFlavor = pre;
+    }
+    oldcontext = MemoryContextSwitchTo( newcontext );
+    pfree(toponame);
+    if ( ! topo )
+    {
+      SPI_finish();
+      lwpgerror("%s", cb_lastErrorMessage(&be_data));
+      PG_RETURN_NULL();
+    }
+
+    POSTGIS_DEBUG(1, "Calling cb_getRingEdges");
+    elems = cb_getRingEdges(topo, edge_id, &nelems, maxedges);
+    POSTGIS_DEBUG(1, "cb_getRingEdges returned");
+    cb_freeTopology(topo);
+
+    if ( ! elems )
+    {
+      SPI_finish();
+      lwpgerror("%s", cb_lastErrorMessage(&be_data));
+      PG_RETURN_NULL();
+    }
+
+    state = lwalloc(sizeof(FACEEDGESSTATE));
+    state->elems = elems;
+    state->nelems = nelems;
+    state->curr = 0;
+    funcctx->user_fctx = state;
+
+    POSTGIS_DEBUG(1, "GetRingEdges calling SPI_finish");
+
+    /*
+     * Get tuple description for return type
+     */
+    get_call_result_type(fcinfo, 0, &funcctx->tuple_desc);
+    BlessTupleDesc(funcctx->tuple_desc);
+
+    MemoryContextSwitchTo(oldcontext);
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
-  {
-    /* should never reach this point, as lwerror would raise an exception */
     SPI_finish();
-    PG_RETURN_NULL();
   }
 
-  POSTGIS_DEBUG(1, "Calling lwt_GetFaceByPoint");
-  node_id = lwt_GetFaceByPoint(topo, pt, tol);
-  POSTGIS_DEBUG(1, "lwt_GetFaceByPoint returned");
-  lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 1);
-  lwt_FreeTopology(topo);
+  POSTGIS_DEBUG(1, "Per-call invocation");
 
-  if ( node_id == -1 )
+  /* stuff done on every call of the function */
+  funcctx = SRF_PERCALL_SETUP();
+
+  /* get state */
+  state = funcctx->user_fctx;
+
+  if ( state->curr == state->nelems )
   {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
+    POSTGIS_DEBUG(1, "We're done, cleaning up all");
+    SRF_RETURN_DONE(funcctx);
   }
 
-  SPI_finish();
-  PG_RETURN_INT32(node_id);
+  edge_id = state->elems[state->curr++];
+  POSTGIS_DEBUGF(1, "GetRingEdges: cur:%d, val:%" LWTFMT_ELEMID,
+                 state->curr-1, edge_id);
+
+
+  ret[0] = Int32GetDatum(state->curr);
+  ret[1] = Int32GetDatum(edge_id);
+  tuple = heap_form_tuple(funcctx->tuple_desc, ret, isnull);
+  result = HeapTupleGetDatum(tuple);
+
+  SRF_RETURN_NEXT(funcctx, result);
 }
 
-/*  TopoGeo_AddPoint(atopology, point, tolerance) */
-Datum TopoGeo_AddPoint(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(TopoGeo_AddPoint);
-Datum TopoGeo_AddPoint(PG_FUNCTION_ARGS)
+/*  GetFaceContainingPoint(atopology, point) */
+Datum GetFaceContainingPoint(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(GetFaceContainingPoint);
+Datum GetFaceContainingPoint(PG_FUNCTION_ARGS)
 {
   text* toponame_text;
   char* toponame;
-  double tol;
-  LWT_ELEMID node_id;
+  LWT_ELEMID face_id;
   GSERIALIZED *geom;
   LWGEOM *lwgeom;
   LWPOINT *pt;
   LWT_TOPOLOGY *topo;
 
-  if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
-  {
-    lwpgerror("SQL/MM Spatial exception - null argument");
-    PG_RETURN_NULL();
-  }
-
   toponame_text = PG_GETARG_TEXT_P(0);
   toponame = text_to_cstring(toponame_text);
   PG_FREE_IF_COPY(toponame_text, 0);
@@ -4993,22 +8005,9 @@ Datum TopoGeo_AddPoint(PG_FUNCTION_ARGS)
   pt = lwgeom_as_lwpoint(lwgeom);
   if ( ! pt )
   {
-    {
-      char buf[32];
-      _lwtype_upper_name(lwgeom_get_type(lwgeom), buf, 32);
-      lwgeom_free(lwgeom);
-      PG_FREE_IF_COPY(geom, 1);
-      lwpgerror("Invalid geometry type (%s) passed to TopoGeo_AddPoint"
-                ", expected POINT", buf );
-      PG_RETURN_NULL();
-    }
-  }
-
-  tol = PG_GETARG_FLOAT8(2);
-  if ( tol < 0 )
-  {
+    lwgeom_free(lwgeom);
     PG_FREE_IF_COPY(geom, 1);
-    lwpgerror("Tolerance must be >=0");
+    lwpgerror("Second argument must be a point geometry");
     PG_RETURN_NULL();
   }
 
@@ -5018,12 +8017,7 @@ Datum TopoGeo_AddPoint(PG_FUNCTION_ARGS)
     PG_RETURN_NULL();
   }
 
-  {
-    int pre = be_data.topoLoadFailMessageFlavor;
-    be_data.topoLoadFailMessageFlavor = 1;
-    topo = lwt_LoadTopology(be_iface, toponame);
-    be_data.topoLoadFailMessageFlavor = pre;
-  }
+  topo = lwt_LoadTopology(be_iface, toponame);
   pfree(toponame);
   if ( ! topo )
   {
@@ -5032,14 +8026,14 @@ Datum TopoGeo_AddPoint(PG_FUNCTION_ARGS)
     PG_RETURN_NULL();
   }
 
-  POSTGIS_DEBUG(1, "Calling lwt_AddPoint");
-  node_id = lwt_AddPoint(topo, pt, tol);
-  POSTGIS_DEBUG(1, "lwt_AddPoint returned");
+  POSTGIS_DEBUG(1, "Calling lwt_GetFaceContainingPoint");
+  face_id = lwt_GetFaceContainingPoint(topo, pt);
+  POSTGIS_DEBUG(1, "lwt_GetFaceContainingPoint returned");
   lwgeom_free(lwgeom);
   PG_FREE_IF_COPY(geom, 1);
   lwt_FreeTopology(topo);
 
-  if ( node_id == -1 )
+  if ( face_id == -1 )
   {
     /* should never reach this point, as lwerror would raise an exception */
     SPI_finish();
@@ -5047,36 +8041,48 @@ Datum TopoGeo_AddPoint(PG_FUNCTION_ARGS)
   }
 
   SPI_finish();
-  PG_RETURN_INT32(node_id);
+  PG_RETURN_INT32(face_id);
 }
 
-/*  TopoGeo_AddLinestring(atopology, point, tolerance) */
-Datum TopoGeo_AddLinestring(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(TopoGeo_AddLinestring);
-Datum TopoGeo_AddLinestring(PG_FUNCTION_ARGS)
+typedef struct VALIDATESTATE
+{
+  LWT_VALIDATION_ERROR *errors;
+  int nerrors;
+  int curr;
+}
+VALIDATESTATE;
+
+/*  ValidateTopologyPartition(atopology, bbox) */
+Datum ValidateTopologyPartition(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(ValidateTopologyPartition);
+Datum ValidateTopologyPartition(PG_FUNCTION_ARGS)
 {
   text* toponame_text;
   char* toponame;
-  double tol;
-  LWT_ELEMID *elems;
-  int nelems;
   GSERIALIZED *geom;
   LWGEOM *lwgeom;
-  LWLINE *ln;
+  GBOX box;
+  GBOX *partition = NULL;
+  LWT_VALIDATION_ERROR *errors;
+  int nerrors;
   LWT_TOPOLOGY *topo;
   FuncCallContext *funcctx;
   MemoryContext oldcontext, newcontext;
-  FACEEDGESSTATE *state;
+  TupleDesc tupdesc;
+  HeapTuple tuple;
+  VALIDATESTATE *state;
+  const LWT_VALIDATION_ERROR *err;
+  char buf[64];
+  char *values[3];
   Datum result;
-  LWT_ELEMID id;
 
   if (SRF_IS_FIRSTCALL())
   {
-    POSTGIS_DEBUG(1, "TopoGeo_AddLinestring first call");
+    POSTGIS_DEBUG(1, "ValidateTopologyPartition first call");
     funcctx = SRF_FIRSTCALL_INIT();
     newcontext = funcctx->multi_call_memory_ctx;
 
-    if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+    if ( PG_ARGISNULL(0) )
     {
       lwpgerror("SQL/MM Spatial exception - null argument");
       PG_RETURN_NULL();
@@ -5086,28 +8092,22 @@ Datum TopoGeo_AddLinestring(PG_FUNCTION_ARGS)
     toponame = text_to_cstring(toponame_text);
     PG_FREE_IF_COPY(toponame_text, 0);
 
-    geom = PG_GETARG_GSERIALIZED_P(1);
-    lwgeom = lwgeom_from_gserialized(geom);
-    ln = lwgeom_as_lwline(lwgeom);
-    if ( ! ln )
+    if ( ! PG_ARGISNULL(1) )
     {
+      geom = PG_GETARG_GSERIALIZED_P(1);
+      lwgeom = lwgeom_from_gserialized(geom);
+      /* The serialized box is float-rounded, we need the exact one
+       * for partitions to share their boundaries */
+      if ( lwgeom_calculate_gbox(lwgeom, &box) != LW_SUCCESS )
       {
-        char buf[32];
-        _lwtype_upper_name(lwgeom_get_type(lwgeom), buf, 32);
         lwgeom_free(lwgeom);
         PG_FREE_IF_COPY(geom, 1);
-        lwpgerror("Invalid geometry type (%s) passed to "
-                  "TopoGeo_AddLinestring, expected LINESTRING", buf);
+        lwpgerror("Partition geometry must not be empty");
         PG_RETURN_NULL();
       }
-    }
-
-    tol = PG_GETARG_FLOAT8(2);
-    if ( tol < 0 )
-    {
+      lwgeom_free(lwgeom);
       PG_FREE_IF_COPY(geom, 1);
-      lwpgerror("Tolerance must be >=0");
-      PG_RETURN_NULL();
+      partition = &box;
     }
 
     if ( SPI_OK_CONNECT != SPI_connect() )
@@ -5116,13 +8116,7 @@ Datum TopoGeo_AddLinestring(PG_FUNCTION_ARGS)
       PG_RETURN_NULL();
     }
 
-    {
-      int pre = be_data.topoLoadFailMessageFlavor;
-      be_data.topoLoadFailMessageFlavor = 1;
-      topo = lwt_LoadTopology(be_iface, toponame);
-      be_data.topoLoadFailMessageFlavor = pre;
-    }
-    oldcontext = MemoryContextSwitchTo( newcontext );
+    topo = lwt_LoadTopology(be_iface, toponame);
     pfree(toponame);
     if ( ! topo )
     {
@@ -5131,234 +8125,724 @@ Datum TopoGeo_AddLinestring(PG_FUNCTION_ARGS)
       PG_RETURN_NULL();
     }
 
-    POSTGIS_DEBUG(1, "Calling lwt_AddLine");
-    elems = lwt_AddLine(topo, ln, tol, &nelems);
-    POSTGIS_DEBUG(1, "lwt_AddLine returned");
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 1);
+    POSTGIS_DEBUG(1, "Calling lwt_ValidateTopology");
+    nerrors = lwt_ValidateTopology(topo, partition, &errors);
+    POSTGIS_DEBUGF(1, "lwt_ValidateTopology returned %d", nerrors);
     lwt_FreeTopology(topo);
 
-    if ( nelems < 0 )
+    if ( nerrors < 0 )
     {
       /* should never reach this point, as lwerror would raise an exception */
       SPI_finish();
       PG_RETURN_NULL();
     }
 
-    state = lwalloc(sizeof(FACEEDGESSTATE));
-    state->elems = elems;
-    state->nelems = nelems;
+    /* Validation memory goes away with SPI, only keep the errors */
+    oldcontext = MemoryContextSwitchTo( newcontext );
+
+    state = palloc(sizeof(VALIDATESTATE));
+    state->errors = palloc(sizeof(LWT_VALIDATION_ERROR) * ( nerrors ? nerrors : 1 ));
+    if ( nerrors )
+      memcpy(state->errors, errors, sizeof(LWT_VALIDATION_ERROR) * nerrors);
+    state->nerrors = nerrors;
     state->curr = 0;
     funcctx->user_fctx = state;
 
-    POSTGIS_DEBUG(1, "TopoGeo_AddLinestring calling SPI_finish");
+    /*
+     * Build a tuple description for a
+     * validatetopology_returntype tuple
+     */
+    tupdesc = RelationNameGetTupleDesc("topology.validatetopology_returntype");
+    funcctx->attinmeta = TupleDescGetAttInMetadata(tupdesc);
 
     MemoryContextSwitchTo(oldcontext);
 
     SPI_finish();
   }
 
-  POSTGIS_DEBUG(1, "Per-call invocation");
-
   /* stuff done on every call of the function */
   funcctx = SRF_PERCALL_SETUP();
 
   /* get state */
   state = funcctx->user_fctx;
 
-  if ( state->curr == state->nelems )
+  if ( state->curr == state->nerrors )
   {
-    POSTGIS_DEBUG(1, "We're done, cleaning up all");
     SRF_RETURN_DONE(funcctx);
   }
 
-  id = state->elems[state->curr++];
-  POSTGIS_DEBUGF(1, "TopoGeo_AddLinestring: cur:%d, val:%" LWTFMT_ELEMID,
-                 state->curr-1, id);
+  err = &(state->errors[state->curr]);
+  values[0] = (char *)err->error;
+  values[1] = buf;
+  values[2] = NULL;
+  snprintf(buf, 32, "%" LWTFMT_ELEMID, err->id1);
+  if ( err->id2 )
+  {
+    values[2] = &(buf[32]);
+    snprintf(values[2], 32, "%" LWTFMT_ELEMID, err->id2);
+  }
 
-  result = Int32GetDatum((int32)id);
+  tuple = BuildTupleFromCStrings(funcctx->attinmeta, values);
+  result = HeapTupleGetDatum(tuple);
+  state->curr++;
 
   SRF_RETURN_NEXT(funcctx, result);
 }
 
-/*  TopoGeo_AddPolygon(atopology, poly, tolerance) */
-Datum TopoGeo_AddPolygon(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(TopoGeo_AddPolygon);
-Datum TopoGeo_AddPolygon(PG_FUNCTION_ARGS)
+/* ----------------- Native TopoJSON export ------------------- */
+
+/* Lookup and storage of arc indices, for the edgeMapTable parameter */
+typedef struct TopoJSONEdgeMap
 {
-  text* toponame_text;
-  char* toponame;
-  double tol;
-  LWT_ELEMID *elems;
-  int nelems;
-  GSERIALIZED *geom;
-  LWGEOM *lwgeom;
-  LWPOLY *pol;
-  LWT_TOPOLOGY *topo;
-  FuncCallContext *funcctx;
-  MemoryContext oldcontext, newcontext;
-  FACEEDGESSTATE *state;
-  Datum result;
-  LWT_ELEMID id;
+  SPIPlanPtr select;
+  SPIPlanPtr insert;
+}
+TopoJSONEdgeMap;
 
-  if (SRF_IS_FIRSTCALL())
+static void
+_topojson_prepareEdgeMap(TopoJSONEdgeMap *map, Oid edgeMapTable)
+{
+  StringInfoData sqldata;
+  StringInfo sql = &sqldata;
+  Oid argtypes[1] = { INT4OID };
+  char *tbl = DatumGetCString(DirectFunctionCall1(regclassout,
+                                ObjectIdGetDatum(edgeMapTable)));
+
+  initStringInfo(sql);
+  appendStringInfo(sql, "SELECT arc_id-1 FROM %s WHERE edge_id = $1", tbl);
+  map->select = SPI_prepare(sql->data, 1, argtypes);
+  if ( ! map->select )
+    lwpgerror("Could not prepare query: %s", sql->data);
+
+  resetStringInfo(sql);
+  appendStringInfo(sql, "INSERT INTO %s(edge_id) VALUES ($1) "
+                        "RETURNING arc_id-1", tbl);
+  map->insert = SPI_prepare(sql->data, 1, argtypes);
+  if ( ! map->insert )
+    lwpgerror("Could not prepare query: %s", sql->data);
+
+  pfree(sqldata.data);
+}
+
+/* Return the 0-based arc index of an edge, adding it to the map if missing */
+static int32
+_topojson_arcid(TopoJSONEdgeMap *map, int32 edge_id)
+{
+  Datum arg = Int32GetDatum(edge_id);
+  Datum dat = 0;
+  bool isnull = true;
+  int spi_result;
+
+  if ( ! map ) return edge_id;
+
+  spi_result = SPI_execute_plan(map->select, &arg, NULL, false, 1);
+  if ( spi_result != SPI_OK_SELECT )
+    lwpgerror("unexpected return (%d) from edge map lookup", spi_result);
+  if ( SPI_processed )
+    dat = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+  SPI_freetuptable(SPI_tuptable);
+  if ( ! isnull ) return DatumGetInt32(dat);
+
+  spi_result = SPI_execute_plan(map->insert, &arg, NULL, false, 1);
+  if ( spi_result != SPI_OK_INSERT_RETURNING || SPI_processed != 1 )
+    lwpgerror("unexpected return (%d) from edge map insert", spi_result);
+  dat = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+  SPI_freetuptable(SPI_tuptable);
+  if ( isnull )
+    lwpgerror("Edge map table returned a NULL arc_id for edge %d", edge_id);
+  return DatumGetInt32(dat);
+}
+
+static void
+_topojson_appendArcs(stringbuffer_t *sb, const int32 *arcs, int narcs, bool reverse)
+{
+  int i;
+  stringbuffer_append_char(sb, '[');
+  for ( i = 0; i < narcs; ++i )
   {
-    POSTGIS_DEBUG(1, "TopoGeo_AddPolygon first call");
-    funcctx = SRF_FIRSTCALL_INIT();
-    newcontext = funcctx->multi_call_memory_ctx;
+    if ( i ) stringbuffer_append_char(sb, ',');
+    stringbuffer_aprintf(sb, "%d", arcs[reverse ? narcs - 1 - i : i]);
+  }
+  stringbuffer_append_char(sb, ']');
+}
 
-    if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2) )
+/*
+ * Write the arcs of a lineal TopoGeometry, ordering the edges of each
+ * component of its geometry by their position along it. Returns the
+ * number of components.
+ */
+static int
+_topojson_lineal(stringbuffer_t *sb, const char *tgrow, const char *toponame,
+                 TopoJSONEdgeMap *map)
+{
+  StringInfoData sqldata;
+  StringInfo sql = &sqldata;
+  int spi_result;
+  uint64 i;
+  int64 comp = 0;
+  int ncomps = 0, nwritten = 0;
+  int32 *arcs;
+  int narcs = 0;
+  SPITupleTable *rows;
+  uint64 nrows;
+
+  initStringInfo(sql);
+  appendStringInfo(sql, "SELECT c.n, e.edge_id, e.pos2 < e.pos "
+    "FROM ST_Dump(topology.Geometry(%s)) WITH ORDINALITY c(path, geom, n) "
+    "LEFT JOIN LATERAL ( SELECT e.edge_id, "
+    "ST_LineLocatePoint(c.geom, ST_LineInterpolatePoint(e.geom, 0.2)) as pos, "
+    "ST_LineLocatePoint(c.geom, ST_LineInterpolatePoint(e.geom, 0.8)) as pos2 "
+    "FROM %s.edge e WHERE ST_Covers(c.geom, e.geom) ) e ON true "
+    "ORDER BY c.n, e.pos", tgrow, quote_identifier(toponame));
+
+  spi_result = SPI_execute(sql->data, false, 0);
+  if ( spi_result != SPI_OK_SELECT )
+    lwpgerror("unexpected return (%d) from query execution: %s", spi_result, sql->data);
+  pfree(sqldata.data);
+
+  /* Arc lookups run queries of their own */
+  rows = SPI_tuptable;
+  nrows = SPI_processed;
+  arcs = palloc(sizeof(int32) * (nrows ? nrows : 1));
+
+  for ( i = 0; i <= nrows; ++i )
+  {
+    int64 n = 0;
+    bool isnull;
+    Datum dat;
+
+    if ( i < nrows )
+      n = DatumGetInt64(SPI_getbinval(rows->vals[i], rows->tupdesc, 1, &isnull));
+
+    /* Component done, those without edges are skipped */
+    if ( i && ( i == nrows || n != comp ) )
     {
-      lwpgerror("SQL/MM Spatial exception - null argument");
-      PG_RETURN_NULL();
+      if ( narcs )
+      {
+        if ( nwritten++ ) stringbuffer_append_char(sb, ',');
+        _topojson_appendArcs(sb, arcs, narcs, false);
+      }
+      narcs = 0;
     }
+    if ( i == nrows ) break;
+    if ( n != comp ) ++ncomps;
+    comp = n;
+
+    dat = SPI_getbinval(rows->vals[i], rows->tupdesc, 2, &isnull);
+    if ( isnull ) continue;
+    arcs[narcs] = _topojson_arcid(map, DatumGetInt32(dat));
+    /* edge goes in opposite direction */
+    if ( DatumGetBool(SPI_getbinval(rows->vals[i], rows->tupdesc, 3, &isnull)) )
+      arcs[narcs] = -(arcs[narcs] + 1);
+    ++narcs;
+  }
+
+  SPI_freetuptable(rows);
+  pfree(arcs);
+  return ncomps;
+}
 
-    toponame_text = PG_GETARG_TEXT_P(0);
-    toponame = text_to_cstring(toponame_text);
-    PG_FREE_IF_COPY(toponame_text, 0);
+typedef struct TopoJSONEdge
+{
+  int32 edge_id;
+  int32 left_face; /* index in the faces array, or -1 */
+  int32 right_face; /* index in the faces array, or -1 */
+  int32 next_left;
+  int32 next_right;
+  bool removed; /* already part of a ring */
+  uint32 seen[2][2]; /* last walk of each side, forward and back */
+}
+TopoJSONEdge;
 
-    geom = PG_GETARG_GSERIALIZED_P(1);
-    lwgeom = lwgeom_from_gserialized(geom);
-    pol = lwgeom_as_lwpoly(lwgeom);
-    if ( ! pol )
+typedef struct TopoJSONEdgeIndex
+{
+  int32 edge_id;
+  int32 idx;
+}
+TopoJSONEdgeIndex;
+
+static int
+_topojson_cmpint32(const void *a, const void *b)
+{
+  int32 ia = *(const int32 *)a;
+  int32 ib = *(const int32 *)b;
+  return ia < ib ? -1 : ia > ib;
+}
+
+static int
+_topojson_cmpedgeindex(const void *a, const void *b)
+{
+  return _topojson_cmpint32(&((const TopoJSONEdgeIndex *)a)->edge_id,
+                            &((const TopoJSONEdgeIndex *)b)->edge_id);
+}
+
+static int32
+_topojson_faceindex(const int32 *faces, int nfaces, int32 face_id)
+{
+  int32 *f = bsearch(&face_id, faces, nfaces, sizeof(int32), _topojson_cmpint32);
+  return f ? (int32)(f - faces) : -1;
+}
+
+static int32
+_topojson_edgeindex(const TopoJSONEdgeIndex *index, int nedges, int32 edge_id)
+{
+  TopoJSONEdgeIndex key, *found;
+  key.edge_id = edge_id;
+  found = bsearch(&key, index, nedges, sizeof(TopoJSONEdgeIndex), _topojson_cmpedgeindex);
+  return found ? found->idx : -1;
+}
+
+/*
+ * Write the polygons of an areal TopoGeometry.
+ *
+ * Shells are the rings walked from the leftmost edge not having the
+ * faces of the TopoGeometry on both sides, holes those walked the same
+ * way within the faces of the shell found before, until none is left.
+ * Edges are loaded with a single query, ordered by their leftmost
+ * point, and rings walked in memory. Returns the number of polygons.
+ */
+static int
+_topojson_areal(stringbuffer_t *sb, const char *tgrow, const char *toponame,
+                TopoJSONEdgeMap *map)
+{
+  StringInfoData sqldata;
+  StringInfo sql = &sqldata;
+  int spi_result;
+  uint64 i;
+  int32 *faces;
+  int nfaces = 0;
+  TopoJSONEdge *edges;
+  TopoJSONEdgeIndex *index;
+  int nedges;
+  bool *cur, *shell;
+  int32 *arcs;
+  int32 *walked;
+  int narcs, nwalked;
+  int first = 0;
+  uint32 walk = 0;
+  bool looking_for_holes = false;
+  int ncomps = 0, nwritten = 0, nrings = 0;
+  stringbuffer_t rings;
+
+  /* Faces of the TopoGeometry, including those of its children */
+  initStringInfo(sql);
+  appendStringInfo(sql, "SELECT (topology.GetTopoGeomElements(%s))[1]", tgrow);
+  spi_result = SPI_execute(sql->data, true, 0);
+  if ( spi_result != SPI_OK_SELECT )
+    lwpgerror("unexpected return (%d) from query execution: %s", spi_result, sql->data);
+  faces = palloc(sizeof(int32) * (SPI_processed ? SPI_processed : 1));
+  for ( i = 0; i < SPI_processed; ++i )
+  {
+    bool isnull;
+    Datum dat = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &isnull);
+    if ( ! isnull ) faces[nfaces++] = DatumGetInt32(dat);
+  }
+  SPI_freetuptable(SPI_tuptable);
+  if ( ! nfaces )
+  {
+    pfree(sqldata.data);
+    pfree(faces);
+    return 0;
+  }
+  qsort(faces, nfaces, sizeof(int32), _topojson_cmpint32);
+
+  /* Edges binding the faces, leftmost first */
+  resetStringInfo(sql);
+  appendStringInfo(sql, "SELECT edge_id, left_face, right_face, "
+    "next_left_edge, next_right_edge FROM %s.edge_data "
+    "WHERE left_face = ANY($1) OR right_face = ANY($1) "
+    "ORDER BY ST_XMin(geom), ST_YMin(geom), edge_id",
+    quote_identifier(toponame));
+  {
+    Oid argtypes[1] = { INT4ARRAYOID };
+    Datum *elems = palloc(sizeof(Datum) * nfaces);
+    Datum arg;
+    int k;
+    for ( k = 0; k < nfaces; ++k ) elems[k] = Int32GetDatum(faces[k]);
+    arg = PointerGetDatum(construct_array(elems, nfaces, INT4OID, 4, true, 'i'));
+    spi_result = SPI_execute_with_args(sql->data, 1, argtypes, &arg, NULL, true, 0);
+    pfree(elems);
+  }
+  if ( spi_result != SPI_OK_SELECT )
+    lwpgerror("unexpected return (%d) from query execution: %s", spi_result, sql->data);
+  pfree(sqldata.data);
+
+  nedges = SPI_processed;
+  edges = palloc0(sizeof(TopoJSONEdge) * (nedges ? nedges : 1));
+  index = palloc(sizeof(TopoJSONEdgeIndex) * (nedges ? nedges : 1));
+  for ( i = 0; i < (uint64)nedges; ++i )
+  {
+    HeapTuple row = SPI_tuptable->vals[i];
+    TupleDesc rowdesc = SPI_tuptable->tupdesc;
+    TopoJSONEdge *e = &edges[i];
+    bool isnull;
+    Datum dat;
+
+    e->edge_id = DatumGetInt32(SPI_getbinval(row, rowdesc, 1, &isnull));
+    dat = SPI_getbinval(row, rowdesc, 2, &isnull);
+    e->left_face = isnull ? -1 : _topojson_faceindex(faces, nfaces, DatumGetInt32(dat));
+    dat = SPI_getbinval(row, rowdesc, 3, &isnull);
+    e->right_face = isnull ? -1 : _topojson_faceindex(faces, nfaces, DatumGetInt32(dat));
+    dat = SPI_getbinval(row, rowdesc, 4, &isnull);
+    e->next_left = isnull ? 0 : DatumGetInt32(dat);
+    dat = SPI_getbinval(row, rowdesc, 5, &isnull);
+    e->next_right = isnull ? 0 : DatumGetInt32(dat);
+    index[i].edge_id = e->edge_id;
+    index[i].idx = i;
+  }
+  SPI_freetuptable(SPI_tuptable);
+  qsort(index, nedges, sizeof(TopoJSONEdgeIndex), _topojson_cmpedgeindex);
+
+  /* Faces currently bounding the rings, and faces found on a shell */
+  cur = palloc(sizeof(bool) * nfaces);
+  shell = palloc0(sizeof(bool) * nfaces);
+  memset(cur, true, sizeof(bool) * nfaces);
+  arcs = palloc(sizeof(int32) * (nedges ? 2 * nedges : 1));
+  walked = palloc(sizeof(int32) * (nedges ? 2 * nedges : 1));
+  stringbuffer_init(&rings);
+
+#define TOPOJSON_IN(faceidx) ( (faceidx) >= 0 && cur[(faceidx)] )
+
+  for (;;)
+  {
+    int start = -1;
+    int k;
+    bool edges_found = false;
+
+    narcs = 0;
+    nwalked = 0;
+
+    while ( first < nedges && edges[first].removed ) ++first;
+    for ( k = first; k < nedges; ++k )
     {
+      TopoJSONEdge *e = &edges[k];
+      if ( e->removed ) continue;
+      if ( TOPOJSON_IN(e->left_face) != TOPOJSON_IN(e->right_face) )
       {
-        char buf[32];
-        _lwtype_upper_name(lwgeom_get_type(lwgeom), buf, 32);
-        lwgeom_free(lwgeom);
-        PG_FREE_IF_COPY(geom, 1);
-        lwpgerror("Invalid geometry type (%s) passed to "
-                  "TopoGeo_AddPolygon, expected POLYGON", buf);
-        PG_RETURN_NULL();
+        start = k;
+        break;
       }
     }
 
-    tol = PG_GETARG_FLOAT8(2);
-    if ( tol < 0 )
+    if ( start >= 0 )
     {
-      PG_FREE_IF_COPY(geom, 1);
-      lwpgerror("Tolerance must be >=0");
-      PG_RETURN_NULL();
+      TopoJSONEdge *e = &edges[start];
+      int32 signed_edge_id = TOPOJSON_IN(e->left_face) ? e->edge_id : -e->edge_id;
+      bool back = false;
+      bool dangling = false;
+      int idx = start;
+
+      ++walk;
+      for (;;)
+      {
+        int32 next;
+
+        e = &edges[idx];
+        e->seen[signed_edge_id < 0][back] = walk;
+        walked[nwalked++] = idx;
+        edges_found = true;
+
+        if ( e->left_face >= 0 ) shell[e->left_face] = true;
+        if ( e->right_face >= 0 ) shell[e->right_face] = true;
+
+        if ( ! dangling && ( e->left_face < 0 || e->right_face < 0 ) )
+        {
+          int32 arcid = map ? _topojson_arcid(map, e->edge_id) : e->edge_id - 1;
+          /* Swap sign, use two's complement for negative edges */
+          if ( signed_edge_id >= 0 ) arcid = -(arcid + 1);
+          arcs[narcs++] = arcid;
+        }
+
+        /* Step to the next edge, backing once on dangling ones */
+        if ( dangling && ! back )
+        {
+          next = -signed_edge_id;
+          back = true;
+        }
+        else
+        {
+          next = signed_edge_id < 0 ? e->next_right : e->next_left;
+          back = false;
+        }
+        if ( ! next ) break;
+        idx = _topojson_edgeindex(index, nedges, ABS(next));
+        if ( idx < 0 || edges[idx].removed ) break;
+        if ( edges[idx].seen[next < 0][back] == walk ) break;
+        signed_edge_id = next;
+        dangling = TOPOJSON_IN(edges[idx].left_face) ==
+                   TOPOJSON_IN(edges[idx].right_face);
+      }
+
+      for ( k = 0; k < nwalked; ++k ) edges[walked[k]].removed = true;
     }
 
-    if ( SPI_OK_CONNECT != SPI_connect() )
+    if ( ! edges_found )
     {
-      lwpgerror("Could not connect to SPI");
-      PG_RETURN_NULL();
+      if ( ! looking_for_holes ) break;
+      /* No more holes, the polygon is complete */
+      looking_for_holes = false;
+      ++ncomps;
+      if ( nrings )
+      {
+        if ( nwritten++ ) stringbuffer_append_char(sb, ',');
+        stringbuffer_append_char(sb, '[');
+        stringbuffer_append(sb, stringbuffer_getstring(&rings));
+        stringbuffer_append_char(sb, ']');
+      }
+      stringbuffer_clear(&rings);
+      nrings = 0;
+      memset(cur, true, sizeof(bool) * nfaces);
+      memset(shell, false, sizeof(bool) * nfaces);
     }
-
+    else
     {
-      int pre = be_data.topoLoadFailMessageFlavor;
-      be_data.topoLoadFailMessageFlavor = 1;
-      topo = lwt_LoadTopology(be_iface, toponame);
-      be_data.topoLoadFailMessageFlavor = pre;
+      memcpy(cur, shell, sizeof(bool) * nfaces);
+      if ( narcs )
+      {
+        if ( nrings++ ) stringbuffer_append_char(&rings, ',');
+        _topojson_appendArcs(&rings, arcs, narcs, true);
+      }
+      looking_for_holes = true;
     }
-    oldcontext = MemoryContextSwitchTo( newcontext );
-    pfree(toponame);
-    if ( ! topo )
+  }
+
+#undef TOPOJSON_IN
+
+  stringbuffer_release(&rings);
+  pfree(walked);
+  pfree(arcs);
+  pfree(shell);
+  pfree(cur);
+  pfree(index);
+  pfree(edges);
+  pfree(faces);
+  return ncomps;
+}
+
+/*  AsTopoJSON(TopoGeometry, edgeMapTable) */
+Datum AsTopoJSON(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(AsTopoJSON);
+Datum AsTopoJSON(PG_FUNCTION_ARGS)
+{
+  HeapTupleHeader tg;
+  int32 fields[4];
+  char tgrow[128];
+  char *toponame = NULL;
+  TopoJSONEdgeMap mapdata;
+  TopoJSONEdgeMap *map = NULL;
+  stringbuffer_t sb;
+  StringInfoData sqldata;
+  StringInfo sql = &sqldata;
+  text *json = NULL;
+  int spi_result;
+  int ncomps;
+  int k;
+
+  if ( PG_ARGISNULL(0) ) PG_RETURN_NULL();
+  tg = PG_GETARG_HEAPTUPLEHEADER(0);
+  for ( k = 0; k < 4; ++k )
+  {
+    bool isnull;
+    Datum dat = GetAttributeByNum(tg, k + 1, &isnull);
+    if ( isnull )
     {
-      /* should never reach this point, as lwerror would raise an exception */
-      SPI_finish();
+      lwpgerror("TopoGeometry has NULL components");
       PG_RETURN_NULL();
     }
+    fields[k] = DatumGetInt32(dat);
+  }
+  snprintf(tgrow, sizeof(tgrow), "ROW(%d,%d,%d,%d)::topology.TopoGeometry",
+           fields[0], fields[1], fields[2], fields[3]);
+
+  if ( fields[3] == 4 )
+  {
+    lwpgerror("Collection TopoGeometries are not supported by AsTopoJSON");
+    PG_RETURN_NULL();
+  }
+  if ( fields[3] < 1 || fields[3] > 3 ) PG_RETURN_NULL();
+
+  /* The output outlives SPI */
+  stringbuffer_init_varlena(&sb);
+
+  if ( SPI_OK_CONNECT != SPI_connect() )
+  {
+    lwpgerror("Could not connect to SPI");
+    PG_RETURN_NULL();
+  }
 
-    POSTGIS_DEBUG(1, "Calling lwt_AddPolygon");
-    elems = lwt_AddPolygon(topo, pol, tol, &nelems);
-    POSTGIS_DEBUG(1, "lwt_AddPolygon returned");
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 1);
-    lwt_FreeTopology(topo);
+  initStringInfo(sql);
 
-    if ( nelems < 0 )
+  /* Puntal TopoGeometry, simply delegate to AsGeoJSON */
+  if ( fields[3] == 1 )
+  {
+    bool isnull;
+    Datum dat;
+
+    appendStringInfo(sql, "SELECT ST_AsGeoJSON(topology.Geometry(%s))", tgrow);
+    spi_result = SPI_execute(sql->data, true, 1);
+    if ( spi_result != SPI_OK_SELECT || SPI_processed != 1 )
     {
-      /* should never reach this point, as lwerror would raise an exception */
       SPI_finish();
+      lwpgerror("unexpected return (%d) from query execution: %s", spi_result, sql->data);
       PG_RETURN_NULL();
     }
+    dat = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+    if ( ! isnull )
+      json = (text *)SPI_datumTransfer(dat, false, -1);
+    SPI_finish();
+    if ( ! json ) PG_RETURN_NULL();
+    PG_RETURN_TEXT_P(json);
+  }
 
-    state = lwalloc(sizeof(FACEEDGESSTATE));
-    state->elems = elems;
-    state->nelems = nelems;
-    state->curr = 0;
-    funcctx->user_fctx = state;
-
-    POSTGIS_DEBUG(1, "TopoGeo_AddPolygon calling SPI_finish");
-
-    MemoryContextSwitchTo(oldcontext);
-
+  appendStringInfo(sql, "SELECT name FROM topology.topology WHERE id = %d", fields[0]);
+  spi_result = SPI_execute(sql->data, true, 1);
+  if ( spi_result != SPI_OK_SELECT )
+  {
+    SPI_finish();
+    lwpgerror("unexpected return (%d) from query execution: %s", spi_result, sql->data);
+    PG_RETURN_NULL();
+  }
+  if ( SPI_processed )
+    toponame = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+  SPI_freetuptable(SPI_tuptable);
+  pfree(sqldata.data);
+  if ( ! toponame )
+  {
     SPI_finish();
+    lwpgerror("No topology with id %d in topology.topology", fields[0]);
+    PG_RETURN_NULL();
   }
 
-  POSTGIS_DEBUG(1, "Per-call invocation");
+  if ( ! PG_ARGISNULL(1) )
+  {
+    _topojson_prepareEdgeMap(&mapdata, PG_GETARG_OID(1));
+    map = &mapdata;
+  }
 
-  /* stuff done on every call of the function */
-  funcctx = SRF_PERCALL_SETUP();
+  if ( fields[3] == 2 )
+  {
+    stringbuffer_append(&sb, "{ \"type\": \"MultiLineString\", \"arcs\": [");
+    ncomps = _topojson_lineal(&sb, tgrow, toponame, map);
+  }
+  else
+  {
+    stringbuffer_append(&sb, "{ \"type\": \"MultiPolygon\", \"arcs\": [");
+    ncomps = _topojson_areal(&sb, tgrow, toponame, map);
+  }
+  stringbuffer_append(&sb, "]}");
 
-  /* get state */
-  state = funcctx->user_fctx;
+  SPI_finish();
 
-  if ( state->curr == state->nelems )
+  /* No components, like concatenating to a NULL array in SQL */
+  if ( ! ncomps )
   {
-    POSTGIS_DEBUG(1, "We're done, cleaning up all");
-    SRF_RETURN_DONE(funcctx);
+    stringbuffer_release(&sb);
+    PG_RETURN_NULL();
   }
+  PG_RETURN_TEXT_P(stringbuffer_getvarlena(&sb));
+}
 
-  id = state->elems[state->curr++];
-  POSTGIS_DEBUGF(1, "TopoGeo_AddPolygon: cur:%d, val:%" LWTFMT_ELEMID,
-                 state->curr-1, id);
+/* Number of edges fetched at once by AsTopoJSONArcs */
+#define TOPOJSON_ARCS_FETCH 1000
+/* Decimal digits of unquantized arcs, as ST_AsGeoJSON */
+#define TOPOJSON_ARCS_PRECISION 9
 
-  result = Int32GetDatum((int32)id);
+typedef struct TOPOJSONARCSSTATE
+{
+  char *portal; /* name of the cursor over the edges */
+  double quantize; /* 0 for no quantization */
+  text **arcs; /* formatted arcs of the last fetch */
+  uint64 narcs;
+  uint64 curr;
+}
+TOPOJSONARCSSTATE;
 
-  SRF_RETURN_NEXT(funcctx, result);
+/*
+ * Write an arc, with positions delta-encoded from the previous one.
+ * When quantizing, positions are rounded to the grid first and the
+ * repeated ones skipped.
+ */
+static void
+_topojson_appendArc(stringbuffer_t *sb, const POINTARRAY *pa, double quantize)
+{
+  uint32_t i;
+  POINT2D prev = {0, 0};
+  int64 qprev[2] = {0, 0};
+  int npos = 0;
+
+  stringbuffer_append_char(sb, '[');
+  for ( i = 0; i < pa->npoints; ++i )
+  {
+    const POINT2D *pt = getPoint2d_cp(pa, i);
+
+    if ( quantize )
+    {
+      int64 q[2];
+      q[0] = (int64) llround(pt->x / quantize);
+      q[1] = (int64) llround(pt->y / quantize);
+      if ( npos && q[0] == qprev[0] && q[1] == qprev[1] &&
+           ( npos > 1 || i < pa->npoints - 1 ) ) continue;
+      if ( npos++ ) stringbuffer_append_char(sb, ',');
+      stringbuffer_aprintf(sb, "[%" PRId64 ",%" PRId64 "]",
+                           q[0] - qprev[0], q[1] - qprev[1]);
+      qprev[0] = q[0];
+      qprev[1] = q[1];
+    }
+    else
+    {
+      if ( npos++ ) stringbuffer_append_char(sb, ',');
+      stringbuffer_append_char(sb, '[');
+      stringbuffer_append_double(sb, i ? pt->x - prev.x : pt->x, TOPOJSON_ARCS_PRECISION);
+      stringbuffer_append_char(sb, ',');
+      stringbuffer_append_double(sb, i ? pt->y - prev.y : pt->y, TOPOJSON_ARCS_PRECISION);
+      stringbuffer_append_char(sb, ']');
+      prev = *pt;
+    }
+  }
+  stringbuffer_append_char(sb, ']');
 }
 
-/*  GetRingEdges(atopology, anedge, maxedges default null) */
-Datum GetRingEdges(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(GetRingEdges);
-Datum GetRingEdges(PG_FUNCTION_ARGS)
+/*  AsTopoJSONArcs(atopology, edgeMapTable, quantize) */
+Datum AsTopoJSONArcs(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(AsTopoJSONArcs);
+Datum AsTopoJSONArcs(PG_FUNCTION_ARGS)
 {
-  text* toponame_text;
-  char* toponame;
-  LWT_ELEMID edge_id;
-  int maxedges = 0;
-  uint64_t nelems;
-  LWT_ELEMID *elems;
-  LWT_BE_TOPOLOGY *topo;
   FuncCallContext *funcctx;
-  MemoryContext oldcontext, newcontext;
-  FACEEDGESSTATE *state;
-  Datum result;
-  HeapTuple tuple;
-  Datum ret[2];
-  bool isnull[2] = {0,0}; /* needed to say neither value is null */
+  MemoryContext oldcontext;
+  TOPOJSONARCSSTATE *state;
+  Portal portal;
+  uint64 i;
 
   if (SRF_IS_FIRSTCALL())
   {
-    POSTGIS_DEBUG(1, "GetRingEdges first call");
-    funcctx = SRF_FIRSTCALL_INIT();
-    newcontext = funcctx->multi_call_memory_ctx;
-
+    char *toponame;
+    char *tbl;
+    StringInfoData sqldata;
+    StringInfo sql = &sqldata;
 
-    if ( PG_ARGISNULL(0) )
-    {
-      lwpgerror("GetRingEdges: topology name cannot be null");
-      PG_RETURN_NULL();
-    }
-    toponame_text = PG_GETARG_TEXT_P(0);
-    toponame = text_to_cstring(toponame_text);
-    PG_FREE_IF_COPY(toponame_text, 0);
+    funcctx = SRF_FIRSTCALL_INIT();
 
-    if ( PG_ARGISNULL(1) )
+    if ( PG_ARGISNULL(0) || PG_ARGISNULL(1) )
     {
-      lwpgerror("GetRingEdges: edge id cannot be null");
-      PG_RETURN_NULL();
+      SRF_RETURN_DONE(funcctx);
     }
-    edge_id = PG_GETARG_INT32(1) ;
 
+    oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+    state = palloc0(sizeof(TOPOJSONARCSSTATE));
     if ( ! PG_ARGISNULL(2) )
     {
-      maxedges = PG_GETARG_INT32(2) ;
+      state->quantize = PG_GETARG_FLOAT8(2);
+      if ( state->quantize <= 0 )
+      {
+        lwpgerror("Quantization must be positive");
+        PG_RETURN_NULL();
+      }
     }
+    funcctx->user_fctx = state;
+
+    toponame = text_to_cstring(PG_GETARG_TEXT_P(0));
+    tbl = DatumGetCString(DirectFunctionCall1(regclassout,
+                            ObjectIdGetDatum(PG_GETARG_OID(1))));
 
     if ( SPI_OK_CONNECT != SPI_connect() )
     {
@@ -5366,136 +8850,100 @@ Datum GetRingEdges(PG_FUNCTION_ARGS)
       PG_RETURN_NULL();
     }
 
-    {
-      int pre = be_data.topoLoadFailMessageFlavor;
-      be_data.topoLoadFailMessageFlavor = 1;
-      topo = cb_loadTopologyByName(&be_data, toponame);
-      be_data.topoLoadFailMessageFlavor = pre;
-    }
-    oldcontext = MemoryContextSwitchTo( newcontext );
-    pfree(toponame);
-    if ( ! topo )
-    {
-      SPI_finish();
-      lwpgerror("%s", cb_lastErrorMessage(&be_data));
-      PG_RETURN_NULL();
-    }
-
-    POSTGIS_DEBUG(1, "Calling cb_getRingEdges");
-    elems = cb_getRingEdges(topo, edge_id, &nelems, maxedges);
-    POSTGIS_DEBUG(1, "cb_getRingEdges returned");
-    cb_freeTopology(topo);
-
-    if ( ! elems )
+    initStringInfo(sql);
+    appendStringInfo(sql, "SELECT e.geom FROM %s m, %s.edge_data e "
+                     "WHERE e.edge_id = m.edge_id ORDER BY m.arc_id",
+                     tbl, quote_identifier(toponame));
+    portal = SPI_cursor_open_with_args(NULL, sql->data, 0, NULL, NULL, NULL, true, 0);
+    if ( ! portal )
     {
       SPI_finish();
-      lwpgerror("%s", cb_lastErrorMessage(&be_data));
+      lwpgerror("Could not open cursor: %s", sql->data);
       PG_RETURN_NULL();
     }
-
-    state = lwalloc(sizeof(FACEEDGESSTATE));
-    state->elems = elems;
-    state->nelems = nelems;
-    state->curr = 0;
-    funcctx->user_fctx = state;
-
-    POSTGIS_DEBUG(1, "GetRingEdges calling SPI_finish");
-
-    /*
-     * Get tuple description for return type
-     */
-    get_call_result_type(fcinfo, 0, &funcctx->tuple_desc);
-    BlessTupleDesc(funcctx->tuple_desc);
+    state->portal = pstrdup(portal->name);
+    pfree(sqldata.data);
+    pfree(toponame);
 
     MemoryContextSwitchTo(oldcontext);
-
     SPI_finish();
   }
 
-  POSTGIS_DEBUG(1, "Per-call invocation");
-
   /* stuff done on every call of the function */
   funcctx = SRF_PERCALL_SETUP();
-
-  /* get state */
   state = funcctx->user_fctx;
 
-  if ( state->curr == state->nelems )
-  {
-    POSTGIS_DEBUG(1, "We're done, cleaning up all");
-    SRF_RETURN_DONE(funcctx);
-  }
-
-  edge_id = state->elems[state->curr++];
-  POSTGIS_DEBUGF(1, "GetRingEdges: cur:%d, val:%" LWTFMT_ELEMID,
-                 state->curr-1, edge_id);
-
-
-  ret[0] = Int32GetDatum(state->curr);
-  ret[1] = Int32GetDatum(edge_id);
-  tuple = heap_form_tuple(funcctx->tuple_desc, ret, isnull);
-  result = HeapTupleGetDatum(tuple);
-
-  SRF_RETURN_NEXT(funcctx, result);
-}
-
-/*  GetFaceContainingPoint(atopology, point) */
-Datum GetFaceContainingPoint(PG_FUNCTION_ARGS);
-PG_FUNCTION_INFO_V1(GetFaceContainingPoint);
-Datum GetFaceContainingPoint(PG_FUNCTION_ARGS)
-{
-  text* toponame_text;
-  char* toponame;
-  LWT_ELEMID face_id;
-  GSERIALIZED *geom;
-  LWGEOM *lwgeom;
-  LWPOINT *pt;
-  LWT_TOPOLOGY *topo;
-
-  toponame_text = PG_GETARG_TEXT_P(0);
-  toponame = text_to_cstring(toponame_text);
-  PG_FREE_IF_COPY(toponame_text, 0);
-
-  geom = PG_GETARG_GSERIALIZED_P(1);
-  lwgeom = lwgeom_from_gserialized(geom);
-  pt = lwgeom_as_lwpoint(lwgeom);
-  if ( ! pt )
+  /* Format the next batch of arcs */
+  if ( state->curr == state->narcs )
   {
-    lwgeom_free(lwgeom);
-    PG_FREE_IF_COPY(geom, 1);
-    lwpgerror("Second argument must be a point geometry");
-    PG_RETURN_NULL();
-  }
+    if ( SPI_OK_CONNECT != SPI_connect() )
+    {
+      lwpgerror("Could not connect to SPI");
+      PG_RETURN_NULL();
+    }
+    portal = SPI_cursor_find(state->portal);
+    if ( ! portal )
+    {
+      SPI_finish();
+      lwpgerror("Cursor %s is gone", state->portal);
+      PG_RETURN_NULL();
+    }
 
-  if ( SPI_OK_CONNECT != SPI_connect() )
-  {
-    lwpgerror("Could not connect to SPI");
-    PG_RETURN_NULL();
-  }
+    SPI_cursor_fetch(portal, true, TOPOJSON_ARCS_FETCH);
+    if ( ! SPI_processed )
+    {
+      SPI_cursor_close(portal);
+      SPI_finish();
+      SRF_RETURN_DONE(funcctx);
+    }
 
-  topo = lwt_LoadTopology(be_iface, toponame);
-  pfree(toponame);
-  if ( ! topo )
-  {
-    /* should never reach this point, as lwerror would raise an exception */
-    SPI_finish();
-    PG_RETURN_NULL();
-  }
+    if ( state->arcs )
+    {
+      for ( i = 0; i < state->narcs; ++i ) pfree(state->arcs[i]);
+      pfree(state->arcs);
+    }
+    state->narcs = SPI_processed;
+    state->curr = 0;
+    state->arcs = MemoryContextAlloc(funcctx->multi_call_memory_ctx,
+                                     sizeof(text *) * state->narcs);
 
-  POSTGIS_DEBUG(1, "Calling lwt_GetFaceContainingPoint");
-  face_id = lwt_GetFaceContainingPoint(topo, pt);
-  POSTGIS_DEBUG(1, "lwt_GetFaceContainingPoint returned");
-  lwgeom_free(lwgeom);
-  PG_FREE_IF_COPY(geom, 1);
-  lwt_FreeTopology(topo);
+    for ( i = 0; i < state->narcs; ++i )
+    {
+      stringbuffer_t sb;
+      bool isnull;
+      Datum dat = SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1, &isnull);
+      GSERIALIZED *geom;
+      LWGEOM *lwg;
+      LWLINE *line;
+
+      oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+      stringbuffer_init_varlena(&sb);
+      MemoryContextSwitchTo(oldcontext);
+
+      if ( ! isnull )
+      {
+        geom = (GSERIALIZED *)PG_DETOAST_DATUM(dat);
+        lwg = lwgeom_from_gserialized(geom);
+        line = lwgeom_as_lwline(lwg);
+        if ( ! line )
+        {
+          SPI_finish();
+          lwpgerror("Edge geometry is not a line");
+          PG_RETURN_NULL();
+        }
+        _topojson_appendArc(&sb, line->points, state->quantize);
+        lwgeom_free(lwg);
+      }
+      else
+      {
+        stringbuffer_append(&sb, "[]");
+      }
+      state->arcs[i] = (text *)stringbuffer_getvarlena(&sb);
+    }
 
-  if ( face_id == -1 )
-  {
-    /* should never reach this point, as lwerror would raise an exception */
+    SPI_freetuptable(SPI_tuptable);
     SPI_finish();
-    PG_RETURN_NULL();
   }
 
-  SPI_finish();
-  PG_RETURN_INT32(face_id);
+  SRF_RETURN_NEXT(funcctx, PointerGetDatum(state->arcs[state->curr++]));
 }
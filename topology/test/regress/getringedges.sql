@@ -13,4 +13,19 @@ SELECT 'R'||edge_id, (topology.GetRingEdges('city_data', edge_id)).*
 SELECT 'R-'||edge_id, (topology.GetRingEdges('city_data', -edge_id)).*
 	FROM city_data.edge;
 
+-- Limit the number of edges to walk
+SELECT 'limit-hit', topology.GetRingEdges('city_data', 6, 5);
+SELECT 'limit-ok', count(*) FROM topology.GetRingEdges('city_data', 6, 10);
+
 SELECT topology.DropTopology('city_data');
+
+-- Walk rings being split repeatedly within a single call
+SELECT NULL FROM topology.CreateTopology('ringsplit');
+SELECT NULL FROM topology.TopoGeo_AddLineString('ringsplit',
+  'LINESTRING(0 0,4 0,4 4,0 4,0 0,4 4,4 0,0 4)');
+SELECT 'ringsplit.faces', count(*) FROM ringsplit.face WHERE face_id > 0;
+SELECT 'ringsplit.invalidities', count(*) FROM topology.ValidateTopology('ringsplit');
+SELECT 'ringsplit.rings', count(*)
+  FROM ringsplit.edge e, topology.GetRingEdges('ringsplit', e.edge_id) r
+  GROUP BY e.edge_id HAVING count(*) NOT IN (3, 4);
+SELECT NULL FROM topology.DropTopology('ringsplit');
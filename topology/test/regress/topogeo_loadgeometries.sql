@@ -0,0 +1,119 @@
+\set VERBOSITY terse
+set client_min_messages to ERROR;
+
+-- Invalid calls
+SELECT 'invalid', TopoGeo_LoadGeometries('invalid', ARRAY['POINT(0 0)'::geometry]);
+SELECT 'invalid', TopoGeo_LoadGeometries(null::varchar, ARRAY['POINT(0 0)'::geometry]);
+SELECT 'invalid', TopoGeo_LoadGeometries('invalid', null::geometry[]);
+
+SELECT topology.CreateTopology('bulk') > 0;
+SELECT topology.CreateTopology('incr') > 0;
+
+SELECT 'invalid', TopoGeo_LoadGeometries('bulk', ARRAY['POINT(0 0)'::geometry], -1);
+SELECT 'invalid', TopoGeo_LoadGeometries('bulk',
+  ARRAY['CIRCULARSTRING(0 0,1 1,2 0)'::geometry]);
+
+CREATE TABLE loadgeoms (id serial, geom geometry);
+INSERT INTO loadgeoms (geom) VALUES
+  -- Polygon with a hole, crossed by a line
+  ('POLYGON((0 0,10 0,10 10,0 10,0 0),(2 2,4 2,4 4,2 4,2 2))'),
+  ('LINESTRING(5 -5,5 15)'),
+  -- Closed line
+  ('LINESTRING(20 0,30 0,30 10,20 10,20 0)'),
+  -- Isolated point
+  ('POINT(40 40)'),
+  -- Lines sharing an endpoint
+  ('MULTILINESTRING((50 0,60 0),(60 0,60 10))'),
+  -- Skipped
+  (NULL),
+  ('LINESTRING EMPTY');
+
+-- Empty topology, bulk path
+SELECT 'bulk' FROM topology.TopoGeo_LoadGeometries('bulk',
+  ARRAY(SELECT geom FROM loadgeoms ORDER BY id));
+
+-- Same input, one geometry at a time
+SELECT 'incr', count(*) FROM (
+  SELECT CASE
+    WHEN GeometryType(geom) = 'POLYGON' THEN
+      (SELECT count(*) FROM topology.TopoGeo_AddPolygon('incr', geom))
+    WHEN GeometryType(geom) = 'POINT' THEN
+      topology.TopoGeo_AddPoint('incr', geom)
+    ELSE
+      (SELECT count(*) FROM ST_Dump(geom) d,
+        topology.TopoGeo_AddLinestring('incr', d.geom))
+    END
+  FROM loadgeoms WHERE NOT ST_IsEmpty(geom) ORDER BY id
+) f;
+
+CREATE FUNCTION pg_temp.compare(label text) RETURNS TABLE (what text, nodes bigint, edges bigint, faces bigint, diff bigint)
+LANGUAGE 'sql' AS $$
+  SELECT label || '-bulk',
+    (SELECT count(*) FROM bulk.node),
+    (SELECT count(*) FROM bulk.edge),
+    (SELECT count(*) FROM bulk.face WHERE face_id > 0),
+    (SELECT count(*) FROM bulk.node b WHERE NOT EXISTS (
+      SELECT 1 FROM incr.node i WHERE ST_Equals(b.geom, i.geom)
+        AND (b.containing_face IS NULL) = (i.containing_face IS NULL) ))
+    + (SELECT count(*) FROM bulk.edge b WHERE NOT EXISTS (
+      SELECT 1 FROM incr.edge i WHERE ST_Equals(b.geom, i.geom) ))
+    + (SELECT count(*) FROM bulk.face b WHERE face_id > 0 AND NOT EXISTS (
+      SELECT 1 FROM incr.face i WHERE face_id > 0 AND ST_Equals(
+        topology.ST_GetFaceGeometry('bulk', b.face_id),
+        topology.ST_GetFaceGeometry('incr', i.face_id)) ))
+  UNION ALL
+  SELECT label || '-incr',
+    (SELECT count(*) FROM incr.node),
+    (SELECT count(*) FROM incr.edge),
+    (SELECT count(*) FROM incr.face WHERE face_id > 0),
+    NULL
+$$;
+
+SELECT * FROM pg_temp.compare('t1');
+SELECT 't1', 'invalidity', * FROM topology.ValidateTopology('bulk');
+
+-- Overlapping an existing batch, incremental path
+SELECT 'bulk' FROM topology.TopoGeo_LoadGeometries('bulk',
+  ARRAY['LINESTRING(-5 5,15 5)'::geometry, 'POINT(3 8)']);
+SELECT 'incr', count(*) FROM topology.TopoGeo_AddLinestring('incr', 'LINESTRING(-5 5,15 5)');
+SELECT 'incr', topology.TopoGeo_AddPoint('incr', 'POINT(3 8)') > 0;
+
+SELECT * FROM pg_temp.compare('t2');
+SELECT 't2', 'invalidity', * FROM topology.ValidateTopology('bulk');
+
+-- Disjoint batch in a non-empty topology, with snapping to the tolerance
+SELECT 'bulk' FROM topology.TopoGeo_LoadGeometries('bulk', ARRAY[
+  'POLYGON((100 0,110 0,110 10,100 10,100 0))'::geometry,
+  'LINESTRING(100.2 5,110.1 5.2)'
+], 0.5);
+SELECT 't3', 'invalidity', * FROM topology.ValidateTopology('bulk');
+SELECT 't3', 'faces', count(*) FROM bulk.face
+  WHERE mbr && 'POLYGON((99 -1,111 -1,111 11,99 11,99 -1))'::geometry;
+SELECT 't3', 'nodes', ST_AsText(geom) FROM bulk.node
+  WHERE geom && 'POLYGON((99 -1,111 -1,111 11,99 11,99 -1))'::geometry
+  ORDER BY ST_X(geom), ST_Y(geom);
+
+-- SRID mismatch, rejected on either path
+SELECT 't4', topology.TopoGeo_LoadGeometries('bulk',
+  ARRAY['SRID=4326;LINESTRING(200 0,210 0)'::geometry]);
+
+-- Batch within a face of an areal TopoGeometry, which keeps its area
+SELECT 't5', topology.CreateTopology('bulkface') > 0;
+CREATE TABLE bulkface.areas(id int);
+SELECT 't5', topology.AddTopoGeometryColumn('bulkface',
+  'bulkface', 'areas', 'g', 'POLYGON');
+INSERT INTO bulkface.areas VALUES (1, topology.toTopoGeom(
+  'POLYGON((0 0,100 0,100 100,0 100,0 0))', 'bulkface', 1));
+SELECT 't5', 'before', ST_Area(topology.Geometry(g)) FROM bulkface.areas;
+SELECT 't5', 'load' FROM topology.TopoGeo_LoadGeometries('bulkface', ARRAY[
+  'POLYGON((40 40,60 40,60 60,40 60,40 40),(45 45,48 45,48 48,45 48,45 45))'::geometry,
+  'LINESTRING(50 40,50 60)',
+  'LINESTRING(70 70,80 70,80 80,70 70)'
+]);
+SELECT 't5', 'after', ST_Area(topology.Geometry(g)) FROM bulkface.areas;
+SELECT 't5', 'invalidity', * FROM topology.ValidateTopology('bulkface');
+SELECT 't5', topology.DropTopology('bulkface');
+
+DROP TABLE loadgeoms;
+SELECT topology.DropTopology('bulk');
+SELECT topology.DropTopology('incr');
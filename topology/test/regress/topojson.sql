@@ -65,6 +65,30 @@ SELECT 'A2-edgemap', feature_name, topology.AsTopoJSON(feature, 'edgemap')
  WHERE feature_name IN ('P1P2', 'P3P4')
  ORDER BY feature_name;
 
+-- Arcs, as computed by the SQL in the AsTopoJSON documentation
+WITH points AS (
+  SELECT m.arc_id, (ST_DumpPoints(e.geom)).*
+  FROM edgemap m, city_data.edge e
+  WHERE e.edge_id = m.edge_id
+), compare AS (
+  SELECT p2.arc_id, p2.path,
+         CASE WHEN p1.path IS NULL THEN p2.geom
+              ELSE ST_Translate(p2.geom, -ST_X(p1.geom), -ST_Y(p1.geom))
+         END AS geom
+  FROM points p2 LEFT OUTER JOIN points p1
+  ON ( p1.arc_id = p2.arc_id AND p2.path[1] = p1.path[1]+1 )
+), arcs AS (
+  SELECT arc_id, '[' || array_to_string(array_agg(
+    substring(ST_AsGeoJSON(geom) from '\[.*\]') ORDER BY path
+  ), ',') || ']' AS a
+  FROM compare GROUP BY arc_id
+)
+SELECT 'arcs', count(*),
+  array_agg(a ORDER BY arc_id) = ARRAY(
+    SELECT topology.AsTopoJSONArcs('city_data', 'edgemap')
+  )
+FROM arcs;
+
 DROP TABLE edgemap;
 -- End edge mapping }
 
@@ -99,3 +123,14 @@ SELECT 'P1-vanilla', feature_name, topology.AsTopoJSON(feature, null)
 
 SELECT topology.DropTopology('city_data');
 DROP SCHEMA features CASCADE;
+
+-- Arcs, with and without quantization
+SELECT NULL FROM topology.CreateTopology('tj');
+SELECT 'E' || TopoGeo_addLinestring('tj', 'LINESTRING(0 0,10.4 0,10.6 0.2,20 5)');
+CREATE TEMP TABLE edgemap (arc_id serial, edge_id int unique);
+INSERT INTO edgemap(edge_id) VALUES (1);
+SELECT 'arcs-tj', topology.AsTopoJSONArcs('tj', 'edgemap');
+SELECT 'arcs-tj-q', topology.AsTopoJSONArcs('tj', 'edgemap', 2);
+SELECT 'arcs-null', count(*) FROM topology.AsTopoJSONArcs(NULL, 'edgemap');
+DROP TABLE edgemap;
+SELECT NULL FROM topology.DropTopology('tj');
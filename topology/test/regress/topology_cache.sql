@@ -0,0 +1,90 @@
+\set VERBOSITY terse
+set client_min_messages to ERROR;
+
+SELECT topology.CreateTopology('cached') > 0;
+SELECT topology.CreateTopology('cachedrc') > 0;
+SELECT topology.CreateTopology('plain') > 0;
+
+-- A grid of lines, crossing each other
+CREATE TABLE cachelines (id serial, geom geometry);
+INSERT INTO cachelines (geom)
+  SELECT ST_MakeLine(ST_MakePoint(x, 0), ST_MakePoint(x, 50))
+  FROM generate_series(0, 50, 5) x;
+INSERT INTO cachelines (geom)
+  SELECT ST_MakeLine(ST_MakePoint(0, y), ST_MakePoint(50, y))
+  FROM generate_series(0, 50, 5) y;
+INSERT INTO cachelines (geom) VALUES
+  ('LINESTRING(-5 -5,55 55)'),
+  ('LINESTRING(12 12,13 14,12 16,12 12)');
+
+CREATE FUNCTION pg_temp.edit(atopology text) RETURNS SETOF text
+LANGUAGE 'plpgsql' AS $$
+BEGIN
+  PERFORM count(*) FROM cachelines c,
+    LATERAL topology.TopoGeo_AddLineString(atopology, c.geom);
+  -- Written by SQL functions, behind the back of the cache
+  PERFORM topology.AddNode(atopology, 'POINT(100 100)');
+  PERFORM topology.TopoGeo_AddLineString(atopology, 'LINESTRING(90 100,110 100)');
+  -- Rolled back changes
+  BEGIN
+    PERFORM topology.TopoGeo_AddLineString(atopology, 'LINESTRING(1 -1,49 51)');
+    RAISE EXCEPTION 'rollback';
+  EXCEPTION WHEN raise_exception THEN
+    NULL;
+  END;
+  PERFORM topology.TopoGeo_AddPoint(atopology, 'POINT(2.5 2.5)');
+  PERFORM topology.TopoGeo_AddPolygon(atopology,
+    'POLYGON((22 22,28 22,28 28,22 28,22 22))');
+  EXECUTE format('SELECT topology.ST_RemEdgeModFace(%L, edge_id) FROM %I.edge'
+    ' WHERE geom ~= %L::geometry', atopology, atopology,
+    'LINESTRING(30 25,35 25)');
+  EXECUTE format('SELECT topology.ST_ModEdgeSplit(%L, edge_id, %L) FROM %I.edge'
+    ' WHERE geom ~= %L::geometry', atopology, 'POINT(42 45)', atopology,
+    'LINESTRING(40 45,45 45)');
+  RETURN NEXT atopology;
+END;
+$$;
+
+-- Primitives are only cached with a transaction snapshot
+BEGIN ISOLATION LEVEL REPEATABLE READ;
+SET LOCAL postgis.topology_cache_size = '64MB';
+SELECT pg_temp.edit('cached');
+COMMIT;
+
+-- Ignored under READ COMMITTED, with a warning
+BEGIN;
+SET LOCAL postgis.topology_cache_size = '64MB';
+SELECT pg_temp.edit('cachedrc');
+COMMIT;
+
+SELECT pg_temp.edit('plain');
+
+SELECT 'counts',
+  (SELECT count(*) FROM cached.node) = (SELECT count(*) FROM plain.node),
+  (SELECT count(*) FROM cached.edge) = (SELECT count(*) FROM plain.edge),
+  (SELECT count(*) FROM cached.face) = (SELECT count(*) FROM plain.face);
+
+SELECT 'diff',
+  (SELECT count(*) FROM cached.node c WHERE NOT EXISTS (
+    SELECT 1 FROM plain.node p WHERE ST_Equals(c.geom, p.geom)
+      AND (c.containing_face IS NULL) = (p.containing_face IS NULL) ))
+  + (SELECT count(*) FROM cached.edge c WHERE NOT EXISTS (
+    SELECT 1 FROM plain.edge p WHERE ST_Equals(c.geom, p.geom) ))
+  + (SELECT count(*) FROM cached.face c WHERE face_id > 0 AND NOT EXISTS (
+    SELECT 1 FROM plain.face p WHERE face_id > 0 AND ST_Equals(
+      topology.ST_GetFaceGeometry('cached', c.face_id),
+      topology.ST_GetFaceGeometry('plain', p.face_id)) ));
+
+SELECT 'invalidity', * FROM topology.ValidateTopology('cached');
+
+SELECT 'counts rc',
+  (SELECT count(*) FROM cachedrc.node) = (SELECT count(*) FROM plain.node),
+  (SELECT count(*) FROM cachedrc.edge) = (SELECT count(*) FROM plain.edge),
+  (SELECT count(*) FROM cachedrc.face) = (SELECT count(*) FROM plain.face);
+
+SELECT 'invalidity rc', * FROM topology.ValidateTopology('cachedrc');
+
+DROP TABLE cachelines;
+SELECT topology.DropTopology('cached');
+SELECT topology.DropTopology('cachedrc');
+SELECT topology.DropTopology('plain');
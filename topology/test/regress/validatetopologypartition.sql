@@ -0,0 +1,98 @@
+\set VERBOSITY terse
+set client_min_messages to ERROR;
+
+-- A grid of partitions, with cells sharing their boundaries
+CREATE TEMP TABLE cells AS
+SELECT i, j, ST_MakeEnvelope(-10 + i * 30, -10 + j * 30,
+                             20 + i * 30, 20 + j * 30) AS geom
+FROM generate_series(0, 4) i, generate_series(0, 4) j;
+
+CREATE FUNCTION pg_temp.validate_grid(toponame varchar)
+RETURNS SETOF topology.ValidateTopology_ReturnType
+LANGUAGE 'sql' AS $$
+  SELECT v.* FROM cells c,
+    LATERAL topology.ValidateTopologyPartition(toponame, c.geom) v
+$$;
+
+-------------------------------------------------------------
+-- Every invalidity is reported by exactly one partition
+-------------------------------------------------------------
+
+SELECT NULL FROM topology.CreateTopology('vtp');
+SELECT NULL FROM topology.TopoGeo_AddLineString('vtp', 'LINESTRING(0 0,100 0)');
+SELECT NULL FROM topology.TopoGeo_AddLineString('vtp', 'LINESTRING(0 10,100 10)');
+
+SELECT 'vtp.valid', count(*) FROM pg_temp.validate_grid('vtp');
+
+-- Edge 2 crosses edge 1 twice
+UPDATE vtp.edge_data SET geom = 'LINESTRING(0 10,50 -5,100 10)'
+  WHERE edge_id = 2;
+-- Coincident isolated nodes, and a node on a cell boundary over edge 1
+INSERT INTO vtp.node (containing_face, geom) VALUES
+  (0, 'POINT(50 50)'), (0, 'POINT(50 50)'), (0, 'POINT(50 0)');
+
+SELECT 'vtp.sql', * FROM topology.ValidateTopology('vtp') ORDER BY 2,3,4;
+SELECT 'vtp.whole', * FROM topology.ValidateTopologyPartition('vtp')
+  ORDER BY 2,3,4;
+SELECT 'vtp.grid', * FROM pg_temp.validate_grid('vtp') ORDER BY 2,3,4;
+
+SELECT NULL FROM topology.DropTopology('vtp');
+
+-------------------------------------------------------------
+-- city_data
+-------------------------------------------------------------
+
+\i :top_builddir/topology/test/load_topology.sql
+
+SELECT 'city_data.whole', count(*)
+  FROM topology.ValidateTopologyPartition('city_data');
+SELECT 'city_data.grid', count(*) FROM pg_temp.validate_grid('city_data');
+
+-- Broken edge linking, see #3042 in validatetopology.sql
+BEGIN;
+UPDATE city_data.edge_data SET next_left_edge = -next_left_edge where edge_id in (9,10,20);
+UPDATE city_data.edge_data SET next_right_edge = -next_right_edge where edge_id = 19;
+UPDATE city_data.edge_data
+SET
+  next_left_edge = -next_left_edge,
+  next_right_edge = -next_right_edge
+where edge_id in (3,25);
+SELECT 'linking.whole', * FROM topology.ValidateTopologyPartition('city_data')
+  ORDER BY 2,3,4;
+-- Linking errors are owned by nodes, so the grid finds them all once
+SELECT 'linking.grid', count(*), count(DISTINCT v)
+  FROM pg_temp.validate_grid('city_data') v
+  WHERE v.error LIKE 'invalid next_%';
+SELECT 'linking.diff', count(*) FROM (
+  SELECT * FROM topology.ValidateTopology('city_data')
+  EXCEPT
+  SELECT * FROM pg_temp.validate_grid('city_data')
+) foo;
+ROLLBACK;
+
+-- Hole in the wrong face, see #4830.1 in validatetopology.sql
+BEGIN;
+UPDATE city_data.edge_data SET left_face = 2, right_face = 2
+  WHERE edge_id = 25;
+SELECT 'hole.grid', * FROM pg_temp.validate_grid('city_data') ORDER BY 2,3,4;
+ROLLBACK;
+
+-- Stale face mbr
+BEGIN;
+UPDATE city_data.face SET mbr = ST_Expand(mbr, 1) WHERE face_id = 1;
+SELECT 'mbr.sql', * FROM topology.ValidateTopology('city_data') ORDER BY 2,3,4;
+SELECT 'mbr.grid', * FROM pg_temp.validate_grid('city_data') ORDER BY 2,3,4;
+ROLLBACK;
+
+-- Only the partitions touched by an edit need to be validated again
+BEGIN;
+UPDATE city_data.face SET mbr = ST_Expand(mbr, 1) WHERE face_id = 1;
+SELECT 'touched', count(*) FROM cells c,
+  LATERAL topology.ValidateTopologyPartition('city_data', c.geom) v
+  WHERE c.geom && ( SELECT mbr FROM city_data.face WHERE face_id = 1 );
+ROLLBACK;
+
+SELECT 'empty', count(*)
+  FROM topology.ValidateTopologyPartition('city_data', 'POINT EMPTY');
+
+SELECT NULL FROM topology.DropTopology('city_data');
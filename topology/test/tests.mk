@@ -74,11 +74,14 @@ TESTS += \
 	$(top_srcdir)/topology/test/regress/topogeo_addlinestring.sql \
 	$(top_srcdir)/topology/test/regress/topogeo_addpoint.sql \
 	$(top_srcdir)/topology/test/regress/topogeo_addpolygon.sql \
+	$(top_srcdir)/topology/test/regress/topogeo_loadgeometries.sql \
 	$(top_srcdir)/topology/test/regress/topogeom_addtopogeom.sql \
 	$(top_srcdir)/topology/test/regress/topogeom_edit.sql \
 	$(top_srcdir)/topology/test/regress/topogeometry_srid.sql \
 	$(top_srcdir)/topology/test/regress/topogeometry_type.sql \
 	$(top_srcdir)/topology/test/regress/topojson.sql \
+	$(top_srcdir)/topology/test/regress/topology_cache.sql \
 	$(top_srcdir)/topology/test/regress/topologysummary.sql \
 	$(top_srcdir)/topology/test/regress/totopogeom.sql \
-	$(top_srcdir)/topology/test/regress/validatetopology.sql
+	$(top_srcdir)/topology/test/regress/validatetopology.sql \
+	$(top_srcdir)/topology/test/regress/validatetopologypartition.sql